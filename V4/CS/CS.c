@@ -13,8 +13,11 @@
 **********************************************************************/
 #include "main.h"
 #include "cmsis_os.h"
+#include <string.h>
 #include "CS.h"
 #include "Track.h"
+#include "Packet.h"
+#include "Service.h"
 
 /**********************************************************************
 *
@@ -22,6 +25,41 @@
 *
 **********************************************************************/
 
+// length byte, up to 6 packet bytes, and the terminator from Packet.c
+#define CS_PACKET_SIZE		8
+
+// events taken off the queue at a time
+#define CS_MESSAGE_BATCH	8
+
+// loco changes from other tasks waiting for the command station task
+#define CS_LOCO_REQUESTS	4
+
+// bit widths of the command station packets, us
+#define CS_CLK1T			116
+#define CS_CLK0T			100
+#define CS_CLK0H			50
+
+// how far ahead of the track packets are built, a speed change waits
+// behind no more than this
+#define CS_SCHEDULE_AHEAD_US	12000
+
+// a refresh interval longer than this is counted late
+#define CS_REFRESH_LATE_US		250000
+
+// a consist member refreshes its functions no more often than this, the
+// lead loco refreshes the consist speed
+#define CS_MEMBER_REFRESH_US	500000
+
+// why a packet was sent
+enum
+{
+	CS_PACKET_CHANGE,
+	CS_PACKET_REPEAT,
+	CS_PACKET_REFRESH,
+	CS_PACKET_MEMBER,			// the functions of a consist member
+	CS_PACKET_NONE,				// nothing for this loco this time
+};
+
 /**********************************************************************
 *
 *							FUNCTION PROTOTYPES
@@ -29,6 +67,11 @@
 **********************************************************************/
 
 void HandlePackets(void);
+static void TrackSlotFree(void);
+static void ApplyLocoRequest(int nRequest);
+static uint32_t ScheduleTime(void);
+static uint32_t PacketTime(const uint8_t* pPacket, uint16_t preambles);
+static uint8_t BuildLocoMessage(Loco* pLoco, uint8_t* pPacket, uint32_t start);
 
 /**********************************************************************
 *
@@ -42,6 +85,24 @@ void HandlePackets(void);
 *
 **********************************************************************/
 
+static osThreadId_t CsThread;
+
+static CS_STATS CsStats;
+static uint32_t CsStatsStart;
+
+// the schedule clock counts us from the DWT cycle counter, TrackEnd is
+// when the packets handed to the track so far should be done
+static uint32_t ScheduleClock;
+static uint32_t ScheduleCycles;
+static uint32_t TrackEnd;
+
+static CS_SCHEDULE_STATS ScheduleStats;
+static uint32_t ScheduleStatsStart;
+static volatile uint8_t bfClearSchedule;
+
+static LOCO_REQUEST aLocoRequest[CS_LOCO_REQUESTS];
+static volatile uint8_t abLocoRequestUsed[CS_LOCO_REQUESTS];
+
 /**********************************************************************
 *
 *							CODE
@@ -56,19 +117,32 @@ void HandlePackets(void);
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Blocks until a track slot comes free, the cab bus
+*				answers, an event is queued or the next millisecond is
+*				due. The cab bus timers, the ACK detector, service mode
+*				and the expiration timers still run once a millisecond,
+*				packets and events are handled as soon as they happen.
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 void CommandStationTask(void* argument)
 {
+	EVENT_MESSAGE aMessages[CS_MESSAGE_BATCH];
 	VIRTUAL_CAB* pVirtualCab;
 	int	nEvent;
-	uint8_t bMessageType;
+	int nMessages;
+	int i;
 	//uint8_t work[_MAX_SS];
 	//FRESULT res;
 	uint8_t ExpirationCount = 10;
+	uint32_t LastTick;
+	uint32_t Now;
+	uint32_t flags;
+	uint32_t start;
+	uint32_t cycles;
+
+	CsThread = osThreadGetId();
 
 	InitMessageQueue();
 
@@ -80,6 +154,10 @@ void CommandStationTask(void* argument)
 	InitCabCommunication(0);
 	//k	InitXpressNet();
 
+	// share the main track with the tester, packet by packet
+	OpenTrack(TR_COMMAND_STATION, TI_NONE, 0);
+	RegisterPacketSlotCallback(TrackSlotFree);
+
 	// set the clock update callback function
 	RegisterClockUpdate(UpdateWangrowClock);
 	//RegisterClockUpdate(UpdateXpressnetClock);
@@ -88,48 +166,256 @@ void CommandStationTask(void* argument)
 	InitState(STATE_IDLE);
 	// ************ Wangrow / NCE state machine
 
+	ClearCommandStationStats();
+	ScheduleCycles = DWT->CYCCNT;
+	ClearScheduleStats();
+	LastTick = osKernelGetTickCount();
 
 	while(1)
 	{
+		flags = 0;
+		if(osKernelGetTickCount() == LastTick)
+		{
+			// this millisecond is done, a timeout of one tick ends at the next one
+			flags = osThreadFlagsWait(CS_FLAGS, osFlagsWaitAny, 1);
+			if(flags & osFlagsError)
+			{
+				flags = 0;
+			}
+		}
+
+		start = DWT->CYCCNT;
+		Now = osKernelGetTickCount();
+
+		CsStats.wakes++;
+		CsStats.slot += (flags & CS_FLAG_SLOT) != 0;
+		CsStats.cab += (flags & CS_FLAG_CAB) != 0;
+		CsStats.message += (flags & CS_FLAG_MESSAGE) != 0;
 
+		// the cab bus counts its timeouts in ticks, it can run on every wake
 		HandleCabCommunication();
 		HandlePackets();
-		Acknowledge();
-		ServiceMode();
 
-		pVirtualCab = GetMessage(&bMessageType, &nEvent);
-		if(pVirtualCab != NULL)
+		if(Now != LastTick)
 		{
-			nEvent = pVirtualCab->nEvent;
-			if(nEvent & EVENT_SPEED_TYPE)
+			LastTick = Now;
+			CsStats.tick++;
+
+			Acknowledge();
+			ServiceMode();
+
+			ExpirationCount--;
+			if(ExpirationCount == 0)
 			{
-				RunOperate(pVirtualCab, nEvent);
+				ExpirationCount = 10;
+				HandleExpiration();
+
+				CheckClockUpdate();
+
 			}
-			else
+		}
+
+		while((nMessages = GetMessages(aMessages, CS_MESSAGE_BATCH)) != 0)
+		{
+			for(i = 0; i < nMessages; i++)
 			{
-				RunState(pVirtualCab, nEvent);
-				RunOperate(pVirtualCab, nEvent);
+				if(aMessages[i].bMessageType == MSG_LOCO_MESSAGE)
+				{
+					ApplyLocoRequest(aMessages[i].nEvent);
+					continue;
+				}
+
+				// the queued event, the cab may have had another since
+				pVirtualCab = aMessages[i].pMessagePointer;
+				nEvent = aMessages[i].nEvent;
+				pVirtualCab->nEvent = nEvent;
+				if(nEvent & EVENT_SPEED_TYPE)
+				{
+					RunOperate(pVirtualCab, nEvent);
+				}
+				else
+				{
+					RunState(pVirtualCab, nEvent);
+					RunOperate(pVirtualCab, nEvent);
+				}
 			}
 		}
 
-		ExpirationCount--;
-		if(ExpirationCount == 0)
+		// a throttle change has a packet ready now
+		HandlePackets();
+
+		cycles = DWT->CYCCNT - start;
+		CsStats.busy_cycles += cycles;
+		if(cycles > CsStats.max_cycles)
 		{
-			ExpirationCount = 10;
-			HandleExpiration();
+			CsStats.max_cycles = cycles;
+		}
+	}
+}
 
-			CheckClockUpdate();
 
-		}
+/**********************************************************************
+*
+* FUNCTION:		SignalCommandStation
+*
+* ARGUMENTS:	flags - CS_FLAG_xxx
+*
+* RETURNS:
+*
+* DESCRIPTION:	Wake the command station task, from a task or from an
+*				interrupt
+*
+* RESTRICTIONS:	Interrupts must be at or below
+*				configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+*
+**********************************************************************/
+void SignalCommandStation(uint32_t flags)
+{
+	if(CsThread != NULL)
+	{
+		osThreadFlagsSet(CsThread, flags);
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RequestLocoChange
+*
+* ARGUMENTS:	pRequest - the loco and what to set
+*
+* RETURNS:		1 = queued, 0 = too many changes waiting
+*
+* DESCRIPTION:	Hand a loco change to the command station task, for the
+*				tasks that do not own the locos. The loco is found or
+*				added, and changed, with the next events.
+*
+* RESTRICTIONS:	Not from an interrupt
+*
+**********************************************************************/
+uint8_t RequestLocoChange(const LOCO_REQUEST* pRequest)
+{
+	int i;
 
-		osDelay(pdMS_TO_TICKS(1));
+	osKernelLock();
+	for(i = 0; i < CS_LOCO_REQUESTS && abLocoRequestUsed[i]; i++)
+	{
 	}
+	if(i < CS_LOCO_REQUESTS)
+	{
+		abLocoRequestUsed[i] = 1;
+	}
+	osKernelUnlock();
+
+	if(i == CS_LOCO_REQUESTS)
+	{
+		return 0;
+	}
+
+	aLocoRequest[i] = *pRequest;
+	if(!QueueMessage(MSG_LOCO_MESSAGE, NULL, i))
+	{
+		abLocoRequestUsed[i] = 0;
+		return 0;
+	}
+	return 1;
 }
 
 
 /**********************************************************************
 *
-* FUNCTION:		HandlePackets
+* FUNCTION:		ApplyLocoRequest
+*
+* ARGUMENTS:	nRequest - aLocoRequest index
+*
+* RETURNS:
+*
+* DESCRIPTION:	Make a loco change queued by RequestLocoChange
+*
+* RESTRICTIONS:	Command station task
+*
+**********************************************************************/
+static void ApplyLocoRequest(int nRequest)
+{
+	LOCO_REQUEST* pRequest;
+	Loco* pLoco;
+
+	if(nRequest < 0 || nRequest >= CS_LOCO_REQUESTS)
+	{
+		return;
+	}
+
+	pRequest = &aLocoRequest[nRequest];
+	pLoco = FindLoco(pRequest->nAddress);
+	if(pLoco == NULL)
+	{
+		pLoco = NewLoco(pRequest->nAddress);
+	}
+
+	if(pLoco != NULL)
+	{
+		if(pRequest->bFields & LOCO_SET_SPEED)
+		{
+			SetLocoSpeed(pLoco, pRequest->nSpeed);
+		}
+		if(pRequest->bFields & LOCO_SET_DIRECTION)
+		{
+			SetLocoDirection(pLoco, pRequest->nDirection);
+		}
+		if(pRequest->bFields & LOCO_SET_FUNCTIONS)
+		{
+			SetLocoFunctions(pLoco, pRequest->nFunctionMap);
+		}
+	}
+
+	abLocoRequestUsed[nRequest] = 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TrackSlotFree
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Main track packet released, from the track wakeup interrupt
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void TrackSlotFree(void)
+{
+
+	SignalCommandStation(CS_FLAG_SLOT);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetCommandStationStats
+*
+* ARGUMENTS:	pStats - where to put them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetCommandStationStats(CS_STATS* pStats)
+{
+
+	*pStats = CsStats;
+	pStats->ms = osKernelGetTickCount() - CsStatsStart;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ClearCommandStationStats
 *
 * ARGUMENTS:
 *
@@ -140,70 +426,368 @@ void CommandStationTask(void* argument)
 * RESTRICTIONS:
 *
 **********************************************************************/
-void HandlePackets(void)
+void ClearCommandStationStats(void)
 {
-	static uint8_t* pPacket;
-	//static BOOL fWhich;
-	//static BOOL fWhichFunction;
-	uint32_t len = 0;
-	static Loco* pLoco;
-	unsigned int nAlias;
-	static uint8_t bfInsertIdle;
 
-//IsTrackOpen - or some such
-	if(IsPacketComplete())
+	memset(&CsStats, 0, sizeof(CsStats));
+	CsStatsStart = osKernelGetTickCount();
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetScheduleStats
+*
+* ARGUMENTS:	pStats - where to put them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetScheduleStats(CS_SCHEDULE_STATS* pStats)
+{
+
+	*pStats = ScheduleStats;
+	pStats->ms = osKernelGetTickCount() - ScheduleStatsStart;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ClearScheduleStats
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	The command station task clears them with the longest
+*				interval of every loco, it owns the refresh ring
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void ClearScheduleStats(void)
+{
+
+	bfClearSchedule = 1;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ScheduleTime
+*
+* ARGUMENTS:
+*
+* RETURNS:		the schedule clock, us
+*
+* DESCRIPTION:	Move the schedule clock on by the whole us the cycle
+*				counter has counted since the last call
+*
+* RESTRICTIONS:	called at least once a cycle counter wrap, every pass
+*				of the command station task does
+*
+**********************************************************************/
+static uint32_t ScheduleTime(void)
+{
+	uint32_t cycles_per_us = SystemCoreClock / 1000000;
+	uint32_t us;
+
+	us = (DWT->CYCCNT - ScheduleCycles) / cycles_per_us;
+	ScheduleCycles += us * cycles_per_us;
+	ScheduleClock += us;
+
+	return ScheduleClock;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		PacketTime
+*
+* ARGUMENTS:	pPacket - length byte and packet bytes
+*				preambles - preamble bits the packet is sent with
+*
+* RETURNS:		us the packet takes on the track
+*
+* DESCRIPTION:	The preamble, a start bit before every byte and the end
+*				bit, with the bit widths the packet is built with
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static uint32_t PacketTime(const uint8_t* pPacket, uint16_t preambles)
+{
+	uint32_t ones = preambles;
+	uint32_t zeros = pPacket[0] + 1;
+	uint8_t bits;
+	int i;
+
+	for(i = 1; i <= pPacket[0]; i++)
 	{
+		for(bits = pPacket[i]; bits; bits &= bits - 1)
+		{
+			ones++;
+		}
+		zeros += 8;
+	}
+	zeros -= ones - preambles;
+
+	return ones * CS_CLK1T + zeros * CS_CLK0T;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		BuildLocoMessage
+*
+* ARGUMENTS:	pLoco - the loco NextLocoMsg picked
+*				pPacket - where to build the packet, length byte first
+*				start - schedule time the packet will start, us
+*
+* RETURNS:		CS_PACKET_xxx, CS_PACKET_NONE if nothing was built
+*
+* DESCRIPTION:	A speed change first, then the stop repeats, then each
+*				changed function group FUNCTION_REPEATS times, the
+*				lowest group first. With nothing changed it is the
+*				refresh, the speed packet.
+*				Only one loco of a consist sends the consist speed,
+*				see GetConsistSpeedLoco. The others leave out the speed
+*				packets and refresh their functions to their own
+*				address instead, every CS_MEMBER_REFRESH_US.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static uint8_t BuildLocoMessage(Loco* pLoco, uint8_t* pPacket, uint32_t start)
+{
+	unsigned int nAlias;
+	uint8_t bfMember;
+	uint8_t bGroup;
+	uint8_t bReason;
 
-//		pPacket = abPacket;
+	bfMember = GetConsistSpeedLoco(pLoco) != pLoco;
+	if(bfMember)
+	{
+		pLoco->bChange &= ~CH_SPEED;
+		pLoco->bNumStopPackets = 0;
+	}
 
+	if(pLoco->bChange & CH_SPEED)
+	{
+		pLoco->bChange &= ~CH_SPEED;
+		bReason = CS_PACKET_CHANGE;
+	}
+	else if(pLoco->bNumStopPackets)
+	{
+		pLoco->bNumStopPackets--;
+		bReason = CS_PACKET_REPEAT;
+	}
+	else if(pLoco->bChange & CH_FUNCTIONS)
+	{
+		if(pLoco->bChange & CH_FUNCTION_1)
+		{
+			bGroup = CH_FUNCTION_1;
+			BuildFunction1Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
+		}
+		else if(pLoco->bChange & CH_FUNCTION_2)
+		{
+			bGroup = CH_FUNCTION_2;
+			BuildFunction2Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
+		}
+		else if(pLoco->bChange & CH_FUNCTION_3)
+		{
+			bGroup = CH_FUNCTION_3;
+			BuildFunction3Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
+		}
+		else
+		{
+			bGroup = CH_FUNCTION_4;
+			BuildFunction4Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
+		}
 
-		if(bfInsertIdle)
+		// this group is done, the next one gets its repeats
+		if(pLoco->bNumFunctionPackets <= 1)
 		{
-			bfInsertIdle = 0;
-//			BuildIdlePacket(pPacket);
+			pLoco->bChange &= ~bGroup;
+			pLoco->bNumFunctionPackets = (pLoco->bChange & CH_FUNCTIONS) ? FUNCTION_REPEATS : 0;
 		}
 		else
 		{
-			bfInsertIdle = 1;
+			pLoco->bNumFunctionPackets--;
+		}
+		return CS_PACKET_REPEAT;
+	}
+	else if(bfMember)
+	{
+		if(pLoco->LastPacketEnd != 0 && (int32_t)(start - pLoco->LastPacketEnd) < CS_MEMBER_REFRESH_US)
+		{
+			// the lead loco has the speed packet for it
+			ScheduleStats.merged++;
+			return CS_PACKET_NONE;
+		}
+		BuildFunction1Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
+		return CS_PACKET_MEMBER;
+	}
+	else
+	{
+		bReason = CS_PACKET_REFRESH;
+	}
+
+	nAlias = GetLocoAlias(pLoco);
+	if(nAlias)
+	{
+		BuildLocoPacket(pPacket, nAlias, pLoco->Speed, pLoco->Direction, pLoco->SpeedMode);
+	}
+	else
+	{
+		BuildLocoPacket(pPacket, pLoco->Address, pLoco->Speed, pLoco->Direction, pLoco->SpeedMode);
+	}
+
+	return bReason;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		HandlePackets
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Pick the next loco, build its packet and hand it to the
+*				track when the arbiter gives a turn. The schedule clock
+*				keeps the time each address last had a packet so the
+*				spacing S-9.2 asks for holds, and the track time of
+*				every packet is added up. Packets are not built more
+*				than CS_SCHEDULE_AHEAD_US ahead of the track, a speed
+*				change does not wait behind a ring full of refresh.
+*				A consist member with nothing to send is passed over
+*				for the next loco. A packet still waiting for a turn
+*				when its loco entry goes to another loco is dropped.
+*
+* RESTRICTIONS:	The end of a packet is estimated from the command
+*				station packets only, the tester packets in between
+*				only make the real spacing longer
+*
+**********************************************************************/
+void HandlePackets(void)
+{
+	static uint8_t abPacket[CS_PACKET_SIZE];
+	static uint32_t len = 0;
+	static Loco* pLoco;
+	static uint8_t bGeneration;
+	static uint8_t bReason;
+	uint32_t now;
+	uint32_t start;
+	uint32_t duration;
+	word tries;
+
+	now = ScheduleTime();
+
+	if(bfClearSchedule)
+	{
+		bfClearSchedule = 0;
+		memset(&ScheduleStats, 0, sizeof(ScheduleStats));
+		ScheduleStatsStart = osKernelGetTickCount();
+		ClearLocoIntervals();
+	}
+
+	// the track is idle or still busy with what was handed to it
+	start = (int32_t)(TrackEnd - now) > 0 ? TrackEnd : now;
+
+	// build the next packet first, the track arbiter only hands out a
+	// turn to a resource with a packet ready
+	if(len == 0)
+	{
+		if(start - now > CS_SCHEDULE_AHEAD_US)
+		{
+			return;
+		}
 
-//			if(!GetProgrammingPacket(pPacket))
+		// at most one round of the refresh ring
+		for(tries = GetRefreshCount(); ; tries--)
+		{
+			pLoco = NextLocoMsg(start);
+			if(pLoco == NULL)
 			{
-				pLoco = NextLocoMsg();
-				if(pLoco != NULL && pLoco->Address != 0)
+				if(GetRefreshCount())
 				{
-					if(pLoco->bChange == CH_FUNCTION_1)
-					{
-						len = BuildFunction1Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
-					}
-					else if(pLoco->bChange == CH_FUNCTION_2)
-					{
-						len = BuildFunction2Packet(pPacket, pLoco->Address, pLoco->FunctionMap);
-					}
-					else
-					{
-						nAlias = GetLocoAlias(pLoco);
-						if(nAlias)
-						{
-							len = BuildLocoPacket(pPacket, nAlias, pLoco->Speed, pLoco->Direction, pLoco->SpeedMode);
-						}
-						else
-						{
-							len = BuildLocoPacket(pPacket, pLoco->Address, pLoco->Speed, pLoco->Direction, pLoco->SpeedMode);
-						}
-					}
+					ScheduleStats.rests++;
 				}
+				return;
 			}
-//			else
-//			{
-//
-//			}
+			if(pLoco->Address != 0)
+			{
+				bReason = BuildLocoMessage(pLoco, abPacket, start);
+				if(bReason != CS_PACKET_NONE)
+				{
+					break;
+				}
+			}
+			if(tries == 0)
+			{
+				return;
+			}
+		}
+
+		// the first byte is the packet length
+		len = abPacket[0];
+		bGeneration = pLoco->bGeneration;
+	}
+
+	// the loco entry was given to another loco (ReuseLoco) while the
+	// packet waited, it is for the old address
+	if(len && pLoco->bGeneration != bGeneration)
+	{
+		len = 0;
+		return;
+	}
+
+	// keep the track packet ring topped up so a late pass does not leave a
+	// gap, as far as the tester leaves room for it
+	if(len && IsTrackTurn(TR_COMMAND_STATION))
+	{
+		//BuildPacket(pPacket, len, DECODER_1T_NOM, DECODER_0T_NOM, DECODER_0H_NOM);
+		if(BuildPacket(&abPacket[1], len, CS_CLK1T, CS_CLK0T, CS_CLK0H) != 0)
+		{
+			// try again on the next pass
+			ReleaseTrackTurn(TR_COMMAND_STATION);
+			return;
+		}
+		len = 0;
+
+		duration = PacketTime(abPacket, GetTrackPreambles(TR_COMMAND_STATION));
+		TrackEnd = start + duration;
+		LocoMsgSent(pLoco, TrackEnd);
+
+		ScheduleStats.packets++;
+		ScheduleStats.track_us += duration;
+		if(bReason == CS_PACKET_CHANGE)
+		{
+			ScheduleStats.changes++;
 		}
-		
-		if(len)
+		else if(bReason == CS_PACKET_REPEAT)
 		{
-			//BuildPacket(pPacket, len, DECODER_1T_NOM, DECODER_0T_NOM, DECODER_0H_NOM);
-			BuildPacket(pPacket, len, 116, 100, 50);
+			ScheduleStats.repeats++;
+		}
+		else if(bReason == CS_PACKET_MEMBER)
+		{
+			ScheduleStats.members++;
+		}
+		else
+		{
+			ScheduleStats.refresh++;
+		}
+
+		// a consist member is refreshed slower on purpose
+		if(GetConsistSpeedLoco(pLoco) == pLoco && pLoco->LastInterval > CS_REFRESH_LATE_US)
+		{
+			ScheduleStats.late++;
 		}
 	}
 }
-
@@ -1,3 +1,5 @@
+#ifndef CS_H_
+#define CS_H_
 
 #include "MsgQueue.h"
 //#include "Track.h"
@@ -5,13 +7,75 @@
 #include "Acknowledge.h"
 #include "TrakList.h"
 #include "Events.h"
-#include "States.h"
+#include "STATES.h"
 #include "Loco.h"
 #include "Service.h"
 #include "Operate.h"
 #include "Clock.h"
 #include "CabNCE.h"
 #include "Cab.h"
+#include "LocoStore.h"
+
+// thread flags that wake the command station task, clear of the track flags
+#define CS_FLAG_SLOT		0x0100		// a main track packet slot came free
+#define CS_FLAG_CAB			0x0200		// the cab bus has a response or finished sending
+#define CS_FLAG_MESSAGE		0x0400		// an event was queued
+#define CS_FLAGS			(CS_FLAG_SLOT | CS_FLAG_CAB | CS_FLAG_MESSAGE)
+
+// what a loco change from another task sets, LOCO_REQUEST bFields
+#define LOCO_SET_SPEED		0x01
+#define LOCO_SET_DIRECTION	0x02
+#define LOCO_SET_FUNCTIONS	0x04
+
+// a loco change from another task (the shell), the command station task
+// owns the locos and the refresh schedule and makes the change itself
+typedef struct
+{
+	unsigned int	nAddress;
+	uint8_t			bFields;			// LOCO_SET_xxx
+	uint8_t			nDirection;
+	word			nSpeed;
+	unsigned long	nFunctionMap;
+} LOCO_REQUEST;
+
+// what woke the command station task, and how long it ran
+typedef struct
+{
+	uint32_t wakes;
+	uint32_t slot;				// wakes by reason, a wake can have several
+	uint32_t cab;
+	uint32_t message;
+	uint32_t tick;
+	uint32_t ms;				// since the statistics were cleared
+	uint64_t busy_cycles;		// DWT cycles spent running, not blocked
+	uint32_t max_cycles;		// longest single pass
+} CS_STATS;
+
+// what the packet scheduler sent and how much of the track it used
+typedef struct
+{
+	uint32_t packets;
+	uint32_t changes;			// packets by reason, a speed change
+	uint32_t repeats;			// a stop or function change repeated
+	uint32_t refresh;			// the refresh round
+	uint32_t members;			// functions of a consist member, in its refresh turn
+	uint32_t merged;			// consist member turns left out, the lead sends the speed
+	uint32_t rests;				// passes with every address on the track still resting
+	uint32_t late;				// refresh intervals longer than CS_REFRESH_LATE_US
+	uint64_t track_us;			// track time of the packets sent
+	uint32_t ms;				// since the statistics were cleared
+} CS_SCHEDULE_STATS;
 
 extern void CommandStationTask(void* argument);
 
+extern void SignalCommandStation(uint32_t flags);
+
+extern uint8_t RequestLocoChange(const LOCO_REQUEST* pRequest);
+
+extern void GetCommandStationStats(CS_STATS* pStats);
+extern void ClearCommandStationStats(void);
+
+extern void GetScheduleStats(CS_SCHEDULE_STATS* pStats);
+extern void ClearScheduleStats(void);
+
+#endif /* CS_H_ */
@@ -22,8 +22,8 @@
 #ifndef CAB_H
 #define CAB_H
 
-#include "Main.h"
-#include "menu.h"
+#include "main.h"
+#include "Menu.h"
 #include "Loco.h"
 
 /**********************************************************************
@@ -14,7 +14,7 @@
 //#include <dos.h>
 //#include <stdafx.h>
 #include <stdio.h>
-#include "Main.h"
+#include "main.h"
 #include "LinkedList.h"
 #include "Loco.h"
 
@@ -19,6 +19,7 @@
 #include "Events.h"
 #include "Cab.h"
 #include "TrakList.h"
+#include "LocoStore.h"
 #include "ff.h"
 
 /**********************************************************************
@@ -29,6 +30,18 @@
 
 #define true 1
 
+// open addressing index over the loco and the consist addresses, at most half full
+#define LOCO_HASH_BITS		9
+#define LOCO_HASH_SIZE		(1 << LOCO_HASH_BITS)
+#define LOCO_HASH_MASK		(LOCO_HASH_SIZE - 1)
+#define LOCO_HASH_EMPTY		0xffff
+
+#if LOCO_HASH_SIZE < 2 * MAX_LOCOS
+#error LOCO_HASH_BITS too small for MAX_LOCOS
+#endif
+
+#define ALIAS_ADDRESS(pLoco)	((pLoco)->Alias & 0x7f)
+
 /**********************************************************************
 *
 *							FUNCTION PROTOTYPES
@@ -40,7 +53,10 @@ extern void SetZeroStretch(unsigned int nSpeed, unsigned char fDirection);
 extern void SendWMIntMessage(int iMsgId, int iMsgData);
 
 void SaveLocoState(void);
-void ReadLocoState(void);
+
+static void BuildLocoIndex(void);
+static void IndexInsert(uint16_t* pTable, unsigned int nKey, uint16_t wLoco);
+static void IndexRemove(uint16_t* pTable, unsigned int nKey, uint16_t wLoco);
 
 /**********************************************************************
 *
@@ -57,6 +73,11 @@ unsigned char abAnalogSpeedTable[29];
 *
 **********************************************************************/
 
+// ActiveLocos indexes, by loco address and by consist address (a
+// consist address has an entry for each loco in it)
+static uint16_t awLocoIndex[LOCO_HASH_SIZE];
+static uint16_t awAliasIndex[LOCO_HASH_SIZE];
+
 /**********************************************************************
 *
 *							CODE
@@ -82,7 +103,8 @@ void InitLoco(void)
 
 	memset(ActiveLocos, 0, sizeof(ActiveLocos));
 
-	//ReadLocoState();		// read loco data from a file
+	LoadLocoStore();		// read loco data from the SD card
+	BuildLocoIndex();
 
 	// ToDo - this should come from a file
 	for(i = 0; i <= 28; i++)
@@ -93,6 +115,169 @@ void InitLoco(void)
 
 
 
+/**********************************************************************
+*
+* FUNCTION:		IndexHash
+*
+* ARGUMENTS:	nKey - loco or consist address
+*
+* RETURNS:		home slot in the index
+*
+* DESCRIPTION:	Fibonacci hash, spreads the runs of loco numbers a club
+*				roster tends to have
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned int IndexHash(unsigned int nKey)
+{
+
+	return (nKey * 2654435761u) >> (32 - LOCO_HASH_BITS);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IndexKey
+*
+* ARGUMENTS:	pTable - awLocoIndex or awAliasIndex
+*				wLoco - ActiveLocos index
+*
+* RETURNS:		the key the loco is filed under in that table
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned int IndexKey(uint16_t* pTable, uint16_t wLoco)
+{
+
+	return pTable == awAliasIndex ? ALIAS_ADDRESS(&ActiveLocos[wLoco]) : ActiveLocos[wLoco].Address;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IndexInsert
+*
+* ARGUMENTS:	pTable - awLocoIndex or awAliasIndex
+*				nKey - address to file the loco under
+*				wLoco - ActiveLocos index
+*
+* RETURNS:
+*
+* DESCRIPTION:	Linear probing, the table is never more than half full
+*				so the probe is short
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void IndexInsert(uint16_t* pTable, unsigned int nKey, uint16_t wLoco)
+{
+	unsigned int i;
+
+	i = IndexHash(nKey);
+	while(pTable[i] != LOCO_HASH_EMPTY)
+	{
+		i = (i + 1) & LOCO_HASH_MASK;
+	}
+	pTable[i] = wLoco;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IndexRemove
+*
+* ARGUMENTS:	pTable - awLocoIndex or awAliasIndex
+*				nKey - address the loco is filed under
+*				wLoco - ActiveLocos index
+*
+* RETURNS:
+*
+* DESCRIPTION:	Remove an entry and move the rest of its run back so no
+*				probe is cut short, there are no deleted markers to
+*				clean up later
+*
+* RESTRICTIONS:	Call before the key in the loco changes
+*
+**********************************************************************/
+static void IndexRemove(uint16_t* pTable, unsigned int nKey, uint16_t wLoco)
+{
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+
+	i = IndexHash(nKey);
+	while(pTable[i] != wLoco)
+	{
+		if(pTable[i] == LOCO_HASH_EMPTY)
+		{
+			// not filed
+			return;
+		}
+		i = (i + 1) & LOCO_HASH_MASK;
+	}
+
+	j = i;
+	while(1)
+	{
+		j = (j + 1) & LOCO_HASH_MASK;
+		if(pTable[j] == LOCO_HASH_EMPTY)
+		{
+			break;
+		}
+
+		// an entry whose home lies between the hole and itself stays
+		k = IndexHash(IndexKey(pTable, pTable[j]));
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+		{
+			continue;
+		}
+
+		pTable[i] = pTable[j];
+		i = j;
+	}
+	pTable[i] = LOCO_HASH_EMPTY;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		BuildLocoIndex
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	File every loco in ActiveLocos, after it is cleared or
+*				read back
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void BuildLocoIndex(void)
+{
+	uint16_t i;
+
+	memset(awLocoIndex, 0xff, sizeof(awLocoIndex));
+	memset(awAliasIndex, 0xff, sizeof(awAliasIndex));
+
+	for(i = 0; i < MAX_LOCOS; i++)
+	{
+		if(ActiveLocos[i].Address != 0)
+		{
+			IndexInsert(awLocoIndex, ActiveLocos[i].Address, i);
+			if(ALIAS_ADDRESS(&ActiveLocos[i]) != 0)
+			{
+				IndexInsert(awAliasIndex, ALIAS_ADDRESS(&ActiveLocos[i]), i);
+			}
+		}
+	}
+}
+
+
 /**********************************************************************
 *
 * FUNCTION:		NewLoco
@@ -109,12 +294,16 @@ void InitLoco(void)
 Loco* NewLoco(unsigned int nAddress)
 {
 	word i;
+	unsigned char bGeneration;
    
 	for(i = 0; i < MAX_LOCOS; i++)
 	{
 		if(0 == ActiveLocos[i].Address)
 		{
+			// a packet built for the old loco is not sent
+			bGeneration = ActiveLocos[i].bGeneration + 1;
 			memset(&ActiveLocos[i], 0, sizeof(ActiveLocos[i]));
+			ActiveLocos[i].bGeneration = bGeneration;
 			ActiveLocos[i].Address = nAddress;
 			ActiveLocos[i].bfStateDirty = true;
 
@@ -125,6 +314,8 @@ Loco* NewLoco(unsigned int nAddress)
 			ActiveLocos[i].MaxSpeed = 100;
 //			ActiveLocos[i].MaxSpeed = 80 | SPEED_UNITS_MASK;
 
+			IndexInsert(awLocoIndex, nAddress, i);
+
 //k			SendWMIntMessage(WM_USER_NEW_LOCO, 0);
 
 			return &ActiveLocos[i];
@@ -134,6 +325,50 @@ Loco* NewLoco(unsigned int nAddress)
 }
 
 
+/**********************************************************************
+*
+* FUNCTION:		ReuseLoco
+*
+* ARGUMENTS:	pLoco - a loco taken off the track (OldestLoco)
+*				nAddress - the new loco address
+*
+* RETURNS:		pLoco
+*
+* DESCRIPTION:	Give the entry of a loco nobody runs any more to a new
+*				loco when the table is full
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+Loco* ReuseLoco(Loco* pLoco, unsigned int nAddress)
+{
+	uint16_t wLoco = pLoco - ActiveLocos;
+	unsigned char bGeneration = pLoco->bGeneration + 1;
+
+	if(pLoco->Address != 0)
+	{
+		IndexRemove(awLocoIndex, pLoco->Address, wLoco);
+	}
+	if(ALIAS_ADDRESS(pLoco) != 0)
+	{
+		IndexRemove(awAliasIndex, ALIAS_ADDRESS(pLoco), wLoco);
+	}
+
+	// OldestLoco took it out of the refresh ring, a packet built for the
+	// old loco is not sent
+	memset(pLoco, 0, sizeof(*pLoco));
+	pLoco->bGeneration = bGeneration;
+	pLoco->Address = nAddress;
+	pLoco->bfStateDirty = true;
+	pLoco->SpeedFcnMode = SPEED_MODE_NORMAL;
+	pLoco->MaxSpeed = 100;
+
+	IndexInsert(awLocoIndex, nAddress, wLoco);
+
+	return pLoco;
+}
+
+
 /**********************************************************************
 *
 * FUNCTION:		FindLoco
@@ -149,14 +384,30 @@ Loco* NewLoco(unsigned int nAddress)
 **********************************************************************/
 Loco* FindLoco(unsigned int nAddress)
 {
-	word i;
-   
-	for(i = 0; i < MAX_LOCOS; i++)
+	unsigned int i;
+	uint16_t wLoco;
+
+	if(nAddress == 0)
 	{
-		if(nAddress == ActiveLocos[i].Address)
+		// the first free entry, free entries are not filed
+		for(i = 0; i < MAX_LOCOS; i++)
 		{
-			return &ActiveLocos[i];
+			if(ActiveLocos[i].Address == 0)
+			{
+				return &ActiveLocos[i];
+			}
+		}
+		return NULL;
+	}
+
+	i = IndexHash(nAddress);
+	while((wLoco = awLocoIndex[i]) != LOCO_HASH_EMPTY)
+	{
+		if(nAddress == ActiveLocos[wLoco].Address)
+		{
+			return &ActiveLocos[wLoco];
 		}
+		i = (i + 1) & LOCO_HASH_MASK;
 	}
 	return NULL;
 }
@@ -169,23 +420,40 @@ Loco* FindLoco(unsigned int nAddress)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	The first loco (in table order) in the consist
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 Loco* FindAlias(unsigned int nAddress)
 {
-	word i;
+	unsigned int i;
+	uint16_t wLoco;
+	uint16_t wFirst = LOCO_HASH_EMPTY;
 
-	for(i = 0; i < MAX_LOCOS; i++)
+	if(nAddress == 0)
 	{
-		if(nAddress == (ActiveLocos[i].Alias & 0x7f))
+		// any loco not in a consist, those are not filed
+		for(i = 0; i < MAX_LOCOS; i++)
 		{
-			return &ActiveLocos[i];
+			if(ALIAS_ADDRESS(&ActiveLocos[i]) == 0)
+			{
+				return &ActiveLocos[i];
+			}
 		}
+		return NULL;
 	}
-	return NULL;
+
+	i = IndexHash(nAddress);
+	while((wLoco = awAliasIndex[i]) != LOCO_HASH_EMPTY)
+	{
+		if(nAddress == ALIAS_ADDRESS(&ActiveLocos[wLoco]) && wLoco < wFirst)
+		{
+			wFirst = wLoco;
+		}
+		i = (i + 1) & LOCO_HASH_MASK;
+	}
+	return wFirst == LOCO_HASH_EMPTY ? NULL : &ActiveLocos[wFirst];
 }
 
 
@@ -197,26 +465,48 @@ Loco* FindAlias(unsigned int nAddress)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	The lead loco of the consist, by consist address or by
+*				the lead loco's own address
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 Loco* FindLeadLoco(unsigned int nAddress)
 {
-	word i;
+	unsigned int i;
+	uint16_t wLoco;
+	uint16_t wFirst = LOCO_HASH_EMPTY;
+	Loco* pLoco;
 
-	for(i = 0; i < MAX_LOCOS; i++)
+	if(nAddress == 0)
 	{
-		if(nAddress == (ActiveLocos[i].Alias & 0x7f) || nAddress == ActiveLocos[i].Address)
+		// a lead loco without a consist address, not filed
+		for(i = 0; i < MAX_LOCOS; i++)
 		{
-			if(ActiveLocos[i].Alias & 0x8000)
-         {
+			if(ALIAS_ADDRESS(&ActiveLocos[i]) == 0 && (ActiveLocos[i].Alias & 0x8000))
+			{
 				return &ActiveLocos[i];
-         }
+			}
 		}
+		return NULL;
 	}
-	return NULL;
+
+	i = IndexHash(nAddress);
+	while((wLoco = awAliasIndex[i]) != LOCO_HASH_EMPTY)
+	{
+		if(nAddress == ALIAS_ADDRESS(&ActiveLocos[wLoco]) && (ActiveLocos[wLoco].Alias & 0x8000) && wLoco < wFirst)
+		{
+			wFirst = wLoco;
+		}
+		i = (i + 1) & LOCO_HASH_MASK;
+	}
+
+	pLoco = FindLoco(nAddress);
+	if(pLoco != NULL && (pLoco->Alias & 0x8000) && pLoco - ActiveLocos < wFirst)
+	{
+		return pLoco;
+	}
+	return wFirst == LOCO_HASH_EMPTY ? NULL : &ActiveLocos[wFirst];
 }
 
 
@@ -302,12 +592,17 @@ void SetLocoSpeed(Loco* pLoco, word nSpeed)
 	{
 //k		SetZeroStretch(nSpeed, pLoco->Direction);
 	}
-	pLoco->bChange = CH_SPEED;
+	pLoco->bChange |= CH_SPEED;
 	MakeMostRecentLoco(pLoco);
 
-	if(nSpeed)
+	// a stop is repeated, a decoder that missed it keeps running
+	if(nSpeed == 0 || nSpeed == ESTOP)
+	{
+		pLoco->bNumStopPackets = STOP_REPEATS;
+	}
+	else
 	{
-		pLoco->bNumStopPackets = 25;
+		pLoco->bNumStopPackets = 0;
 	}
 
 //k	SendWMIntMessage(WM_USER_SPEED_CHANGE, 0);
@@ -454,7 +749,7 @@ void SetLocoDirection(Loco* pLoco, unsigned char fDirection)
 	{
 //k		SetZeroStretch(pLoco->Speed, fDirection);
 	}
-	pLoco->bChange = CH_SPEED;
+	pLoco->bChange |= CH_SPEED;
 	MakeMostRecentLoco(pLoco);
 	pLoco->bfStateDirty = true;
 
@@ -579,7 +874,7 @@ void SetLocoFunctions(Loco* pLoco, unsigned long nFunctionMap)
 
 	pLoco->FunctionMap = nFunctionMap;
 	MakeMostRecentLoco(pLoco);
-	pLoco->bNumFunctionPackets = 10;
+	pLoco->bNumFunctionPackets = FUNCTION_REPEATS;
 	pLoco->bfStateDirty = true;
 }
 
@@ -818,6 +1113,12 @@ void SetLocoSpeedLabel(Loco* pLoco, char* pSpeedLabel)
 **********************************************************************/
 void SetLocoAlias(Loco* pLoco, unsigned short nAlias, unsigned short nDirection, unsigned char bLeadLoco)
 {
+	uint16_t wLoco = pLoco - ActiveLocos;
+
+	if(ALIAS_ADDRESS(pLoco) != 0)
+	{
+		IndexRemove(awAliasIndex, ALIAS_ADDRESS(pLoco), wLoco);
+	}
 
 	pLoco->Alias = nAlias;
 
@@ -830,6 +1131,11 @@ void SetLocoAlias(Loco* pLoco, unsigned short nAlias, unsigned short nDirection,
     {
 		pLoco->Alias |= 0x8000;
     }
+
+	if(ALIAS_ADDRESS(pLoco) != 0)
+	{
+		IndexInsert(awAliasIndex, ALIAS_ADDRESS(pLoco), wLoco);
+	}
 	pLoco->bfStateDirty = true;
 }
 
@@ -895,6 +1201,40 @@ unsigned char IsLeadLoco(Loco* pLoco)
 }
 
 
+/**********************************************************************
+*
+* FUNCTION:		GetConsistSpeedLoco
+*
+* ARGUMENTS:	pLoco - a loco on the track
+*
+* RETURNS:		the loco that sends the speed packets to its consist
+*				address, pLoco itself when it is not in a consist
+*
+* DESCRIPTION:	The lead loco carries the speed and direction of a
+*				consist. Without a lead loco on the track every member
+*				sends its own, as before.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+Loco* GetConsistSpeedLoco(Loco* pLoco)
+{
+	Loco* pLead;
+
+	if(ALIAS_ADDRESS(pLoco) == 0 || IsLeadLoco(pLoco))
+	{
+		return pLoco;
+	}
+
+	pLead = FindLeadLoco(ALIAS_ADDRESS(pLoco));
+	if(pLead == NULL || pLead->pRefreshNext == NULL)
+	{
+		return pLoco;
+	}
+	return pLead;
+}
+
+
 /**********************************************************************
 *
 * FUNCTION:		StopAllLocos
@@ -988,51 +1328,15 @@ word GetNumLocos(void)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Have the loco store task write the changed locos now,
+*				it does every few seconds anyway
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 void SaveLocoState(void)
 {
-//k	int ret;
-//k	FIL fp;
-//k	unsigned int bw;
-
-	// open file
-//k	ret = f_open(&fp, "Locos", FA_CREATE_ALWAYS | FA_WRITE);
-//k	if(ret == FR_OK)
-//k	{
-//k		ret = f_write(&fp, ActiveLocos, sizeof(ActiveLocos), &bw);
-//k		(void)f_close (&fp);
-//k	}
-}
 
-/**********************************************************************
-*
-* FUNCTION:		GetLocoState
-*
-* ARGUMENTS:
-*
-* RETURNS:
-*
-* DESCRIPTION:
-*
-* RESTRICTIONS:
-*
-**********************************************************************/
-void ReadLocoState(void)
-{
-	int ret;
-	FIL fp;
-	unsigned int br;
-
-	// open file
-	ret = f_open(&fp, "LocoState", FA_READ);
-	if(ret == FR_OK)
-	{
-		ret = f_read (&fp, ActiveLocos, sizeof(ActiveLocos), &br);
-		(void)f_close (&fp);
-	}
+	FlushLocoStore(LOCO_STORE_FLAG_FLUSH);
 }
 
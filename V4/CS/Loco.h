@@ -39,20 +39,27 @@ enum
 	SPEED_MODE_14_PERCENT,
 } SPEED_MODE;
 
+// bits in bChange, what still has to go to the track
 enum
 {
-	CH_SPEED,
-	CH_FUNCTION_1,
-	CH_FUNCTION_2,
-	CH_FUNCTION_3,
-	CH_FUNCTION_4,
+	CH_SPEED		= 0x01,
+	CH_FUNCTION_1	= 0x02,
+	CH_FUNCTION_2	= 0x04,
+	CH_FUNCTION_3	= 0x08,
+	CH_FUNCTION_4	= 0x10,
 } CHANGE;
 
+#define CH_FUNCTIONS		(CH_FUNCTION_1 | CH_FUNCTION_2 | CH_FUNCTION_3 | CH_FUNCTION_4)
+
+// times a stop or a changed function group is sent
+#define STOP_REPEATS		25
+#define FUNCTION_REPEATS	10
+
 #define SPEED_UNITS_MASK	0x8000
 
 #define ANALOG_LOCO			0xfffe
 
-#define MAX_LOCOS	32
+#define MAX_LOCOS	256
 //#define MAX_LOCOS	10
 
 
@@ -89,10 +96,22 @@ typedef struct Loco
 	{
 		unsigned char	bfSendLoco:1;		// flag for indicating the loco message has been sent *
 		unsigned char	bfStateDirty:1;		// flag to indicate that the loco information has changed and the state should be written *
+		unsigned char	bfPromoted:1;		// flag for waiting to go to the track ahead of the refresh round *
+		unsigned char	bfPromotedSpeed:1;	// flag for waiting with a speed change, ahead of the other waiting locos *
 	};
-	unsigned char	bChange:1;				// a bit mask of what has been updated - speed, functions, ...
+	unsigned char	bChange;				// a bit mask of what has been updated - speed, functions, ... *
 
 	unsigned char	bfWhichFunction;		// which function group is currently showing *
+	unsigned char	bGeneration;			// counts the times the entry was given to a new loco *
+
+	struct Loco*	pRefreshNext;			// the next older loco in the refresh ring, NULL when not on the track *
+	struct Loco*	pRefreshPrev;			// the next newer loco in the refresh ring *
+	struct Loco*	pPromotedNext;			// the loco waiting behind this one, NULL for the last *
+	struct Loco*	pPromotedPrev;			// the loco waiting ahead of this one, NULL for the first *
+
+	uint32_t		LastPacketEnd;			// schedule time in us the last packet to this address ended, 0 never *
+	uint32_t		LastInterval;			// us between the last two packets to this address *
+	uint32_t		MaxInterval;			// the longest of them *
 } Loco;
 
 // * the state does not have to be saved
@@ -118,6 +137,7 @@ Loco* FindAlias(unsigned int nAddress);
 Loco* FindLeadLoco(unsigned int nAddress);
 
 Loco* NewLoco(unsigned int nAddress);
+Loco* ReuseLoco(Loco* pLoco, unsigned int nAddress);
 
 //void DeleteRecallLoco(VIRTUAL_CAB* pVirtualCab, unsigned int nLocoIndex);
 
@@ -149,6 +169,7 @@ word GetLocoAlias(Loco* pLoco);
 unsigned char GetLocoAliasDirection(Loco* pLoco);
 
 unsigned char IsLeadLoco(Loco* pLoco);
+Loco* GetConsistSpeedLoco(Loco* pLoco);
 
 word GetLocoAddress(Loco* pLoco);
 
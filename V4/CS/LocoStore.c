@@ -0,0 +1,617 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	LocoStore.c
+*
+* DATE CREATED:		12/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		The loco roster on the SD card. LOCOS.DAT is a
+*					snapshot of every loco, LOCOS.JNL the locos changed
+*					since, appended in batches by the loco store task.
+*					Every record carries the slot in ActiveLocos, a
+*					sequence number and a CRC. At boot the snapshot and
+*					then the journal are replayed, a slot takes the
+*					record with the highest sequence and the journal
+*					ends at the first bad record, the one power loss
+*					cut short. When the journal gets long a new snapshot
+*					is written beside the old one and renamed over it.
+*
+* COPYRIGHT (c) 2000-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include <string.h>
+#include "ff.h"
+#include "Loco.h"
+#include "LocoStore.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define LOCO_STORE_FILE		"LOCOS.DAT"
+#define LOCO_STORE_TEMP		"LOCOS.TMP"
+#define LOCO_JOURNAL_FILE	"LOCOS.JNL"
+
+// how often the changed locos are written, ms
+#define LOCO_STORE_PERIOD	2000
+
+// records written with one f_write
+#define LOCO_STORE_BATCH	16
+
+// journal records before a new snapshot is written
+#define LOCO_JOURNAL_MAX	(2 * MAX_LOCOS)
+
+#define LOCO_RECORD_MAGIC	0x4C4F
+#define LOCO_LINK_NONE		0xffff
+
+// the persistent part of a Loco, in fixed sizes
+typedef struct
+{
+	uint32_t	Address;
+	uint32_t	Train;
+	uint32_t	Locomotive;
+	char		pTrainName[64];
+	uint32_t	Tons;
+	uint32_t	Alias;
+	uint32_t	FunctionMap;
+	uint32_t	FunctionOverrideMap;
+	uint16_t	MaxSpeed;
+	uint16_t	wConsistLink;			// ActiveLocos index, LOCO_LINK_NONE
+	uint8_t		SpeedMode;
+	uint8_t		SpeedFcnMode;
+	uint8_t		bHornFunction;
+	uint8_t		bBellFunction;
+	uint8_t		Direction;
+	char		pSpeedLabel[8];
+	uint8_t		bPad[3];
+} LOCO_STATE;
+
+typedef struct
+{
+	uint16_t	wMagic;
+	uint16_t	wLoco;					// ActiveLocos index
+	uint32_t	Sequence;				// a later record of the slot wins
+	LOCO_STATE	State;
+	uint32_t	Crc;					// of everything before it
+} LOCO_RECORD;
+
+// HAL_CRC_Calculate takes whole words
+typedef char LOCO_RECORD_SIZE_CHECK[(sizeof(LOCO_RECORD) % 4) == 0 ? 1 : -1];
+
+#define LOCO_RECORD_WORDS	((sizeof(LOCO_RECORD) - sizeof(uint32_t)) / 4)
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+static uint32_t RecordCrc(LOCO_RECORD* pRecord);
+static void TakeRecord(uint16_t wLoco, LOCO_RECORD* pRecord, uint8_t bfClearDirty);
+static void ApplyRecord(const LOCO_RECORD* pRecord);
+static uint32_t ReplayFile(const char* szFile, uint8_t bfJournal);
+static void WriteJournal(void);
+static void Compact(void);
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+extern CRC_HandleTypeDef hcrc;
+extern Loco ActiveLocos[];
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static osThreadId_t StoreThread;
+static volatile uint8_t bfLoaded;
+
+static uint32_t StoreSequence;
+static uint32_t JournalCount;
+
+static LOCO_STORE_STATS StoreStats;
+
+// the store task owns the file and the batch, the replay runs before it starts
+static FIL StoreFile;
+static LOCO_RECORD aBatch[LOCO_STORE_BATCH];
+
+// replay, the sequence each slot was restored from and its consist link
+static uint32_t aReplaySequence[MAX_LOCOS];
+static uint16_t awReplayLink[MAX_LOCOS];
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+* FUNCTION:		RecordCrc
+*
+* ARGUMENTS:	pRecord - a record
+*
+* RETURNS:		the CRC of the record up to its Crc field
+*
+* DESCRIPTION:	The CRC unit, CRC-32 over whole words
+*
+* RESTRICTIONS:	The replay and then only the store task use the CRC unit
+*
+**********************************************************************/
+static uint32_t RecordCrc(LOCO_RECORD* pRecord)
+{
+
+	return HAL_CRC_Calculate(&hcrc, (uint32_t*)pRecord, LOCO_RECORD_WORDS);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TakeRecord
+*
+* ARGUMENTS:	wLoco - ActiveLocos index
+*				pRecord - where to build the record
+*				bfClearDirty - the record is for the journal
+*
+* RETURNS:
+*
+* DESCRIPTION:	Copy the persistent part of a loco into a record. The
+*				command station task owns the locos, the scheduler is
+*				held off for the copy so the record is never half of
+*				one change and half of the next.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void TakeRecord(uint16_t wLoco, LOCO_RECORD* pRecord, uint8_t bfClearDirty)
+{
+	Loco* pLoco = &ActiveLocos[wLoco];
+	LOCO_STATE* pState = &pRecord->State;
+
+	memset(pRecord, 0, sizeof(*pRecord));
+
+	osKernelLock();
+
+	pState->Address = pLoco->Address;
+	pState->Train = pLoco->Train;
+	pState->Locomotive = pLoco->Locomotive;
+	memcpy(pState->pTrainName, pLoco->pTrainName, sizeof(pState->pTrainName));
+	pState->Tons = pLoco->Tons;
+	pState->Alias = pLoco->Alias;
+	pState->FunctionMap = pLoco->FunctionMap;
+	pState->FunctionOverrideMap = pLoco->FunctionOverrideMap;
+	pState->MaxSpeed = pLoco->MaxSpeed;
+	pState->wConsistLink = pLoco->pConsistLink ? pLoco->pConsistLink - ActiveLocos : LOCO_LINK_NONE;
+	pState->SpeedMode = pLoco->SpeedMode;
+	pState->SpeedFcnMode = pLoco->SpeedFcnMode;
+	pState->bHornFunction = pLoco->bHornFunction;
+	pState->bBellFunction = pLoco->bBellFunction;
+	pState->Direction = pLoco->Direction;
+	memcpy(pState->pSpeedLabel, pLoco->pSpeedLabel, sizeof(pState->pSpeedLabel));
+
+	if(bfClearDirty)
+	{
+		pLoco->bfStateDirty = 0;
+	}
+
+	osKernelUnlock();
+
+	pRecord->wMagic = LOCO_RECORD_MAGIC;
+	pRecord->wLoco = wLoco;
+	pRecord->Sequence = ++StoreSequence;
+	pRecord->Crc = RecordCrc(pRecord);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ApplyRecord
+*
+* ARGUMENTS:	pRecord - a good record
+*
+* RETURNS:
+*
+* DESCRIPTION:	Restore a loco from a record, a record without an
+*				address empties the slot. The consist links are put
+*				back once every record is in.
+*
+* RESTRICTIONS:	boot only, before the locos are in use
+*
+**********************************************************************/
+static void ApplyRecord(const LOCO_RECORD* pRecord)
+{
+	Loco* pLoco = &ActiveLocos[pRecord->wLoco];
+	const LOCO_STATE* pState = &pRecord->State;
+
+	memset(pLoco, 0, sizeof(*pLoco));
+	awReplayLink[pRecord->wLoco] = LOCO_LINK_NONE;
+
+	if(pState->Address == 0)
+	{
+		return;
+	}
+
+	pLoco->Address = pState->Address;
+	pLoco->Train = pState->Train;
+	pLoco->Locomotive = pState->Locomotive;
+	memcpy(pLoco->pTrainName, pState->pTrainName, sizeof(pLoco->pTrainName));
+	pLoco->pTrainName[sizeof(pLoco->pTrainName) - 1] = '\0';
+	pLoco->Tons = pState->Tons;
+	pLoco->Alias = pState->Alias;
+	pLoco->FunctionMap = pState->FunctionMap;
+	pLoco->FunctionOverrideMap = pState->FunctionOverrideMap;
+	pLoco->MaxSpeed = pState->MaxSpeed;
+	pLoco->SpeedMode = pState->SpeedMode;
+	pLoco->SpeedFcnMode = pState->SpeedFcnMode;
+	pLoco->bHornFunction = pState->bHornFunction;
+	pLoco->bBellFunction = pState->bBellFunction;
+	pLoco->Direction = pState->Direction;
+	memcpy(pLoco->pSpeedLabel, pState->pSpeedLabel, sizeof(pLoco->pSpeedLabel));
+	pLoco->pSpeedLabel[sizeof(pLoco->pSpeedLabel) - 1] = '\0';
+
+	awReplayLink[pRecord->wLoco] = pState->wConsistLink;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ReplayFile
+*
+* ARGUMENTS:	szFile - the snapshot or the journal
+*				bfJournal - cut the file at a bad record
+*
+* RETURNS:		good records in the file
+*
+* DESCRIPTION:	Apply every record that is newer than what its slot
+*				has. A bad record ends the file, in the journal it is
+*				the last write that power loss cut short, the file is
+*				truncated there so new records follow good ones.
+*
+* RESTRICTIONS:	boot only
+*
+**********************************************************************/
+static uint32_t ReplayFile(const char* szFile, uint8_t bfJournal)
+{
+	LOCO_RECORD Record;
+	uint32_t count = 0;
+	UINT br;
+
+	if(f_open(&StoreFile, szFile, bfJournal ? FA_READ | FA_WRITE : FA_READ) != FR_OK)
+	{
+		return 0;
+	}
+
+	while(f_read(&StoreFile, &Record, sizeof(Record), &br) == FR_OK && br != 0)
+	{
+		if(br != sizeof(Record) || Record.wMagic != LOCO_RECORD_MAGIC ||
+			Record.wLoco >= MAX_LOCOS || RecordCrc(&Record) != Record.Crc)
+		{
+			StoreStats.bad++;
+			if(bfJournal)
+			{
+				f_lseek(&StoreFile, count * sizeof(Record));
+				f_truncate(&StoreFile);
+			}
+			break;
+		}
+
+		if(Record.Sequence > aReplaySequence[Record.wLoco])
+		{
+			aReplaySequence[Record.wLoco] = Record.Sequence;
+			ApplyRecord(&Record);
+			StoreStats.replayed++;
+		}
+		if(Record.Sequence > StoreSequence)
+		{
+			StoreSequence = Record.Sequence;
+		}
+		count++;
+	}
+
+	f_close(&StoreFile);
+	return count;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		LoadLocoStore
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Restore the roster, the snapshot and then the journal,
+*				and let the store task write changes from now on
+*
+* RESTRICTIONS:	InitLoco, after ActiveLocos is cleared and before the
+*				loco indexes are built
+*
+**********************************************************************/
+void LoadLocoStore(void)
+{
+	FILINFO Info;
+	uint16_t i;
+
+	memset(aReplaySequence, 0, sizeof(aReplaySequence));
+	memset(awReplayLink, 0xff, sizeof(awReplayLink));
+
+	// power was lost between removing the old snapshot and renaming the new one
+	if(f_stat(LOCO_STORE_FILE, &Info) != FR_OK && f_stat(LOCO_STORE_TEMP, &Info) == FR_OK)
+	{
+		f_rename(LOCO_STORE_TEMP, LOCO_STORE_FILE);
+	}
+
+	ReplayFile(LOCO_STORE_FILE, 0);
+	JournalCount = ReplayFile(LOCO_JOURNAL_FILE, 1);
+
+	for(i = 0; i < MAX_LOCOS; i++)
+	{
+		if(awReplayLink[i] < MAX_LOCOS && ActiveLocos[awReplayLink[i]].Address != 0)
+		{
+			ActiveLocos[i].pConsistLink = &ActiveLocos[awReplayLink[i]];
+		}
+	}
+
+	bfLoaded = 1;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		WriteJournal
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Append a record for every loco marked bfStateDirty,
+*				LOCO_STORE_BATCH records to a write. The journal is
+*				synced before the file is closed. If a write fails the
+*				locos in it are marked again for the next time.
+*
+* RESTRICTIONS:	store task
+*
+**********************************************************************/
+static void WriteJournal(void)
+{
+	uint32_t start;
+	uint32_t ms;
+	uint16_t wLoco;
+	UINT count = 0;
+	UINT bw;
+	FRESULT res;
+
+	for(wLoco = 0; wLoco < MAX_LOCOS && !ActiveLocos[wLoco].bfStateDirty; wLoco++)
+	{
+	}
+	if(wLoco == MAX_LOCOS)
+	{
+		return;
+	}
+
+	start = osKernelGetTickCount();
+
+	res = f_open(&StoreFile, LOCO_JOURNAL_FILE, FA_OPEN_ALWAYS | FA_WRITE);
+	if(res == FR_OK)
+	{
+		res = f_lseek(&StoreFile, JournalCount * sizeof(LOCO_RECORD));
+	}
+
+	for(; wLoco < MAX_LOCOS && res == FR_OK; wLoco++)
+	{
+		if(ActiveLocos[wLoco].bfStateDirty)
+		{
+			TakeRecord(wLoco, &aBatch[count++], 1);
+		}
+
+		if(count == LOCO_STORE_BATCH || (wLoco == MAX_LOCOS - 1 && count != 0))
+		{
+			res = f_write(&StoreFile, aBatch, count * sizeof(LOCO_RECORD), &bw);
+			if(res == FR_OK && bw != count * sizeof(LOCO_RECORD))
+			{
+				// the card is full
+				res = FR_DENIED;
+			}
+			if(res == FR_OK)
+			{
+				JournalCount += count;
+				StoreStats.records += count;
+				count = 0;
+			}
+		}
+	}
+
+	if(res == FR_OK)
+	{
+		res = f_sync(&StoreFile);
+	}
+	f_close(&StoreFile);
+
+	if(res != FR_OK)
+	{
+		StoreStats.errors++;
+
+		// write these again, the journal is cut back to its good records at boot.
+		// The flag shares its byte with the scheduler flags of the command
+		// station task, it is set with the scheduler held off like TakeRecord
+		osKernelLock();
+		while(count)
+		{
+			ActiveLocos[aBatch[--count].wLoco].bfStateDirty = 1;
+		}
+		osKernelUnlock();
+	}
+
+	StoreStats.writes++;
+	ms = osKernelGetTickCount() - start;
+	if(ms > StoreStats.max_write_ms)
+	{
+		StoreStats.max_write_ms = ms;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		Compact
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Write every loco to a new snapshot and empty the
+*				journal. The new snapshot is complete and synced before
+*				the old one is removed, the journal records are older
+*				than the snapshot and lose to it at boot if power is
+*				lost before the journal is emptied.
+*
+* RESTRICTIONS:	store task
+*
+**********************************************************************/
+static void Compact(void)
+{
+	LOCO_RECORD Record;
+	uint16_t wLoco;
+	UINT bw;
+	FRESULT res;
+
+	res = f_open(&StoreFile, LOCO_STORE_TEMP, FA_CREATE_ALWAYS | FA_WRITE);
+	for(wLoco = 0; wLoco < MAX_LOCOS && res == FR_OK; wLoco++)
+	{
+		if(ActiveLocos[wLoco].Address != 0)
+		{
+			TakeRecord(wLoco, &Record, 0);
+			res = f_write(&StoreFile, &Record, sizeof(Record), &bw);
+			if(res == FR_OK && bw != sizeof(Record))
+			{
+				res = FR_DENIED;
+			}
+		}
+	}
+	if(res == FR_OK)
+	{
+		res = f_sync(&StoreFile);
+	}
+	f_close(&StoreFile);
+
+	if(res == FR_OK)
+	{
+		f_unlink(LOCO_STORE_FILE);
+		res = f_rename(LOCO_STORE_TEMP, LOCO_STORE_FILE);
+	}
+	if(res == FR_OK)
+	{
+		res = f_open(&StoreFile, LOCO_JOURNAL_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+		f_close(&StoreFile);
+	}
+
+	if(res != FR_OK)
+	{
+		StoreStats.errors++;
+		return;
+	}
+
+	JournalCount = 0;
+	StoreStats.compactions++;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		LocoStoreTask
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Write the changed locos every LOCO_STORE_PERIOD, or at
+*				once for FlushLocoStore. The command station only marks
+*				a loco bfStateDirty, it never waits for the card.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void LocoStoreTask(void* argument)
+{
+	uint32_t flags;
+
+	StoreThread = osThreadGetId();
+
+	while(1)
+	{
+		flags = osThreadFlagsWait(LOCO_STORE_FLAG_FLUSH | LOCO_STORE_FLAG_COMPACT, osFlagsWaitAny, LOCO_STORE_PERIOD);
+		if(flags & osFlagsError)
+		{
+			flags = 0;
+		}
+
+		// nothing is written before the roster is read back
+		if(!bfLoaded)
+		{
+			continue;
+		}
+
+		WriteJournal();
+
+		if(JournalCount >= LOCO_JOURNAL_MAX || (flags & LOCO_STORE_FLAG_COMPACT))
+		{
+			Compact();
+		}
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		FlushLocoStore
+*
+* ARGUMENTS:	flags - LOCO_STORE_FLAG_xxx
+*
+* RETURNS:
+*
+* DESCRIPTION:	Have the store task write the changed locos now, and
+*				with LOCO_STORE_FLAG_COMPACT a new snapshot
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void FlushLocoStore(uint32_t flags)
+{
+
+	if(StoreThread != NULL)
+	{
+		osThreadFlagsSet(StoreThread, flags);
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetLocoStoreStats
+*
+* ARGUMENTS:	pStats - where to put them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetLocoStoreStats(LOCO_STORE_STATS* pStats)
+{
+
+	*pStats = StoreStats;
+	pStats->journal = JournalCount;
+}
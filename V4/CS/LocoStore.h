@@ -0,0 +1,55 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	LocoStore.h
+*
+* DATE CREATED:		12/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Loco roster on the SD card, a snapshot and a journal
+*					of the locos changed since
+*
+* COPYRIGHT (c) 2000-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef LOCO_STORE_H_
+#define LOCO_STORE_H_
+
+#include "main.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// thread flags of the loco store task
+#define LOCO_STORE_FLAG_FLUSH		0x0001		// write the changed locos now
+#define LOCO_STORE_FLAG_COMPACT		0x0002		// and write a new snapshot
+
+typedef struct
+{
+	uint32_t replayed;			// records applied at boot
+	uint32_t bad;				// a bad record ended the journal at boot
+	uint32_t records;			// records added to the journal
+	uint32_t writes;			// journal writes, each a batch of records
+	uint32_t compactions;		// snapshots written
+	uint32_t errors;			// FatFs errors, the locos are written again later
+	uint32_t journal;			// records in the journal now
+	uint32_t max_write_ms;		// longest journal write
+} LOCO_STORE_STATS;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void LoadLocoStore(void);
+extern void LocoStoreTask(void* argument);
+
+extern void FlushLocoStore(uint32_t flags);
+
+extern void GetLocoStoreStats(LOCO_STORE_STATS* pStats);
+
+#endif /* LOCO_STORE_H_ */
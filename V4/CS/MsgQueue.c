@@ -12,10 +12,12 @@
 * COPYRIGHT (c) 2003 by K2 Engineering, Inc.  All Rights Reserved.
 *
 *********************************************************************/
-#include "Main.h"
+#include "main.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include "MsgQueue.h"
+#include "CS.h"
 
 
 /*********************************************************************
@@ -24,13 +26,20 @@
 *
 *********************************************************************/
 
-#define MESSAGE_QUEUE_DEPTH 20
+#define MESSAGE_QUEUE_MASK	(MESSAGE_QUEUE_DEPTH - 1)
 
-//#pragma section NV_RAM
-EVENT_MESSAGE MessageQueue[MESSAGE_QUEUE_DEPTH];	// Queue
-unsigned char message_queue_in;		   				// queue input index
-unsigned char message_queue_out;	   				// queue output index
-//#pragma section
+// A bounded queue for many producers and one consumer. Every entry
+// carries a sequence number. A producer claims a position by moving
+// the in count with compare and swap. It writes the entry and then
+// sets the sequence to position + 1, and the consumer only takes
+// entries with that sequence. When the consumer takes an entry it
+// sets the sequence to position + depth, which frees the entry for
+// the next lap. Nothing is locked, so tasks and interrupts can queue.
+typedef struct
+{
+	atomic_uint_fast32_t	Sequence;
+	EVENT_MESSAGE			Message;
+} QUEUE_ENTRY;
 
 /*********************************************************************
 *
@@ -38,6 +47,21 @@ unsigned char message_queue_out;	   				// queue output index
 *
 *********************************************************************/
 
+static void UpdateHighWater(uint32_t waiting);
+
+/*********************************************************************
+*
+*							STATIC VARIABLES
+*
+*********************************************************************/
+
+static QUEUE_ENTRY MessageQueue[MESSAGE_QUEUE_DEPTH];
+static atomic_uint_fast32_t MessageQueueIn;		// next position a producer claims
+static atomic_uint_fast32_t MessageQueueOut;	// next position the consumer takes
+
+static atomic_uint_fast32_t MessagesQueued;
+static atomic_uint_fast32_t MessagesDropped;
+static atomic_uint_fast32_t MessagesHighWater;
 
 /*********************************************************************
 *
@@ -49,48 +73,116 @@ unsigned char message_queue_out;	   				// queue output index
 /************************************************************************
 * QueueMessage
 *
-*  parameters:	
+*  parameters:	bMessageType - MSG_xxx
+*				pMessagePointer - the cab the event is for
+*				nEvent - the event
 *
 *  returns:	TRUE if sucessfull
-*		FALSE if queue is full
+*		FALSE if queue is full, the event is counted as dropped
 *
-*  description:	queues up the event pointer (string_ptr)
+*  description:	queues up the event and wakes the command station,
+*		safe from any task or from an interrupt at or below
+*		configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
 *
 *	psuedo code:
-*		if in_ptr = out_ptr & q_ptr(in_ptr) <> 0
-*			return queue full
-*		if high priority
-*			move down other pionters in queue
-*			index = out_ptr
-*		else
-*			index = in_ptr
-*		q_ptr(in_ptr) = messege_to_be_queued
-*		inc in_ptr (accounting for wrap)
+*		position = in count
+*		loop
+*			if entry(position) sequence = position
+*				claim position (in count = position + 1)
+*				if claimed break
+*			else if entry(position) sequence < position
+*				return queue full
+*			else
+*				position = in count, another producer got it
+*		write the entry
+*		entry(position) sequence = position + 1
 *
 *************************************************************************/
 unsigned char QueueMessage(unsigned char bMessageType, VIRTUAL_CAB* pMessagePointer, int nEvent)
 {
+	QUEUE_ENTRY* pEntry;
+	uint_fast32_t position;
+	int_fast32_t diff;
 
-	if((message_queue_in == message_queue_out) && (MessageQueue[message_queue_in].bMessageType != '\0'))
+	position = atomic_load_explicit(&MessageQueueIn, memory_order_relaxed);
+	while(1)
 	{
-		/* queue is full */
-		return 0;
+		pEntry = &MessageQueue[position & MESSAGE_QUEUE_MASK];
+		diff = (int_fast32_t)(atomic_load_explicit(&pEntry->Sequence, memory_order_acquire) - position);
+		if(diff == 0)
+		{
+			if(atomic_compare_exchange_weak_explicit(&MessageQueueIn, &position, position + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+			// position was reloaded by the compare
+		}
+		else if(diff < 0)
+		{
+			/* queue is full */
+			atomic_fetch_add_explicit(&MessagesDropped, 1, memory_order_relaxed);
+			return 0;
+		}
+		else
+		{
+			position = atomic_load_explicit(&MessageQueueIn, memory_order_relaxed);
+		}
 	}
-	else
-	{
-		/* queue is not full */
-		MessageQueue[message_queue_in].pMessagePointer = pMessagePointer;
-		MessageQueue[message_queue_in].bMessageType = bMessageType;
-		MessageQueue[message_queue_in].nEvent = nEvent;
 
-		++message_queue_in;
-		if(message_queue_in == MESSAGE_QUEUE_DEPTH)
+	pEntry->Message.pMessagePointer = pMessagePointer;
+	pEntry->Message.bMessageType = bMessageType;
+	pEntry->Message.nEvent = nEvent;
+	atomic_store_explicit(&pEntry->Sequence, position + 1, memory_order_release);
+
+	atomic_fetch_add_explicit(&MessagesQueued, 1, memory_order_relaxed);
+	UpdateHighWater(position + 1 - atomic_load_explicit(&MessageQueueOut, memory_order_relaxed));
+
+	SignalCommandStation(CS_FLAG_MESSAGE);
+
+	return 1;
+}
+
+
+/*********************************************************************
+*
+* FUNCTION:		GetMessages
+*
+* ARGUMENTS:	pMessages - where to put the events
+*				nMax - room in pMessages
+*
+* RETURNS:		number of events taken off the queue
+*
+* DESCRIPTION:	take up to nMax events off the queue in the order they
+*				were queued
+*
+* RESTRICTIONS:	only the command station task takes events, an entry
+*				that was claimed but is still being written ends the
+*				batch, it is taken next time
+*
+*********************************************************************/
+int GetMessages(EVENT_MESSAGE* pMessages, int nMax)
+{
+	QUEUE_ENTRY* pEntry;
+	uint_fast32_t position;
+	int count;
+
+	position = atomic_load_explicit(&MessageQueueOut, memory_order_relaxed);
+	for(count = 0; count < nMax; count++, position++)
+	{
+		pEntry = &MessageQueue[position & MESSAGE_QUEUE_MASK];
+		if(atomic_load_explicit(&pEntry->Sequence, memory_order_acquire) != position + 1)
 		{
-			message_queue_in = 0;
+			/* queue is empty */
+			break;
 		}
 
-		return 1;
+		pMessages[count] = pEntry->Message;
+		atomic_store_explicit(&pEntry->Sequence, position + MESSAGE_QUEUE_DEPTH, memory_order_release);
 	}
+	atomic_store_explicit(&MessageQueueOut, position, memory_order_relaxed);
+
+	return count;
 }
 
 
@@ -98,53 +190,110 @@ unsigned char QueueMessage(unsigned char bMessageType, VIRTUAL_CAB* pMessagePoin
 *
 * FUNCTION:		GetMessage
 *
-* ARGUMENTS:	None
+* ARGUMENTS:	bMessageType - the message type
+*				nEvent - the event
 *
-* RETURNS:		Event or 0
+* RETURNS:		the cab or NULL if the queue is empty
 *
-* DESCRIPTION:	get the next message from the queue
-*				does not take the message off the queue
+* DESCRIPTION:	take the next event off the queue
 *
-*	psuedo code:
-*		if in_ptr = out_ptr & queue(out_ptr) = 0
-*			return queue empty
-*		else
-*			save queue(out_ptr)
-*			zero queue(out_ptr)
-*			inc out_ptr (accounting for wrap)
-*			return saved pointer
-*
-*
-* RESTRICTIONS:	*
+* RESTRICTIONS:	see GetMessages
 *
 *********************************************************************/
 VIRTUAL_CAB* GetMessage(unsigned char* bMessageType, int* nEvent)
 {
-	VIRTUAL_CAB* pMessagePointer;
+	EVENT_MESSAGE Message;
 
-	if((message_queue_in == message_queue_out) && (MessageQueue[message_queue_out].bMessageType == '\0'))
+	if(GetMessages(&Message, 1) == 0)
 	{
-		/* queue is empty */
 		return NULL;
 	}
-	else
+
+	*bMessageType = Message.bMessageType;
+	*nEvent = Message.nEvent;
+	return Message.pMessagePointer;
+}
+
+
+/*********************************************************************
+*
+* FUNCTION:		UpdateHighWater
+*
+* ARGUMENTS:	waiting - events waiting after one was queued
+*
+* RETURNS:		none
+*
+* DESCRIPTION:	keep the most events that were waiting at once
+*
+* RESTRICTIONS:	none
+*
+*********************************************************************/
+static void UpdateHighWater(uint32_t waiting)
+{
+	uint_fast32_t high;
+
+	high = atomic_load_explicit(&MessagesHighWater, memory_order_relaxed);
+	while(waiting > high)
 	{
-		/* queue is not empty */
-		pMessagePointer = MessageQueue[message_queue_out].pMessagePointer;
-		*bMessageType = MessageQueue[message_queue_out].bMessageType;
-		*nEvent = MessageQueue[message_queue_out].nEvent;
-		MessageQueue[message_queue_out].bMessageType = '\0';
-
-		++message_queue_out;
-		if(message_queue_out == MESSAGE_QUEUE_DEPTH)
+		if(atomic_compare_exchange_weak_explicit(&MessagesHighWater, &high, waiting,
+				memory_order_relaxed, memory_order_relaxed))
 		{
-			message_queue_out = 0;
+			break;
 		}
-		return pMessagePointer;
 	}
 }
 
 
+/*********************************************************************
+*
+* FUNCTION:		GetMessageQueueStats
+*
+* ARGUMENTS:	pStats - where to put the statistics
+*
+* RETURNS:		none
+*
+* DESCRIPTION:	event queue counters and the high water mark
+*
+* RESTRICTIONS:	none
+*
+*********************************************************************/
+void GetMessageQueueStats(MSG_QUEUE_STATS* pStats)
+{
+	uint32_t in;
+	uint32_t out;
+
+	out = atomic_load_explicit(&MessageQueueOut, memory_order_relaxed);
+	in = atomic_load_explicit(&MessageQueueIn, memory_order_relaxed);
+
+	pStats->queued = atomic_load_explicit(&MessagesQueued, memory_order_relaxed);
+	pStats->dropped = atomic_load_explicit(&MessagesDropped, memory_order_relaxed);
+	pStats->high_water = atomic_load_explicit(&MessagesHighWater, memory_order_relaxed);
+	pStats->waiting = in - out;
+	pStats->depth = MESSAGE_QUEUE_DEPTH;
+}
+
+
+/*********************************************************************
+*
+* FUNCTION:		ClearMessageQueueStats
+*
+* ARGUMENTS:	none
+*
+* RETURNS:		none
+*
+* DESCRIPTION:	start the counters and the high water mark again
+*
+* RESTRICTIONS:	none
+*
+*********************************************************************/
+void ClearMessageQueueStats(void)
+{
+	atomic_store_explicit(&MessagesQueued, 0, memory_order_relaxed);
+	atomic_store_explicit(&MessagesDropped, 0, memory_order_relaxed);
+	atomic_store_explicit(&MessagesHighWater, 0, memory_order_relaxed);
+}
+
+
 /*********************************************************************
 *
 * FUNCTION:		InitMessageQueue
@@ -157,22 +306,23 @@ VIRTUAL_CAB* GetMessage(unsigned char* bMessageType, int* nEvent)
 *
 * GLOBAL VARS MODIFIED:		none
 *
-* DESCRIPTION:	initialize the rt queue
+* DESCRIPTION:	initialize the event queue, entry n is free for
+*				position n
 *
-* RESTRICTIONS:	none
+* RESTRICTIONS:	before anything queues an event
 *
 *********************************************************************/
 void InitMessageQueue(void)
 {
 	int index;
 
-
-	message_queue_in = 0;
-	message_queue_out = 0;
+	atomic_store(&MessageQueueIn, 0);
+	atomic_store(&MessageQueueOut, 0);
 
 	for(index = 0; index < MESSAGE_QUEUE_DEPTH; ++index)
 	{
-		MessageQueue[index].bMessageType = 0;
+		atomic_store(&MessageQueue[index].Sequence, index);
 	}
-}
 
+	ClearMessageQueueStats();
+}
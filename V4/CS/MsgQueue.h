@@ -14,7 +14,7 @@
 #ifndef _MSG_QUEUE_H
 #define _MSG_QUEUE_H
 
-#include "cab.h"
+#include "Cab.h"
 
 /*********************************************************************
 *
@@ -25,7 +25,16 @@
 // Message types
 #define MSG_CAB_KEY_MESSAGE		0x01
 #define MSG_CAB_SPEED_MESSAGE		0x02
+#define MSG_LOCO_MESSAGE		0x03	// a loco change from another task, nEvent is the request
 
+// entries in the event queue, a power of two
+#ifndef MESSAGE_QUEUE_DEPTH
+#define MESSAGE_QUEUE_DEPTH		64
+#endif
+
+#if (MESSAGE_QUEUE_DEPTH & (MESSAGE_QUEUE_DEPTH - 1)) != 0
+#error MESSAGE_QUEUE_DEPTH must be a power of two
+#endif
 
 typedef struct
 {
@@ -34,6 +43,16 @@ typedef struct
 	VIRTUAL_CAB*	pMessagePointer;
 } EVENT_MESSAGE;
 
+// event queue statistics, since InitMessageQueue or ClearMessageQueueStats
+typedef struct
+{
+	uint32_t queued;			// events accepted
+	uint32_t dropped;			// events refused, the queue was full
+	uint32_t high_water;		// most events waiting at once
+	uint32_t waiting;			// events waiting now
+	uint32_t depth;				// MESSAGE_QUEUE_DEPTH
+} MSG_QUEUE_STATS;
+
 
 /*********************************************************************
 *
@@ -43,6 +62,10 @@ typedef struct
 
 extern unsigned char QueueMessage(unsigned char bMessageType, VIRTUAL_CAB* pMsgPointer, int nEvent);
 extern VIRTUAL_CAB* GetMessage(unsigned char* bMessageType, int* nEvent);
+extern int GetMessages(EVENT_MESSAGE* pMessages, int nMax);
+
+extern void GetMessageQueueStats(MSG_QUEUE_STATS* pStats);
+extern void ClearMessageQueueStats(void);
 
 extern void InitMessageQueue(void);
 
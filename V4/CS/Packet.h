@@ -52,6 +52,10 @@ void BuildWriteCVPacket(unsigned char* pPacket, unsigned short nCV, unsigned cha
 
 void BuildVerifyCVPacket(unsigned char* pPacket, unsigned short nCV, unsigned char bValue, unsigned char Mode);
 
+void BuildWriteBitPacket(unsigned char* pPacket, unsigned short nCV, unsigned char bBit, unsigned char bValue);
+
+void BuildVerifyBitPacket(unsigned char* pPacket, unsigned short nCV, unsigned char bBit, unsigned char bValue);
+
 void BuildPresetPagePacket(unsigned char* pPacket);
 
 void BuildSetPagePacket(unsigned char* pPacket, unsigned char page);
@@ -6,14 +6,18 @@
 *
 * PROGRAMMER:
 *
-* DESCRIPTION:
+* DESCRIPTION:		Service mode on the programming track, a queue of CV
+*					reads and writes run one packet burst at a time from
+*					the command station tick. A CV is read with eight bit
+*					verifies and a byte verify of the result.
 *
 * COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
 *
 **********************************************************************/
 //#include <stdio.h>
-//#include <string.h>
-#include "Main.h"
+#include <string.h>
+#include "main.h"
+#include "cmsis_os.h"
 //#include "GPIO.h"
 #include "Track.h"
 //#include "Loco.h"
@@ -21,6 +25,10 @@
 #include "Packet.h"
 #include "CV.h"
 #include "PacketQueue.h"
+#include "Acknowledge.h"
+#include "Recorder.h"
+#include "Latency.h"
+#include "Service.h"
 
 
 /**********************************************************************
@@ -32,11 +40,50 @@
 enum
 {
 	SM_IDLE,
+	SM_SEND,
 	SM_WAIT_FOR_ACK,
-	SM_WRITE,
-	SM_VERIFY,
+	SM_SETTLE,
+};
+
+enum
+{
+	SM_OP_READ,
+	SM_OP_WRITE,
+	SM_OP_VERIFY,
+	SM_OP_PACKET,				// one packet, the track stays on with idles
+	SM_OP_OFF,					// let the track go off
 };
 
+// S-9.2.3 direct mode, resets ahead of the instruction packets
+#define SM_RESET_PACKETS		3
+#define SM_COMMAND_PACKETS		5
+
+// and after the track was off, so the decoder is powered up
+#define SM_POWER_ON_RESETS		20
+
+// ms after the last packet an ACK can still show up
+#define SM_ACK_WAIT				10
+
+// ms without an ACK before the next burst, so an ACK pulse is over
+#define SM_ACK_QUIET			3
+
+// steps of a read, bits 7 to 0 and the byte verify
+#define SM_READ_BYTE_STEP		8
+
+// a read that fails its byte verify is started over this many times
+#define SM_READ_RETRIES			1
+
+typedef struct
+{
+	uint8_t				bOp;			// one of SM_OP_
+	uint8_t				bValue;			// value to write, LAT_TEST_ of a packet
+	uint16_t			nCV;			// first CV
+	uint16_t			nCount;			// CVs to read from nCV up
+	SERVICE_CALLBACK	pCallback;
+	void*				pArg;
+	uint8_t				abPacket[SM_PACKET_SIZE];	// SM_OP_PACKET, length first
+} SM_REQUEST;
+
 
 /**********************************************************************
 *
@@ -44,8 +91,13 @@ enum
 *
 **********************************************************************/
 
-void AckStart(void);
-int GetAck(void);
+static int QueueRequest(const SM_REQUEST* pRequest);
+static int TrackRequest(const SM_REQUEST* pRequest);
+static void StartStep(void);
+static void StepDone(int bfAck);
+static void FinishCV(int status);
+static void StartProgPackets(void);
+static void SendProgPackets(void);
 
 /**********************************************************************
 *
@@ -60,9 +112,29 @@ int GetAck(void);
 **********************************************************************/
 
 static int SmState = SM_IDLE;
-//static int SmNextState = SM_IDLE;
-static unsigned short SmCV;
+
+// pending requests, added by any task, taken by the command station task
+static SM_REQUEST aSmQueue[SM_QUEUE_SIZE];
+static volatile uint32_t SmQueueHead;
+static volatile uint32_t SmQueueTail;
+static volatile uint8_t bSmCancel;
+
+// the request being worked on, nCV and nCount move along a range
+static SM_REQUEST SmRequest;
+static unsigned char SmStep;
 static unsigned char SmValue;
+static unsigned char SmRetries;
+static uint32_t SmTick;
+static uint32_t SmCVTick;
+
+// packet for the programming track, the first byte is the length
+static unsigned char SmPacket[SM_PACKET_SIZE];
+static unsigned char SmResets;
+static unsigned char SmCommands;
+
+static const uint8_t abSmReset[] = {0x00, 0x00, 0x00};
+
+static SERVICE_STATS SmStats;
 
 /**********************************************************************
 *
@@ -78,81 +150,459 @@ static unsigned char SmValue;
 *
 * RETURNS:
 *
-* DESCRIPTION:	Run the service mode state machine
+* DESCRIPTION:	Run the service mode state machine, called every tick
+*				after Acknowledge()
 *
-* RESTRICTIONS:
+* RESTRICTIONS:	command station task only
 *
 **********************************************************************/
-
-enum
-{
-	PT_NO_MESSAGE,
-	PT_ALL_PACKETS_SENT,
-	PT_ACK,
-};
-
-
 void ServiceMode(void)
 {
-	unsigned char packet[8];
-	int status;
-
-	// get the ACK status, overcurrent status, and the state of the Prog Track state machine and set status accordingly
-	//if()
-	//status = GetProgTrackStatus();
+	uint8_t Ack;
+	uint32_t Now;
 
-	status = PT_NO_MESSAGE;
+	if(bSmCancel)
+	{
+		bSmCancel = 0;
+		SmQueueTail = SmQueueHead;
+		if(SmState != SM_IDLE)
+		{
+			// the burst on the track finishes by itself
+			SmRequest.nCount = 1;
+			FinishCV(SM_CANCELLED);
+		}
+	}
 
+	Ack = GetAck();
+	Now = HAL_GetTick();
 
+	if(SmState != SM_IDLE && Ack == OVER_CURRENT)
+	{
+		// the track is off, this CV and the rest of the range are lost
+		SmRequest.nCount = 1;
+		FinishCV(SM_TRACK_ERROR);
+	}
 
 	switch(SmState)
 	{
 		case SM_IDLE:
+			if(SmQueueTail == SmQueueHead)
+			{
+				break;
+			}
+
+			SmRequest = aSmQueue[SmQueueTail % SM_QUEUE_SIZE];
+			if(TrackRequest(&SmRequest) != 0)
+			{
+				// ring full, carry on next pass
+				break;
+			}
+			SmQueueTail++;
+			if(SmRequest.bOp == SM_OP_PACKET || SmRequest.bOp == SM_OP_OFF)
+			{
+				break;
+			}
+
+			// power the decoder up, then keep it in service mode with
+			// resets between the bursts
+			SmResets = GetTrackChannelState(TC_PROG) ? 0 : SM_POWER_ON_RESETS;
+			SetChannelIdle(TC_PROG, TI_RESET);
+
+			SmStep = 0;
+			SmValue = 0;
+			SmRetries = 0;
+			SmCVTick = Now;
+			StartStep();
+		break;
+
+		case SM_SEND:
+			SendProgPackets();
 		break;
 
 		case SM_WAIT_FOR_ACK:
-			if(status == PT_ALL_PACKETS_SENT)
+			if(Ack == ACK_DETECTED)
 			{
-				// EQ = error
-				SmState = SM_IDLE;
+				SmStats.acks++;
+				SmState = SM_SETTLE;
+				SmTick = Now;
 			}
-			else if(status == PT_ACK)
+			else if(!IsChannelPacketComplete(TC_PROG))
 			{
-				// EQ =  operation OK
-				//SmState = SmNextState;
-				SmState = SM_IDLE;
+				SmTick = Now;
+			}
+			else if(Now - SmTick >= SM_ACK_WAIT)
+			{
+				StepDone(0);
 			}
 		break;
 
-		case SM_WRITE:
+		case SM_SETTLE:
+			// the ACK pulse can outlast the burst
+			if(Ack == ACK_DETECTED || !IsChannelPacketComplete(TC_PROG))
+			{
+				ClearAck();
+				SmTick = Now;
+			}
+			else if(Now - SmTick >= SM_ACK_QUIET)
+			{
+				StepDone(1);
+			}
+		break;
+	}
+}
 
 
-		break;
+/**********************************************************************
+*
+* FUNCTION:		TrackRequest
+*
+* ARGUMENTS:	pRequest - the request at the head of the queue
+*
+* RETURNS:		0 = done or not a track request, 1 = the ring is full
+*
+* DESCRIPTION:	Run a request that only sends a packet or switches the
+*				track off, this task is the only one that queues
+*				programming track packets
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static int TrackRequest(const SM_REQUEST* pRequest)
+{
 
-		case SM_VERIFY:
-			BuildWriteCVPacket(packet, SmCV, SmValue, MODE_DIRECT);
-//k			if(QueueProgPacket(11, packet) == 0)
-//k			{
-//k				// error
-//k			}
-			SmState = SM_WAIT_FOR_ACK;
-		break;
+	if(pRequest->bOp == SM_OP_PACKET)
+	{
+		SetChannelIdle(TC_PROG, TI_IDLE);
+		SetLatencyTest(pRequest->bValue);
+		if(BuildChannelPacket(TC_PROG, &pRequest->abPacket[1], pRequest->abPacket[0], SM_CLK_1T, SM_CLK_0T, SM_CLK_0H) == 1)
+		{
+			return 1;
+		}
+	}
+	else if(pRequest->bOp == SM_OP_OFF)
+	{
+		SetLatencyTest(LAT_TEST_NONE);
+		SetChannelIdle(TC_PROG, TI_NONE);
+	}
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		StartStep
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Build the packet for the current step of the request
+*				and start sending it
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void StartStep(void)
+{
+
+	if(SmRequest.bOp == SM_OP_VERIFY)
+	{
+		BuildVerifyCVPacket(SmPacket, SmRequest.nCV, SmRequest.bValue, MODE_DIRECT);
+		RecordTrigger(REC_TAG_VERIFY, SmRequest.nCV, SmRequest.bValue);
+		SetLatencyTest(LAT_TEST_VERIFY);
+	}
+	else if(SmRequest.bOp == SM_OP_WRITE)
+	{
+		if(SmStep == 0)
+		{
+			BuildWriteCVPacket(SmPacket, SmRequest.nCV, SmRequest.bValue, MODE_DIRECT);
+			RecordTrigger(REC_TAG_WRITE, SmRequest.nCV, SmRequest.bValue);
+			SetLatencyTest(LAT_TEST_WRITE);
+		}
+		else
+		{
+			BuildVerifyCVPacket(SmPacket, SmRequest.nCV, SmRequest.bValue, MODE_DIRECT);
+			RecordTrigger(REC_TAG_VERIFY, SmRequest.nCV, SmRequest.bValue);
+			SetLatencyTest(LAT_TEST_VERIFY);
+		}
+	}
+	else if(SmStep < SM_READ_BYTE_STEP)
+	{
+		// is bit (7 - step) a one
+		BuildVerifyBitPacket(SmPacket, SmRequest.nCV, 7 - SmStep, 1);
+		RecordTrigger(REC_TAG_READ_BIT, SmRequest.nCV, 7 - SmStep);
+		SetLatencyTest(LAT_TEST_READ_BIT);
+	}
+	else
+	{
+		BuildVerifyCVPacket(SmPacket, SmRequest.nCV, SmValue, MODE_DIRECT);
+		RecordTrigger(REC_TAG_VERIFY, SmRequest.nCV, SmValue);
+		SetLatencyTest(LAT_TEST_VERIFY);
+	}
+
+	StartProgPackets();
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		StepDone
+*
+* ARGUMENTS:	bfAck - the decoder acknowledged the burst
+*
+* RETURNS:
+*
+* DESCRIPTION:	Move the request on to its next step
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void StepDone(int bfAck)
+{
+	ACK_PULSE Pulse;
+
+	// the ACK pulse is over by now
+	if(bfAck && GetAckPulse(&Pulse) != 0)
+	{
+		RecordResult(REC_STATUS_ACK, Pulse.width_us > 0xffff ? 0xffff : Pulse.width_us);
+	}
+	else
+	{
+		RecordResult(bfAck ? REC_STATUS_ACK : REC_STATUS_NO_ACK, 0);
+	}
+
+	if(SmRequest.bOp == SM_OP_VERIFY)
+	{
+		FinishCV(bfAck ? SM_OK : SM_NO_ACK);
+		return;
+	}
+
+	if(SmRequest.bOp == SM_OP_WRITE)
+	{
+		if(SmStep == 0)
+		{
+			// the write ACK is optional, the verify tells
+			SmStep++;
+			StartStep();
+		}
+		else
+		{
+			FinishCV(bfAck ? SM_OK : SM_NO_ACK);
+		}
+		return;
+	}
+
+	if(SmStep < SM_READ_BYTE_STEP)
+	{
+		if(bfAck)
+		{
+			SmValue |= 0x80 >> SmStep;
+		}
+		SmStep++;
+		StartStep();
+	}
+	else if(bfAck)
+	{
+		FinishCV(SM_OK);
+	}
+	else if(SmRetries < SM_READ_RETRIES)
+	{
+		// a missed or a false ACK on one of the bits
+		SmRetries++;
+		SmStats.retries++;
+		SmStep = 0;
+		SmValue = 0;
+		StartStep();
+	}
+	else
+	{
+		// no ACK at all is a missing decoder, not a bad value
+		FinishCV(SmValue == 0 ? SM_NO_ACK : SM_VERIFY_FAILED);
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		FinishCV
+*
+* ARGUMENTS:	status - SM_OK or the error
+*
+* RETURNS:
+*
+* DESCRIPTION:	Report the CV to the requester and go on to the next
+*				CV of the range, or the next request
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void FinishCV(int status)
+{
+	uint32_t ms;
+
+	ms = HAL_GetTick() - SmCVTick;
+	SmStats.last_ms = ms;
+	if(ms > SmStats.max_ms)
+	{
+		SmStats.max_ms = ms;
+	}
+
+	if(SmRequest.bOp == SM_OP_WRITE)
+	{
+		SmStats.writes++;
+	}
+	else if(SmRequest.bOp == SM_OP_VERIFY)
+	{
+		SmStats.verifies++;
+	}
+	else
+	{
+		SmStats.reads++;
+	}
+	if(status != SM_OK)
+	{
+		SmStats.errors++;
+	}
+	if(status == SM_TRACK_ERROR)
+	{
+		RecordResult(REC_STATUS_ERROR, 0);
+	}
+	if(status != SM_OK && status != SM_CANCELLED)
+	{
+		// keep the current of the bursts that led up to it
+		RecordHold();
+	}
+
+	if(SmRequest.pCallback != NULL)
+	{
+		SmRequest.pCallback(SmRequest.nCV, status,
+			SmRequest.bOp == SM_OP_READ ? SmValue : SmRequest.bValue, SmRequest.pArg);
+	}
+
+	ClearAck();
+
+	if(SmRequest.nCount > 1)
+	{
+		SmRequest.nCV++;
+		SmRequest.nCount--;
+
+		SmStep = 0;
+		SmValue = 0;
+		SmRetries = 0;
+		SmCVTick = HAL_GetTick();
+		StartStep();
+	}
+	else
+	{
+		SmState = SM_IDLE;
+		if(SmQueueTail == SmQueueHead)
+		{
+			// nothing more to do, let the track go off
+			SetChannelIdle(TC_PROG, TI_NONE);
+			SetLatencyTest(LAT_TEST_NONE);
+		}
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		StartProgPackets
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Start sending the resets and the packet in SmPacket on
+*				the programming track, the main track keeps running
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void StartProgPackets(void)
+{
+
+	// on top of the power on resets of a new request
+	SmResets += SM_RESET_PACKETS;
+	SmCommands = SM_COMMAND_PACKETS;
+	SmStats.operations++;
+
+	ClearAck();
+
+	SmState = SM_SEND;
+	SendProgPackets();
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SendProgPackets
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Queue as many of the outstanding programming track packets
+*				as there are free slots, then wait for the ACK
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void SendProgPackets(void)
+{
+
+	while(SmResets != 0)
+	{
+		if(BuildChannelPacket(TC_PROG, abSmReset, sizeof(abSmReset), SM_CLK_1T, SM_CLK_0T, SM_CLK_0H) != 0)
+		{
+			// ring full, carry on next pass
+			return;
+		}
+		SmResets--;
+	}
+
+	while(SmCommands != 0)
+	{
+		if(BuildChannelPacket(TC_PROG, &SmPacket[1], SmPacket[0], SM_CLK_1T, SM_CLK_0T, SM_CLK_0H) != 0)
+		{
+			return;
+		}
+		SmCommands--;
 	}
+
+	SmState = SM_WAIT_FOR_ACK;
+	SmTick = HAL_GetTick();
 }
 
 
-//void AckStart(void)
-//{
-//
-//	// snapshot the current for the base level
-//}
+/**********************************************************************
+*
+* FUNCTION:		QueueRequest
+*
+* ARGUMENTS:	pRequest - the operation
+*
+* RETURNS:		0 = queued, 1 = queue full
+*
+* DESCRIPTION:	Add an operation for the command station task
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static int QueueRequest(const SM_REQUEST* pRequest)
+{
+	int Ret = 1;
 
-//int GetAck(void)
-//{
-//
-//	return 0;
-//}
+	osKernelLock();
+	if(SmQueueHead - SmQueueTail < SM_QUEUE_SIZE)
+	{
+		aSmQueue[SmQueueHead % SM_QUEUE_SIZE] = *pRequest;
+		SmQueueHead++;
+		Ret = 0;
+	}
+	osKernelUnlock();
 
+	return Ret;
+}
 
 
 #ifdef NOT_USED
@@ -195,22 +645,224 @@ void EnterServiceMode(void)
 *
 * FUNCTION:		ServiceModeWriteCV
 *
+* ARGUMENTS:	nCV - CV number, 1 to 1024
+*				bValue - value to write
+*				pCallback - called with the result, NULL = none
+*				pArg - handed to the callback
+*
+* RETURNS:		0 = queued, 1 = queue full
+*
+* DESCRIPTION:	Write a CV in direct mode and byte verify it
+*
+* RESTRICTIONS:	the callback runs in the command station task
+*
+**********************************************************************/
+int ServiceModeWriteCV(unsigned short nCV, unsigned char bValue, SERVICE_CALLBACK pCallback, void* pArg)
+{
+	SM_REQUEST Request;
+
+	Request.bOp = SM_OP_WRITE;
+	Request.bValue = bValue;
+	Request.nCV = nCV;
+	Request.nCount = 1;
+	Request.pCallback = pCallback;
+	Request.pArg = pArg;
+
+	return QueueRequest(&Request);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ServiceModeReadCV
+*
+* ARGUMENTS:	nCV - first CV number, 1 to 1024
+*				nCount - number of CVs to read
+*				pCallback - called with the value of each CV
+*				pArg - handed to the callback
+*
+* RETURNS:		0 = queued, 1 = queue full
+*
+* DESCRIPTION:	Read CVs in direct mode, a bit verify of each bit and a
+*				byte verify of the result, nine bursts a CV
+*
+* RESTRICTIONS:	the callback runs in the command station task
+*
+**********************************************************************/
+int ServiceModeReadCV(unsigned short nCV, unsigned short nCount, SERVICE_CALLBACK pCallback, void* pArg)
+{
+	SM_REQUEST Request;
+
+	if(nCount == 0)
+	{
+		return 0;
+	}
+
+	Request.bOp = SM_OP_READ;
+	Request.bValue = 0;
+	Request.nCV = nCV;
+	Request.nCount = nCount;
+	Request.pCallback = pCallback;
+	Request.pArg = pArg;
+
+	return QueueRequest(&Request);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ServiceModeVerifyCV
+*
+* ARGUMENTS:	nCV - CV number, 1 to 1024
+*				bValue - value the CV should have
+*				pCallback - called with the result
+*				pArg - handed to the callback
+*
+* RETURNS:		0 = queued, 1 = queue full
+*
+* DESCRIPTION:	Byte verify a CV in direct mode, one burst, SM_OK when
+*				the decoder has the value, SM_NO_ACK when it does not
+*
+* RESTRICTIONS:	the callback runs in the command station task
+*
+**********************************************************************/
+int ServiceModeVerifyCV(unsigned short nCV, unsigned char bValue, SERVICE_CALLBACK pCallback, void* pArg)
+{
+	SM_REQUEST Request;
+
+	Request.bOp = SM_OP_VERIFY;
+	Request.bValue = bValue;
+	Request.nCV = nCV;
+	Request.nCount = 1;
+	Request.pCallback = pCallback;
+	Request.pArg = pArg;
+
+	return QueueRequest(&Request);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ServiceModeSendPacket
+*
+* ARGUMENTS:	pPacket - packet, the first byte is the length
+*				bTest - LAT_TEST_ the decoder response is timed for
+*
+* RETURNS:		0 = queued, 1 = queue full or packet too long
+*
+* DESCRIPTION:	Send one packet on the programming track after the
+*				operations queued ahead of it, the track then stays on
+*				with idles until ServiceModeTrackOff or the next
+*				operation
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int ServiceModeSendPacket(const unsigned char* pPacket, unsigned char bTest)
+{
+	SM_REQUEST Request;
+
+	if(pPacket[0] >= SM_PACKET_SIZE)
+	{
+		return 1;
+	}
+
+	memset(&Request, 0, sizeof(Request));
+	Request.bOp = SM_OP_PACKET;
+	Request.bValue = bTest;
+	memcpy(Request.abPacket, pPacket, pPacket[0] + 1);
+
+	return QueueRequest(&Request);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ServiceModeTrackOff
+*
+* ARGUMENTS:
+*
+* RETURNS:		0 = queued, 1 = queue full
+*
+* DESCRIPTION:	Let the programming track go off after the operations
+*				queued ahead of it
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int ServiceModeTrackOff(void)
+{
+	SM_REQUEST Request;
+
+	memset(&Request, 0, sizeof(Request));
+	Request.bOp = SM_OP_OFF;
+
+	return QueueRequest(&Request);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ServiceModeCancel
+*
 * ARGUMENTS:
 *
 * RETURNS:
 *
-* DESCRIPTION:	Run the service mode state machine
+* DESCRIPTION:	Drop the queued operations, the one running ends with
+*				SM_CANCELLED at the next tick
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-void ServiceModeWriteCV(unsigned short nCV, unsigned char bValue)
+void ServiceModeCancel(void)
 {
 
-	SmCV = nCV;
-	SmValue = bValue;
+	bSmCancel = 1;
+}
 
-	SmState = SM_WRITE;
+
+/**********************************************************************
+*
+* FUNCTION:		GetServiceModePending
+*
+* ARGUMENTS:
+*
+* RETURNS:		number of requests queued or running
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+uint32_t GetServiceModePending(void)
+{
+
+	return (SmQueueHead - SmQueueTail) + (SmState != SM_IDLE);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetServiceStats / ClearServiceStats
+*
+* ARGUMENTS:	pStats - where to put the statistics
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetServiceStats(SERVICE_STATS* pStats)
+{
+
+	*pStats = SmStats;
 }
 
+void ClearServiceStats(void)
+{
 
+	memset(&SmStats, 0, sizeof(SmStats));
+}
@@ -21,6 +21,40 @@
 *
 *********************************************************************/
 
+// result of a service mode operation, handed to the SERVICE_CALLBACK
+#define SM_OK					0
+#define SM_NO_ACK				1		// the decoder did not acknowledge
+#define SM_VERIFY_FAILED		2		// the byte verify of the bits read failed
+#define SM_TRACK_ERROR			3		// over current on the programming track
+#define SM_CANCELLED			4		// ServiceModeCancel
+
+// pending operations, a read of a range of CVs is one entry
+#define SM_QUEUE_SIZE			8
+
+// a packet with its length byte in front
+#define SM_PACKET_SIZE			8
+
+// nominal bit timing of the programming track in us
+#define SM_CLK_1T				116
+#define SM_CLK_0T				200
+#define SM_CLK_0H				100
+
+// nCV - CV of the operation, bValue - the value read or written
+typedef void (*SERVICE_CALLBACK)(unsigned short nCV, int status, unsigned char bValue, void* pArg);
+
+typedef struct
+{
+	uint32_t reads;				// CVs read
+	uint32_t writes;			// CVs written
+	uint32_t verifies;			// CVs byte verified against a known value
+	uint32_t errors;			// operations that did not end with SM_OK
+	uint32_t retries;			// reads started again after a failed byte verify
+	uint32_t operations;		// packet bursts on the programming track
+	uint32_t acks;				// of those, acknowledged
+	uint32_t last_ms;			// time of the last CV read or written
+	uint32_t max_ms;			// longest CV read or write
+} SERVICE_STATS;
+
 /*********************************************************************
 *
 *                            FUNCTION PROTOTYPES
@@ -29,8 +63,19 @@
 
 extern void ServiceMode(void);
 
-extern void ServiceModeWriteCV(unsigned short nCV, unsigned char bValue);
+extern int ServiceModeWriteCV(unsigned short nCV, unsigned char bValue, SERVICE_CALLBACK pCallback, void* pArg);
+
+extern int ServiceModeReadCV(unsigned short nCV, unsigned short nCount, SERVICE_CALLBACK pCallback, void* pArg);
+
+extern int ServiceModeVerifyCV(unsigned short nCV, unsigned char bValue, SERVICE_CALLBACK pCallback, void* pArg);
+
+extern int ServiceModeSendPacket(const unsigned char* pPacket, unsigned char bTest);
+extern int ServiceModeTrackOff(void);
+extern void ServiceModeCancel(void);
+
+extern uint32_t GetServiceModePending(void);
 
-extern void ServiceModeReadCV(word nCV);
+extern void GetServiceStats(SERVICE_STATS* pStats);
+extern void ClearServiceStats(void);
 
 #endif
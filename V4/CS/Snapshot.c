@@ -0,0 +1,687 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Snapshot.c
+*
+* DATE CREATED:		20/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Decoder snapshots. The CVs in aSnapshotSet are read on
+*					the programming track in one batch through the service
+*					mode queue and kept in DECODERS/ under the manufacturer,
+*					version and serial (CV105, CV106) of the decoder. When
+*					the decoder comes back only the volatile CVs and one in
+*					SNAPSHOT_SAMPLE of the others are byte verified against
+*					the cache, the rest is taken from it. A sampled CV that
+*					changed means the cache is stale and is read again.
+*					The sample moves on by one every session so the whole
+*					cache is checked over SNAPSHOT_SAMPLE sessions.
+*
+* COPYRIGHT (c) 2000-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include <stdio.h>
+#include <string.h>
+#include "ff.h"
+#include "CV.h"
+#include "Service.h"
+#include "Snapshot.h"
+#include "Latency.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define SNAPSHOT_MAGIC			0x534E4150
+
+// one in this many cached CVs is verified each session
+#define SNAPSHOT_SAMPLE			8
+
+// how often the batch is checked, ms
+#define SNAPSHOT_POLL			20
+
+// ms without a CV coming back before the batch is given up
+#define SNAPSHOT_STALL			3000
+
+// aSnapshotSet flags
+#define SNAP_KEY				0x01	// identifies the decoder, always read
+#define SNAP_VOLATILE			0x02	// changes under test, always verified
+
+typedef struct
+{
+	uint16_t	nFirst;
+	uint16_t	nCount;
+	uint8_t		bFlags;
+} SNAPSHOT_BLOCK;
+
+#define CV_WORD(nCV)			(((nCV) - 1) >> 5)
+#define CV_BIT(nCV)				(1UL << (((nCV) - 1) & 31))
+#define IS_CV(a, nCV)			(((a)[CV_WORD(nCV)] & CV_BIT(nCV)) != 0)
+#define SET_CV(a, nCV)			((a)[CV_WORD(nCV)] |= CV_BIT(nCV))
+#define CLEAR_CV(a, nCV)		((a)[CV_WORD(nCV)] &= ~CV_BIT(nCV))
+
+#define SNAPSHOT_CRC_BYTES		(sizeof(DECODER_SNAPSHOT) - sizeof(uint32_t))
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+static uint32_t SnapshotCrc(const DECODER_SNAPSHOT* pSnap);
+static void BatchCallback(unsigned short nCV, int status, unsigned char bValue, void* pArg);
+static void BatchStart(DECODER_SNAPSHOT* pSnap);
+static void BatchRead(uint16_t nCV, uint16_t nCount);
+static void BatchVerify(uint16_t nCV, uint8_t bValue);
+static int BatchWait(void);
+static void CountReads(const uint32_t* aRead, SNAPSHOT_RESULT* pResult);
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+// the CVs of a snapshot, identity first
+static const SNAPSHOT_BLOCK aSnapshotSet[] =
+{
+	{cvVersion,					2,	SNAP_KEY},
+	{cvUserIdentifier1,			2,	SNAP_KEY},
+	{cvAddress,					1,	SNAP_VOLATILE},
+	{cvStartVoltage,			5,	0},
+	{cvPWMPeriod,				6,	0},
+	{cvExtendedAddressLow,		3,	SNAP_VOLATILE},
+	{cvConsistFunctionsActive,	5,	0},
+	{cvConfigurationData1,		1,	SNAP_VOLATILE},
+	{cvOutputLocoationFL,		14,	0},
+	{cvKickStart,				31,	0},
+	{cvExcvManufacturerLow,		5,	0},
+};
+
+#define SNAPSHOT_BLOCKS			(sizeof(aSnapshotSet) / sizeof(aSnapshotSet[0]))
+
+// the batch, filled in by the service mode callback in the command station task
+static DECODER_SNAPSHOT* pBatchSnap;
+static uint32_t aBatchFailed[SNAPSHOT_CVS / 32];
+static volatile uint32_t BatchDone;
+static uint32_t BatchQueued;
+
+// CVs verified and to be read in this session
+static uint32_t aVerify[SNAPSHOT_CVS / 32];
+static uint32_t aRead[SNAPSHOT_CVS / 32];
+
+static FIL SnapFile;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+* FUNCTION:		SnapshotCrc
+*
+* ARGUMENTS:	pSnap - a snapshot
+*
+* RETURNS:		the CRC-32 of the snapshot up to its Crc field
+*
+* DESCRIPTION:	Done in software, the CRC unit belongs to the loco
+*				store task
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static uint32_t SnapshotCrc(const DECODER_SNAPSHOT* pSnap)
+{
+	const uint8_t* pByte = (const uint8_t*)pSnap;
+	uint32_t Crc = 0xffffffff;
+	uint32_t i;
+	int bit;
+
+	for(i = 0; i < SNAPSHOT_CRC_BYTES; i++)
+	{
+		Crc ^= pByte[i];
+		for(bit = 0; bit < 8; bit++)
+		{
+			Crc = (Crc >> 1) ^ (0xEDB88320 & -(Crc & 1));
+		}
+	}
+	return ~Crc;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		BatchCallback
+*
+* ARGUMENTS:	nCV - CV number
+*				status - SM_OK or the error
+*				bValue - value read or verified
+*				pArg - not used
+*
+* RETURNS:
+*
+* DESCRIPTION:	A CV of the batch is done
+*
+* RESTRICTIONS:	command station task
+*
+**********************************************************************/
+static void BatchCallback(unsigned short nCV, int status, unsigned char bValue, void* pArg)
+{
+
+	if(nCV >= 1 && nCV <= SNAPSHOT_CVS)
+	{
+		if(status == SM_OK)
+		{
+			pBatchSnap->abValue[nCV - 1] = bValue;
+			SET_CV(pBatchSnap->aValid, nCV);
+			CLEAR_CV(aBatchFailed, nCV);
+		}
+		else
+		{
+			CLEAR_CV(pBatchSnap->aValid, nCV);
+			SET_CV(aBatchFailed, nCV);
+		}
+	}
+
+	BatchDone++;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		BatchStart / BatchRead / BatchVerify
+*
+* ARGUMENTS:	pSnap - where the batch puts the CVs
+*				nCV - CV number
+*				nCount - CVs to read from nCV up
+*				bValue - value the CV should have
+*
+* RETURNS:
+*
+* DESCRIPTION:	Queue service mode operations for the batch, waiting
+*				for room in the queue
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void BatchStart(DECODER_SNAPSHOT* pSnap)
+{
+
+	pBatchSnap = pSnap;
+	memset(aBatchFailed, 0, sizeof(aBatchFailed));
+	BatchDone = 0;
+	BatchQueued = 0;
+}
+
+static void BatchRead(uint16_t nCV, uint16_t nCount)
+{
+
+	while(ServiceModeReadCV(nCV, nCount, BatchCallback, NULL) != 0)
+	{
+		osDelay(SNAPSHOT_POLL);
+	}
+	BatchQueued += nCount;
+}
+
+static void BatchVerify(uint16_t nCV, uint8_t bValue)
+{
+
+	while(ServiceModeVerifyCV(nCV, bValue, BatchCallback, NULL) != 0)
+	{
+		osDelay(SNAPSHOT_POLL);
+	}
+	BatchQueued++;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		BatchWait
+*
+* ARGUMENTS:
+*
+* RETURNS:		0 = every CV of the batch is done, 1 = the batch stalled
+*
+* DESCRIPTION:	Wait for the batch. A "read stop" drops the queue
+*				without callbacks, the batch stalls and is given up.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static int BatchWait(void)
+{
+	uint32_t Last = BatchDone;
+	uint32_t Tick = osKernelGetTickCount();
+
+	while(BatchDone < BatchQueued)
+	{
+		osDelay(SNAPSHOT_POLL);
+
+		if(BatchDone != Last)
+		{
+			Last = BatchDone;
+			Tick = osKernelGetTickCount();
+		}
+		else if(osKernelGetTickCount() - Tick >= SNAPSHOT_STALL)
+		{
+			ServiceModeCancel();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		CountReads
+*
+* ARGUMENTS:	aRead - CVs that were read
+*				pResult - where to count them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void CountReads(const uint32_t* aRead, SNAPSHOT_RESULT* pResult)
+{
+	uint16_t nCV;
+
+	for(nCV = 1; nCV <= SNAPSHOT_CVS; nCV++)
+	{
+		if(IS_CV(aRead, nCV))
+		{
+			if(IS_CV(pBatchSnap->aValid, nCV))
+			{
+				pResult->read++;
+			}
+			else
+			{
+				pResult->failed++;
+			}
+		}
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TakeSnapshot
+*
+* ARGUMENTS:	pSnap - the snapshot
+*				pCache - where the cached snapshot of the decoder goes
+*				bfFull - read every CV, do not use the cache
+*				pResult - how the CVs were come by
+*
+* RETURNS:		SNAPSHOT_OK or the error
+*
+* DESCRIPTION:	Read the decoder on the programming track. The identity
+*				CVs are read, then with a cached snapshot of the decoder
+*				the volatile and the sampled CVs are verified, and only
+*				those that changed are read. A changed sampled CV reads
+*				everything the cache had. The snapshot is saved.
+*
+* RESTRICTIONS:	blocks for the whole batch, one snapshot at a time
+*
+**********************************************************************/
+int TakeSnapshot(DECODER_SNAPSHOT* pSnap, DECODER_SNAPSHOT* pCache, uint8_t bfFull, SNAPSHOT_RESULT* pResult)
+{
+	const SNAPSHOT_BLOCK* pBlock;
+	char szFile[32];
+	uint32_t Start = osKernelGetTickCount();
+	uint16_t nCV;
+	uint16_t i;
+	uint16_t Sample = 0;
+	int Ret;
+
+	memset(pSnap, 0, sizeof(*pSnap));
+	memset(pResult, 0, sizeof(*pResult));
+	memset(aVerify, 0, sizeof(aVerify));
+	memset(aRead, 0, sizeof(aRead));
+
+	// the reads of the identity are timed before it is known
+	SetLatencyDecoder(0, 0, 0);
+	BatchStart(pSnap);
+
+	// who it is
+	for(pBlock = aSnapshotSet; pBlock < &aSnapshotSet[SNAPSHOT_BLOCKS]; pBlock++)
+	{
+		if(pBlock->bFlags & SNAP_KEY)
+		{
+			for(i = 0; i < pBlock->nCount; i++)
+			{
+				SET_CV(aRead, pBlock->nFirst + i);
+			}
+			BatchRead(pBlock->nFirst, pBlock->nCount);
+		}
+	}
+	if(BatchWait())
+	{
+		return SNAPSHOT_ABORTED;
+	}
+	if(!IS_CV(pSnap->aValid, cvVersion) || !IS_CV(pSnap->aValid, cvManufacturer))
+	{
+		return SNAPSHOT_NO_DECODER;
+	}
+
+	pSnap->bManufacturer = pSnap->abValue[cvManufacturer - 1];
+	pSnap->bVersion = pSnap->abValue[cvVersion - 1];
+	pSnap->wSerial = (pSnap->abValue[cvUserIdentifier1 - 1] << 8) | pSnap->abValue[cvUserIdentifier2 - 1];
+	SetLatencyDecoder(pSnap->bManufacturer, pSnap->bVersion, pSnap->wSerial);
+
+	GetSnapshotFileName(pSnap, szFile);
+	pResult->bfCacheHit = !bfFull && LoadSnapshot(szFile, pCache) == 0 &&
+		pCache->bManufacturer == pSnap->bManufacturer &&
+		pCache->bVersion == pSnap->bVersion &&
+		pCache->wSerial == pSnap->wSerial;
+
+	// verify what has to be, take the rest from the cache
+	for(pBlock = aSnapshotSet; pBlock < &aSnapshotSet[SNAPSHOT_BLOCKS]; pBlock++)
+	{
+		if(pBlock->bFlags & SNAP_KEY)
+		{
+			continue;
+		}
+
+		for(i = 0; i < pBlock->nCount; i++)
+		{
+			nCV = pBlock->nFirst + i;
+
+			if(!pResult->bfCacheHit || !IS_CV(pCache->aValid, nCV))
+			{
+				SET_CV(aRead, nCV);
+			}
+			else if((pBlock->bFlags & SNAP_VOLATILE) || Sample++ % SNAPSHOT_SAMPLE == pCache->bPhase % SNAPSHOT_SAMPLE)
+			{
+				SET_CV(aVerify, nCV);
+				BatchVerify(nCV, pCache->abValue[nCV - 1]);
+			}
+			else
+			{
+				pSnap->abValue[nCV - 1] = pCache->abValue[nCV - 1];
+				SET_CV(pSnap->aValid, nCV);
+			}
+		}
+	}
+	if(BatchWait())
+	{
+		return SNAPSHOT_ABORTED;
+	}
+
+	// a changed CV is read, a changed sampled one reads the whole cache
+	for(pBlock = aSnapshotSet; pBlock < &aSnapshotSet[SNAPSHOT_BLOCKS]; pBlock++)
+	{
+		for(i = 0; i < pBlock->nCount; i++)
+		{
+			nCV = pBlock->nFirst + i;
+
+			if(IS_CV(aVerify, nCV) && !IS_CV(pSnap->aValid, nCV))
+			{
+				SET_CV(aRead, nCV);
+				pResult->changed++;
+				if(!(pBlock->bFlags & SNAP_VOLATILE))
+				{
+					pResult->bfStale = 1;
+				}
+			}
+		}
+	}
+
+	for(pBlock = aSnapshotSet; pBlock < &aSnapshotSet[SNAPSHOT_BLOCKS]; pBlock++)
+	{
+		for(i = 0; i < pBlock->nCount; i++)
+		{
+			nCV = pBlock->nFirst + i;
+
+			if(IS_CV(aVerify, nCV) && IS_CV(pSnap->aValid, nCV))
+			{
+				pResult->verified++;
+			}
+			else if(!IS_CV(aVerify, nCV) && !IS_CV(aRead, nCV))
+			{
+				if(pResult->bfStale)
+				{
+					CLEAR_CV(pSnap->aValid, nCV);
+					SET_CV(aRead, nCV);
+				}
+				else
+				{
+					pResult->cached++;
+				}
+			}
+
+			if(IS_CV(aRead, nCV) && !(pBlock->bFlags & SNAP_KEY))
+			{
+				BatchRead(nCV, 1);
+			}
+		}
+	}
+	if(BatchWait())
+	{
+		return SNAPSHOT_ABORTED;
+	}
+
+	CountReads(aRead, pResult);
+
+	pSnap->bPhase = pResult->bfCacheHit ? pCache->bPhase + 1 : 1;
+
+	Ret = SaveSnapshot(pSnap) == 0 ? SNAPSHOT_OK : SNAPSHOT_SD_ERROR;
+
+	pResult->ms = osKernelGetTickCount() - Start;
+	return Ret;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		LoadSnapshot
+*
+* ARGUMENTS:	szFile - snapshot file
+*				pSnap - where to put it
+*
+* RETURNS:		0 = loaded, 1 = no file, 2 = not a good snapshot
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int LoadSnapshot(const char* szFile, DECODER_SNAPSHOT* pSnap)
+{
+	FRESULT res;
+	UINT br;
+
+	if(f_open(&SnapFile, szFile, FA_READ) != FR_OK)
+	{
+		return 1;
+	}
+
+	res = f_read(&SnapFile, pSnap, sizeof(*pSnap), &br);
+	f_close(&SnapFile);
+
+	if(res != FR_OK || br != sizeof(*pSnap) || pSnap->Magic != SNAPSHOT_MAGIC || SnapshotCrc(pSnap) != pSnap->Crc)
+	{
+		return 2;
+	}
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SaveSnapshot
+*
+* ARGUMENTS:	pSnap - the snapshot, its Magic and Crc are filled in
+*
+* RETURNS:		0 = saved, 1 = FatFs error
+*
+* DESCRIPTION:	Write the snapshot to the cache, over the last one of
+*				the decoder
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int SaveSnapshot(DECODER_SNAPSHOT* pSnap)
+{
+	char szFile[32];
+	FRESULT res;
+	UINT bw;
+
+	pSnap->Magic = SNAPSHOT_MAGIC;
+	pSnap->Crc = SnapshotCrc(pSnap);
+
+	// there already after the first one
+	f_mkdir(SNAPSHOT_DIR);
+
+	GetSnapshotFileName(pSnap, szFile);
+	if(f_open(&SnapFile, szFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	{
+		return 1;
+	}
+
+	res = f_write(&SnapFile, pSnap, sizeof(*pSnap), &bw);
+	if(f_close(&SnapFile) != FR_OK || res != FR_OK || bw != sizeof(*pSnap))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ExportSnapshot
+*
+* ARGUMENTS:	pSnap - the snapshot
+*				szFile - text file to write
+*
+* RETURNS:		0 = written, 1 = FatFs error
+*
+* DESCRIPTION:	The CVs of the snapshot as CV,value lines
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int ExportSnapshot(const DECODER_SNAPSHOT* pSnap, const char* szFile)
+{
+	char szLine[64];
+	uint16_t nCV;
+	int Ret = 0;
+
+	if(f_open(&SnapFile, szFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	{
+		return 1;
+	}
+
+	sprintf(szLine, "; manufacturer %u version %u serial %u\r\n",
+		pSnap->bManufacturer, pSnap->bVersion, pSnap->wSerial);
+	f_puts(szLine, &SnapFile);
+	f_puts("CV,Value\r\n", &SnapFile);
+
+	for(nCV = 1; nCV <= SNAPSHOT_CVS; nCV++)
+	{
+		if(IS_CV(pSnap->aValid, nCV))
+		{
+			sprintf(szLine, "%u,%u\r\n", nCV, pSnap->abValue[nCV - 1]);
+			if(f_puts(szLine, &SnapFile) < 0)
+			{
+				Ret = 1;
+				break;
+			}
+		}
+	}
+
+	if(f_close(&SnapFile) != FR_OK)
+	{
+		Ret = 1;
+	}
+	return Ret;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetSnapshotFileName
+*
+* ARGUMENTS:	pSnap - the snapshot
+*				szFile - at least 32 characters
+*
+* RETURNS:
+*
+* DESCRIPTION:	DECODERS/MMVVSSSS.CVS, the manufacturer, version and
+*				serial in hex to fit an 8.3 name
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetSnapshotFileName(const DECODER_SNAPSHOT* pSnap, char* szFile)
+{
+
+	sprintf(szFile, SNAPSHOT_DIR "/%02X%02X%04X.CVS", pSnap->bManufacturer, pSnap->bVersion, pSnap->wSerial);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IsSnapshotCV
+*
+* ARGUMENTS:	pSnap - the snapshot
+*				nCV - CV number
+*
+* RETURNS:		1 = the snapshot has the CV
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+uint8_t IsSnapshotCV(const DECODER_SNAPSHOT* pSnap, uint16_t nCV)
+{
+
+	return nCV >= 1 && nCV <= SNAPSHOT_CVS && IS_CV(pSnap->aValid, nCV);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		DiffSnapshot
+*
+* ARGUMENTS:	pA, pB - the snapshots
+*				nCV - CV to start at
+*
+* RETURNS:		the first CV from nCV up that differs, 0 = none
+*
+* DESCRIPTION:	A CV differs when only one snapshot has it or the
+*				values are not the same
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+uint16_t DiffSnapshot(const DECODER_SNAPSHOT* pA, const DECODER_SNAPSHOT* pB, uint16_t nCV)
+{
+
+	for(; nCV >= 1 && nCV <= SNAPSHOT_CVS; nCV++)
+	{
+		if(IS_CV(pA->aValid, nCV) != IS_CV(pB->aValid, nCV) ||
+			(IS_CV(pA->aValid, nCV) && pA->abValue[nCV - 1] != pB->abValue[nCV - 1]))
+		{
+			return nCV;
+		}
+	}
+	return 0;
+}
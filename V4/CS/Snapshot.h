@@ -0,0 +1,79 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Snapshot.h
+*
+* DATE CREATED:		20/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Decoder CV snapshots read on the programming track,
+*					cached on the SD card by decoder
+*
+* COPYRIGHT (c) 2000-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "main.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define SNAPSHOT_CVS			1024
+
+// where the snapshots are kept, one file per decoder
+#define SNAPSHOT_DIR			"DECODERS"
+
+// TakeSnapshot results
+#define SNAPSHOT_OK				0
+#define SNAPSHOT_NO_DECODER		1		// the identity CVs did not read
+#define SNAPSHOT_SD_ERROR		2		// read, but not saved to the cache
+#define SNAPSHOT_ABORTED		3		// service mode was cancelled
+
+typedef struct
+{
+	uint32_t	Magic;
+	uint8_t		bManufacturer;			// CV8
+	uint8_t		bVersion;				// CV7
+	uint16_t	wSerial;				// CV105, CV106
+	uint8_t		bPhase;					// which CVs the next session samples
+	uint8_t		bPad[3];
+	uint32_t	aValid[SNAPSHOT_CVS / 32];	// bit (CV - 1), the value was read
+	uint8_t		abValue[SNAPSHOT_CVS];		// [CV - 1]
+	uint32_t	Crc;					// of everything before it
+} DECODER_SNAPSHOT;
+
+typedef struct
+{
+	uint32_t	read;					// CVs read bit by bit
+	uint32_t	verified;				// cached CVs confirmed by a byte verify
+	uint32_t	cached;					// cached CVs taken without touching the track
+	uint32_t	changed;				// cached CVs that failed the verify and were read
+	uint32_t	failed;					// CVs that did not read
+	uint32_t	ms;						// time of the snapshot
+	uint8_t		bfCacheHit;				// there was a snapshot of the decoder
+	uint8_t		bfStale;				// a sampled CV changed, the cache was read again
+} SNAPSHOT_RESULT;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern int TakeSnapshot(DECODER_SNAPSHOT* pSnap, DECODER_SNAPSHOT* pCache, uint8_t bfFull, SNAPSHOT_RESULT* pResult);
+
+extern int LoadSnapshot(const char* szFile, DECODER_SNAPSHOT* pSnap);
+extern int SaveSnapshot(DECODER_SNAPSHOT* pSnap);
+extern int ExportSnapshot(const DECODER_SNAPSHOT* pSnap, const char* szFile);
+
+extern void GetSnapshotFileName(const DECODER_SNAPSHOT* pSnap, char* szFile);
+
+extern uint8_t IsSnapshotCV(const DECODER_SNAPSHOT* pSnap, uint16_t nCV);
+extern uint16_t DiffSnapshot(const DECODER_SNAPSHOT* pA, const DECODER_SNAPSHOT* pB, uint16_t nCV);
+
+#endif /* SNAPSHOT_H_ */
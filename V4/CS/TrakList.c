@@ -14,7 +14,7 @@
 //#include "stdafx.h"
 //#include <dos.h>
 #include <stdio.h>
-#include "Main.h"
+#include "main.h"
 #include "LinkedList.h"
 #include "TrakList.h"
 #include "Loco.h"
@@ -26,12 +26,23 @@
 *
 **********************************************************************/
 
+// locos waiting to go ahead of the refresh round, first come first served
+typedef struct
+{
+	Loco*	pFirst;
+	Loco*	pLast;
+} PROMOTED_LIST;
+
 /**********************************************************************
 *
 *							FUNCTION PROTOTYPES
 *
 **********************************************************************/
-Link *GetFree(void);
+static void RefreshUnlink(Loco* pLoco);
+static void RefreshInsert(Loco* pLoco);
+static void PromotedAppend(Loco* pLoco);
+static void PromotedDrop(Loco* pLoco);
+static uint8_t IsLocoRested(Loco* pLoco, uint32_t start);
 
 /**********************************************************************
 *
@@ -39,21 +50,12 @@ Link *GetFree(void);
 *
 **********************************************************************/
 
+extern Loco ActiveLocos[];
+
 //#pragma section NV_RAM
-Link	FreeLinks[MAX_LOCOS];
 Link	FreeAccyLinks[MAX_ACCESSORIES];
 //#pragma section
 
-LList	FreeLocos;
-LList	TrackLocos;
-ListIterator	trackSequence;
-
-//LList	LocoFunction1;
-//ListIterator	functionSequence1;
-
-//LList	LocoFunction2;
-//ListIterator	functionSequence2;
-
 LList	FreeAccys;
 LList	TrackAccys;
 ListIterator	accySequence;
@@ -64,6 +66,21 @@ ListIterator	accySequence;
 *
 **********************************************************************/
 
+// The refresh ring is threaded through the locos themselves (pRefreshNext
+// and pRefreshPrev), most recently changed first, so the oldest is the one
+// before the newest. Every operation is a few pointer moves however many
+// locos are on the track.
+static Loco*	pNewestLoco;
+static Loco*	pRefreshLoco;			// the next loco of the refresh round
+static word		RefreshCount;
+
+// locos with a change or repeats to send go ahead of the refresh round,
+// in the order they asked, linked through pPromotedNext and pPromotedPrev.
+// A speed change waits in a list of its own so the next one is always
+// the first of a list.
+static PROMOTED_LIST	SpeedLocos;
+static PROMOTED_LIST	RepeatLocos;
+
 /**********************************************************************
 *
 *							CODE
@@ -73,19 +90,22 @@ void InitLocoList(void)
 {
 	word i;
 
-	setup(&FreeLocos);
 	for (i = 0; i < MAX_LOCOS; i++)
 	{
-		InsertAtTop(&FreeLocos, &FreeLinks[i]);
+		ActiveLocos[i].pRefreshNext = NULL;
+		ActiveLocos[i].pRefreshPrev = NULL;
+		ActiveLocos[i].pPromotedNext = NULL;
+		ActiveLocos[i].pPromotedPrev = NULL;
+		ActiveLocos[i].bfPromoted = 0;
+		ActiveLocos[i].bfPromotedSpeed = 0;
 	}
-	setup(&TrackLocos);
-	trackSequence.m_List = &TrackLocos; 
-	First(&trackSequence);
-
-	//functionSequence1.m_List = &TrackLocos;
-	//First(&functionSequence1);
-	//functionSequence2.m_List = &TrackLocos;
-	//First(&functionSequence2);
+	pNewestLoco = NULL;
+	pRefreshLoco = NULL;
+	RefreshCount = 0;
+	SpeedLocos.pFirst = NULL;
+	SpeedLocos.pLast = NULL;
+	RepeatLocos.pFirst = NULL;
+	RepeatLocos.pLast = NULL;
 
 	setup(&FreeAccys);
 	for (i = 0; i < MAX_ACCESSORIES; i++)
@@ -100,61 +120,267 @@ void InitLocoList(void)
 
 /**********************************************************************
 *
-* FUNCTION:		NextLocoMsg
+* FUNCTION:		RefreshUnlink
 *
-* ARGUMENTS:
+* ARGUMENTS:	pLoco - a loco in the refresh ring
 *
 * RETURNS:
 *
-* DESCRIPTION:	Called when the Track can take a new msg. (Currently only
-*				checks Loco list). Uses Timestamp to time out zero-speed
-*				Locos.
+* DESCRIPTION:	Take a loco out of the refresh ring, the refresh round
+*				carries on with the next one
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-Loco* NextLocoMsg(void)
+static void RefreshUnlink(Loco* pLoco)
 {
-	Link *pnext;
-	Loco* pLoco = NULL;
+	if(pLoco->pRefreshNext == pLoco)
+	{
+		// the only one
+		pNewestLoco = NULL;
+		pRefreshLoco = NULL;
+	}
+	else
+	{
+		pLoco->pRefreshPrev->pRefreshNext = pLoco->pRefreshNext;
+		pLoco->pRefreshNext->pRefreshPrev = pLoco->pRefreshPrev;
+		if(pNewestLoco == pLoco)
+		{
+			pNewestLoco = pLoco->pRefreshNext;
+		}
+		if(pRefreshLoco == pLoco)
+		{
+			pRefreshLoco = pLoco->pRefreshNext;
+		}
+	}
+	pLoco->pRefreshNext = NULL;
+	pLoco->pRefreshPrev = NULL;
+	RefreshCount--;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RefreshInsert
+*
+* ARGUMENTS:	pLoco - a loco not in the refresh ring
+*
+* RETURNS:
+*
+* DESCRIPTION:	Put a loco in the refresh ring as the newest
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void RefreshInsert(Loco* pLoco)
+{
+	if(pNewestLoco == NULL)
+	{
+		pLoco->pRefreshNext = pLoco;
+		pLoco->pRefreshPrev = pLoco;
+		pRefreshLoco = pLoco;
+	}
+	else
+	{
+		pLoco->pRefreshNext = pNewestLoco;
+		pLoco->pRefreshPrev = pNewestLoco->pRefreshPrev;
+		pNewestLoco->pRefreshPrev->pRefreshNext = pLoco;
+		pNewestLoco->pRefreshPrev = pLoco;
+	}
+	pNewestLoco = pLoco;
+	RefreshCount++;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		PromotedAppend
+*
+* ARGUMENTS:	pLoco - a loco that is not waiting
+*
+* RETURNS:
+*
+* DESCRIPTION:	Queue a loco ahead of the refresh round, behind the
+*				others that are waiting. A speed change waits with the
+*				other speed changes.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void PromotedAppend(Loco* pLoco)
+{
+	PROMOTED_LIST* pList;
+
+	pLoco->bfPromotedSpeed = (pLoco->bChange & CH_SPEED) != 0;
+	pList = pLoco->bfPromotedSpeed ? &SpeedLocos : &RepeatLocos;
+
+	pLoco->bfPromoted = 1;
+	pLoco->pPromotedNext = NULL;
+	pLoco->pPromotedPrev = pList->pLast;
+	if(pList->pLast == NULL)
+	{
+		pList->pFirst = pLoco;
+	}
+	else
+	{
+		pList->pLast->pPromotedNext = pLoco;
+	}
+	pList->pLast = pLoco;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		PromotedDrop
+*
+* ARGUMENTS:	pLoco - a loco leaving the track
+*
+* RETURNS:
+*
+* DESCRIPTION:	Take a loco out of the waiting locos if it is there,
+*				the others keep their order
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void PromotedDrop(Loco* pLoco)
+{
+	PROMOTED_LIST* pList;
 
-	pnext = Next(&trackSequence);
-	if(NULL == pnext)
+	if(!pLoco->bfPromoted)
 	{
-		//got to end of list last time...
-		pnext = First(&trackSequence);
+		return;
 	}
 
-#ifdef MOVED_TO_PACKET_HANDLER
-	if(NULL != pnext)
+	pList = pLoco->bfPromotedSpeed ? &SpeedLocos : &RepeatLocos;
+	if(pLoco->pPromotedPrev == NULL)
 	{
-		if(0 == ((Loco*)(pnext->m_index))->Speed)
+		pList->pFirst = pLoco->pPromotedNext;
+	}
+	else
+	{
+		pLoco->pPromotedPrev->pPromotedNext = pLoco->pPromotedNext;
+	}
+	if(pLoco->pPromotedNext == NULL)
+	{
+		pList->pLast = pLoco->pPromotedPrev;
+	}
+	else
+	{
+		pLoco->pPromotedNext->pPromotedPrev = pLoco->pPromotedPrev;
+	}
+	pLoco->pPromotedNext = NULL;
+	pLoco->pPromotedPrev = NULL;
+	pLoco->bfPromoted = 0;
+	pLoco->bfPromotedSpeed = 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IsLocoRested
+*
+* ARGUMENTS:	pLoco - loco to check
+*				start - schedule time the next packet would start, us
+*
+* RETURNS:		TRUE if a packet to this address may start then
+*
+* DESCRIPTION:	S-9.2 wants ADDRESS_SPACING_US from the end of one packet
+*				to the start of the next packet to the same decoder
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static uint8_t IsLocoRested(Loco* pLoco, uint32_t start)
+{
+
+	return pLoco->LastPacketEnd == 0 || (int32_t)(start - pLoco->LastPacketEnd) >= ADDRESS_SPACING_US;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		NextLocoMsg
+*
+* ARGUMENTS:	start - schedule time the packet will start, us
+*
+* RETURNS:		the loco for the next packet, NULL if every address
+*				on the track is still resting
+*
+* DESCRIPTION:	Called when the Track can take a new msg. (Currently only
+*				checks Loco list). The first loco with a speed change
+*				goes first, then the first loco with function or stop
+*				repeats, then the next loco of the refresh round so the
+*				old locos are not starved by busy throttles. Only those
+*				three are looked at. One whose address had a packet less
+*				than ADDRESS_SPACING_US ago is passed over, a waiting
+*				loco keeps its place and the refresh round moves on.
+*
+* RESTRICTIONS:	LocoMsgSent once the packet is on the track
+*
+**********************************************************************/
+Loco* NextLocoMsg(uint32_t start)
+{
+	Loco* pLoco;
+
+	pLoco = SpeedLocos.pFirst;
+	if(pLoco == NULL || !IsLocoRested(pLoco, start))
+	{
+		pLoco = RepeatLocos.pFirst;
+	}
+	if(pLoco != NULL && IsLocoRested(pLoco, start))
+	{
+		PromotedDrop(pLoco);
+		return pLoco;
+	}
+
+	pLoco = pRefreshLoco;
+	if(pLoco != NULL)
+	{
+		pRefreshLoco = pLoco->pRefreshNext;
+		if(IsLocoRested(pLoco, start))
 		{
-			if(0 != ((Loco*)(pnext->m_index))->bNumStopPackets)
-			{
-				--((Loco*)(pnext->m_index))->bNumStopPackets;
-//				break;
-			}
-			else
-			{
-				Remove((LList *)&trackSequence, pnext);
-				return NULL;
-//				pnext = Next(&trackSequence);
-//				if(NULL == pnext)
-//				{	//got to end of list last time...
-//					pnext = First(&trackSequence);
-//				}
-			}
+			return pLoco;
 		}
 	}
-#endif
 
-   if(pnext != NULL && pnext->m_index != 0)
-   {
-		pLoco = ((Loco*)(pnext->m_index));
-   }
+	return NULL;
+}
 
-	return pLoco;
+
+/**********************************************************************
+*
+* FUNCTION:		LocoMsgSent
+*
+* ARGUMENTS:	pLoco - the loco NextLocoMsg returned
+*				end - schedule time the packet will end, us
+*
+* RETURNS:
+*
+* DESCRIPTION:	Note when the address had its packet and how long it
+*				was since the one before. A loco with more of its change
+*				to send waits again, behind the others.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void LocoMsgSent(Loco* pLoco, uint32_t end)
+{
+
+	if(pLoco->LastPacketEnd != 0)
+	{
+		pLoco->LastInterval = end - pLoco->LastPacketEnd;
+		if(pLoco->LastInterval > pLoco->MaxInterval)
+		{
+			pLoco->MaxInterval = pLoco->LastInterval;
+		}
+	}
+	pLoco->LastPacketEnd = end ? end : 1;
+
+	if((pLoco->bChange || pLoco->bNumStopPackets || pLoco->bNumFunctionPackets) && !pLoco->bfPromoted)
+	{
+		PromotedAppend(pLoco);
+	}
 }
 
 
@@ -175,9 +401,6 @@ Loco* NextLocoMsg(void)
 **********************************************************************/
 void MakeMostRecentLoco(Loco *testLoco)
 {
-	Link			*pnext;
-	ListIterator	testIter;
-
 #ifdef MOVED_TO_LOCO
 	if(0 != testLoco->Speed)
 	{
@@ -186,21 +409,30 @@ void MakeMostRecentLoco(Loco *testLoco)
 #endif
 
 	//is the loco in the track sequence list?
-	testIter.m_List = trackSequence.m_List;
-	if(0 == (pnext = FindByKey(&testIter, testLoco->Address)))
+	if(testLoco->pRefreshNext == NULL)
 	{
 		//not found, a new loco...
-		pnext = GetFree();
-		pnext->m_index = (void*)testLoco;
-		pnext->m_key = testLoco->Address; 
-		InsertAtTop(trackSequence.m_List, pnext);
+		testLoco->LastPacketEnd = 0;
+		testLoco->LastInterval = 0;
+		testLoco->MaxInterval = 0;
+		RefreshInsert(testLoco);
 	}
-	else
+	else if(testLoco != pNewestLoco)
 	{
 		//yes, update to top of list
-		BringToTop(trackSequence.m_List, pnext);
+		RefreshUnlink(testLoco);
+		RefreshInsert(testLoco);
+	}
+
+	// a speed change does not wait behind function repeats
+	if(testLoco->bfPromoted && !testLoco->bfPromotedSpeed && (testLoco->bChange & CH_SPEED))
+	{
+		PromotedDrop(testLoco);
+	}
+	if(!testLoco->bfPromoted)
+	{
+		PromotedAppend(testLoco);
 	}
-	First(&trackSequence);	//reset the track sequence iterator
 }
 
 
@@ -212,7 +444,8 @@ void MakeMostRecentLoco(Loco *testLoco)
 *
 * RETURNS:
 *
-* DESCRIPTION:	
+* DESCRIPTION:	Take the loco off the track once its stop and function
+*				packets have all been sent
 *
 * RESTRICTIONS:
 *
@@ -221,9 +454,10 @@ void RemoveLocoMsg(Loco* pLoco)
 {
 
 	//if(pLoco->bNumStopPackets == 0 && pLoco->bNumFunction1Packets == 0 && pLoco->bNumFunction2Packets == 0)
-	if(pLoco->bNumStopPackets == 0 && pLoco->bNumFunctionPackets == 0)
+	if(pLoco->bNumStopPackets == 0 && pLoco->bNumFunctionPackets == 0 && pLoco->pRefreshNext != NULL)
 	{
-		Remove((LList *)&trackSequence, (Link *)pLoco);
+		PromotedDrop(pLoco);
+		RefreshUnlink(pLoco);
 	}
 }
 
@@ -234,7 +468,7 @@ void RemoveLocoMsg(Loco* pLoco)
 *
 * ARGUMENTS:
 *
-* RETURNS:
+* RETURNS:		the least-recently-used loco, NULL if none
 *
 * DESCRIPTION:	Finds least-recently-used loco, removes it from list and
 *				returns a pointer to it..
@@ -244,50 +478,89 @@ void RemoveLocoMsg(Loco* pLoco)
 **********************************************************************/
 Loco *OldestLoco(void)
 {
-	Link			*pnext;
-	Link			*pcurr = NULL;
-	ListIterator	testIter;
-	Loco			*testLoco;
+	Loco* pLoco;
 
-	testIter.m_List = trackSequence.m_List;
-	pnext = First(&testIter);
-	while(pnext)
+	if(pNewestLoco == NULL)
 	{
-		testLoco = (Loco*)pnext->m_index;
-		pnext->m_key = testLoco->Address;
-		pcurr = pnext;
-		pnext = Next(&testIter);
+		return NULL;
 	}
-	if(pcurr != NULL)
+
+	pLoco = pNewestLoco->pRefreshPrev;
+	PromotedDrop(pLoco);
+	RefreshUnlink(pLoco);
+	return pLoco;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetRefreshCount
+*
+* ARGUMENTS:
+*
+* RETURNS:		number of locos in the refresh ring
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+word GetRefreshCount(void)
+{
+
+	return RefreshCount;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		NextRefreshLoco
+*
+* ARGUMENTS:	pLoco - NULL for the first
+*
+* RETURNS:		the next loco on the track, newest first, NULL after
+*				the oldest
+*
+* DESCRIPTION:	Walk the locos on the track
+*
+* RESTRICTIONS:	the ring must not change during the walk
+*
+**********************************************************************/
+Loco* NextRefreshLoco(Loco* pLoco)
+{
+
+	if(pLoco == NULL)
 	{
-		pcurr->m_pnext = NULL;	//unlink it
+		return pNewestLoco;
 	}
-	InsertAtTop(&FreeLocos, pnext);
-	return (Loco*)pnext->m_index;
+
+	pLoco = pLoco->pRefreshNext;
+	return pLoco == pNewestLoco ? NULL : pLoco;
 }
 
 
 /**********************************************************************
 *
-* FUNCTION:		GetFree
+* FUNCTION:		ClearLocoIntervals
 *
 * ARGUMENTS:
 *
 * RETURNS:
 *
-* DESCRIPTION:	get an unused link from the free list
+* DESCRIPTION:	Start the longest refresh interval of every loco on the
+*				track again
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-Link *GetFree(void)
+void ClearLocoIntervals(void)
 {
-	Link *temp;
+	Loco* pLoco = NULL;
 
-	if(isEmpty(&FreeLocos)) return NULL;
-	temp = FreeLocos.head;
-	Remove(&FreeLocos, FreeLocos.head);
-	return temp;
+	while((pLoco = NextRefreshLoco(pLoco)) != NULL)
+	{
+		pLoco->MaxInterval = 0;
+	}
 }
 
 
@@ -11,11 +11,15 @@
 * COPYRIGHT (c) 2000-2002 by K2 Engineering  All Rights Reserved.
 *
 **********************************************************************/
-#include "loco.h"
+#include "Loco.h"
+
+// S-9.2, from the end of a packet to the start of the next one to the same decoder
+#define ADDRESS_SPACING_US	5000
 
 extern void InitLocoList(void);
 
-extern Loco* NextLocoMsg(void);
+extern Loco* NextLocoMsg(uint32_t start);
+extern void LocoMsgSent(Loco* pLoco, uint32_t end);
 
 extern void RemoveLocoMsg(Loco* pLoco);
 
@@ -31,4 +35,8 @@ extern void StopAllLocos(void);
 
 extern Loco *OldestLoco(void);
 
+extern word GetRefreshCount(void);
+extern Loco* NextRefreshLoco(Loco* pLoco);
+extern void ClearLocoIntervals(void);
+
 
@@ -24,6 +24,7 @@
 *
 **********************************************************************/
 #include "main.h"
+#include "cmsis_os.h"
 //#include "stm32l4xx_hal.h"
 #include "stm32f4xx_ll_usart.h"
 #include <string.h>
@@ -62,8 +63,6 @@
 #define MAXTXBUFLEN    	128
 #define MAXRXBUFLEN		128
 
-#define OVERFLOW        1
-
 #undef THIS_UART
 #define THIS_UART		USART2
 
@@ -73,15 +72,18 @@
 #undef THIS_CLK_ENABLE
 #define THIS_CLK_ENABLE	__USART2_CLK_ENABLE
 
+// USART2_RX is DMA1 stream 5 channel 4, USART2_TX is DMA1 stream 6 channel 4
+#define RX_DMA_STREAM	DMA1_Stream5
+#define RX_DMA_CHANNEL	DMA_CHANNEL_4
+#define RX_DMA_IRQn		DMA1_Stream5_IRQn
+
+#define TX_DMA_STREAM	DMA1_Stream6
+#define TX_DMA_CHANNEL	DMA_CHANNEL_4
+#define TX_DMA_IRQn		DMA1_Stream6_IRQn
+
 
 #define BYTE0(Var)   (*((uint8_t*)&Var + 0))
 #define BYTE1(Var)   (*((uint8_t*)&Var + 1))
-#define BYTE2(Var)   (*((uint8_t*)&Var + 2))
-#define BYTE3(Var)   (*((uint8_t*)&Var + 3))
-#define BYTE4(Var)   (*((uint8_t*)&Var + 4))
-#define BYTE5(Var)   (*((uint8_t*)&Var + 5))
-#define BYTE6(Var)   (*((uint8_t*)&Var + 6))
-#define BYTE7(Var)   (*((uint8_t*)&Var + 7))
 
 /**********************************************************************
 *
@@ -89,6 +91,11 @@
 *
 **********************************************************************/
 
+static void RxDrain(uint8_t bfIdle);
+static void RxDmaEvent(DMA_HandleTypeDef* hdma);
+static void TxStart(void);
+static void TxDmaComplete(DMA_HandleTypeDef* hdma);
+
 /**********************************************************************
 *
 *							GLOBAL VARIABLES
@@ -108,14 +115,18 @@ static UART_DEF mUartDef;
 static uint8_t RxBuf[32];
 static uint8_t RxNumberChars;
 
+static DMA_HandleTypeDef hdmaRx;
+static DMA_HandleTypeDef hdmaTx;
 
-static uint8_t tx_restart = 0;
-static uint16_t tstore_ptr=0;
-static uint16_t tload_ptr=0;
-static uint16_t rload_ptr=0;
-static uint16_t rx_index=0;
-static uint8_t tx_buf[MAXTXBUFLEN];
-static uint8_t rx_buf[MAXRXBUFLEN];
+// whole data registers, 9 bit characters go through the DMA as they are
+static uint16_t rx_buf[MAXRXBUFLEN];		// written by the circular DMA
+static uint16_t rload_ptr = 0;
+
+static uint16_t tx_buf[MAXTXBUFLEN];
+static volatile uint16_t tstore_ptr = 0;
+static volatile uint16_t tload_ptr = 0;
+static volatile uint16_t tx_dma_length = 0;	// characters the DMA is sending from tload_ptr, 0 idle
+static volatile uint8_t tx_active = 0;		// the direction pin is on transmit
 
 /**********************************************************************
 *
@@ -131,7 +142,10 @@ static uint8_t rx_buf[MAXRXBUFLEN];
 *
 * RETURNS:
 *
-* DESCRIPTION:	Initializes communication peripheral and buffers
+* DESCRIPTION:	Initializes communication peripheral and buffers.
+*				Both directions go through the DMA, the receive DMA
+*				runs round rx_buf for ever and is emptied at line idle
+*				and at each half of the buffer.
 *
 * RESTRICTIONS:
 *
@@ -146,6 +160,7 @@ HAL_StatusTypeDef Uart2_Init(UART_DEF* uart_def)
 
 
 	THIS_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
 
 	LL_USART_Disable(THIS_UART);
 
@@ -172,36 +187,59 @@ HAL_StatusTypeDef Uart2_Init(UART_DEF* uart_def)
     */
     LL_USART_SetBaudRate(THIS_UART, PCLK1Freq, LL_USART_OVERSAMPLING_16, uart_def->baud);
 
-//k	LL_USART_SetDEDeassertionTime(THIS_UART, 0);
-//k	LL_USART_SetDEAssertionTime(THIS_UART, 0);
-//k	LL_USART_SetDESignalPolarity(THIS_UART, LL_USART_DE_POLARITY_HIGH);
-//k	LL_USART_EnableDEMode(THIS_UART);
-
-
-	//LL_USART_DisableIT_ERROR(THIS_UART);
-	//LL_USART_DisableIT_PE(THIS_UART);
-	//LL_USART_DisableIT_RTO(THIS_UART);
-	//LL_USART_DisableIT_EOB(THIS_UART);
-	//LL_USART_DisableIT_CTS(THIS_UART);
-	//LL_USART_DisableIT_WKUP(THIS_UART);
-	//LL_USART_DisableIT_CM(THIS_UART);
+	// the data register is read and written a half word at a time
+	hdmaRx.Instance = RX_DMA_STREAM;
+	hdmaRx.Init.Channel = RX_DMA_CHANNEL;
+	hdmaRx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+	hdmaRx.Init.PeriphInc = DMA_PINC_DISABLE;
+	hdmaRx.Init.MemInc = DMA_MINC_ENABLE;
+	hdmaRx.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+	hdmaRx.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+	hdmaRx.Init.Mode = DMA_CIRCULAR;
+	hdmaRx.Init.Priority = DMA_PRIORITY_HIGH;
+	hdmaRx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	if (HAL_DMA_Init(&hdmaRx) != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	hdmaRx.XferHalfCpltCallback = RxDmaEvent;
+	hdmaRx.XferCpltCallback = RxDmaEvent;
+
+	hdmaTx.Instance = TX_DMA_STREAM;
+	hdmaTx.Init.Channel = TX_DMA_CHANNEL;
+	hdmaTx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+	hdmaTx.Init.PeriphInc = DMA_PINC_DISABLE;
+	hdmaTx.Init.MemInc = DMA_MINC_ENABLE;
+	hdmaTx.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+	hdmaTx.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+	hdmaTx.Init.Mode = DMA_NORMAL;
+	hdmaTx.Init.Priority = DMA_PRIORITY_MEDIUM;
+	hdmaTx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	if (HAL_DMA_Init(&hdmaTx) != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	hdmaTx.XferCpltCallback = TxDmaComplete;
 
+	rload_ptr = 0;
+	tstore_ptr = 0;
+	tload_ptr = 0;
+	tx_dma_length = 0;
+	tx_active = 0;
+	RxNumberChars = 0;
 
-//	if(uart_def->mode == U_MATCH)
-//	{
-//		LL_USART_ConfigNodeAddress(THIS_UART, LL_USART_ADDRESS_DETECT_7B, uart_def->match);
-//		LL_USART_EnableIT_CM(THIS_UART);
-//	}
-	if(uart_def->mode == U_IDLE || uart_def->mode == U_IDLE_9B)
+	if (HAL_DMA_Start_IT(&hdmaRx, (uint32_t)&THIS_UART->DR, (uint32_t)rx_buf, MAXRXBUFLEN) != HAL_OK)
 	{
-		LL_USART_EnableIT_IDLE(THIS_UART);
+		return HAL_ERROR;
 	}
 
-	LL_USART_EnableIT_RXNE(THIS_UART);
+	LL_USART_EnableDMAReq_RX(THIS_UART);
+	LL_USART_EnableDMAReq_TX(THIS_UART);
 
-    LL_USART_Enable(THIS_UART);
+	// every mode is emptied at line idle, a character at a time is too slow for the cab bus
+	LL_USART_EnableIT_IDLE(THIS_UART);
 
-    tx_restart = 1;
+    LL_USART_Enable(THIS_UART);
 
 	GPIO_InitStruct.Pin = CAB_TX_PIN;
 	GPIO_InitStruct.Mode = CAB_TX_MODE;
@@ -224,42 +262,186 @@ HAL_StatusTypeDef Uart2_Init(UART_DEF* uart_def)
 	GPIO_InitStruct.Alternate = CAB_DIR_AF;
 	HAL_GPIO_Init(CAB_DIR_PORT, &GPIO_InitStruct);
 
-	/* Peripheral interrupt init*/
-	HAL_NVIC_SetPriority(THIS_IRQn, 0, 0);
+	/* Peripheral interrupt init, the callbacks wake the command station task */
+	HAL_NVIC_SetPriority(THIS_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
 	HAL_NVIC_EnableIRQ(THIS_IRQn);
+	HAL_NVIC_SetPriority(RX_DMA_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(RX_DMA_IRQn);
+	HAL_NVIC_SetPriority(TX_DMA_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TX_DMA_IRQn);
 
 	return HAL_OK;
 }
 
 
+/**********************************************************************
+*
+* FUNCTION:		RxDrain
+*
+* ARGUMENTS:	bfIdle - the line went idle, the message is complete
+*
+* RETURNS:
+*
+* DESCRIPTION:	Hand the characters the DMA has written since the last
+*				time to the receive callback, one at a time in U_CHAR
+*				mode, a message at line idle in the idle modes
+*
+* RESTRICTIONS:	interrupt only, the USART and the receive DMA
+*				interrupts have the same priority
+*
+**********************************************************************/
+static void RxDrain(uint8_t bfIdle)
+{
+	uint16_t rstore_ptr;
+	uint16_t w;
+	uint8_t max;
+
+	// characters RxBuf holds, two bytes each in 9 bit mode
+	max = mUartDef.mode == U_IDLE_9B ? sizeof(RxBuf) / 2 : sizeof(RxBuf);
+
+	rstore_ptr = MAXRXBUFLEN - __HAL_DMA_GET_COUNTER(&hdmaRx);
+	if(rstore_ptr >= MAXRXBUFLEN)
+	{
+		rstore_ptr = 0;
+	}
+
+	while(rload_ptr != rstore_ptr)
+	{
+		w = rx_buf[rload_ptr++];
+		if(rload_ptr > MAXRXBUFLEN - 1)
+		{
+			rload_ptr = 0;
+		}
+
+		if(mUartDef.mode == U_CHAR)
+		{
+			RxBuf[0] = BYTE0(w);
+			RxNumberChars = 1;
+			if(mUartDef.UartRxCallback != NULL)
+			{
+				(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
+			}
+			RxNumberChars = 0;
+		}
+		else
+		{
+			if(mUartDef.mode == U_IDLE_9B)
+			{
+				RxBuf[RxNumberChars * 2] = BYTE0(w);
+				RxBuf[RxNumberChars * 2 + 1] = BYTE1(w) & 0x01;
+			}
+			else
+			{
+				RxBuf[RxNumberChars] = BYTE0(w);
+			}
+
+			// RxBuf is full, pass it on before the line is idle
+			if(++RxNumberChars == max)
+			{
+				if(mUartDef.UartRxCallback != NULL)
+				{
+					(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
+				}
+				RxNumberChars = 0;
+			}
+		}
+	}
+
+	if(bfIdle && RxNumberChars != 0)
+	{
+		if(mUartDef.UartRxCallback != NULL)
+		{
+			(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
+		}
+		RxNumberChars = 0;
+	}
+}
 
 
 /**********************************************************************
 *
-* FUNCTION:		GetRxChar
+* FUNCTION:		RxDmaEvent
 *
-* ARGUMENTS:
+* ARGUMENTS:	hdma - the receive DMA
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Half or all of rx_buf was filled without the line going
+*				idle, empty it before the DMA comes round again
 *
 * RESTRICTIONS:
 *
-**********************************************************************///
-static uint8_t GetRxChar(uint8_t* c)
+**********************************************************************/
+static void RxDmaEvent(DMA_HandleTypeDef* hdma)
+{
+
+	RxDrain(0);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TxStart
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Start the DMA on what is waiting in tx_buf, as far as
+*				the end of the buffer if it wraps
+*
+* RESTRICTIONS:	interrupts off, or the transmit DMA interrupt
+*
+**********************************************************************/
+static void TxStart(void)
 {
-	if(rload_ptr == rx_index)
+	uint16_t length;
+
+	if(tx_dma_length != 0 || tstore_ptr == tload_ptr)
 	{
-	    return 0;
+		return;
 	}
 
-	*c = rx_buf[rload_ptr++];
-	if(rload_ptr > MAXRXBUFLEN - 1)
+	length = (tstore_ptr > tload_ptr ? tstore_ptr : MAXTXBUFLEN) - tload_ptr;
+
+	// the line is still ours, transmission complete comes after the last character
+	LL_USART_DisableIT_TC(THIS_UART);
+	LL_USART_ClearFlag_TC(THIS_UART);
+
+	tx_dma_length = length;
+	HAL_DMA_Start_IT(&hdmaTx, (uint32_t)&tx_buf[tload_ptr], (uint32_t)&THIS_UART->DR, length);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TxDmaComplete
+*
+* ARGUMENTS:	hdma - the transmit DMA
+*
+* RETURNS:
+*
+* DESCRIPTION:	The DMA has handed the last character to the USART.
+*				Send what was queued meanwhile, or wait for the
+*				transmission complete interrupt to turn the line round.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void TxDmaComplete(DMA_HandleTypeDef* hdma)
+{
+
+	tload_ptr = (tload_ptr + tx_dma_length) % MAXTXBUFLEN;
+	tx_dma_length = 0;
+
+	if(tstore_ptr != tload_ptr)
 	{
-	  rload_ptr = 0;
+		TxStart();
+	}
+	else
+	{
+		LL_USART_EnableIT_TC(THIS_UART);
 	}
-	return 1;
 }
 
 
@@ -271,212 +453,119 @@ static uint8_t GetRxChar(uint8_t* c)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Line idle, the message is in, and transmission complete,
+*				the stop bits of the last character are out and the
+*				line is turned round to receive
 *
 * RESTRICTIONS:
 *
 **********************************************************************///
 void USART2_IRQHandler(void)
 {
-	uint8_t c;
-	uint16_t w;
-
-	if(LL_USART_IsActiveFlag_RXNE(THIS_UART) && LL_USART_IsEnabledIT_RXNE(THIS_UART))
-	{
-		if(mUartDef.mode == U_IDLE_9B)
-		{
-			w = LL_USART_ReceiveData9(THIS_UART);
-
-			if(mUartDef.mode == U_CHAR)
-			{
-				rx_buf[0] = BYTE0(w);
-		        rx_buf[1] = BYTE1(w);
-				RxNumberChars = 2;
-				if(mUartDef.UartRxCallback != NULL)
-				{
-					(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
-				}
-			}
-			else
-			{
-				rx_buf[rx_index++] = BYTE0(w);
-		        if( rx_index > MAXRXBUFLEN - 1 )
-		        {
-		            rx_index = 0;
-		        }
-		        rx_buf[rx_index++] = BYTE1(w);
-		        if( rx_index > MAXRXBUFLEN - 1 )
-		        {
-		            rx_index = 0;
-		        }
-		        RxNumberChars++;
-			}
-		}
-		else
-		{
-			c = LL_USART_ReceiveData8(THIS_UART);
-
-			if(mUartDef.mode == U_CHAR)
-			{
-				RxBuf[0] = c;
-				RxNumberChars = 1;
-				if(mUartDef.UartRxCallback != NULL)
-				{
-					(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
-				}
-			}
-			else
-			{
-				rx_buf[rx_index++] = c; // store data in buffer
-				// check if we are on the buffer wrap
-				if( rx_index > MAXRXBUFLEN - 1 )
-				{
-					rx_index = 0;
-				}
-				RxNumberChars++;
-			}
-		}
-	}
-
-//	if(LL_USART_IsActiveFlag_CM(THIS_UART) && LL_USART_IsEnabledIT_CM(THIS_UART))
-//	{
-//		LL_USART_ClearFlag_CM(THIS_UART);
-//
-//		if(mUartDef.mode == U_MATCH)
-//		{
-//			RxNumberChars = 0;
-//			while(GetRxChar(&c))
-//			{
-//				RxBuf[RxNumberChars++] = c;
-//			}
-//			if(mUartDef.UartRxCallback != NULL)
-//			{
-//				(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
-//			}
-//		}
-//	}
 
+	// clearing IDLE reads the data register, it is empty when the line is idle
 	if(LL_USART_IsActiveFlag_IDLE(THIS_UART) && LL_USART_IsEnabledIT_IDLE(THIS_UART))
 	{
 		LL_USART_ClearFlag_IDLE(THIS_UART);
-		if(mUartDef.mode == U_IDLE || mUartDef.mode == U_IDLE_9B)
-		{
-			RxNumberChars = 0;
-			while(GetRxChar(&c))
-			{
-				RxBuf[RxNumberChars++] = c;
-			}
-			if(mUartDef.UartRxCallback != NULL)
-			{
-				(*mUartDef.UartRxCallback)(RxBuf, &RxNumberChars);
-			}
-		}
+		RxDrain(1);
 	}
 
-	if(LL_USART_IsActiveFlag_TXE(THIS_UART) && LL_USART_IsEnabledIT_TXE(THIS_UART))
+	if(LL_USART_IsActiveFlag_TC(THIS_UART) && LL_USART_IsEnabledIT_TC(THIS_UART))
 	{
+		LL_USART_DisableIT_TC(THIS_UART);
+		LL_USART_ClearFlag_TC(THIS_UART);
 
-	    if( tstore_ptr != tload_ptr ){    // check if we have data in the buffer
-	        c = tx_buf[tload_ptr++];
-	        if( tload_ptr > MAXTXBUFLEN - 1 ){
-	            tload_ptr = 0;
-	        }
-			LL_USART_TransmitData8(THIS_UART, c);
-	        tx_restart = 0;
-	    }
-	    else
-	    {
-	        // reset pointers
-			LL_USART_DisableIT_TXE(THIS_UART);
-	        tx_restart = 1;
+		if(tx_dma_length == 0 && tstore_ptr == tload_ptr)
+		{
+			HAL_GPIO_WritePin(CAB_DIR_PORT, CAB_DIR_PIN, GPIO_PIN_RESET);
+			tx_active = 0;
 
 			if(mUartDef.UartTxCallback != NULL)
 			{
 				(*mUartDef.UartTxCallback)();
 			}
-
-			LL_USART_ClearFlag_TC(THIS_UART);
-			LL_USART_EnableIT_TC(THIS_UART);
-	    }
+		}
 	}
+}
 
 
-	if(LL_USART_IsActiveFlag_TC(THIS_UART))
-	{
-		HAL_GPIO_WritePin(CAB_DIR_PORT, CAB_DIR_PIN, GPIO_PIN_RESET);
-		LL_USART_DisableIT_TC(THIS_UART);
+/**********************************************************************
+*
+* FUNCTION:		DMA1_Stream5_IRQHandler
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Receive DMA interrupt, each half of rx_buf
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void DMA1_Stream5_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdmaRx);
+}
 
-//		LL_USART_DisableIT_TXE(THIS_UART);
-//        tx_restart = 1;
-	}
 
-	LL_USART_ClearFlag_PE(THIS_UART);
-	LL_USART_ClearFlag_FE(THIS_UART);
-	LL_USART_ClearFlag_NE(THIS_UART);
-	LL_USART_ClearFlag_ORE(THIS_UART);
-	LL_USART_ClearFlag_IDLE(THIS_UART);
-	LL_USART_ClearFlag_TC(THIS_UART);
-//	LL_USART_ClearFlag_CM(THIS_UART);
+/**********************************************************************
+*
+* FUNCTION:		DMA1_Stream6_IRQHandler
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Transmit DMA interrupt, the end of each block
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void DMA1_Stream6_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdmaTx);
 }
 
 
 /*********************************************************************
 *
-* FUNCTION:		Uart_SendChar
+* FUNCTION:		Uart2_Send
 *
-* ARGUMENTS:	the character to send
+* ARGUMENTS:	data - characters, 9 bits each
+*				size - number of characters
 *
 * RETURNS:		none
 *
-* DESCRIPTION:	Put a character in the send FIFO and make the transmit
-* 				interrupt is on
+* DESCRIPTION:	Put the characters in the send FIFO, turn the line to
+*				transmit and start the DMA if it is not running. Waits
+*				for room if the FIFO is full.
 *
 *********************************************************************/
-static void Uart2_SendChar(const char c)
+static void Uart2_Send(const uint16_t* data, uint8_t size)
 {
-	int j=0;
+	uint16_t next;
+	uint8_t i;
 
-	HAL_GPIO_WritePin(CAB_DIR_PORT, CAB_DIR_PIN, GPIO_PIN_SET);
+	for(i = 0; i < size; i++)
+	{
+		next = (tstore_ptr + 1) % MAXTXBUFLEN;
+		while(next == tload_ptr)
+		{
+			// allow characters to get clear
+		}
 
-	// check if we on the buffer wrap
-    while((tstore_ptr+1) == tload_ptr)
-    {
-        j++;// allow bytes to get clear
-    }
-    while(((tstore_ptr+1) == MAXTXBUFLEN) && (tload_ptr==0))
-    {
-        j++;// allow bytes to get clear
-    }
-    if( tstore_ptr < tload_ptr ){
-        if( tload_ptr - tstore_ptr > OVERFLOW ){
-            tx_buf[tstore_ptr++] = c;
-            if( tstore_ptr > MAXTXBUFLEN - 1 ){
-                tstore_ptr = 0;
-            }
-        }
-    }else{
-        if( tstore_ptr > tload_ptr ){
-            if( (( tload_ptr - tstore_ptr ) + MAXTXBUFLEN ) > OVERFLOW ){
-                tx_buf[tstore_ptr++] = c;
-                if( tstore_ptr > MAXTXBUFLEN - 1 ){
-                    tstore_ptr = 0;
-                }
-            }
-        }else{
-            tx_buf[tstore_ptr++] = c;
-            if( tstore_ptr > MAXTXBUFLEN - 1 ){
-                tstore_ptr = 0;
-            }
-        }
-    }
+		tx_buf[tstore_ptr] = data[i];
+		tstore_ptr = next;
+	}
 
-    // Start the interrupt
-    if( tx_restart )
-    {
-		LL_USART_EnableIT_TXE(THIS_UART);
-//		LL_USART_EnableIT_TC(THIS_UART);
-    }
-    return;
+	__disable_irq();
+	if(!tx_active)
+	{
+		tx_active = 1;
+		HAL_GPIO_WritePin(CAB_DIR_PORT, CAB_DIR_PIN, GPIO_PIN_SET);
+	}
+	TxStart();
+	__enable_irq();
 }
 
 
@@ -488,25 +577,32 @@ static void Uart2_SendChar(const char c)
 *
 * RETURNS:		none
 *
-* DESCRIPTION:	Sends a message by looping through the buffer for the
-* 				number of bytes using the Uart_SendChar function
+* DESCRIPTION:	Sends a message, the DMA takes it from the send FIFO
 *
 *********************************************************************/
 void Uart2_SendPacket(uint8_t *data, uint8_t size)
 {
-    int i = 0;
+	uint16_t aw[MAXTXBUFLEN / 8];
+	uint8_t n;
+	uint8_t i;
 
     // sanity check
-    if(size > MAXTXBUFLEN)
+    if(size > MAXTXBUFLEN - 1)
     {
         return;
     }
 
-    // Loop through the buffer
-    for( i = 0; i < size; i++ )
-    {
-        Uart2_SendChar(data[i]);
-    }
+	// in pieces, a long message starts going out while the rest is copied
+	while(size)
+	{
+		n = size < sizeof(aw) / sizeof(aw[0]) ? size : sizeof(aw) / sizeof(aw[0]);
+		for(i = 0; i < n; i++)
+		{
+			aw[i] = *data++;
+		}
+		Uart2_Send(aw, n);
+		size -= n;
+	}
 }
 
 
@@ -519,28 +615,40 @@ void Uart2_SendPacket(uint8_t *data, uint8_t size)
 *
 * RETURNS:
 *
-* DESCRIPTION:		Sends data via communication peripheral
+* DESCRIPTION:		Sends data via communication peripheral, with the
+*					9th bit set in 9 bit mode
 *
-* RESTRICTIONS:		This does not check for transmitter not busy
+* RESTRICTIONS:
 *
 **********************************************************************///
 void Uart2_SendToken(uint8_t token)
 {
+	uint16_t w = token;
 
-	HAL_GPIO_WritePin(CAB_DIR_PORT, CAB_DIR_PIN, GPIO_PIN_SET);
 	if(mUartDef.bits == U_DATAWIDTH_9B)
 	{
-		LL_USART_TransmitData9(THIS_UART, token | 0x100);
-	}
-	else
-	{
-		LL_USART_TransmitData8(THIS_UART, token);
+		w |= 0x100;
 	}
-
-    if( tx_restart )
-    {
-		LL_USART_EnableIT_TXE(THIS_UART);
-//		LL_USART_EnableIT_TC(THIS_UART);
-    }
+	Uart2_Send(&w, 1);
 }
 
+
+/**********************************************************************
+*
+* FUNCTION:		IsTxBusy
+*
+* ARGUMENTS:
+*
+* RETURNS:		1 until the last character is out and the line is
+*				turned round
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************///
+uint8_t IsTxBusy(void)
+{
+
+	return tx_active;
+}
@@ -13,12 +13,14 @@
 **********************************************************************/
 #include "main.h"
 #include "Main.h"
+#include "cmsis_os.h"
 #include "CabNCE.h"
 #include <string.h>
 #include <ctype.h>
 #include "Events.h"
 #include "MsgQueue.h"
 #include "Uart2.h"
+#include "CS.h"
 //#include "Uart3.h"
 #include "BitMask.h"
 //#include "Clock.h"
@@ -37,7 +39,22 @@
 *
 **********************************************************************/
 
-#define CAB_POLL_TIME				5
+// ticks after an answer before the next poll
+#define CAB_POLL_GAP				1
+
+// ticks a cab has to answer, the token, the cab's turnaround, two
+// characters and the line idle that ends them come to about 5.5ms
+#define CAB_RESPONSE_TIME			7
+
+// a cab with no key or speed change for this long is polled every CAB_SEEN_CYCLES
+#define CAB_ACTIVE_TIME				10000
+#define CAB_SEEN_CYCLES				4
+
+// polls in a row without an answer before a cab is absent
+#define CAB_MISSES					3
+
+// ticks between discovery polls of absent addresses
+#define CAB_DISCOVERY_TIME			100
 
 #define CAB_NO_KEY					0x7d
 #define CAB_REFRESH_DISPLAY			0x7e
@@ -45,6 +62,11 @@
 
 #define TX_TIMEOUT					10
 
+// a whole display quadrant, CAB_TEXT_n and 8 characters
+#define CAB_TEXT_PACKET				9
+
+#define CAB_CURSOR_UNKNOWN			0
+
 /**********************************************************************
 *
 *							FUNCTION PROTOTYPES
@@ -52,8 +74,13 @@
 **********************************************************************/
 
 unsigned char HandleCabOutput(unsigned char bCab);
-void HandleCabResponse(unsigned char Cab);
-unsigned char IsAnyCabText(unsigned char bCab);
+unsigned char HandleCabResponse(unsigned char Cab);
+static unsigned char IsTextDirty(CAB_BUS* pCab, unsigned char bQuadrant);
+static void ClearTextDirty(CAB_BUS* pCab, unsigned char bQuadrant);
+static unsigned char QuadrantCursor(unsigned char bQuadrant, unsigned char bPos);
+static unsigned char TextCost(CAB_BUS* pCab, unsigned char bQuadrant, unsigned char* pbFirst);
+static void SendCabPacket(unsigned char* Packet, unsigned char PacketLength);
+static unsigned char HandleCabText(unsigned char bCab);
 
 void NCE_PutQueue(unsigned char bCab, int nMsg);
 
@@ -61,7 +88,12 @@ void RxCabResponse(unsigned char* Response, unsigned char* ResponseLength);
 void TxCabResponse(void);
 
 void SelectNextCab(void);
-void MakeCabActive(unsigned char bCab);
+
+static void ClearCabStats(void);
+static unsigned char IsCabDue(unsigned char bCab);
+static void CabPolled(unsigned char bCab);
+static void CabAnswered(unsigned char bCab, unsigned char bfInput);
+static void CabMissed(unsigned char bCab);
 
 /**********************************************************************
 *
@@ -71,11 +103,6 @@ void MakeCabActive(unsigned char bCab);
 
 unsigned long NCE_KeyFilter;
 
-unsigned char abCabActiveQueue[MAX_CABS];
-unsigned char abCabInactiveQueue[MAX_CABS];
-unsigned char bCabIndex;
-unsigned char bInactiveCabIndex;
-
 extern RTC_HandleTypeDef hrtc;
 
 /**********************************************************************
@@ -97,6 +124,23 @@ static unsigned char TxTimeout;
 
 static unsigned char SuppressClock = 0;
 
+// the poller, a cycle goes through the addresses from bPollCursor
+static unsigned char bPollCursor;
+static unsigned char bDiscoveryCab;
+static uint32_t CycleTick;
+static uint32_t DiscoveryTick;
+static unsigned char abMissed[MAX_CABS];
+static uint32_t aLastPollTick[MAX_CABS];
+static uint32_t aLastInputTick[MAX_CABS];
+
+// cycle counter at the token and at the answer
+static uint32_t PollCycles;
+static volatile uint32_t ResponseCycles;
+
+static NCE_CAB_STATS aCabStats[MAX_CABS];
+static NCE_BUS_STATS BusStats;
+static volatile unsigned char bfClearStats;
+
 /**********************************************************************
 *
 *							CODE
@@ -176,7 +220,6 @@ enum
  	CAB_BUS_POLLING,
 	CAB_BUS_TRANSMIT_WAIT,
     CAB_BUS_EXSISTING_CAB,
-    CAB_BUS_NEW_CAB,
 };
 
 
@@ -212,13 +255,15 @@ void InitCabCommunication(unsigned char Ports)
 	}
 
 
-	memset(abCabActiveQueue, 0, MAX_CABS);
+	memset(CabBus, 0, sizeof(CabBus));
+	memset(aCabStats, 0, sizeof(aCabStats));
+	memset(&BusStats, 0, sizeof(BusStats));
+	memset(abMissed, 0, sizeof(abMissed));
 
-	for(i = 0; i < MAX_CABS - 1; i++)
+	for(i = 0; i < MAX_CABS; i++)
 	{
-		abCabInactiveQueue[i] = i + 1;
-
-		memset(CabBus, 0, sizeof(CabBus));
+		// every address is found by the discovery sweep
+		aCabStats[i].state = CAB_STATE_ABSENT;
 
 		CabBus[i].TextQuadrant1 = 0;
 		CabBus[i].TextQuadrant2 = 0;
@@ -234,81 +279,241 @@ void InitCabCommunication(unsigned char Ports)
 		CabBus[i].nQueue4 = 0;
 	}
 
-	bCabIndex = MAX_CABS;
-	bInactiveCabIndex = 0;
-	bCab = 1;					// anything non-zero
+	bDiscoveryCab = 0;
+	CycleTick = osKernelGetTickCount();
+	DiscoveryTick = CycleTick - CAB_DISCOVERY_TIME;
+	iCabBusState = CAB_BUS_STARTUP;
 }
 
 
+/**********************************************************************
+*
+* FUNCTION:		ClearCabStats
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Start the poll statistics again
+*
+* RESTRICTIONS:	command station task, the shell asks with ClearNCECabStats
+*
+**********************************************************************/
+static void ClearCabStats(void)
+{
+	unsigned char i;
+
+	memset(&BusStats, 0, sizeof(BusStats));
+	for(i = 0; i < MAX_CABS; i++)
+	{
+		aCabStats[i].polls = 0;
+		aCabStats[i].responses = 0;
+		aCabStats[i].misses = 0;
+		aCabStats[i].response_us = 0;
+		aCabStats[i].max_response_us = 0;
+		aCabStats[i].interval_ms = 0;
+		aCabStats[i].max_interval_ms = 0;
+	}
+	bfClearStats = 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IsCabDue
+*
+* ARGUMENTS:	bCab - cab address
+*
+* RETURNS:		1 if the cab is polled in this cycle
+*
+* DESCRIPTION:	An active cab every cycle, a cab that answers but has
+*				not been used for a while every CAB_SEEN_CYCLES cycles,
+*				spread over the cycles by address. An absent address
+*				only gets the discovery poll.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned char IsCabDue(unsigned char bCab)
+{
+
+	switch(aCabStats[bCab].state)
+	{
+		case CAB_STATE_ACTIVE:
+			return 1;
+
+		case CAB_STATE_SEEN:
+			return ((BusStats.cycles + bCab) % CAB_SEEN_CYCLES) == 0;
+
+		default:
+			return 0;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SelectNextCab
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Pick the next address to poll into bCab. A cycle is
+*				the broadcast address 0, then every cab that is due,
+*				then one absent address if the discovery sweep is due.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
 void SelectNextCab(void)
 {
+	uint32_t Now = osKernelGetTickCount();
+	unsigned char i;
 
-	if(bCab == 0)
+	// the cabs due in this cycle
+	while(bPollCursor < MAX_CABS)
 	{
-		//bInactiveCabIndex++;
-		bCab = abCabInactiveQueue[bInactiveCabIndex];
-		if(bCab == 0)
+		bCab = bPollCursor++;
+		if(IsCabDue(bCab))
 		{
-			bInactiveCabIndex = 0;
-			bCab = abCabInactiveQueue[bInactiveCabIndex];
+			return;
 		}
-		bInactiveCabIndex++;
 	}
-	else
+
+	// one absent address now and then
+	if(bPollCursor == MAX_CABS)
 	{
-		// select the next Cab
-		bCabIndex++;
-		if(bCabIndex >= MAX_CABS)
+		bPollCursor++;
+		if(Now - DiscoveryTick >= CAB_DISCOVERY_TIME)
 		{
-			bCabIndex = 0;
+			DiscoveryTick = Now;
+			for(i = 1; i < MAX_CABS; i++)
+			{
+				if(++bDiscoveryCab >= MAX_CABS)
+				{
+					bDiscoveryCab = 1;
+				}
+				if(aCabStats[bDiscoveryCab].state == CAB_STATE_ABSENT)
+				{
+					bCab = bDiscoveryCab;
+					BusStats.discovery++;
+					return;
+				}
+			}
 		}
+	}
 
-		bCab = abCabActiveQueue[bCabIndex];
+	// a new cycle
+	BusStats.cycle_ms = Now - CycleTick;
+	if(BusStats.cycles != 0 && BusStats.cycle_ms > BusStats.max_cycle_ms)
+	{
+		BusStats.max_cycle_ms = BusStats.cycle_ms;
 	}
+	BusStats.cycles++;
+	CycleTick = Now;
+
+	bCab = 0;
+	bPollCursor = 1;
 }
 
 
-void MakeCabActive(unsigned char bCab)
+/**********************************************************************
+*
+* FUNCTION:		CabPolled
+*
+* ARGUMENTS:	bCab - cab address
+*
+* RETURNS:
+*
+* DESCRIPTION:	Count a poll and the time since the cab's last one
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void CabPolled(unsigned char bCab)
 {
-	unsigned char i;
+	NCE_CAB_STATS* pStats = &aCabStats[bCab];
+	uint32_t Now = osKernelGetTickCount();
 
-	// take it out of the inactive list
-	for(i = bInactiveCabIndex; i < MAX_CABS - 1; i++)
+	if(pStats->polls != 0)
 	{
-		abCabInactiveQueue[i] = abCabInactiveQueue[i + 1];
+		pStats->interval_ms = Now - aLastPollTick[bCab];
+		if(pStats->interval_ms > pStats->max_interval_ms)
+		{
+			pStats->max_interval_ms = pStats->interval_ms;
+		}
 	}
-	abCabInactiveQueue[i] = 0;
-
-	// put it in the active list
-	abCabActiveQueue[bCabIndex] = bCab;
-
-	// reset to beginning of list
-	bCabIndex = 0;
-
-	//bCab = abCabActiveQueue[bCabIndex];
+	aLastPollTick[bCab] = Now;
+	pStats->polls++;
+	BusStats.polls++;
 }
 
 
-void MakeCabInactive(unsigned char bCab)
+/**********************************************************************
+*
+* FUNCTION:		CabAnswered
+*
+* ARGUMENTS:	bCab - cab address
+*				bfInput - the cab sent a key or a new speed
+*
+* RETURNS:
+*
+* DESCRIPTION:	A cab that is used is active, one that only answers
+*				drops to seen after CAB_ACTIVE_TIME
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void CabAnswered(unsigned char bCab, unsigned char bfInput)
 {
-	unsigned char i;
+	NCE_CAB_STATS* pStats = &aCabStats[bCab];
+	uint32_t Now = osKernelGetTickCount();
 
-	// cab has timed-out, remove from active list
-	for(i = bCabIndex; i < MAX_CABS - 1; i++)
+	pStats->responses++;
+	pStats->response_us = (ResponseCycles - PollCycles) / (SystemCoreClock / 1000000);
+	if(pStats->response_us > pStats->max_response_us)
 	{
-		abCabActiveQueue[i] = abCabActiveQueue[i + 1];
+		pStats->max_response_us = pStats->response_us;
 	}
-	abCabActiveQueue[i] = 0;
+	abMissed[bCab] = 0;
 
-	// put it in the inactive list
-	for(i = 0; i < MAX_CABS; i++)
+	// a cab just plugged in is active until it has its display
+	if(bfInput || pStats->state == CAB_STATE_ABSENT)
 	{
-		if(abCabInactiveQueue[i] == 0)
-		{
-			break;
-		}
+		pStats->state = CAB_STATE_ACTIVE;
+		aLastInputTick[bCab] = Now;
+	}
+	else if(pStats->state == CAB_STATE_ACTIVE && Now - aLastInputTick[bCab] >= CAB_ACTIVE_TIME)
+	{
+		pStats->state = CAB_STATE_SEEN;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		CabMissed
+*
+* ARGUMENTS:	bCab - cab address
+*
+* RETURNS:
+*
+* DESCRIPTION:	A cab is absent after CAB_MISSES polls in a row without
+*				an answer, one lost answer does not cost it its turn
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void CabMissed(unsigned char bCab)
+{
+
+	aCabStats[bCab].misses++;
+	BusStats.misses++;
+	if(aCabStats[bCab].state != CAB_STATE_ABSENT && ++abMissed[bCab] >= CAB_MISSES)
+	{
+		aCabStats[bCab].state = CAB_STATE_ABSENT;
 	}
-	abCabInactiveQueue[i] = bCab;
 }
 
 
@@ -320,82 +525,66 @@ void MakeCabInactive(unsigned char bCab)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Poll the cabs. A poll is the address token, then the
+*				cab has CAB_RESPONSE_TIME to answer, then whatever is
+*				queued for its display goes out. The next poll follows
+*				CAB_POLL_GAP later, so a cycle takes as long as the
+*				cabs in it.
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 void HandleNCECabCommunication(unsigned char Ports)
 {
-	//byte i;
 	static int iPollTime;
-	//static byte bNewCab;
-	unsigned char poll;
+	static uint32_t LastTick;
+	unsigned char bfTick;
+	unsigned char bfInput;
+
+	// the command station calls this on cab bus events too, the timers count ticks
+	bfTick = osKernelGetTickCount() != LastTick;
+	LastTick = osKernelGetTickCount();
+
+	if(bfClearStats)
+	{
+		ClearCabStats();
+	}
 
 	switch(iCabBusState)
 	{
 	 	case CAB_BUS_STARTUP:
-			bCabIndex = 0;
-			bInactiveCabIndex = 0;
+			bPollCursor = MAX_CABS + 1;
+			SelectNextCab();
 			iPollTime = 1;
-			bCab = 0;
 			iCabBusState = CAB_BUS_POLLING;
 	 	break;
 
 	 	case CAB_BUS_POLLING:
-			if(--iPollTime == 0)
+			if(bfTick && --iPollTime == 0)
 			{
-				poll = bCab + 0x80;
-				//if(Ports == CAB_PORT_RIGHT)
-				//{
-					Uart2_SendToken(poll);
-				//}
-
-				//if(Ports == CAB_PORT_LEFT)
-				//{
-				//	Uart3_SendToken(poll);
-				//}
 				GotCabResponse = 0;
 				CabRxIndex = 0;
+				PollCycles = DWT->CYCCNT;
+				Uart2_SendToken(bCab + 0x80);
+				CabPolled(bCab);
 
 				if(bCab == 0)
 				{
-					// Cab is zero
+					// nobody answers the broadcast address
 					if(HandleCabOutput(bCab))
 					{
 						iCabBusState = CAB_BUS_TRANSMIT_WAIT;
 					}
 					else
 					{
-						//bCab = abCabInactiveQueue[bInactiveCabIndex];
-
-						//if(bCab == 0)
-						//{
-						//	bInactiveCabIndex = 0;
-						//	bCab = abCabInactiveQueue[bInactiveCabIndex];
-						//}
 						SelectNextCab();
-
-						CabBus[bCab].NewCab = 1;
-
-						iPollTime = CAB_POLL_TIME;
-						iCabBusState = CAB_BUS_POLLING;
+						iPollTime = CAB_POLL_GAP;
 					}
 				}
 				else
 				{
-					// Cab is not zero
-					if(CabBus[bCab].NewCab)
-					{
-						CabBus[bCab].NewCab = 0;
-						iPollTime = CAB_POLL_TIME;
-						iCabBusState = CAB_BUS_NEW_CAB;
-					}
-					else
-					{
-						iPollTime = CAB_POLL_TIME;
-						iCabBusState = CAB_BUS_EXSISTING_CAB;
-					}
+					iPollTime = CAB_RESPONSE_TIME;
+					iCabBusState = CAB_BUS_EXSISTING_CAB;
 				}
 			}
 	 	break;
@@ -406,141 +595,40 @@ void HandleNCECabCommunication(unsigned char Ports)
 				GotCabResponse = 0 ;
 
 		    	// this cab responded - queue a 'cab' message
-				HandleCabResponse(bCab);
-
-				// select the next Cab
-				//bCabIndex++;
-				//if(bCabIndex >= MAX_CABS)
-				//{
-				//	bCabIndex = 0;
-				//}
-
-				if(HandleCabOutput(bCab))
-				{
-					iCabBusState = CAB_BUS_TRANSMIT_WAIT;
-				}
-				else
-				{
-					SelectNextCab();
-					bCab = abCabActiveQueue[bCabIndex];
-					iPollTime = CAB_POLL_TIME;
-					iCabBusState = CAB_BUS_POLLING;
-				}
-			}
-			else
-			{
-				if(--iPollTime == 0)
-				{
-					// no response
-
-					// cab has timed-out, remove from active list
-					//for(i = bCabIndex; i < MAX_CABS - 1; i++)
-					//{
-					//	abCabActiveQueue[i] = abCabActiveQueue[i + 1];
-					//}
-					//abCabActiveQueue[i] = 0;
-
-					// put it in the inactive list
-					//for(i = 0; i < MAX_CABS; i++)
-					//{
-					//	if(abCabInactiveQueue[i] == 0)
-					//	{
-					//		break;
-					//	}
-					//}
-					//abCabInactiveQueue[i] = bCab;
-
-					MakeCabInactive(bCab);
-
-					// select the next Cab
-					//bCabIndex++;
-					//if(bCabIndex >= MAX_CABS)
-					//{
-					//	bCabIndex = 0;
-					//}
-					SelectNextCab();
-
-					bCab = abCabActiveQueue[bCabIndex];
-					iPollTime = CAB_POLL_TIME;
-					iCabBusState = CAB_BUS_POLLING;
-				}
-			}
-	    break;
-
-	    case CAB_BUS_NEW_CAB:
-		    if(GotCabResponse)
-			{
-		    	GotCabResponse = 0 ;
-
-				// this cab responded - queue a 'cab' message
-				HandleCabResponse(bCab);
-
-				// handle any cab list management
-				// take it out of the inactive list
-				//for(i = bInactiveCabIndex; i < MAX_CABS - 1; i++)
-				//{
-            	//	abCabInactiveQueue[i] = abCabInactiveQueue[i + 1];
-            	//}
-            	//abCabInactiveQueue[i] = 0;
-
-				// put it in the active list
-				//abCabActiveQueue[bCabIndex] = bCab;
-
-				// reset to beginning of list
-				//bCabIndex = 0;
-
-				MakeCabActive(bCab);
+				bfInput = HandleCabResponse(bCab);
+				CabAnswered(bCab, bfInput);
 
 				if(HandleCabOutput(bCab))
 				{
-					//iCabBusState = CAB_BUS_TRANSMIT_DELAY;
 					iCabBusState = CAB_BUS_TRANSMIT_WAIT;
 				}
 				else
 				{
 					SelectNextCab();
-					bCab = abCabActiveQueue[bCabIndex];
-					iPollTime = CAB_POLL_TIME;
+					iPollTime = CAB_POLL_GAP;
 					iCabBusState = CAB_BUS_POLLING;
 				}
 			}
-			else
+			else if(bfTick && --iPollTime == 0)
 			{
-				if(--iPollTime == 0)
-				{
-					// no response
-
-					// reset to beginning of list
-					bCabIndex = 0;
-
-					// select next inactive Can
-					//bInactiveCabIndex++;
-					//if(abCabInactiveQueue[bInactiveCabIndex] == 0)
-        			//{
-					//	bInactiveCabIndex = 0;
-					//}
+				// no response
+				CabMissed(bCab);
 
-					//bCab = abCabActiveQueue[bCabIndex];
-
-					bCab = 0;		// force a cab from the inactive queue
-					SelectNextCab();
-
-					iPollTime = CAB_POLL_TIME;
-					iCabBusState = CAB_BUS_POLLING;
-				}
+				SelectNextCab();
+				iPollTime = CAB_POLL_GAP;
+				iCabBusState = CAB_BUS_POLLING;
 			}
 	    break;
 
 	 	case CAB_BUS_TRANSMIT_WAIT:
-	 		TxTimeout++;
+	 		TxTimeout += bfTick;
 			if(TxComplete || TxTimeout > TX_TIMEOUT)
 			{
 				TxComplete = 0;
 
-				//bCab = abCabInactiveQueue[bInactiveCabIndex];
 				SelectNextCab();
 
-				iPollTime = CAB_POLL_TIME;
+				iPollTime = CAB_POLL_GAP;
 				iCabBusState = CAB_BUS_POLLING;
 			}
 	 	break;
@@ -554,21 +642,84 @@ void HandleNCECabCommunication(unsigned char Ports)
 
 /**********************************************************************
 *
-* FUNCTION:		HandleCabResponse
+* FUNCTION:		GetNCECabStats
+*
+* ARGUMENTS:	bCab - cab address
+*				pStats - where to put them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetNCECabStats(unsigned char bCab, NCE_CAB_STATS* pStats)
+{
+
+	*pStats = aCabStats[bCab];
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetNCEBusStats
+*
+* ARGUMENTS:	pStats - where to put them
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetNCEBusStats(NCE_BUS_STATS* pStats)
+{
+
+	*pStats = BusStats;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ClearNCECabStats
 *
 * ARGUMENTS:
 *
 * RETURNS:
 *
+* DESCRIPTION:	Have the command station task clear the poll statistics,
+*				the cab states stay
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void ClearNCECabStats(void)
+{
+
+	bfClearStats = 1;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		HandleCabResponse
+*
+* ARGUMENTS:
+*
+* RETURNS:		1 if the cab sent a key or a new speed
+*
 * DESCRIPTION:
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-void HandleCabResponse(unsigned char bCab)
+unsigned char HandleCabResponse(unsigned char bCab)
 {
 	unsigned char Speed;
 	unsigned char bCabType;
+	unsigned char bfInput = 0;
 	short nEvent;
 
 	// get response data
@@ -585,23 +736,19 @@ void HandleCabResponse(unsigned char bCab)
 	}
 	else if(CabResponse[0] == CAB_REFRESH_DISPLAY)
 	{
-		CabBus[bCab].TextQuadrant1 = 1;
-		CabBus[bCab].TextQuadrant2 = 1;
-		CabBus[bCab].TextQuadrant3 = 1;
-		CabBus[bCab].TextQuadrant4 = 1;
+		NCE_RefreshDisplay(bCab);
 		NCE_DisplayChar(bCab, GET_VERSION);
 		NCE_CursorOff(bCab);
 		CabBus[bCab].VersionReturn = 1;
 	}
 	else if(CabResponse[0] != CAB_NO_KEY)
 	{
+		bfInput = 1;
+
 		// if we don't have a virtual cab at this point - get one (error condition)
 		if(CabBus[bCab].pVirtualCab == 0)
 		{
-			CabBus[bCab].TextQuadrant1 = 1;
-			CabBus[bCab].TextQuadrant2 = 1;
-			CabBus[bCab].TextQuadrant3 = 1;
-			CabBus[bCab].TextQuadrant4 = 1;
+			NCE_RefreshDisplay(bCab);
 			NCE_CursorOff(bCab);
 			NCE_DisplayChar(bCab, GET_VERSION);
 			CabBus[bCab].VersionReturn = 1;
@@ -636,14 +783,12 @@ void HandleCabResponse(unsigned char bCab)
 			CabBus[bCab].DownLimit = 0;
 		}
 		CabBus[bCab].OldSpeed = Speed;
+		bfInput = 1;
 
 		// if we don't have a virtual cab at this point - get one (error condition)
 		if(CabBus[bCab].pVirtualCab == 0)
 		{
-			CabBus[bCab].TextQuadrant1 = 1;
-			CabBus[bCab].TextQuadrant2 = 1;
-			CabBus[bCab].TextQuadrant3 = 1;
-			CabBus[bCab].TextQuadrant4 = 1;
+			NCE_RefreshDisplay(bCab);
 			NCE_CursorOff(bCab);
 			NCE_DisplayChar(bCab, GET_VERSION);
 			CabBus[bCab].VersionReturn = 1;
@@ -660,6 +805,8 @@ void HandleCabResponse(unsigned char bCab)
 	}
 
 //	abCabTimeout[bCab] = CAB_TIMEOUT;
+
+	return bfInput;
 }
 
 
@@ -678,9 +825,8 @@ void HandleCabResponse(unsigned char bCab)
 **********************************************************************/
 unsigned char HandleCabOutput(unsigned char bCab)
 {
-	unsigned char bQuadrant;
 	unsigned char bTemp;
-	unsigned char Packet[9];
+	unsigned char Packet[2];
 	unsigned char PacketLength;
 
 	// Handle the single/two byte commands from the "queue"
@@ -697,10 +843,23 @@ unsigned char HandleCabOutput(unsigned char bCab)
 			PacketLength++;
 		}
 
+		// keep track of the cab's cursor and display
+		if(Packet[0] == MOVE_CURSOR)
+		{
+			CabBus[bCab].bCabCursor = Packet[1];
+		}
+		else if(Packet[0] == CLEAR_DISPLAY)
+		{
+			CabBus[bCab].bShownValid = 0;
+			CabBus[bCab].bCabCursor = CAB_CURSOR_UNKNOWN;
+		}
+		else if(Packet[0] != CURSOR_ON && Packet[0] != CURSOR_OFF)
+		{
+			CabBus[bCab].bCabCursor = CAB_CURSOR_UNKNOWN;
+		}
+
 		// send to the correct context
-		Uart2_SendPacket(Packet, PacketLength);
-		TxComplete = 0;
-		TxTimeout = 0;
+		SendCabPacket(Packet, PacketLength);
 
 		// pop the "queue"
 		CabBus[bCab].nQueue1 = CabBus[bCab].nQueue2;
@@ -709,46 +868,258 @@ unsigned char HandleCabOutput(unsigned char bCab)
 		CabBus[bCab].nQueue4 = 0;
 		return 1;
 	}
-	else
+
+	return HandleCabText(bCab);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SendCabPacket
+*
+* ARGUMENTS:	Packet - what follows the cab's answer
+*				PacketLength - bytes in it
+*
+* RETURNS:
+*
+* DESCRIPTION:	Send to the polled cab and wait for the transmit callback
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void SendCabPacket(unsigned char* Packet, unsigned char PacketLength)
+{
+
+	Uart2_SendPacket(Packet, PacketLength);
+	TxComplete = 0;
+	TxTimeout = 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		IsTextDirty
+*
+* ARGUMENTS:	pCab - the cab
+*				bQuadrant - 0 to 3
+*
+* RETURNS:		1 if the quadrant was written since it was last sent
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned char IsTextDirty(CAB_BUS* pCab, unsigned char bQuadrant)
+{
+
+	switch(bQuadrant)
 	{
-		bQuadrant = IsAnyCabText(bCab);
-		if(bQuadrant)
-		{
-			bQuadrant--;
+		case 0:
+			return pCab->TextQuadrant1;
+		case 1:
+			return pCab->TextQuadrant2;
+		case 2:
+			return pCab->TextQuadrant3;
+		default:
+			return pCab->TextQuadrant4;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ClearTextDirty
+*
+* ARGUMENTS:	pCab - the cab
+*				bQuadrant - 0 to 3
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void ClearTextDirty(CAB_BUS* pCab, unsigned char bQuadrant)
+{
+
+	switch(bQuadrant)
+	{
+		case 0:
+			pCab->TextQuadrant1 = 0;
+		break;
+		case 1:
+			pCab->TextQuadrant2 = 0;
+		break;
+		case 2:
+			pCab->TextQuadrant3 = 0;
+		break;
+		default:
+			pCab->TextQuadrant4 = 0;
+		break;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		QuadrantCursor
+*
+* ARGUMENTS:	bQuadrant - 0 to 3
+*				bPos - character in the quadrant
+*
+* RETURNS:		the MOVE_CURSOR position of the character
+*
+* DESCRIPTION:	Same encoding as NCE_SetCursorPosition
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned char QuadrantCursor(unsigned char bQuadrant, unsigned char bPos)
+{
+
+	return (((bQuadrant / 2) * CAB_KEY_OFFSET) + ((bQuadrant % 2) * 8) + bPos) | 0x80;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		TextCost
+*
+* ARGUMENTS:	pCab - the cab
+*				bQuadrant - 0 to 3, in bShownValid
+*				pbFirst - the first character that differs
+*
+* RETURNS:		bytes to bring the quadrant up to date a character at
+*				a time, 0 if it already is
+*
+* DESCRIPTION:	A TTY_NEXT per changed character, and a MOVE_CURSOR
+*				wherever the cursor is not already on it
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned char TextCost(CAB_BUS* pCab, unsigned char bQuadrant, unsigned char* pbFirst)
+{
+	unsigned char bCursor = pCab->bCabCursor;
+	unsigned char bCost = 0;
+	unsigned char i;
 
-			switch(bQuadrant)
+	*pbFirst = 8;
+	for(i = 0; i < 8; i++)
+	{
+		if(pCab->TextQuadrant[bQuadrant][i] != pCab->ShownQuadrant[bQuadrant][i])
+		{
+			if(*pbFirst == 8)
 			{
-				case 0:
-					bTemp = CAB_TEXT_1;
-				break;
-				case 1:
-					bTemp = CAB_TEXT_2;
-				break;
-				case 2:
-					bTemp = CAB_TEXT_3;
-				break;
-				case 3:
-					bTemp = CAB_TEXT_4;
-				break;
-				default:
-					bTemp = CAB_TEXT_1;
-				break;
+				*pbFirst = i;
 			}
-			Packet[0] = bTemp;
-			memcpy(&Packet[1], CabBus[bCab].TextQuadrant[bQuadrant], 8);
+			if(bCursor != QuadrantCursor(bQuadrant, i))
+			{
+				bCost += 2;
+			}
+			bCost += 2;
+			bCursor = QuadrantCursor(bQuadrant, i) + 1;
+		}
+	}
+	return bCost;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		HandleCabText
+*
+* ARGUMENTS:	bCab - the polled cab
+*
+* RETURNS:		1 if something was sent
+*
+* DESCRIPTION:	Send one step of what the cab's display is missing. A
+*				quadrant written with what the cab already shows is
+*				dropped, one with a few changed characters goes a
+*				character at a time with TTY_NEXT, anything else as a
+*				whole quadrant. Writes between two polls of the cab
+*				come out as one difference. The cursor is put back
+*				when the text is done.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static unsigned char HandleCabText(unsigned char bCab)
+{
+	CAB_BUS* pCab = &CabBus[bCab];
+	unsigned char Packet[CAB_TEXT_PACKET];
+	unsigned char bQuadrant;
+	unsigned char bCost;
+	unsigned char bPos;
 
-			// send to the correct context
-			Uart2_SendPacket(Packet, 9);
-			TxComplete = 0;
-			TxTimeout = 0;
+	for(bQuadrant = 0; bQuadrant < 4; bQuadrant++)
+	{
+		if(!IsTextDirty(pCab, bQuadrant))
+		{
+			continue;
+		}
 
-			if(CabBus[bCab].CursonOn)
+		if(pCab->bShownValid & (1 << bQuadrant))
+		{
+			bCost = TextCost(pCab, bQuadrant, &bPos);
+			if(bCost == 0)
 			{
-				NCE_PutQueue(bCab, MOVE_CURSOR | (CabBus[bCab].nCursor << 8));
+				ClearTextDirty(pCab, bQuadrant);
+				BusStats.text_unchanged++;
+				continue;
+			}
+
+			// the broadcast moves every cab's cursor, it only gets whole quadrants
+			if(bCab != 0 && bCost < CAB_TEXT_PACKET)
+			{
+				Packet[1] = QuadrantCursor(bQuadrant, bPos);
+				if(pCab->bCabCursor != Packet[1])
+				{
+					Packet[0] = MOVE_CURSOR;
+					pCab->bCabCursor = Packet[1];
+				}
+				else
+				{
+					Packet[0] = TTY_NEXT;
+					Packet[1] = pCab->TextQuadrant[bQuadrant][bPos];
+					pCab->ShownQuadrant[bQuadrant][bPos] = Packet[1];
+					pCab->bCabCursor++;
+					BusStats.text_chars++;
+
+					if(TextCost(pCab, bQuadrant, &bPos) == 0)
+					{
+						ClearTextDirty(pCab, bQuadrant);
+					}
+				}
+				SendCabPacket(Packet, 2);
+				return 1;
 			}
-			return 1;
 		}
+
+		ClearTextDirty(pCab, bQuadrant);
+
+		Packet[0] = CAB_TEXT_1 + bQuadrant;
+		memcpy(&Packet[1], pCab->TextQuadrant[bQuadrant], 8);
+		SendCabPacket(Packet, CAB_TEXT_PACKET);
+
+		memcpy(pCab->ShownQuadrant[bQuadrant], pCab->TextQuadrant[bQuadrant], 8);
+		pCab->bShownValid |= 1 << bQuadrant;
+		pCab->bCabCursor = CAB_CURSOR_UNKNOWN;
+		BusStats.text_quadrants++;
+		return 1;
+	}
+
+	if(pCab->CursonOn && pCab->bCabCursor != pCab->nCursor)
+	{
+		Packet[0] = MOVE_CURSOR;
+		Packet[1] = pCab->nCursor;
+		pCab->bCabCursor = pCab->nCursor;
+		SendCabPacket(Packet, 2);
+		return 1;
 	}
+
 	return 0;
 }
 
@@ -810,57 +1181,6 @@ void SendNCECabKey(unsigned char bCab, short nEvent)
 }
 
 
-/**********************************************************************
-*
-* FUNCTION:		IsAnyCabText
-*
-* ARGUMENTS:
-*
-* RETURNS:
-*
-* DESCRIPTION:
-*
-* RESTRICTIONS:
-*
-**********************************************************************/
-unsigned char IsAnyCabText(unsigned char bCab)
-{
-	//int i;
-
-	// send any new text
-   //for(i = 0; i < 4; i++)
-   //{
-	//	if(CabBus[bCab].Flags & cBitMask[i])
-	//	{
-	//		CabBus[bCab].Flags &= ~cBitMask[i];
-	//		return i + 1;
-	//	}
-   //}
-
-   if(CabBus[bCab].TextQuadrant1)
-   {
-	   CabBus[bCab].TextQuadrant1 = 0;
-	   return 1;
-   }
-   else if(CabBus[bCab].TextQuadrant2)
-   {
-	   CabBus[bCab].TextQuadrant2 = 0;
-	   return 2;
-   }
-   else if(CabBus[bCab].TextQuadrant3)
-   {
-	   CabBus[bCab].TextQuadrant3 = 0;
-	   return 3;
-   }
-   else if(CabBus[bCab].TextQuadrant4)
-   {
-	   CabBus[bCab].TextQuadrant4 = 0;
-	   return 4;
-   }
-   return 0;
-}
-
-
 /**********************************************************************
 *
 * FUNCTION:		RxCabResponse
@@ -880,14 +1200,18 @@ void RxCabResponse(unsigned char* Response, unsigned char* ResponseLength)
 #ifdef USE_IDLE
 	CabResponse[0] = Response[0];
 	CabResponse[1] = Response[1];
+	ResponseCycles = DWT->CYCCNT;
 	GotCabResponse = 1;
+	SignalCommandStation(CS_FLAG_CAB);
 #else
 
 	CabResponse[CabRxIndex++] = Response[0];
 	if(CabRxIndex >= 2)
 	{
 		CabRxIndex = 2;	// guard
+		ResponseCycles = DWT->CYCCNT;
 		GotCabResponse = 1;
+		SignalCommandStation(CS_FLAG_CAB);
 	}
 #endif
 }
@@ -909,6 +1233,7 @@ void RxCabResponse(unsigned char* Response, unsigned char* ResponseLength)
 void TxCabResponse(void)
 {
 	TxComplete = 1;
+	SignalCommandStation(CS_FLAG_CAB);
 }
 
 
@@ -946,7 +1271,7 @@ void SetLimits(unsigned char bCab, unsigned char upper, unsigned char lower)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	The cab lost its display, send all of it again
 *
 * RESTRICTIONS:
 *
@@ -958,6 +1283,8 @@ void NCE_RefreshDisplay(unsigned char bCab)
 	CabBus[bCab].TextQuadrant2 = 1;
 	CabBus[bCab].TextQuadrant3 = 1;
 	CabBus[bCab].TextQuadrant4 = 1;
+	CabBus[bCab].bShownValid = 0;
+	CabBus[bCab].bCabCursor = CAB_CURSOR_UNKNOWN;
 }
 
 
@@ -15,7 +15,7 @@
 #define CABBUS_H
 
 #include "Cab.h"
-#include "Main.h"
+#include "main.h"
 
 /**********************************************************************
 *
@@ -63,6 +63,11 @@ typedef struct
 	unsigned int		NewCab :1;
 	unsigned int		VersionReturn :1;
 
+	// what the cab's display shows, the text goes out as the difference
+	char				ShownQuadrant[4][8];
+	unsigned char		bShownValid;			// a bit per quadrant of ShownQuadrant
+	unsigned char		bCabCursor;				// where the cab's cursor is, 0 unknown
+
 	// Menu stuff
 #ifdef MOVE_THIS_HERE
 	int				nEvent;
@@ -80,8 +85,38 @@ typedef struct
 } CAB_BUS;
 
 
-extern unsigned char abCabActiveQueue[MAX_CABS];
-extern unsigned char abCabInactiveQueue[MAX_CABS];
+// how often the poller asks for a cab
+enum
+{
+	CAB_STATE_ABSENT,		// only the discovery sweep polls it
+	CAB_STATE_SEEN,			// answers but is not being used, polled now and then
+	CAB_STATE_ACTIVE,		// polled every cycle
+};
+
+typedef struct
+{
+	unsigned char	state;				// CAB_STATE_xxx
+	uint32_t		polls;
+	uint32_t		responses;
+	uint32_t		misses;
+	uint32_t		response_us;		// from the token to the answer
+	uint32_t		max_response_us;
+	uint32_t		interval_ms;		// between polls of this cab
+	uint32_t		max_interval_ms;
+} NCE_CAB_STATS;
+
+typedef struct
+{
+	uint32_t		cycles;
+	uint32_t		cycle_ms;			// the last cycle
+	uint32_t		max_cycle_ms;
+	uint32_t		polls;
+	uint32_t		misses;
+	uint32_t		discovery;			// polls of absent addresses
+	uint32_t		text_quadrants;		// display quadrants sent whole
+	uint32_t		text_chars;			// display characters sent one at a time
+	uint32_t		text_unchanged;		// quadrants written with what the cab already shows
+} NCE_BUS_STATS;
                                      
 
 // NCE Cab Commands
@@ -175,6 +210,11 @@ extern void NCE_CursorOn(unsigned char bCab);
 extern void NCE_CursorOff(unsigned char bCab);
 
 
+extern void GetNCECabStats(unsigned char bCab, NCE_CAB_STATS* pStats);
+extern void GetNCEBusStats(NCE_BUS_STATS* pStats);
+extern void ClearNCECabStats(void);
+
+
 extern void UpdateWangrowClock(void);
 extern void NCE_SuppressClock(unsigned char bClock);
 
@@ -181,6 +181,10 @@ Loco* SelectLoco(VIRTUAL_CAB* pVirtualCab, unsigned int nLoco)
 		if(pLoco == NULL)
 		{
 			pLoco = OldestLoco();
+			if(pLoco != NULL)
+			{
+				ReuseLoco(pLoco, nLoco);
+			}
 		}
 	}
 
@@ -22,7 +22,7 @@
 #ifndef MENU_H
 #define MENU_H
 
-#include "Main.h"
+#include "main.h"
 #include "Cab.h"
 
 /**********************************************************************
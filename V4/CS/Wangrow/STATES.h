@@ -23,8 +23,8 @@
 #ifndef _STATES_H
 #define _STATES_H
 
-#include "Main.h"
-#include "cab.h"
+#include "main.h"
+#include "Cab.h"
 
 /**********************************************************************
 *
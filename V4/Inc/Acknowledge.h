@@ -16,14 +16,74 @@ enum
 	OVER_CURRENT,
 };
 
+// over-current trip, the ADC analog watchdog turns the track off from its interrupt
+typedef enum
+{
+	TRIP_ARMED,				// track running, watchdog armed
+	TRIP_BACKOFF,			// tripped, the track comes back on after the backoff
+	TRIP_LOCKED,			// out of retries, stays off until ResetTrip()
+} TRIP_STATE;
+
+typedef struct
+{
+	uint16_t threshold;		// ADC counts, a single sample above this trips
+	uint16_t retries;		// times the track is turned back on, 0 = stay off
+	uint16_t backoff;		// ms before the first retry, doubled for each further trip
+	uint16_t backoff_max;	// ms, the longest backoff
+} TRIP_CONFIG;
+
+typedef struct
+{
+	uint32_t tick;			// HAL tick (ms) of the trip
+	uint32_t cycles;		// DWT cycle counter at the trip
+	uint16_t off_cycles;	// cycles from the watchdog interrupt to the track off
+	uint16_t sample;		// ADC counts of the sample that tripped
+	uint16_t peak;			// highest ADC counts seen while the current fell
+	uint16_t retry;			// consecutive trip number
+} TRIP_ENTRY;
+
+#define TRIP_LOG_SIZE	16
+
+// an ACK pulse, timed from the samples
+typedef struct
+{
+	uint32_t start;			// DWT cycle counter at the rising edge
+	uint32_t end;			// and at the falling edge
+	uint32_t width_us;
+	uint16_t amplitude;		// ADC counts, the peak above the baseline
+	uint16_t base;			// ADC counts, the baseline under the pulse
+} ACK_PULSE;
+
+typedef struct
+{
+	uint32_t blocks;		// halves of the sample buffer filtered
+	uint32_t pulses;		// ACK pulses measured
+	uint32_t glitches;		// above ACK_CURRENT, too short for an ACK
+	uint32_t long_pulses;	// too long for an ACK, the baseline moved
+	uint32_t overruns;		// ADC overruns, DMA restarted
+	uint16_t level;			// ADC counts, now
+	uint16_t base;
+} ACK_STATS;
+
 
 extern void InitAcknowledge(void);
 
 extern void Acknowledge(void);
 
-//extern void ClearAck(void);
-//extern byte IsAck(void);
+extern void ClearAck(void);
+extern uint8_t IsAck(void);
 
 extern uint8_t GetAck(void);
+extern uint32_t GetAckPulse(ACK_PULSE* pPulse);
+extern void GetAckStats(ACK_STATS* pStats);
+extern void ClearAckStats(void);
+
+extern void GetTripConfig(TRIP_CONFIG* pConfig);
+extern int SetTripConfig(const TRIP_CONFIG* pConfig);
+extern TRIP_STATE GetTripState(void);
+extern void ResetTrip(void);
+extern uint32_t GetTripCount(void);
+extern int GetTripEntry(uint32_t n, TRIP_ENTRY* pEntry);
+extern void ClearTripLog(void);
 
 #endif /* ACKNOWLEDGE_H_ */
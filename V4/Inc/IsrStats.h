@@ -0,0 +1,76 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	IsrStats.h
+*
+* DATE CREATED:		8/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Interrupt latency and duration statistics measured with
+*				the Cortex-M4 DWT cycle counter
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+
+#ifndef ISRSTATS_H_
+#define ISRSTATS_H_
+
+#include "cmsis_os.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// fixed width histogram buckets, the last one also counts everything above
+#define STATS_HIST_BUCKETS		32
+#define ISR_STATS_BUCKET_SHIFT	5			// 32 cycles (190ns at 168MHz) per bucket
+
+/** @struct STATS_HIST
+	@brief Histogram of samples in buckets of (1 << shift), with the
+	smallest and largest sample and their sum for the mean
+ */
+typedef struct statshist_t
+{
+	uint32_t		count;
+	uint32_t		min;
+	uint32_t		max;
+	uint32_t		sum;
+	uint32_t		hist[STATS_HIST_BUCKETS];
+} STATS_HIST;
+
+/** @struct ISR_STATS
+	@brief Latency (update event to handler entry) and duration of an
+	interrupt handler in CPU cycles, and the worst latency since reset
+	with the task it interrupted
+ */
+typedef struct isrstats_t
+{
+	STATS_HIST		latency;
+	STATS_HIST		duration;
+
+	uint32_t		worst_latency;
+	uint32_t		worst_duration;		// duration of the worst latency entry
+	uint32_t		worst_time;			// cycle counter at that entry
+	osThreadId_t	worst_task;			// task running when it happened
+} ISR_STATS;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void IsrStatsInit(void);
+
+extern void IsrStatsClear(ISR_STATS* pStats);
+
+extern void IsrStatsRecord(ISR_STATS* pStats, uint32_t start, uint32_t latency);
+
+extern void StatsHistRecord(STATS_HIST* pHist, uint32_t value, uint32_t shift);
+
+extern uint32_t StatsHistPercentile(const STATS_HIST* pHist, uint32_t shift, uint32_t per_mille);
+
+#endif /* ISRSTATS_H_ */
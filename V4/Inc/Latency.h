@@ -0,0 +1,81 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Latency.h
+*
+* DATE CREATED:		24/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Decoder response latency, from the end of a packet on
+*					the programming track to the current rise it caused,
+*					histograms per decoder and per test
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "IsrStats.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// histogram bucket width, 512us (STATS_HIST_BUCKETS of them)
+#define LAT_BUCKET_SHIFT		9
+
+// a rise longer than this after the last packet was not caused by it
+#define LAT_WINDOW_US			100000
+
+// decoders kept, the first is the one not identified yet
+#define LAT_DECODERS			8
+
+// what the packets were sent for
+enum
+{
+	LAT_TEST_READ_BIT,
+	LAT_TEST_VERIFY,
+	LAT_TEST_WRITE,
+	LAT_TEST_SPEED,				// a loco speed command, the motor current step
+	LAT_TESTS,
+	LAT_TEST_NONE = 0xff,		// rises are counted but not timed
+};
+
+typedef struct
+{
+	uint8_t bfUsed;
+	uint8_t bManufacturer;		// 0 = not identified
+	uint8_t bVersion;
+	uint8_t bPad;
+	uint16_t wSerial;
+	STATS_HIST aTest[LAT_TESTS];	// in us
+} LATENCY_DECODER;
+
+typedef struct
+{
+	uint32_t rises;				// confirmed current rises
+	uint32_t timed;				// of those, put in a histogram
+	uint32_t untested;			// no test running
+	uint32_t unmatched;			// no packet end before it, or too long before
+	uint32_t replaced;			// decoders dropped to make room
+} LATENCY_STATS;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void LatencyRise(uint32_t onset);
+
+extern void SetLatencyTest(uint8_t bTest);
+extern void SetLatencyDecoder(uint8_t bManufacturer, uint8_t bVersion, uint16_t wSerial);
+
+extern int GetLatencyDecoder(uint8_t bIndex, LATENCY_DECODER* pDecoder);
+extern void GetLatencyStats(LATENCY_STATS* pStats);
+extern void ClearLatencyStats(void);
+
+#endif /* LATENCY_H_ */
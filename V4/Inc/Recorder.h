@@ -0,0 +1,109 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Recorder.h
+*
+* DATE CREATED:		22/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Programming track current recorder, windows of raw
+*					ADC samples around the service mode packet bursts
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// windows kept in RAM, the oldest is reused
+#define REC_WINDOWS				4
+
+// samples in a window, 96ms at 42.7kHz, a whole burst and the ACK
+#define REC_WINDOW_SAMPLES		4096
+
+// of those, from before the trigger, a multiple of the DMA half buffer
+#define REC_PRE_SAMPLES			256
+
+// what triggered a window
+enum
+{
+	REC_TAG_MANUAL,
+	REC_TAG_READ_BIT,			// arg = bit
+	REC_TAG_VERIFY,				// arg = value
+	REC_TAG_WRITE,				// arg = value
+};
+
+// how the burst in the window ended
+enum
+{
+	REC_STATUS_NONE,
+	REC_STATUS_ACK,
+	REC_STATUS_NO_ACK,
+	REC_STATUS_ERROR,
+};
+
+// window states
+enum
+{
+	REC_FREE,
+	REC_FILLING,
+	REC_DONE,
+	REC_CLAIMED,				// handed to a writer, not reused
+};
+
+typedef struct
+{
+	uint32_t sequence;			// 1 up in trigger order
+	uint32_t trigger;			// DWT cycle counter at the trigger
+	uint32_t first;				// and at samples[0]
+	uint32_t sample_cycles;		// DWT cycles between samples
+	uint32_t tick;				// HAL tick at the trigger
+	uint16_t cv;
+	uint8_t tag;				// REC_TAG_
+	uint8_t arg;
+	uint16_t ack_us;			// width of the ACK pulse, 0 = none
+	uint8_t status;				// REC_STATUS_
+	uint8_t state;				// REC_FREE ...
+	uint32_t count;				// samples in the window
+	uint16_t samples[REC_WINDOW_SAMPLES];
+} REC_WINDOW;
+
+// the part of a REC_WINDOW ahead of the samples, the binary dump header
+#define REC_HEADER_SIZE			(sizeof(REC_WINDOW) - REC_WINDOW_SAMPLES * sizeof(uint16_t))
+
+typedef struct
+{
+	uint32_t triggers;
+	uint32_t windows;			// filled
+	uint32_t dropped;			// triggers with every window claimed or held
+	uint32_t holds;				// failed operations that held the windows
+	uint8_t bfHeld;
+} REC_STATS;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void RecordSamples(const uint16_t* pSamples, uint32_t count, uint32_t last, uint32_t sample_cycles);
+
+extern void RecordTrigger(uint8_t tag, uint16_t cv, uint8_t arg);
+extern void RecordResult(uint8_t status, uint16_t ack_us);
+extern void RecordHold(void);
+extern void RecordClear(void);
+
+extern const REC_WINDOW* RecordClaim(uint32_t after);
+extern void RecordRelease(const REC_WINDOW* pWindow);
+
+extern int RecordDump(const char* szFile, uint8_t bfCsv);
+
+extern void GetRecordStats(REC_STATS* pStats);
+
+#endif /* RECORDER_H_ */
@@ -15,6 +15,8 @@
 #ifndef Track_H
 #define Track_H
 
+#include "IsrStats.h"
+
 /**********************************************************************
 *
 *							DEFINITIONS
@@ -32,17 +34,49 @@
 
 #define NO_OF_PREAMBLE_BITS		18
 
+// service mode packets have a long preamble (S-9.2.3)
+#define SERVICE_PREAMBLE_BITS	20
+
+// the longest preamble OpenTrack accepts, one pattern entry
+#define MAX_PREAMBLE_BITS		256
+
+// entries in a packet buffer, runs of equal bits share one entry so this
+// covers any 8 byte packet (and longer ones with runs of equal bits)
+#define TRACK_PACKET_SIZE		80
+
+// packets that can be queued ahead of the track output (a power of 2)
+#define TRACK_PACKET_SLOTS		8
+
+// compiled packets kept for reuse, and the longest packet (bytes) cached
+#define TRACK_CACHE_ENTRIES		16
+#define TRACK_CACHE_BYTES		6
+
 /** @enum PACKET_BITS
 	@brief The three registers that define the track output bits
+
+	The field order matches the TIM1 register order ARR, RCR, CCR1 so a
+	pattern can be streamed by the timer DMA burst (DCR/DMAR) unchanged.
  */
 typedef struct packet_t
 {
 	uint16_t	period;
-	uint16_t	pulse;
 	uint16_t	count;
+	uint16_t	pulse;
 } PACKET_BITS;
 
 
+/** @enum TRACK_CHANNEL
+	@brief The track outputs, each with its own timer, packet ring, idle
+	policy and statistics
+ */
+typedef enum
+{
+	TC_MAIN,			// main (operations) track, TIM1
+	TC_PROG,			// programming track, TIM8
+	TRACK_CHANNELS,
+} TRACK_CHANNEL;
+
+
 /** @enum TRACK_RESOURCE
 	@brief Which resource is using the track output
  */
@@ -51,6 +85,8 @@ typedef enum
 	TR_NONE,
 	TR_TESTER,
 	TR_COMMAND_STATION,
+	TR_SHELL,
+	TRACK_RESOURCES,
 } TRACK_RESOURCE;
 
 
@@ -77,20 +113,38 @@ typedef enum
 
 
 /** @struct TRACK_LOCK
-	@brief The track lock structure
+	@brief What one resource asked of the main track, and how it shares
+	the track with the other resources
  */
 typedef struct tracklock_t
 {
-	TRACK_RESOURCE	lock;
+	uint8_t			open;
 	TRACK_IDLE		idle;
 	uint16_t		preambles;
+	uint8_t			share;			// percent of the packets while the resources contend
+	uint8_t			priority;		// wins ties and sets the idle policy, higher first
+	uint8_t			waiting;		// has a packet ready, but it is not its turn
+	int16_t			credit;			// weighted round robin credit
+	uint32_t		packets;		// packets queued
+	uint32_t		waits;			// times it had to give way
 } TRACK_LOCK;
 
 
-/** TRACK_RESOURCE
-	@brief Track Lock variable
+/** @struct TRACK_STATS
+	@brief Packet encoder statistics
  */
-extern TRACK_LOCK TrackLock;
+typedef struct trackstats_t
+{
+	uint32_t	packets;		// packets encoded
+	uint32_t	bits;			// track bits encoded
+	uint32_t	entries;		// PACKET_BITS entries used for them
+	uint32_t	max_entries;	// largest packet in entries
+	uint32_t	overflows;		// packets that did not fit a buffer
+	uint32_t	cache_hits;		// packets queued from the compiled cache
+	uint32_t	cache_misses;	// packets that had to be encoded
+} TRACK_STATS;
+
+
 
  /**********************************************************************
 *
@@ -99,14 +153,69 @@ extern TRACK_LOCK TrackLock;
 **********************************************************************/
 
 extern void MainTrackConfig(void);
+extern void ProgTrackConfig(void);
 
 extern void EnableTrack(void);
 extern void DisableTrack(void);
 
 extern uint8_t GetTrackState(void);
 
+extern void EnableTrackChannel(TRACK_CHANNEL tc);
+extern void DisableTrackChannel(TRACK_CHANNEL tc);
+extern uint8_t GetTrackChannelState(TRACK_CHANNEL tc);
+
 extern int BuildPacket(const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
 
+extern int BuildChannelPacket(TRACK_CHANNEL tc, const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+
+extern int BuildPacketBytes(const uint8_t packet_byte, uint8_t count, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+
+extern int BuildPacketAmbig1(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t, uint16_t clk0h);
+
+extern int BuildPacketAmbig2(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t2, uint16_t clk0h2, uint16_t clk0t, uint16_t clk0h);
+
 extern int BuildPacketBits(const PACKET_BITS* packet, uint8_t count);
 
+extern int BuildPacketStream(const uint8_t* stream, uint32_t bits, uint8_t invert, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+
+extern int SetIdleClocks(uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+extern int SetChannelIdle(TRACK_CHANNEL tc, TRACK_IDLE ti);
+
+extern uint32_t IsPacketBufferAvailable(void);
+extern uint32_t IsPacketComplete(void);
+extern uint32_t GetFreePacketSlots(void);
+extern int WaitForPacketSlot(uint32_t timeout);
+extern void RegisterPacketSlotCallback(void (*pCallback)(void));
+
+extern uint32_t IsChannelBufferAvailable(TRACK_CHANNEL tc);
+extern uint32_t IsChannelPacketComplete(TRACK_CHANNEL tc);
+extern uint32_t GetChannelFreeSlots(TRACK_CHANNEL tc);
+extern int WaitForChannelSlot(TRACK_CHANNEL tc, uint32_t timeout);
+extern void RegisterChannelSlotCallback(TRACK_CHANNEL tc, void (*pCallback)(void));
+
+extern void GetTrackStats(TRACK_STATS* pStats);
+extern void ClearTrackStats(void);
+
+extern int GetTrackIsrStats(ISR_STATS* pStats);
+extern void ClearTrackIsrStats(void);
+
+extern TRACK_LOCK_STATUS OpenTrack(TRACK_RESOURCE tr, TRACK_IDLE ti, uint16_t preambles);
+extern void CloseTrack(TRACK_RESOURCE tr);
+extern uint8_t IsTrackOpen(TRACK_RESOURCE tr);
+extern uint16_t GetTrackPreambles(TRACK_RESOURCE tr);
+
+extern int SetTrackShare(TRACK_RESOURCE tr, uint8_t share, uint8_t priority);
+extern uint32_t IsTrackTurn(TRACK_RESOURCE tr);
+extern int WaitForTrackTurn(TRACK_RESOURCE tr, uint32_t timeout);
+extern void ReleaseTrackTurn(TRACK_RESOURCE tr);
+extern int EnterTrackCritical(TRACK_RESOURCE tr, uint32_t timeout);
+extern void ExitTrackCritical(TRACK_RESOURCE tr);
+extern void GetTrackLock(TRACK_RESOURCE tr, TRACK_LOCK* pLock);
+
+extern void GetChannelStats(TRACK_CHANNEL tc, TRACK_STATS* pStats);
+extern void ClearChannelStats(TRACK_CHANNEL tc);
+extern int GetChannelIsrStats(TRACK_CHANNEL tc, ISR_STATS* pStats);
+extern void ClearChannelIsrStats(TRACK_CHANNEL tc);
+extern int GetChannelPacketEnd(TRACK_CHANNEL tc, uint32_t before, uint32_t* pEnd);
+
 #endif
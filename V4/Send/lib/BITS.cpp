@@ -92,6 +92,7 @@ Bits::Bits(
 	}
 
 	last_byte	=	&bytes[ isize - 1];
+	flip_byte	=	(BYTE *)0;			// clr_in() resets any flipped bit.
 
 	clr_in();
 
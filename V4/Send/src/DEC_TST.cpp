@@ -1786,14 +1786,21 @@ Dec_tst::decoder_str0_ames(
 		{
 			pre_fail	=	true;
 		}
+
+		if ( Dcc_reg.start_seq() != OK )	// Keep the packet in one piece.
+		{
+			ERRPRINT( my_name, LOG_ERR, "No turn on the track, test stopped" );
+			retval	=	FAIL;
+			break;
+		}
         /*
          * Send BYTES immediately before single stretched 0.
          */
 		dcc_bits2.rst_out();
 		dcc_bits2.get_byte( pbyte );			// Send first 2 preamble bits.
-		Dcc_reg.send_bytes( 1, pbyte, "Send 1st stretched trigger byte." );
+		Dcc_reg.send_raw_bytes( 1, pbyte, "Send 1st stretched trigger byte." );
 		dcc_bits2.get_byte( pbyte );			// Send remaining 8 preambles.
-		Dcc_reg.send_bytes( 1, pbyte, "Send 2nd stretched trigger byte." );
+		Dcc_reg.send_raw_bytes( 1, pbyte, "Send 2nd stretched trigger byte." );
 
 		/*
 		 * Send a scope trigger at start of trigger packet
@@ -1805,16 +1812,22 @@ Dec_tst::decoder_str0_ames(
 		}
 
 		dcc_bits2.get_byte( pbyte );			// Get first part of packet.
-		Dcc_reg.send_stretched_byte(	iclk0t,	// Send single stretched 0.
-										iclk0h,
-										pbyte,
-										"Send byte with single stretched 0." );
+		Dcc_reg.send_raw_stretched_byte(	iclk0t,	// Send single stretched 0.
+											iclk0h,
+											pbyte,
+											"Send byte with single stretched 0." );
 		// Send remaining part of packet.
 		while ( dcc_bits2.get_byte( pbyte ) == OK )
 		{
-			Dcc_reg.send_bytes(	1, pbyte,
+			Dcc_reg.send_raw_bytes(	1, pbyte,
 								"Send remaining stretched trigger packet." );
 		}
+		if ( Dcc_reg.end_seq() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Trigger not sent in one piece, test stopped" );
+			retval	=	FAIL;
+			break;
+		}
 
 		/*
 		 * The following code sends another idle filler, turns
@@ -3215,6 +3228,12 @@ Dec_tst::decoder_prior(
 
 				OUT_PC( PC_POS_UNDERCLRL, 0 );
 				Dcc_reg.send_pkt( fsoc, "Send fail safe start up sequence." );
+				if ( Dcc_reg.start_seq() != OK )	// Preset and trigger back to back.
+				{
+					ERRPRINT( my_name, LOG_ERR, "No turn on the track, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
 				for ( j = 0; j < pkt_rep_cnt;  j++ )	// Preset.
 				{
 					Dcc_reg.send_pkt( dcc_bits, "Send prior packet preset." );
@@ -3237,6 +3256,12 @@ Dec_tst::decoder_prior(
 
 				// Trigger.
 				Dcc_reg.send_pkt( dcc_bits2, "Send prior packet trigger." );
+				if ( Dcc_reg.end_seq() != OK )
+				{
+					ERRPRINT( my_name, LOG_ERR, "Trigger not sent in one piece, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
 
 				/*
 				 * The following code sends another idle filler, turns
@@ -3831,11 +3856,17 @@ Dec_tst::decoder_ambig1(
             	//	Reset dcc_bits2 to the beginning of the packet.
             	dcc_bits2.rst_out();
 
+				if ( Dcc_reg.start_seq() != OK )	// Keep the packet in one piece.
+				{
+					ERRPRINT( my_name, LOG_ERR, "No turn on the track, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
         		//	Send pre_bytes just before ambiguous bit.
             	for ( j = 0; j < pre_bytes; j++ )
             	{
             		dcc_bits2.get_byte( pbyte );
-                	Dcc_reg.send_bytes( 1, pbyte,
+                	Dcc_reg.send_raw_bytes( 1, pbyte,
         				"Send preset BYTE just before ambiguous bit." );
             	}
 
@@ -3846,17 +3877,23 @@ Dec_tst::decoder_ambig1(
                  Dcc_reg.set_scope( true );
 
 				dcc_bits2.get_byte( pbyte );	// Get first BYTE of packet.
-				Dcc_reg.send_1_ambig_bit(	ambig1_0t,
-                							ambig1_0h,
-                                            pbyte,
-                                            "Send byte with 1 ambiguous bit." );
+				Dcc_reg.send_raw_1_ambig_bit(	ambig1_0t,
+                								ambig1_0h,
+                                            	pbyte,
+                                            	"Send byte with 1 ambiguous bit." );
 
 				// Send remaining part of preset packet & the trigger packet.
 				while ( dcc_bits2.get_byte( pbyte ) == OK )
 				{
-					Dcc_reg.send_bytes(	1, pbyte,
+					Dcc_reg.send_raw_bytes(	1, pbyte,
 										"Send remaining ambig 1 packet." );
 				}
+				if ( Dcc_reg.end_seq() != OK )
+				{
+					ERRPRINT( my_name, LOG_ERR, "Trigger not sent in one piece, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
 
 				send_filler();		  			// Send filler.
 
@@ -4119,6 +4156,12 @@ Dec_tst::decoder_ambig2(
         			pre_fail	=	true;
         		}
 
+				if ( Dcc_reg.start_seq() != OK )	// Keep the packet in one piece.
+				{
+					ERRPRINT( my_name, LOG_ERR, "No turn on the track, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
         		//	Send preset just before feedback bits.
         		Dcc_reg.send_pkt(	dcc_bits2,
         			"Send preset just before ambig 2 bits." );
@@ -4131,19 +4174,25 @@ Dec_tst::decoder_ambig2(
 
         		dcc_bits3.rst_out();
 				dcc_bits3.get_byte( pbyte );	// Get first BYTE of packet.
-				Dcc_reg.send_2_ambig_bits(	ambig2_0t1,
-        								ambig2_0h1,
-                                    	ambig2_0t2,
-                                    	ambig2_0h2,
-                                    	pbyte,
-                                    	"Send byte with 2 ambiguous bits." );
+				Dcc_reg.send_raw_2_ambig_bits(	ambig2_0t1,
+        									ambig2_0h1,
+                                    		ambig2_0t2,
+                                    		ambig2_0h2,
+                                    		pbyte,
+                                    		"Send byte with 2 ambiguous bits." );
 
 				// Send remaining part of packet.
 				while ( dcc_bits3.get_byte( pbyte ) == OK )
 				{
-					Dcc_reg.send_bytes(	1, pbyte,
+					Dcc_reg.send_raw_bytes(	1, pbyte,
 									"Send remaining ambig 2 trigger packet." );
 				}
+				if ( Dcc_reg.end_seq() != OK )
+				{
+					ERRPRINT( my_name, LOG_ERR, "Trigger not sent in one piece, test stopped" );
+					retval	=	FAIL;
+					break;
+				}
 
 				send_filler();					// Send filler.
         
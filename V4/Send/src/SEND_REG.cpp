@@ -26,16 +26,9 @@
 #include <bits.h>
 #include <port.h>
 #include <SEND_REG.h>
-//#include "Track.h"
 
 #if SEND_VERSION >= 4
-extern "C"
-{
-	int BuildPacket(const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
-	int BuildPacketBytes(const uint8_t packet_byte, uint8_t count, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
-	int BuildPacketAmbig1(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t, uint16_t clk0h);
-	int BuildPacketAmbig2(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t2, uint16_t clk0h2, uint16_t clk0t, uint16_t clk0h);
-};
+const uint32_t	SLOT_TIMEOUT	= 1000;			// OS ticks to wait for a turn on the track.
 #endif
 
 static const char sccsid[]      = "@(#) $Workfile: SEND_REG.CPP $$ $Revision: 19 $$";
@@ -398,7 +391,12 @@ Send_reg::start_clk( void )
 
 	if ( !m_log_pkts )
 	{
-		// ToDo - add DCC packet control
+		// Share the track with the command station.
+		if ( OpenTrack( TR_TESTER, TI_NONE, 0 ) != TL_ASSIGNED )
+		{
+			ERRPRINT( my_name, LOG_ERR,	"Track not available to the tester" );
+			return ( FAIL );
+		}
 	}
 	else
 	{
@@ -446,7 +444,7 @@ Send_reg::stop_clk( void )
 
 	if ( !m_log_pkts )
 	{
-		// ToDo - add DCC packet control
+		CloseTrack( TR_TESTER );
 	}
 	else
 	{
@@ -460,6 +458,276 @@ Send_reg::stop_clk( void )
 }
 #endif
 
+
+/*--------------------------------------------------------------------------*/
+/*
+ *	NAME
+ *
+ *		start_seq()							-	 Start unsplittable sequence.
+ *
+ *	RETURN VALUE
+ *
+ *		OK		-	Sucess.
+ *		FAIL	-	Timed out waiting for the track.
+ *
+ *	DESCRIPTION
+ *
+ *		start_seq() keeps the track for the tester until end_seq().
+ *		The command station shares the track at packet boundaries, a
+ *		packet sent in pieces (stretched or ambiguous bits) or a preset
+ *		and trigger sent back to back must not have its packets
+ *		interleaved.  Until end_seq() the send_raw_...() bits are added
+ *		to one pattern without a preamble or packet framing of their own,
+ *		the other calls send the same packets they do outside a sequence,
+ *		after the raw bits sent before them.
+ */
+/*--------------------------------------------------------------------------*/
+
+Rslt_t
+Send_reg::start_seq( void )
+{
+	const char		*my_name = "Send_reg::start_seq";
+
+	if ( m_log_pkts )
+	{
+		TO_PKT_LOG( "!%s() Sequence started.\n", my_name );
+	}
+#if SEND_VERSION >= 4
+	else if ( EnterTrackCritical( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+	{
+		ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+		return ( FAIL );
+	}
+	else
+	{
+		m_in_seq	=	true;
+		m_seq_err	=	false;
+		m_seq_cnt	=	0;
+	}
+#endif
+
+	return ( OK );
+}
+
+
+/*--------------------------------------------------------------------------*/
+/*
+ *	NAME
+ *
+ *		end_seq()							-	 End unsplittable sequence.
+ *
+ *	RETURN VALUE
+ *
+ *		OK		-	Sucess.
+ *		FAIL	-	Part of the sequence was not sent.
+ *
+ *	DESCRIPTION
+ *
+ *		end_seq() sends what is left of the sequence pattern and lets
+ *		the command station back onto the track.
+ */
+/*--------------------------------------------------------------------------*/
+
+Rslt_t
+Send_reg::end_seq( void )
+{
+	const char		*my_name = "Send_reg::end_seq";
+	Rslt_t			rslt	=	OK;
+
+	if ( m_log_pkts )
+	{
+		TO_PKT_LOG( "!%s() Sequence ended.\n", my_name );
+	}
+#if SEND_VERSION >= 4
+	else
+	{
+		if ( m_seq_err || seq_flush() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Sequence not sent in one piece" );
+			rslt	=	FAIL;
+		}
+		m_in_seq	=	false;
+		m_seq_cnt	=	0;
+		ExitTrackCritical( TR_TESTER );
+	}
+#endif
+
+	return ( rslt );
+}
+
+
+#if SEND_VERSION >= 4
+/*--------------------------------------------------------------------------*/
+/*
+ *	NAME
+ *
+ *		seq_bits()							-	 Add bits to sequence.
+ *
+ *	RETURN VALUE
+ *
+ *		OK		-	Sucess.
+ *		FAIL	-	The full pattern could not be queued.
+ *
+ *	DESCRIPTION
+ *
+ *		seq_bits() adds 'icnt' bits of the same timing (in ticks) to the
+ *		sequence pattern, merged into the last entry when the timing
+ *		matches.  A full pattern is queued and a new one started, the
+ *		track is held so the patterns play back to back.
+ */
+/*--------------------------------------------------------------------------*/
+
+Rslt_t
+Send_reg::seq_bits(
+	u_short			iperiod,				// Bit period in ticks.
+	u_short			ipulse,					// First half in ticks.
+	u_int			icnt )					// Bits to add.
+{
+	PACKET_BITS		*last;					// Last entry of the pattern.
+	u_int			run;					// Bits merged into it.
+
+	while ( icnt > 0 )
+	{
+		if ( m_seq_err )
+		{
+			return ( FAIL );
+		}
+
+		last	=	m_seq_cnt > 0 ? &m_seq[m_seq_cnt - 1] : NULL;
+		if ( last != NULL && last->period == iperiod &&
+			 last->pulse == ipulse && last->count < SEQ_MAX_RUN )
+		{
+			run	=	SEQ_MAX_RUN - last->count;
+			if ( run > icnt )
+			{
+				run	=	icnt;
+			}
+			last->count	+=	run;
+			icnt		-=	run;
+		}
+		else if ( m_seq_cnt < SEQ_SIZE )
+		{
+			m_seq[m_seq_cnt].period	=	iperiod;
+			m_seq[m_seq_cnt].pulse	=	ipulse;
+			m_seq[m_seq_cnt].count	=	0;
+			++m_seq_cnt;
+			--icnt;
+		}
+		else if ( seq_flush() != OK )
+		{
+			return ( FAIL );
+		}
+	}
+
+	return ( OK );
+}
+
+
+/*--------------------------------------------------------------------------*/
+/*
+ *	NAME
+ *
+ *		seq_byte()							-	 Add BYTE to sequence.
+ *
+ *	RETURN VALUE
+ *
+ *		OK		-	Sucess.
+ *		FAIL	-	The full pattern could not be queued.
+ *
+ *	DESCRIPTION
+ *
+ *		seq_byte() adds the bits of 'ibyte' to the sequence pattern, most
+ *		significant first the way the sender board shifts them out,
+ *		skipping the first 'ifirst' bits.
+ */
+/*--------------------------------------------------------------------------*/
+
+Rslt_t
+Send_reg::seq_byte(
+	BYTE			ibyte,					// Byte to add.
+	u_int			ifirst )				// Bits already sent.
+{
+	u_int			bit;					// Bit position.
+
+	if ( m_swap_0_1 )
+	{
+		ibyte	=	~ibyte;
+	}
+
+	for ( bit = ifirst; bit < BITS_IN_BYTE; ++bit )
+	{
+		if ( ibyte & (0x80 >> bit) )
+		{
+			if ( seq_bits( clk1t * TICKS_PER_MICROSECOND,
+						   clk1t * TICKS_PER_MICROSECOND / 2, 1 ) != OK )
+			{
+				return ( FAIL );
+			}
+		}
+		else if ( seq_bits( clk0t * TICKS_PER_MICROSECOND,
+							clk0h * TICKS_PER_MICROSECOND, 1 ) != OK )
+		{
+			return ( FAIL );
+		}
+	}
+
+	return ( OK );
+}
+
+
+/*--------------------------------------------------------------------------*/
+/*
+ *	NAME
+ *
+ *		seq_flush()							-	 Queue sequence pattern.
+ *
+ *	RETURN VALUE
+ *
+ *		OK		-	Sucess, or nothing to queue.
+ *		FAIL	-	Timed out or no track packet.
+ *
+ *	DESCRIPTION
+ *
+ *		seq_flush() queues the sequence pattern built so far as it is,
+ *		and starts a new one.  A failure drops the rest of the sequence.
+ */
+/*--------------------------------------------------------------------------*/
+
+Rslt_t
+Send_reg::seq_flush( void )
+{
+	const char		*my_name = "Send_reg::seq_flush";
+
+	if ( m_seq_err )
+	{
+		return ( FAIL );
+	}
+
+	if ( m_seq_cnt == 0 )
+	{
+		return ( OK );
+	}
+
+	if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+	{
+		ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+		m_seq_err	=	true;
+		return ( FAIL );
+	}
+
+	if ( BuildPacketBits( m_seq, m_seq_cnt ) != 0 )
+	{
+		ERRPRINT( my_name, LOG_ERR, "%u pattern entries not queued", m_seq_cnt );
+		ReleaseTrackTurn( TR_TESTER );
+		m_seq_err	=	true;
+		return ( FAIL );
+	}
+
+	m_seq_cnt	=	0;
+	return ( OK );
+}
+#endif
+
 /*--------------------------------------------------------------------------*/
 /*
  *	NAME
@@ -609,7 +877,11 @@ Send_reg::set_clk(
 #if SEND_VERSION >= 4
 	// kk added
 	// rebuild the idle packet with the new times
-	//BuildIdlePacket(18);
+	if ( SetIdleClocks( clk1t, clk0t, clk0h ) != 0 )
+	{
+		ERRPRINT( my_name, LOG_WARNING,	"SetIdleClocks() FAILED, idle packet not changed" );
+	}
+	start_clk();
 	send_idle();
 #else
 	start_clk();
@@ -645,7 +917,7 @@ Send_reg::set_clk(
 /*
  *	NAME
  *
- *		send_bytes()						-	 Send byte repeatedly.
+ *		put_bytes()							-	 Send byte repeatedly.
  *
  *	RETURN VALUE
  *
@@ -654,19 +926,23 @@ Send_reg::set_clk(
  *
  *	DESCRIPTION
  *
- *		send_bytes() sends 'ibyte' 'icnt' times.  It returns FAIL if the
+ *		put_bytes() sends 'ibyte' 'icnt' times.  It returns FAIL if the
  *		INTRA line does not go inactive in a reasonable length of time or
- *		if the underflow flag gets set.
+ *		if the underflow flag gets set.  send_bytes() sends the bytes as
+ *		a packet of their own, preamble and framing included,
+ *		send_raw_bytes() ('iraw' true) adds the bits to the sequence as
+ *		they are.
  */
 /*--------------------------------------------------------------------------*/
 
 Rslt_t
-Send_reg::send_bytes(
+Send_reg::put_bytes(
 	u_int			icnt,					// Bytes to send.
 	BYTE			ibyte,					// Byte to repeat.
-	const char		*info )					// Packet log info.
+	const char		*info,					// Packet log info.
+	bool			iraw )					// true for raw sequence bits.
 {
-	const char* my_name = "Send_reg::send_bytes";
+	const char* my_name = "Send_reg::put_bytes";
 	register u_int	count;			// Count of BYTES sent.
 	register u_long	san_cnt;		// Sanity timeout.
 
@@ -682,7 +958,40 @@ Send_reg::send_bytes(
 
 #if SEND_VERSION >= 4
 
-		BuildPacketBytes(ibyte, icnt, clk1t, clk0t, clk0h);
+		if ( iraw )
+		{
+			if ( !m_in_seq )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Raw bytes are only sent in a sequence" );
+				return ( FAIL );
+			}
+			for ( count = 0; count < icnt; ++count )
+			{
+				if ( seq_byte( ibyte, 0 ) != OK )
+				{
+					ERRPRINT( my_name, LOG_ERR, "Sequence dropped after %u bytes", count );
+					return ( FAIL );
+				}
+			}
+		}
+		// raw bits of a sequence go out first
+		else if ( m_in_seq && seq_flush() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Sequence not sent" );
+			return ( FAIL );
+		}
+		else if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+			return ( FAIL );
+		}
+		// the count is a byte, a longer run must not wrap to a short one
+		else if ( icnt > 0xff || BuildPacketBytes(ibyte, icnt, clk1t, clk0t, clk0h) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "%u bytes do not fit a track packet", icnt );
+			ReleaseTrackTurn( TR_TESTER );
+			return ( FAIL );
+		}
 
 #else
 		start_crit();
@@ -757,7 +1066,7 @@ Send_reg::send_bytes(
 /*
  *	NAME
  *
- *		send_stretched_byte()				-	 Send stretched Byte.
+ *		put_stretched_byte()				-	 Send stretched Byte.
  *
  *	RETURN VALUE
  *
@@ -770,18 +1079,20 @@ Send_reg::send_bytes(
  *		This routine is designed to stretch the interbyte 0 immediately
  *		following the preamble bits by loading clock values 'iclk0t' and
  *		'iclk0h' for the duration of the first 0 bit in 'ibyte'.
- *		It returns FAIL if a problem occurs.
+ *		It returns FAIL if a problem occurs.  'iraw' is true for
+ *		send_raw_stretched_byte(), see put_bytes().
  */
 /*--------------------------------------------------------------------------*/
 
 Rslt_t
-Send_reg::send_stretched_byte(
+Send_reg::put_stretched_byte(
 	u_short			iclk0t,					// Stretched 0T duration in usec.
 	u_short			iclk0h,					// Stretched 0H duration in usec.
 	BYTE			ibyte,					// Byte to send.
-	const char		*info )					// Packet log info.
+	const char		*info,					// Packet log info.
+	bool			iraw )					// true for raw sequence bits.
 {
-	const char		*my_name = "Send_reg::send_stretched_byte";
+	const char		*my_name = "Send_reg::put_stretched_byte";
 	register u_long	san_cnt;		   		// Sanity timeout.
 	u_short			tclk0t;					// clk0t for stretched 0.
 
@@ -827,7 +1138,36 @@ Send_reg::send_stretched_byte(
 
 #if SEND_VERSION >= 4
 
-		BuildPacketBytes(ibyte, 1, 0, tclk0t, iclk0h);
+		if ( iraw )
+		{
+			if ( !m_in_seq )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Raw bytes are only sent in a sequence" );
+				return ( FAIL );
+			}
+			if ( seq_bits( tclk0t * TICKS_PER_MICROSECOND, iclk0h * TICKS_PER_MICROSECOND, 1 ) != OK ||
+				 seq_byte( ibyte, 1 ) != OK )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Stretched byte not queued" );
+				return ( FAIL );
+			}
+		}
+		else if ( m_in_seq && seq_flush() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Sequence not sent" );
+			return ( FAIL );
+		}
+		else if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+			return ( FAIL );
+		}
+		else if ( BuildPacketBytes(ibyte, 1, clk1t, tclk0t, iclk0h) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Stretched byte not queued" );
+			ReleaseTrackTurn( TR_TESTER );
+			return ( FAIL );
+		}
 
 #else
 		if ( inportb( PA ) != 0xff )
@@ -1009,7 +1349,7 @@ Send_reg::send_stretched_byte(
 /*
  *	NAME
  *
- *		send_1_ambig_bit()				-	 Send ambiguous bit.
+ *		put_1_ambig_bit()				-	 Send ambiguous bit.
  *
  *	RETURN VALUE
  *
@@ -1018,22 +1358,24 @@ Send_reg::send_stretched_byte(
  *
  *	DESCRIPTION
  *
- *		send_1_ambig_bit() sends 'ibyte' with a stretched 0.
+ *		put_1_ambig_bit() sends 'ibyte' with a stretched 0.
  *		This routine is designed to provide an ambiguous sized 0 bit.  It does
  *		this by loading clock values 'iclk0t' and 'iclk0h' for the duration
  *		of the 0 bit in 'ibyte'.
- *		It returns FAIL if a problem occurs.
+ *		It returns FAIL if a problem occurs.  'iraw' is true for
+ *		send_raw_1_ambig_bit(), see put_bytes().
  */
 /*--------------------------------------------------------------------------*/
 
 Rslt_t
-Send_reg::send_1_ambig_bit(
+Send_reg::put_1_ambig_bit(
 	u_short			iclk0t,					// Stretched 0T in usec.
 	u_short			iclk0h,					// Stretched 0H in usec.
 	BYTE			ibyte,					// Byte to send.
-	const char		*info )					// Packet log info.
+	const char		*info,					// Packet log info.
+	bool			iraw )					// true for raw sequence bits.
 {
-	const char		*my_name = "Send_reg::send_1_ambig_bit";
+	const char		*my_name = "Send_reg::put_1_ambig_bit";
 	register		u_long	san_cnt;		// Sanity timeout.
 
 	if ( ibyte & 0x80 )
@@ -1080,7 +1422,36 @@ Send_reg::send_1_ambig_bit(
 	{
 #if SEND_VERSION >= 4
 
-		BuildPacketAmbig1(ibyte, clk1t, iclk0t, iclk0h, clk0t, clk0h);
+		if ( iraw )
+		{
+			if ( !m_in_seq )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Raw bytes are only sent in a sequence" );
+				return ( FAIL );
+			}
+			if ( seq_bits( iclk0t * TICKS_PER_MICROSECOND, iclk0h * TICKS_PER_MICROSECOND, 1 ) != OK ||
+				 seq_byte( ibyte, 1 ) != OK )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Ambiguous bit not queued" );
+				return ( FAIL );
+			}
+		}
+		else if ( m_in_seq && seq_flush() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Sequence not sent" );
+			return ( FAIL );
+		}
+		else if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+			return ( FAIL );
+		}
+		else if ( BuildPacketAmbig1(ibyte, clk1t, iclk0t, iclk0h, clk0t, clk0h) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Ambiguous bit not queued" );
+			ReleaseTrackTurn( TR_TESTER );
+			return ( FAIL );
+		}
 
 #else
 		start_crit();
@@ -1289,7 +1660,7 @@ Send_reg::send_1_ambig_bit(
 /*
  *	NAME
  *
- *		send_2_ambig_bits()				-	 Send 2 ambiguous bits.
+ *		put_2_ambig_bits()				-	 Send 2 ambiguous bits.
  *
  *	RETURN VALUE
  *
@@ -1298,27 +1669,29 @@ Send_reg::send_1_ambig_bit(
  *
  *	DESCRIPTION
  *
- *		send_2_ambig_bits() sends 'ibyte' with a stretched first 0 and a
+ *		put_2_ambig_bits() sends 'ibyte' with a stretched first 0 and a
  *		different stretched second 0.  This routine is designed to provide
  *		sized 0 bits immediately after the stop bit to test proper operation
  *		with advanced feedback that occurs immedicately after the packet end
  *		bit.  It does this by loading clock values 'iclk0t1' and
  *		'iclk0h1' for the duration of the first 0 bit in 'ibyte' and loads
  *		'iclkoh2' and 'iclk0t2' for the second 0 bit in 'ibyte'.
- *		It returns FAIL if a problem occurs.
+ *		It returns FAIL if a problem occurs.  'iraw' is true for
+ *		send_raw_2_ambig_bits(), see put_bytes().
  */
 /*--------------------------------------------------------------------------*/
 
 Rslt_t
-Send_reg::send_2_ambig_bits(
+Send_reg::put_2_ambig_bits(
 	u_short			iclk0t1,				// 1st stretched 0T in usec.
 	u_short			iclk0h1,				// 1st stretched 0H in usec.
 	u_short			iclk0t2,				// 2nd stretched 0T in usec.
 	u_short			iclk0h2,				// 2nd stretched 0H in usec.
 	BYTE			ibyte,					// Byte to send.
-	const char		*info )					// Packet log info.
+	const char		*info,					// Packet log info.
+	bool			iraw )					// true for raw sequence bits.
 {
-	const char		*my_name = "Send_reg::send_2_ambig_bits";
+	const char		*my_name = "Send_reg::put_2_ambig_bits";
 	register		u_long	san_cnt;	 	// Sanity timeout.
 
 	if ( ibyte & 0xC0 )
@@ -1340,12 +1713,12 @@ Send_reg::send_2_ambig_bits(
 
 	if ( iclk0t2 ==  DCC_CLK_HOLD )
 	{
-		iclk0t1	=	clk0t;
+		iclk0t2	=	clk0t;
 	}
 
 	if ( iclk0h2 == DCC_CLK_HOLD )
 	{
-		iclk0h1	=	clk0h;
+		iclk0h2	=	clk0h;
 	}
 
 	if ( iclk0t1 < AMBIG_0T_MIN )
@@ -1391,8 +1764,37 @@ Send_reg::send_2_ambig_bits(
 	{
 #if SEND_VERSION >= 4
 
-		//BuildPacketAmbig2(ibyte, clk1t, iclk0t1, iclk0h1,	iclk0t2, iclk0h2);
-		//void BuildPacketAmbig2(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t2, uint16_t clk0h2, uint16_t clk0t, uint16_t clk0h)
+		if ( iraw )
+		{
+			if ( !m_in_seq )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Raw bytes are only sent in a sequence" );
+				return ( FAIL );
+			}
+			if ( seq_bits( iclk0t1 * TICKS_PER_MICROSECOND, iclk0h1 * TICKS_PER_MICROSECOND, 1 ) != OK ||
+				 seq_bits( iclk0t2 * TICKS_PER_MICROSECOND, iclk0h2 * TICKS_PER_MICROSECOND, 1 ) != OK ||
+				 seq_byte( ibyte, 2 ) != OK )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Ambiguous bits not queued" );
+				return ( FAIL );
+			}
+		}
+		else if ( m_in_seq && seq_flush() != OK )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Sequence not sent" );
+			return ( FAIL );
+		}
+		else if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+			return ( FAIL );
+		}
+		else if ( BuildPacketAmbig2(ibyte, clk1t, iclk0t1, iclk0h1, iclk0t2, iclk0h2, clk0t, clk0h) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Ambiguous bits not queued" );
+			ReleaseTrackTurn( TR_TESTER );
+			return ( FAIL );
+		}
 
 #else
 		start_crit();
@@ -1690,7 +2092,25 @@ Send_reg::send_pkt(
 	{
 #if SEND_VERSION >= 4
 
-		BuildPacket(ibytes, isize, clk1t, clk0t, clk0h);
+		// the bytes of a sequence go out first
+		if ( m_in_seq && seq_flush() != OK )
+		{
+			return ( FAIL );
+		}
+
+		if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+			return ( FAIL );
+		}
+
+		/* The array is the raw bit stream, preamble included */
+		if ( BuildPacketStream( ibytes, isize * BITS_IN_BYTE, m_swap_0_1, clk1t, clk0t, clk0h ) != 0 )
+		{
+			ERRPRINT( my_name, LOG_ERR, "%u bytes do not fit a track packet", isize );
+			ReleaseTrackTurn( TR_TESTER );
+			return ( FAIL );
+		}
 
 #else
 		/* Send first BYTE, then activate underflow warning */
@@ -1789,8 +2209,9 @@ Rslt_t Send_reg::send_pkt(Bits &ibits, const char *info )					// Packet log info
 	#if SEND_VERSION < 4
 		register u_long	san_cnt;	   		// Sanity timeout.
 	#endif
-	BYTE			pbyte;					// Present BYTE.
-	uint8_t PacketBuf[10];
+	#if SEND_VERSION < 4
+		BYTE		pbyte;					// Present BYTE.
+	#endif
 
 	if ( ibits.get_obj_errs() )
 	{
@@ -1805,12 +2226,38 @@ Rslt_t Send_reg::send_pkt(Bits &ibits, const char *info )					// Packet log info
 
 	if ( !m_log_pkts )	// Skip hardware interraction if just logging.
 	{
-		for (	count = 0, ibits.rst_out();	ibits.get_byte( pbyte ) == OK; count++ )
-		{
-			PacketBuf[count] = pbyte;
-		}
 		#if SEND_VERSION >= 4
-			BuildPacket(PacketBuf, count, clk1t, clk0t, clk0h);
+			/*
+			 *	Encode the bits straight from the Bits array, so truncated
+			 *	packets, odd preambles and flipped bits go out as built.
+			 */
+			count = ibits.get_byte_size();
+			if ( ibits.get_bit_size() == 0 )
+			{
+				ERRPRINT( my_name, LOG_ERR,
+					"0 Bytes sent, b_cnt %lu, p_cnt %lu", b_cnt, p_cnt );
+				return ( FAIL );
+			}
+
+			// the bytes of a sequence go out first
+			if ( m_in_seq && seq_flush() != OK )
+			{
+				return ( FAIL );
+			}
+
+			if ( WaitForTrackTurn( TR_TESTER, SLOT_TIMEOUT ) != 0 )
+			{
+				ERRPRINT( my_name, LOG_ERR, "Timed out waiting for a turn on the track" );
+				return ( FAIL );
+			}
+
+			if ( BuildPacketStream( ibits.get_byte_array(), ibits.get_bit_size(), m_swap_0_1,
+					clk1t, clk0t, clk0h ) != 0 )
+			{
+				ERRPRINT( my_name, LOG_ERR, "%u bits do not fit a track packet", ibits.get_bit_size() );
+				ReleaseTrackTurn( TR_TESTER );
+				return ( FAIL );
+			}
 		#else
 			start_crit();
 			for (	count = 0, ibits.rst_out();
@@ -29,6 +29,16 @@
 #include <SR_CORE.h>
 #include "pds601.h"
 
+#if SEND_VERSION >= 4
+extern "C"
+{
+	#include "Track.h"
+};
+
+const u_int		SEQ_SIZE		= TRACK_PACKET_SIZE - 1;	// Sequence pattern entries.
+const u_int		SEQ_MAX_RUN		= 0xff;						// Repeats in one entry.
+#endif
+
 const u_short	DCC_CLK_HOLD	= 0;		// Hold present clock value.
 const u_short	DCC_CLK_ERR		= 1;		// Clock has an error.
 const u_short	DCC_CLK_MIN		= 10;		// Minimum valid clock value.
@@ -61,6 +71,11 @@ class Send_reg : public Sr_core
 		m_swap_0_1( false ), m_log_pkts( false )
 	{
 		rst_stats();
+#if SEND_VERSION >= 4
+		m_in_seq = false;
+		m_seq_err = false;
+		m_seq_cnt = 0;
+#endif
 	}
 
 	/* Simple get methods */
@@ -119,6 +134,8 @@ class Send_reg : public Sr_core
 	void	clr_err_cnt( void ) { err_cnt = 0; }
 	Rslt_t	start_clk( void );
 	Rslt_t	stop_clk( void );
+	Rslt_t	start_seq( void );
+	Rslt_t	end_seq( void );
 	Rslt_t	send_rst( void )
 	{ return ( send_pkt(rst_bytes,PKT_SIZE,"Reset") ); }
 	Rslt_t	send_hard_rst( void )
@@ -127,17 +144,43 @@ class Send_reg : public Sr_core
 	{ return ( send_pkt(idle_bytes,PKT_SIZE,"Idle") ); }
 	Rslt_t	send_base( void )
 	{ return ( send_pkt(base_bytes,PKT_SIZE,"Baseline") ); }
-	Rslt_t	send_bytes( u_int icnt, BYTE ibyte, const char *info );
+	Rslt_t	send_bytes( u_int icnt, BYTE ibyte, const char *info )
+	{ return ( put_bytes(icnt,ibyte,info,false) ); }
 	Rslt_t	send_stretched_byte(
 									u_short iclk0t, u_short iclk0h,
-									BYTE ibyte, const char *into );
+									BYTE ibyte, const char *info )
+	{ return ( put_stretched_byte(iclk0t,iclk0h,ibyte,info,false) ); }
 	Rslt_t	send_1_ambig_bit(
 									u_short iclk0t, u_short iclk0h,
-									BYTE ibyte, const char *into );
+									BYTE ibyte, const char *info )
+	{ return ( put_1_ambig_bit(iclk0t,iclk0h,ibyte,info,false) ); }
 	Rslt_t	send_2_ambig_bits(
 									u_short iclk0t1, u_short iclk0h1,
 									u_short iclk0t2, u_short iclk0h2,
-									BYTE ibyte, const char *into );
+									BYTE ibyte, const char *info )
+	{ return ( put_2_ambig_bits(iclk0t1,iclk0h1,iclk0t2,iclk0h2,ibyte,info,false) ); }
+
+	/*
+	 *	Raw versions, the bits go out as the sender board shifted them,
+	 *	most significant first with no preamble or packet framing.  They
+	 *	are only sent between start_seq() and end_seq().
+	 */
+	Rslt_t	send_raw_bytes( u_int icnt, BYTE ibyte, const char *info )
+	{ return ( put_bytes(icnt,ibyte,info,true) ); }
+	Rslt_t	send_raw_stretched_byte(
+									u_short iclk0t, u_short iclk0h,
+									BYTE ibyte, const char *info )
+	{ return ( put_stretched_byte(iclk0t,iclk0h,ibyte,info,true) ); }
+	Rslt_t	send_raw_1_ambig_bit(
+									u_short iclk0t, u_short iclk0h,
+									BYTE ibyte, const char *info )
+	{ return ( put_1_ambig_bit(iclk0t,iclk0h,ibyte,info,true) ); }
+	Rslt_t	send_raw_2_ambig_bits(
+									u_short iclk0t1, u_short iclk0h1,
+									u_short iclk0t2, u_short iclk0h2,
+									BYTE ibyte, const char *info )
+	{ return ( put_2_ambig_bits(iclk0t1,iclk0h1,iclk0t2,iclk0h2,ibyte,info,true) ); }
+
 	Rslt_t	send_pkt( Bits &ibits, const char *info );
 	Rslt_t	send_pkt(	const BYTE *ibytes, u_int isize,
 						const char *info );
@@ -181,6 +224,12 @@ class Send_reg : public Sr_core
 	u_int				m_pc_delay_1usec;	   	// Loop count for 1 usec. delay.
 	bool				m_swap_0_1;				// Swap 0 & 1 if true.
 	bool				m_log_pkts;				// true to log pkts.
+#if SEND_VERSION >= 4
+	bool				m_in_seq;				// true between start_seq() and end_seq().
+	bool				m_seq_err;				// Sequence did not fit.
+	u_int				m_seq_cnt;				// Entries in m_seq.
+	PACKET_BITS			m_seq[SEQ_SIZE];		// Raw bits of the sequence.
+#endif
 
 	/* Method section */
 	void
@@ -200,6 +249,24 @@ class Send_reg : public Sr_core
 	u_int	pc_delay_low( register u_int idelay );
 
 	void	print_pkt_log( const BYTE *ibytes, u_int isize );
+
+	Rslt_t	put_bytes( u_int icnt, BYTE ibyte, const char *info, bool iraw );
+	Rslt_t	put_stretched_byte(
+									u_short iclk0t, u_short iclk0h,
+									BYTE ibyte, const char *info, bool iraw );
+	Rslt_t	put_1_ambig_bit(
+									u_short iclk0t, u_short iclk0h,
+									BYTE ibyte, const char *info, bool iraw );
+	Rslt_t	put_2_ambig_bits(
+									u_short iclk0t1, u_short iclk0h1,
+									u_short iclk0t2, u_short iclk0h2,
+									BYTE ibyte, const char *info, bool iraw );
+
+#if SEND_VERSION >= 4
+	Rslt_t	seq_bits( u_short iperiod, u_short ipulse, u_int icnt );
+	Rslt_t	seq_byte( BYTE ibyte, u_int ifirst );
+	Rslt_t	seq_flush( void );
+#endif
 };
 
 #endif /* SEND_REG_H_DECLARED */
@@ -117,6 +117,7 @@ CMD_RETURN ShCursor(uint8_t bPort, int argc, char *argv[]);
 CMD_RETURN ShTextColor(uint8_t bPort, int argc, char *argv[]);
 
 CMD_RETURN ShTasks(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShIsrStats(uint8_t bPort, int argc, char *argv[]);
 
 CMD_RETURN ShTcp(uint8_t bPort, int argc, char *argv[]);
 
@@ -187,6 +188,7 @@ const SHELL_TABLE ShellTable[] =
 
 	{"args",     0x00,	SUPPRESS_HELP, 					ShArgs,				"List arguments"},
 	{"tasks",   0x00,	NO_FLAGS, 						ShTasks,			"Task List"},
+	{"isrstat", 0x00,	NO_FLAGS, 						ShIsrStats,			"Track interrupt latency in cycles [prog] [clear]"},
 //	{"tcp",   	0x00,	NO_FLAGS, 						ShTcp,				"TCP/IP Info"},
 
 	// command station
@@ -196,8 +198,19 @@ const SHELL_TABLE ShellTable[] =
 	{"status",  0x00,	SUPPRESS_HELP, 					ShSystemStatus,		""},
 	{"train", 	0x00,	NO_FLAGS, 						ShSetLoco,			"<address> [[[[<speed>] <direction 0/1>] <function1>] <function2>]"},
 	{"disp",	0x00,	NO_FLAGS,						ShCabDisplay,		"<cab> ""Massage"""},
-	{"write",	0x00,	NO_FLAGS,						ShProgTrackWriteCV,	"CV, Value"},
-	{"read",	0x00,	NO_FLAGS,						ShProgTrackReadCV,	"CV"},
+	{"write",	0x00,	NO_FLAGS,						ShProgTrackWriteCV,	"<cv> <value>"},
+	{"read",	0x00,	NO_FLAGS,						ShProgTrackReadCV,	"<cv> [<count>] | stop | stats [clear]"},
+	{"snap",	0x00,	NO_FLAGS,						ShSnapshot,			"Decoder snapshot [full|show|export <file>|diff [<file>]]"},
+	{"trackstat",0x00,	NO_FLAGS,						ShTrackStats,		"Track packet encoder statistics [prog] [clear]"},
+	{"trackshare",0x00,	NO_FLAGS,						ShTrackShare,		"Track shares [tester|cs|shell <share> <priority>]"},
+	{"trip",	0x00,	NO_FLAGS,						ShTrip,				"Over-current trips [clear|reset|<threshold> <retries> <backoff ms> <max backoff ms>]"},
+	{"ack",	0x00,	NO_FLAGS,						ShAck,				"Programming track ACK detector [clear]"},
+	{"rec",	0x00,	NO_FLAGS,						ShRecord,			"Programming track current recorder [dump <file> [csv]|hold|clear|trigger]"},
+	{"latency",0x00,	NO_FLAGS,						ShLatency,			"Decoder response latency per decoder and test [clear|off|speed <address> <speed>]"},
+	{"csstat",	0x00,	NO_FLAGS,						ShCsStats,			"Command station task wakeups, load and event queue [clear]"},
+	{"sched",	0x00,	NO_FLAGS,						ShSchedule,			"Main track use and refresh interval per address [clear]"},
+	{"locostore",0x00,	NO_FLAGS,						ShLocoStore,		"Loco roster journal on the SD card [flush|compact]"},
+	{"cabpoll",	0x00,	NO_FLAGS,						ShCabPoll,			"NCE cab bus poll cycle and answer time per cab [clear]"},
 
 
 //	{"test",   	0x00,	NO_FLAGS, 						ShTestBits,			"DCC Bit Test"},
@@ -1194,6 +1207,97 @@ CMD_RETURN ShTasks(uint8_t bPort, int argc, char *argv[])
 	return CMD_OK;
 }
 
+/*********************************************************************
+*
+* ShIsrStats
+*
+* @brief	Show the track interrupt latency and run time statistics,
+*			isrstat prog shows the programming track
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShIsrStats(uint8_t bPort, int argc, char *argv[])
+{
+	static const uint16_t awPerMille[] = { 500, 900, 990, 999 };
+	static char* const aszPercent[] = { "50%", "90%", "99%", "99.9%" };
+	ISR_STATS Stats;
+	const char* pName;
+	TRACK_CHANNEL tc = TC_MAIN;
+	int arg = 1;
+
+	// optional track output, then optional clear
+	if(argc > arg && strcmp(argv[arg], "prog") == 0)
+	{
+		tc = TC_PROG;
+		arg++;
+	}
+
+	if(argc == arg + 1)
+	{
+		if(strcmp(argv[arg], "clear") == 0)
+		{
+			ClearChannelIsrStats(tc);
+			return CMD_OK;
+		}
+		return CMD_BAD_PARAMS;
+	}
+	else if(argc > arg + 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	if(GetChannelIsrStats(tc, &Stats) != 0)
+	{
+		ShNL(bPort);
+		ShFieldOut(bPort, "Not measured in this build", 0);
+		ShNL(bPort);
+		return CMD_OK;
+	}
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Cycles", 10);
+	ShFieldOut(bPort, "Latency", 10);
+	ShFieldOut(bPort, "Duration", 10);
+	ShNL(bPort);
+
+	ShFieldOut(bPort, "min", 10);
+	ShFieldNumberOut(bPort, "", Stats.latency.min, 10);
+	ShFieldNumberOut(bPort, "", Stats.duration.min, 10);
+	ShNL(bPort);
+
+	for(int i = 0; i < sizeof(awPerMille) / sizeof(awPerMille[0]); i++)
+	{
+		ShFieldOut(bPort, aszPercent[i], 10);
+		ShFieldNumberOut(bPort, "", StatsHistPercentile(&Stats.latency, ISR_STATS_BUCKET_SHIFT, awPerMille[i]), 10);
+		ShFieldNumberOut(bPort, "", StatsHistPercentile(&Stats.duration, ISR_STATS_BUCKET_SHIFT, awPerMille[i]), 10);
+		ShNL(bPort);
+	}
+
+	ShFieldOut(bPort, "max", 10);
+	ShFieldNumberOut(bPort, "", Stats.latency.max, 10);
+	ShFieldNumberOut(bPort, "", Stats.duration.max, 10);
+	ShNL(bPort);
+
+	ShFieldNumberOut(bPort, "Samples: ", Stats.latency.count, 0);
+	ShNL(bPort);
+
+	// worst case since reset
+	pName = Stats.worst_task ? osThreadGetName(Stats.worst_task) : NULL;
+	ShFieldNumberOut(bPort, "Worst:   ", Stats.worst_latency, 0);
+	ShFieldNumberOut(bPort, " latency ", Stats.worst_duration, 0);
+	ShFieldOut(bPort, " duration, task ", 0);
+	ShFieldOut(bPort, pName ? (char*)pName : "-", 0);
+	ShNL(bPort);
+
+	return CMD_OK;
+}
+
 #ifdef TAKE_OUT
 //extern uint8_t IP_ADDRESS[4];
 //extern uint8_t NETMASK_ADDRESS[4];
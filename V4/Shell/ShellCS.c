@@ -19,17 +19,31 @@
 #include "Text.h"
 //#include "TrackProg.h"
 #include "Service.h"
+#include "Snapshot.h"
+#include "Acknowledge.h"
+#include "Recorder.h"
+#include "Latency.h"
+#include "Packet.h"
+#include "CS.h"
 #include "GetLine.h"
 
 //*******************************************************************************
 // Definitions
 //*******************************************************************************
 
+// largest long address, and speed in the units of the 128 step packet
+#define SH_MAX_ADDRESS		10239
+#define SH_MAX_SPEED_128	252
+
+// os ticks the packet command waits for each main track turn
+#define SH_TURN_TIMEOUT		1000
+
 //*******************************************************************************
 // Static Variables
 //*******************************************************************************
 
-static PACKET_BITS apShellPacket[80];
+static PACKET_BITS apShellPacket[TRACK_PACKET_SIZE];
+static uint8_t ShellPacketEntries;
 
 //*******************************************************************************
 // Global Variables
@@ -45,6 +59,61 @@ extern Loco ActiveLocos[];
 // Source
 //*******************************************************************************
 
+/*********************************************************************
+*
+* SendShellPacket
+*
+* @brief	Queue the shell packet on the main track 'count' times. The
+*			shell waits for its own turn and a free slot before each
+*			packet, like the tester and the command station.
+*
+* @param	bPort - port that issued the command
+*			count - number of times to send the packet
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+static CMD_RETURN SendShellPacket(uint8_t bPort, uint32_t count)
+{
+	CMD_RETURN ret = CMD_OK;
+	uint32_t sent = 0;
+
+	if(OpenTrack(TR_SHELL, TI_NONE, 0) != TL_ASSIGNED)
+	{
+		ShFieldOut(bPort, "Track locked.\r\n", 0);
+		return CMD_FAILED;
+	}
+
+	while(sent < count)
+	{
+		if(WaitForTrackTurn(TR_SHELL, SH_TURN_TIMEOUT) != 0)
+		{
+			ShFieldOut(bPort, "Track busy, ", 0);
+			ret = CMD_FAILED;
+			break;
+		}
+		if(BuildPacketBits(apShellPacket, ShellPacketEntries) != 0)
+		{
+			ReleaseTrackTurn(TR_SHELL);
+			ShFieldOut(bPort, "Packet ring full, ", 0);
+			ret = CMD_FAILED;
+			break;
+		}
+		sent++;
+	}
+
+	CloseTrack(TR_SHELL);
+
+	if(ret != CMD_OK)
+	{
+		ShFieldNumberOut(bPort, "sent ", sent, 0);
+		ShFieldNumberOut(bPort, " of ", count, 0);
+		ShNL(bPort);
+	}
+	return ret;
+}
+
+
 /*********************************************************************
 *
 * ShCabStat
@@ -61,11 +130,10 @@ extern Loco ActiveLocos[];
 *********************************************************************/
 CMD_RETURN ShCabStat(uint8_t bPort, int argc, char *argv[])
 {
+	static char* apLabels[] = { "Absent Cabs:", "Seen Cabs:", "Active Cabs:" };
+	NCE_CAB_STATS Cab;
 	int i;
-	int j;
-	int index;
-	//char CabBuf[64];
-	char LabelBuf[64];
+	int state;
 	//int cab;
 
 	if(argc == 2)
@@ -77,50 +145,18 @@ CMD_RETURN ShCabStat(uint8_t bPort, int argc, char *argv[])
 	else
 	{
 		ShNL(bPort);
-		strcpy(LabelBuf, "Active Cabs:");
-		for(i = 0; i < (MAX_CABS / 8); i++)
-		{
-			index = i * 8;
-			if(abCabActiveQueue[index])
-			{
-				ShFieldOut(bPort, LabelBuf, 16);
-				for(j = 0; j < 8; j++)
-				{
-					if(abCabActiveQueue[(i * 8) + j])
-					{
-						ShFieldNumberOut(bPort, "", abCabActiveQueue[(i * 8) + j], 3);
-					}
-				}
-				ShNL(bPort);
-				strcpy(LabelBuf, "");
-			}
-			else
-			{
-				break;
-			}
-		}
-
-		strcpy(LabelBuf, "Inactive Cabs:");
-		for(i = 0; i < (MAX_CABS / 8); i++)
+		for(state = CAB_STATE_ACTIVE; state >= CAB_STATE_ABSENT; state--)
 		{
-			index = i * 8;
-			if(abCabInactiveQueue[index])
+			ShFieldOut(bPort, apLabels[state], 16);
+			for(i = 1; i < MAX_CABS; i++)
 			{
-				ShFieldOut(bPort, LabelBuf, 16);
-				for(j = 0; j < 8; j++)
+				GetNCECabStats(i, &Cab);
+				if(Cab.state == state)
 				{
-					if(abCabInactiveQueue[(i * 8) + j])
-					{
-						ShFieldNumberOut(bPort, "", abCabInactiveQueue[(i * 8) + j], 3);
-					}
+					ShFieldNumberOut(bPort, "", i, 3);
 				}
-				ShNL(bPort);
-				strcpy(LabelBuf, "");
-			}
-			else
-			{
-				break;
 			}
+			ShNL(bPort);
 		}
 	}
 	return CMD_OK;
@@ -370,10 +406,9 @@ CMD_RETURN ShSendPacket(uint8_t bPort, int argc, char *argv[])
 
 	if(argc == 1)
 	{
-		if(apShellPacket[0].period != 0)
+		if(ShellPacketEntries != 0)
 		{
-			bc = atoi(argv[1]);
-			BuildPacketBits(apShellPacket, bc);
+			return SendShellPacket(bPort, 1);
 		}
 		else
 		{
@@ -402,7 +437,8 @@ CMD_RETURN ShSendPacket(uint8_t bPort, int argc, char *argv[])
 				preambles = atoi(&szTypeBuf[12]);
 				
 				i = 0;
-				while(1)
+				// the last entry is left for the terminator
+				while(i < TRACK_PACKET_SIZE - 1)
 				{
 					bc = getLine(&fp, szTypeBuf, sizeof(szTypeBuf));
 					if(bc == 0)
@@ -417,23 +453,25 @@ CMD_RETURN ShSendPacket(uint8_t bPort, int argc, char *argv[])
 					apShellPacket[i].pulse = atoi(pp);
 					pp = strsep(&pBuf, ",");
 					apShellPacket[i].count = atoi(pp);
+					if(apShellPacket[i].period == 0)
+					{
+						// the file's own terminator
+						break;
+					}
 					i++;
 				}
 				f_close(&fp);
+				ShellPacketEntries = i;
 
 				// add the terminator
 				apShellPacket[i].period = 0;
 				apShellPacket[i].pulse = 0;
 				apShellPacket[i].count = 0;
 				
-				if(argc == 3)
-				{
-					bc = atoi(argv[1]);
-					BuildPacketBits(apShellPacket, bc);
-				}
-				else
+				bc = argc == 3 ? atoi(argv[2]) : 1;
+				if(i != 0 && bc != 0)
 				{
-					BuildPacketBits(apShellPacket, 1);
+					return SendShellPacket(bPort, bc);
 				}
 			}
 			else
@@ -446,9 +484,9 @@ CMD_RETURN ShSendPacket(uint8_t bPort, int argc, char *argv[])
 			// if no file, try to convert arg to a number,
 			// if less than 100 send that many packets
 			bc = atoi(argv[1]);
-			if(apShellPacket[0].period != 0 && bc != 0 && bc <= 100)
+			if(ShellPacketEntries != 0 && bc != 0 && bc <= 100)
 			{
-				BuildPacketBits(apShellPacket, bc);
+				return SendShellPacket(bPort, bc);
 			}
 			else
 			{
@@ -515,69 +553,44 @@ CMD_RETURN ShSelectAccessory(uint8_t bPort, int argc, char *argv[])
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Set the speed, direction and functions of a loco, the
+*				loco is added if it is new
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
 CMD_RETURN ShSetLoco(uint8_t bPort, int argc, char *argv[])
 {
-    Loco* pLoco;
-    unsigned int nAddress;
-    word nSpeed;
-    uint8_t nDirection;
-    unsigned long nFunctionMap;
-    
-	if(argc >= 2)
+	LOCO_REQUEST Request;
+
+	if(argc < 2)
 	{
-		nAddress = atoi(argv[1]);
-		pLoco = FindLoco(nAddress);
-		//Loco* FindAlias(unsigned int nAddress);
-		//Loco* FindLeadLoco(unsigned int nAddress);
-		if(pLoco == NULL)
-		{
-			pLoco = NewLoco(nAddress);
-		}
+		return CMD_BAD_PARAMS;
+	}
 
-		if(pLoco != NULL)
-		{
-			if(argc >= 3)
-			{
-				nSpeed = atoi(argv[2]);
-				SetLocoSpeed(pLoco, nSpeed);
-			}
-			if(argc >= 4)
-			{
-				nDirection = atoi(argv[3]);
-				SetLocoDirection(pLoco, nDirection);
-			}
-#ifdef COMBINED_FUNCTIONS
-			if(argc >= 5)
-			{
-				nFunctionMap = atoi(argv[4]);
-				SetLocoFunctions1(pLoco, nFunctionMap);
-			}
-			if(argc >= 6)
-			{
-				nFunctionMap = atoi(argv[5]);
-				SetLocoFunctions2(pLoco, nFunctionMap);
-			}
-#endif
-			if(argc >= 5)
-			{
-				nFunctionMap = atoi(argv[4]);
-				SetLocoFunctions(pLoco, nFunctionMap);
-			}
-			//    SetLocoFunctions3(pLoco, nFunctionMap);
-		}
-		else
-		{
-			return CMD_FAILED;
-		}
+	// the command station task owns the locos and their refresh schedule,
+	// it makes the change
+	memset(&Request, 0, sizeof(Request));
+	Request.nAddress = atoi(argv[1]);
+	if(argc >= 3)
+	{
+		Request.nSpeed = atoi(argv[2]);
+		Request.bFields |= LOCO_SET_SPEED;
 	}
-	else
+	if(argc >= 4)
 	{
-		return CMD_BAD_PARAMS;
+		Request.nDirection = atoi(argv[3]);
+		Request.bFields |= LOCO_SET_DIRECTION;
+	}
+	if(argc >= 5)
+	{
+		Request.nFunctionMap = atoi(argv[4]);
+		Request.bFields |= LOCO_SET_FUNCTIONS;
+	}
+
+	if(!RequestLocoChange(&Request))
+	{
+		return CMD_FAILED;
 	}
 	return CMD_OK;
 }
@@ -606,62 +619,1183 @@ CMD_RETURN ShCabDisplay(uint8_t bPort, int argc, char *argv[])
 }
 
 
-void ServiceModeCallback(int status)
+/*********************************************************************
+*
+* ServiceModeCallback
+*
+* @brief	Print the result of a programming track read or write
+*
+* @param	nCV - CV number
+*			status - SM_OK or the error
+*			bValue - value read or written
+*			pArg - port that issued the command
+*
+* @return	none
+*
+*********************************************************************/
+static void ServiceModeCallback(unsigned short nCV, int status, unsigned char bValue, void* pArg)
 {
-//	uint8_t Value;
+	static char* apszStatus[] = {"OK", "No ACK", "Verify Failed", "Track Error", "Cancelled"};
+	uint8_t bPort = (uint8_t)(uintptr_t)pArg;
 
-//	if(status == SM_OK)
+	ShFieldNumberOut(bPort, "CV ", nCV, 0);
+	if(status == SM_OK)
 	{
-//		ShFieldNumberOut(bPort, "Read Successful: ", Value, 0);
-//		ShFieldOut(bPort, "Write Successful", 0);
+		ShFieldNumberOut(bPort, " = ", bValue, 0);
 	}
-//	else
+	else
 	{
-//		ShFieldOut(bPort, "Failed", 0);
+		ShFieldOut(bPort, ": ", 0);
+		ShFieldOut(bPort, apszStatus[status], 0);
 	}
-//   ShNL(bPort);
+	ShNL(bPort);
 }
 
+
+/*********************************************************************
+*
+* ShProgTrackWriteCV
+* @catagory	Shell Command
+*
+* @brief	Write a CV on the programming track, write <cv> <value>
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
 CMD_RETURN ShProgTrackWriteCV(uint8_t bPort, int argc, char *argv[])
 {
-//	int CV;
-//	int Value;
+	int CV;
+	int Value;
 
 	if(argc == 3)
 	{
-//		CV = atoi(argv[1]);
-//		Value = atoi(argv[2]);
+		CV = atoi(argv[1]);
+		Value = atoi(argv[2]);
 
-//		ServiceModeWriteCV(CV, Value, ServiceModeCallback, NULL);
+		if(CV < 1 || CV > 1024 || Value < 0 || Value > 255)
+		{
+			return CMD_BAD_PARAMS;
+		}
+		if(ServiceModeWriteCV(CV, Value, ServiceModeCallback, (void*)(uintptr_t)bPort) != 0)
+		{
+			ShFieldOut(bPort, "Programming Queue Full", 0);
+			ShNL(bPort);
+		}
 	}
 	else
 	{
-//		return CMD_NEED_HELP;
+		return CMD_BAD_PARAMS;
 	}
 
 	return CMD_OK;
 }
 
 
+/*********************************************************************
+*
+* ShProgTrackReadCV
+* @catagory	Shell Command
+*
+* @brief	Read CVs on the programming track, read <cv> [count],
+*			read stop drops the queued reads, read stats [clear]
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
 CMD_RETURN ShProgTrackReadCV(uint8_t bPort, int argc, char *argv[])
 {
-//	int CV;
+	SERVICE_STATS Stats;
+	int CV;
+	int Count = 1;
 
-	if(argc == 2)
+	if(argc < 2 || argc > 3)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	if(strcmp(argv[1], "stop") == 0)
+	{
+		ServiceModeCancel();
+		return CMD_OK;
+	}
+
+	if(strcmp(argv[1], "stats") == 0)
+	{
+		if(argc == 3)
+		{
+			if(strcmp(argv[2], "clear") != 0)
+			{
+				return CMD_BAD_PARAMS;
+			}
+			ClearServiceStats();
+			return CMD_OK;
+		}
+
+		GetServiceStats(&Stats);
+
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Reads:          ", Stats.reads, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Writes:         ", Stats.writes, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Verifies:       ", Stats.verifies, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Errors:         ", Stats.errors, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Retries:        ", Stats.retries, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Operations:     ", Stats.operations, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "ACKs:           ", Stats.acks, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Last CV ms:     ", Stats.last_ms, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Max CV ms:      ", Stats.max_ms, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Pending:        ", GetServiceModePending(), 0);
+		ShNL(bPort);
+		return CMD_OK;
+	}
+
+	CV = atoi(argv[1]);
+	if(argc == 3)
+	{
+		Count = atoi(argv[2]);
+	}
+	if(CV < 1 || Count < 1 || CV + Count - 1 > 1024)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	if(ServiceModeReadCV(CV, Count, ServiceModeCallback, (void*)(uintptr_t)bPort) != 0)
+	{
+		ShFieldOut(bPort, "Programming Queue Full", 0);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* SnapshotCVOut
+*
+* @brief	Print a CV of a snapshot, - when the snapshot does not have it
+*
+* @param	bPort - port
+*			pSnap - the snapshot
+*			nCV - CV number
+*
+* @return	none
+*
+*********************************************************************/
+static void SnapshotCVOut(uint8_t bPort, const DECODER_SNAPSHOT* pSnap, uint16_t nCV)
+{
+
+	if(IsSnapshotCV(pSnap, nCV))
+	{
+		ShFieldNumberOut(bPort, "", pSnap->abValue[nCV - 1], 4);
+	}
+	else
+	{
+		ShFieldOut(bPort, "   -", 0);
+	}
+}
+
+
+/*********************************************************************
+*
+* ShSnapshot
+* @catagory	Shell Command
+*
+* @brief	Decoder snapshot on the programming track. snap [full] reads
+*			the decoder, from the SD cache where it can, snap show lists
+*			the CVs, snap export <file> writes them as text, snap diff
+*			[<file>] compares them with the cached snapshot the last
+*			snap found, or with a snapshot file
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShSnapshot(uint8_t bPort, int argc, char *argv[])
+{
+	static DECODER_SNAPSHOT Snap;
+	static DECODER_SNAPSHOT SnapOther;
+	static uint8_t bfSnap;
+	static uint8_t bfOther;
+	SNAPSHOT_RESULT Result;
+	char szFile[32];
+	uint16_t nCV;
+	int Ret;
+
+	if(argc == 1 || (argc == 2 && strcmp(argv[1], "full") == 0))
+	{
+		ShFieldOut(bPort, "Reading...", 0);
+		ShNL(bPort);
+
+		Ret = TakeSnapshot(&Snap, &SnapOther, argc == 2, &Result);
+		if(Ret == SNAPSHOT_NO_DECODER)
+		{
+			ShFieldOut(bPort, "No Decoder", 0);
+			ShNL(bPort);
+			return CMD_OK;
+		}
+		else if(Ret == SNAPSHOT_ABORTED)
+		{
+			ShFieldOut(bPort, "Aborted", 0);
+			ShNL(bPort);
+			return CMD_OK;
+		}
+		bfSnap = 1;
+		bfOther = Result.bfCacheHit;
+
+		GetSnapshotFileName(&Snap, szFile);
+
+		ShFieldNumberOut(bPort, "Manufacturer: ", Snap.bManufacturer, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Version:      ", Snap.bVersion, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Serial:       ", Snap.wSerial, 0);
+		ShNL(bPort);
+		ShFieldOut(bPort, "File:         ", 0);
+		ShFieldOut(bPort, Ret == SNAPSHOT_SD_ERROR ? "not saved" : szFile, 0);
+		ShNL(bPort);
+		ShFieldOut(bPort, "Cache:        ", 0);
+		ShFieldOut(bPort, !Result.bfCacheHit ? "none" : Result.bfStale ? "stale" : "used", 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Read:         ", Result.read, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Verified:     ", Result.verified, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Cached:       ", Result.cached, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Changed:      ", Result.changed, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "Failed:       ", Result.failed, 0);
+		ShNL(bPort);
+		ShFieldNumberOut(bPort, "ms:           ", Result.ms, 0);
+		ShNL(bPort);
+		return CMD_OK;
+	}
+
+	if(!bfSnap)
 	{
-//		CV = atoi(argv[1]);
+		ShFieldOut(bPort, "No Snapshot", 0);
+		ShNL(bPort);
+		return CMD_OK;
+	}
+
+	if(argc == 2 && strcmp(argv[1], "show") == 0)
+	{
+		for(nCV = 1; nCV <= SNAPSHOT_CVS; nCV++)
+		{
+			if(IsSnapshotCV(&Snap, nCV))
+			{
+				ShFieldNumberOut(bPort, "CV ", nCV, 0);
+				ShFieldNumberOut(bPort, " = ", Snap.abValue[nCV - 1], 0);
+				ShNL(bPort);
+			}
+		}
+	}
+	else if(argc == 3 && strcmp(argv[1], "export") == 0)
+	{
+		if(ExportSnapshot(&Snap, argv[2]) != 0)
+		{
+			ShFieldOut(bPort, "Write Failed", 0);
+			ShNL(bPort);
+		}
+	}
+	else if((argc == 2 || argc == 3) && strcmp(argv[1], "diff") == 0)
+	{
+		if(argc == 3)
+		{
+			bfOther = LoadSnapshot(argv[2], &SnapOther) == 0;
+		}
+		if(!bfOther)
+		{
+			ShFieldOut(bPort, "Nothing To Compare", 0);
+			ShNL(bPort);
+			return CMD_OK;
+		}
 
-//		ServiceModeReadCV(CV, ServiceModeCallback, NULL);
+		// this snapshot, then the other
+		for(nCV = DiffSnapshot(&Snap, &SnapOther, 1); nCV != 0; nCV = DiffSnapshot(&Snap, &SnapOther, nCV + 1))
+		{
+			ShFieldNumberOut(bPort, "CV ", nCV, 5);
+			SnapshotCVOut(bPort, &Snap, nCV);
+			SnapshotCVOut(bPort, &SnapOther, nCV);
+			ShNL(bPort);
+		}
 	}
 	else
 	{
-//		return CMD_NEED_HELP;
+		return CMD_BAD_PARAMS;
 	}
 
 	return CMD_OK;
 }
 
 
+/*********************************************************************
+*
+* ShTrackStats
+* @catagory	Shell Command
+*
+* @brief	Track packet encoder statistics, trackstat clear resets them,
+*			trackstat prog [clear] for the programming track
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShTrackStats(uint8_t bPort, int argc, char *argv[])
+{
+	TRACK_STATS Stats;
+	TRACK_CHANNEL tc = TC_MAIN;
+	int arg = 1;
+
+	// optional track output, then optional clear
+	if(argc > arg && strcmp(argv[arg], "prog") == 0)
+	{
+		tc = TC_PROG;
+		arg++;
+	}
+
+	if(argc == arg + 1)
+	{
+		if(strcmp(argv[arg], "clear") == 0)
+		{
+			ClearChannelStats(tc);
+			return CMD_OK;
+		}
+		return CMD_BAD_PARAMS;
+	}
+	else if(argc > arg + 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetChannelStats(tc, &Stats);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Packets:        ", Stats.packets, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Bits:           ", Stats.bits, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Entries:        ", Stats.entries, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Max Entries:    ", Stats.max_entries, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Overflows:      ", Stats.overflows, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Free Slots:     ", GetChannelFreeSlots(tc), 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Cache Hits:     ", Stats.cache_hits, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Cache Misses:   ", Stats.cache_misses, 0);
+	ShNL(bPort);
+	if(Stats.entries)
+	{
+		// bits per entry, in hundredths
+		ShFieldNumberOut(bPort, "Bits/Entry x100:", (Stats.bits * 100) / Stats.entries, 0);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* ShTrackShare
+* @catagory	Shell Command
+*
+* @brief	Show how the tester and the command station share the main
+*			track, trackshare tester|cs|shell <share> <priority> sets it
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShTrackShare(uint8_t bPort, int argc, char *argv[])
+{
+	static char* const aszResource[] = { "", "Tester", "CS", "Shell" };
+	TRACK_LOCK Lock;
+	TRACK_RESOURCE tr;
+
+	if(argc == 4)
+	{
+		if(strcmp(argv[1], "tester") == 0)
+		{
+			tr = TR_TESTER;
+		}
+		else if(strcmp(argv[1], "cs") == 0)
+		{
+			tr = TR_COMMAND_STATION;
+		}
+		else if(strcmp(argv[1], "shell") == 0)
+		{
+			tr = TR_SHELL;
+		}
+		else
+		{
+			return CMD_BAD_PARAMS;
+		}
+
+		SetTrackShare(tr, atoi(argv[2]), atoi(argv[3]));
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "", 8);
+	ShFieldOut(bPort, "Open", 6);
+	ShFieldOut(bPort, "Share", 7);
+	ShFieldOut(bPort, "Pri", 5);
+	ShFieldOut(bPort, "Packets", 12);
+	ShFieldOut(bPort, "Waits", 12);
+	ShNL(bPort);
+
+	for(tr = TR_TESTER; tr < TRACK_RESOURCES; tr++)
+	{
+		GetTrackLock(tr, &Lock);
+		ShFieldOut(bPort, aszResource[tr], 8);
+		ShFieldNumberOut(bPort, "", Lock.open, 6);
+		ShFieldNumberOut(bPort, "", Lock.share, 7);
+		ShFieldNumberOut(bPort, "", Lock.priority, 5);
+		ShFieldNumberOut(bPort, "", Lock.packets, 12);
+		ShFieldNumberOut(bPort, "", Lock.waits, 12);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+
+
+/*********************************************************************
+*
+* ShTrip
+* @catagory	Shell Command
+*
+* @brief	Show the over-current trip settings and log, trip clear
+*			clears the log, trip reset turns a tripped track back on,
+*			trip <threshold> <retries> <backoff> <max backoff> sets it
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShTrip(uint8_t bPort, int argc, char *argv[])
+{
+	static char* const aszState[] = { "Armed", "Backoff", "Locked" };
+	TRIP_CONFIG Config;
+	TRIP_ENTRY Entry;
+
+	if(argc == 5)
+	{
+		Config.threshold = atoi(argv[1]);
+		Config.retries = atoi(argv[2]);
+		Config.backoff = atoi(argv[3]);
+		Config.backoff_max = atoi(argv[4]);
+		return SetTripConfig(&Config) == 0 ? CMD_OK : CMD_BAD_PARAMS;
+	}
+	else if(argc == 2)
+	{
+		if(strcmp(argv[1], "clear") == 0)
+		{
+			ClearTripLog();
+		}
+		else if(strcmp(argv[1], "reset") == 0)
+		{
+			ResetTrip();
+		}
+		else
+		{
+			return CMD_BAD_PARAMS;
+		}
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetTripConfig(&Config);
+	ShNL(bPort);
+	ShFieldOut(bPort, "State: ", 0);
+	ShFieldOut(bPort, aszState[GetTripState()], 0);
+	ShFieldNumberOut(bPort, "  Threshold: ", Config.threshold, 0);
+	ShFieldNumberOut(bPort, "  Retries: ", Config.retries, 0);
+	ShFieldNumberOut(bPort, "  Backoff: ", Config.backoff, 0);
+	ShFieldNumberOut(bPort, "-", Config.backoff_max, 0);
+	ShFieldOut(bPort, " ms", 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Trips: ", GetTripCount(), 0);
+	ShNL(bPort);
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Time ms", 12);
+	ShFieldOut(bPort, "Cycles", 12);
+	ShFieldOut(bPort, "Off", 7);
+	ShFieldOut(bPort, "Sample", 8);
+	ShFieldOut(bPort, "Peak", 8);
+	ShFieldOut(bPort, "Retry", 6);
+	ShNL(bPort);
+
+	// latest first
+	for(uint32_t n = 0; GetTripEntry(n, &Entry) == 0; n++)
+	{
+		ShFieldNumberOut(bPort, "", Entry.tick, 12);
+		ShFieldNumberOut(bPort, "", Entry.cycles, 12);
+		ShFieldNumberOut(bPort, "", Entry.off_cycles, 7);
+		ShFieldNumberOut(bPort, "", Entry.sample, 8);
+		ShFieldNumberOut(bPort, "", Entry.peak, 8);
+		ShFieldNumberOut(bPort, "", Entry.retry, 6);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* ShAck
+* @catagory	Shell Command
+*
+* @brief	Show the programming track current, the ACK detector and
+*			the last ACK pulse, ack clear resets them
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShAck(uint8_t bPort, int argc, char *argv[])
+{
+	static char* const aszStatus[] = { "None", "Loco Present", "ACK", "Over Current" };
+	ACK_STATS Stats;
+	ACK_PULSE Pulse;
+
+	if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		ClearAckStats();
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetAckStats(&Stats);
+
+	ShNL(bPort);
+	ShFieldOut(bPort, "Status:      ", 0);
+	ShFieldOut(bPort, aszStatus[GetAck()], 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Level:       ", Stats.level, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Baseline:    ", Stats.base, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Blocks:      ", Stats.blocks, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Pulses:      ", Stats.pulses, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Glitches:    ", Stats.glitches, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Long Pulses: ", Stats.long_pulses, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Overruns:    ", Stats.overruns, 0);
+	ShNL(bPort);
+
+	if(GetAckPulse(&Pulse) != 0)
+	{
+		ShFieldNumberOut(bPort, "Last Pulse:  ", Pulse.width_us, 0);
+		ShFieldNumberOut(bPort, " us, ", Pulse.amplitude, 0);
+		ShFieldNumberOut(bPort, " over ", Pulse.base, 0);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* ShRecord
+* @catagory	Shell Command
+*
+* @brief	Programming track current recorder. rec lists the windows
+*			in RAM, rec dump <file> [csv] writes them to the SD card
+*			(binary unless csv), rec hold keeps them, rec clear drops
+*			them and records again, rec trigger starts a window now
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShRecord(uint8_t bPort, int argc, char *argv[])
+{
+	static char* const aszTag[] = { "Manual", "Bit", "Verify", "Write" };
+	static char* const aszStatus[] = { "", "ACK", "No ACK", "Error" };
+	const REC_WINDOW* pWindow;
+	REC_STATS Stats;
+	uint32_t after = 0;
+	int count;
+
+	if(argc == 2 && strcmp(argv[1], "hold") == 0)
+	{
+		RecordHold();
+		return CMD_OK;
+	}
+	else if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		RecordClear();
+		return CMD_OK;
+	}
+	else if(argc == 2 && strcmp(argv[1], "trigger") == 0)
+	{
+		RecordTrigger(REC_TAG_MANUAL, 0, 0);
+		return CMD_OK;
+	}
+	else if((argc == 3 || argc == 4) && strcmp(argv[1], "dump") == 0)
+	{
+		if(argc == 4 && strcmp(argv[3], "csv") != 0)
+		{
+			return CMD_BAD_PARAMS;
+		}
+
+		count = RecordDump(argv[2], argc == 4);
+		if(count < 0)
+		{
+			ShFieldOut(bPort, "Write Failed", 0);
+		}
+		else
+		{
+			ShFieldNumberOut(bPort, "Windows: ", count, 0);
+		}
+		ShNL(bPort);
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetRecordStats(&Stats);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Triggers: ", Stats.triggers, 0);
+	ShFieldNumberOut(bPort, "  Windows: ", Stats.windows, 0);
+	ShFieldNumberOut(bPort, "  Dropped: ", Stats.dropped, 0);
+	ShFieldNumberOut(bPort, "  Holds: ", Stats.holds, 0);
+	ShFieldOut(bPort, Stats.bfHeld ? "  Held" : "", 0);
+	ShNL(bPort);
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Seq", 8);
+	ShFieldOut(bPort, "Time ms", 12);
+	ShFieldOut(bPort, "Tag", 8);
+	ShFieldOut(bPort, "CV", 6);
+	ShFieldOut(bPort, "Arg", 5);
+	ShFieldOut(bPort, "Status", 8);
+	ShFieldOut(bPort, "ACK us", 8);
+	ShFieldOut(bPort, "Samples", 8);
+	ShNL(bPort);
+
+	// oldest first, each window is held only while it prints
+	while((pWindow = RecordClaim(after)) != NULL)
+	{
+		after = pWindow->sequence;
+
+		ShFieldNumberOut(bPort, "", pWindow->sequence, 8);
+		ShFieldNumberOut(bPort, "", pWindow->tick, 12);
+		ShFieldOut(bPort, aszTag[pWindow->tag], 8);
+		ShFieldNumberOut(bPort, "", pWindow->cv, 6);
+		ShFieldNumberOut(bPort, "", pWindow->arg, 5);
+		ShFieldOut(bPort, aszStatus[pWindow->status], 8);
+		ShFieldNumberOut(bPort, "", pWindow->ack_us, 8);
+		ShFieldNumberOut(bPort, "", pWindow->count, 8);
+		ShNL(bPort);
+
+		RecordRelease(pWindow);
+	}
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* ShLatency
+* @catagory	Shell Command
+*
+* @brief	Decoder response latency from the end of a packet to the
+*			current rise, per decoder and test. latency clear starts
+*			again, latency speed <address> <speed> sends one 128 step
+*			speed packet on the programming track (kept powered with
+*			idles) to time the motor current step, latency off lets
+*			the programming track go off again
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShLatency(uint8_t bPort, int argc, char *argv[])
+{
+	static char* const aszTest[] = { "Bit", "Verify", "Write", "Speed" };
+	LATENCY_DECODER Decoder;
+	LATENCY_STATS Stats;
+	STATS_HIST* pHist;
+	unsigned char abPacket[SM_PACKET_SIZE];
+	int nAddress;
+	int nSpeed;
+	uint8_t i;
+	int j;
+
+	if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		ClearLatencyStats();
+		return CMD_OK;
+	}
+	else if(argc == 2 && strcmp(argv[1], "off") == 0)
+	{
+		// service mode owns the programming track, it goes off in turn
+		if(ServiceModeTrackOff() != 0)
+		{
+			ShNL(bPort);
+			ShFieldOut(bPort, "Programming Queue Full", 0);
+			ShNL(bPort);
+		}
+		return CMD_OK;
+	}
+	else if(argc == 4 && strcmp(argv[1], "speed") == 0)
+	{
+		nAddress = atoi(argv[2]);
+		nSpeed = atoi(argv[3]);
+		if(nAddress < 1 || nAddress > SH_MAX_ADDRESS || nSpeed < 0 || nSpeed > SH_MAX_SPEED_128)
+		{
+			return CMD_BAD_PARAMS;
+		}
+
+		// the command station task queues every programming track packet
+		BuildLocoPacket(abPacket, nAddress, nSpeed, 1, SPEED_MODE_128);
+		if(ServiceModeSendPacket(abPacket, LAT_TEST_SPEED) != 0)
+		{
+			ShNL(bPort);
+			ShFieldOut(bPort, "Programming Queue Full", 0);
+			ShNL(bPort);
+		}
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Test us", 10);
+	ShFieldOut(bPort, "Count", 8);
+	ShFieldOut(bPort, "Min", 8);
+	ShFieldOut(bPort, "50%", 8);
+	ShFieldOut(bPort, "90%", 8);
+	ShFieldOut(bPort, "99%", 8);
+	ShFieldOut(bPort, "Max", 8);
+	ShFieldOut(bPort, "Mean", 8);
+	ShNL(bPort);
+
+	for(i = 0; i < LAT_DECODERS; i++)
+	{
+		if(GetLatencyDecoder(i, &Decoder) != 0)
+		{
+			continue;
+		}
+
+		if(Decoder.bManufacturer == 0)
+		{
+			ShFieldOut(bPort, "Decoder not identified", 0);
+		}
+		else
+		{
+			ShFieldNumberOut(bPort, "Decoder ", Decoder.bManufacturer, 0);
+			ShFieldNumberOut(bPort, " version ", Decoder.bVersion, 0);
+			ShFieldNumberOut(bPort, " serial ", Decoder.wSerial, 0);
+		}
+		ShNL(bPort);
+
+		for(j = 0; j < LAT_TESTS; j++)
+		{
+			pHist = &Decoder.aTest[j];
+			if(pHist->count == 0)
+			{
+				continue;
+			}
+			ShFieldOut(bPort, aszTest[j], 10);
+			ShFieldNumberOut(bPort, "", pHist->count, 8);
+			ShFieldNumberOut(bPort, "", pHist->min, 8);
+			ShFieldNumberOut(bPort, "", StatsHistPercentile(pHist, LAT_BUCKET_SHIFT, 500), 8);
+			ShFieldNumberOut(bPort, "", StatsHistPercentile(pHist, LAT_BUCKET_SHIFT, 900), 8);
+			ShFieldNumberOut(bPort, "", StatsHistPercentile(pHist, LAT_BUCKET_SHIFT, 990), 8);
+			ShFieldNumberOut(bPort, "", pHist->max, 8);
+			ShFieldNumberOut(bPort, "", pHist->sum / pHist->count, 8);
+			ShNL(bPort);
+		}
+	}
+
+	GetLatencyStats(&Stats);
+	ShFieldNumberOut(bPort, "Rises:     ", Stats.rises, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Timed:     ", Stats.timed, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "No Test:   ", Stats.untested, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Unmatched: ", Stats.unmatched, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Replaced:  ", Stats.replaced, 0);
+	ShNL(bPort);
+
+	return CMD_OK;
+}
+
+
+/*********************************************************************
+*
+* ShCsStats
+* @catagory	Shell Command
+*
+* @brief	Show what wakes the command station task and how much of
+*			the processor it uses, and how full the event queue
+*			got, csstat clear starts again
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShCsStats(uint8_t bPort, int argc, char *argv[])
+{
+	CS_STATS Stats;
+	MSG_QUEUE_STATS Queue;
+	uint64_t total;
+
+	if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		ClearCommandStationStats();
+		ClearMessageQueueStats();
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetCommandStationStats(&Stats);
+	GetMessageQueueStats(&Queue);
+
+	// cycles in the time since the statistics were cleared
+	total = (uint64_t)Stats.ms * (SystemCoreClock / 1000);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Time ms:   ", Stats.ms, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Wakes:     ", Stats.wakes, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  tick     ", Stats.tick, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  slot     ", Stats.slot, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  cab      ", Stats.cab, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  message  ", Stats.message, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Load 0.1%: ", total ? (int)(Stats.busy_cycles * 1000 / total) : 0, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Max pass:  ", Stats.max_cycles, 0);
+	ShFieldOut(bPort, " cycles", 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Events:    ", Queue.queued, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  dropped  ", Queue.dropped, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  waiting  ", Queue.waiting, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  most     ", Queue.high_water, 0);
+	ShFieldNumberOut(bPort, " of ", Queue.depth, 0);
+	ShNL(bPort);
+
+	return CMD_OK;
+}
+
+/*********************************************************************
+*
+* ShSchedule
+* @catagory	Shell Command
+*
+* @brief	Show how much of the main track the command station uses,
+*			why it sent its packets, how many consist member turns were
+*			left out, and the consist address and the last and longest
+*			interval between packets for every loco on the track, sched
+*			clear starts again
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShSchedule(uint8_t bPort, int argc, char *argv[])
+{
+	CS_SCHEDULE_STATS Stats;
+	Loco* pLoco = NULL;
+	int n;
+
+	if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		ClearScheduleStats();
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetScheduleStats(&Stats);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Time ms:    ", Stats.ms, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Packets:    ", Stats.packets, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  change    ", Stats.changes, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  repeat    ", Stats.repeats, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  refresh   ", Stats.refresh, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  member    ", Stats.members, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Merged:     ", Stats.merged, 0);
+	ShNL(bPort);
+	// track us in the ms since the statistics were cleared
+	ShFieldNumberOut(bPort, "Track 0.1%: ", Stats.ms ? (int)(Stats.track_us / Stats.ms) : 0, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Resting:    ", Stats.rests, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Late:       ", Stats.late, 0);
+	ShNL(bPort);
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Address", 10);
+	ShFieldOut(bPort, "Consist", 10);
+	ShFieldOut(bPort, "Last ms", 10);
+	ShFieldOut(bPort, "Worst ms", 10);
+	ShNL(bPort);
+
+	// the command station task may change the ring meanwhile, it only
+	// ever holds locos so a bounded walk is safe
+	for(n = 0; n < MAX_LOCOS && (pLoco = NextRefreshLoco(pLoco)) != NULL; n++)
+	{
+		ShFieldNumberOut(bPort, "", pLoco->Address, 10);
+		ShFieldNumberOut(bPort, "", GetLocoAlias(pLoco), 10);
+		ShFieldNumberOut(bPort, "", pLoco->LastInterval / 1000, 10);
+		ShFieldNumberOut(bPort, "", pLoco->MaxInterval / 1000, 10);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
+/*********************************************************************
+*
+* ShLocoStore
+* @catagory	Shell Command
+*
+* @brief	Show the loco roster store, what was read back at boot and
+*			what has been written since, locostore flush writes the
+*			changed locos now and locostore compact a new snapshot
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShLocoStore(uint8_t bPort, int argc, char *argv[])
+{
+	LOCO_STORE_STATS Stats;
+
+	if(argc == 2 && strcmp(argv[1], "flush") == 0)
+	{
+		FlushLocoStore(LOCO_STORE_FLAG_FLUSH);
+		return CMD_OK;
+	}
+	else if(argc == 2 && strcmp(argv[1], "compact") == 0)
+	{
+		FlushLocoStore(LOCO_STORE_FLAG_COMPACT);
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetLocoStoreStats(&Stats);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Replayed:    ", Stats.replayed, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Bad:         ", Stats.bad, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Records:     ", Stats.records, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Writes:      ", Stats.writes, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Longest ms:  ", Stats.max_write_ms, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Journal:     ", Stats.journal, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Compactions: ", Stats.compactions, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Errors:      ", Stats.errors, 0);
+	ShNL(bPort);
+
+	return CMD_OK;
+}
+
+/*********************************************************************
+*
+* ShCabPoll
+* @catagory	Shell Command
+*
+* @brief	Show the NCE cab bus poller, how long a cycle of polls
+*			takes, how the display text went out and for every
+*			address that has answered its state, its answer time and
+*			how often it is polled, cabpoll clear starts again
+*
+* @param	bPort - port that issued this command
+*			argc - argument count
+*			argv - argc array of arguments
+*
+* @return	CMD_RETURN - shell result
+*
+*********************************************************************/
+CMD_RETURN ShCabPoll(uint8_t bPort, int argc, char *argv[])
+{
+	static char* apStates[] = { "absent", "seen", "active" };
+	NCE_BUS_STATS Bus;
+	NCE_CAB_STATS Cab;
+	unsigned char i;
+
+	if(argc == 2 && strcmp(argv[1], "clear") == 0)
+	{
+		ClearNCECabStats();
+		return CMD_OK;
+	}
+	else if(argc != 1)
+	{
+		return CMD_BAD_PARAMS;
+	}
+
+	GetNCEBusStats(&Bus);
+
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Cycles:     ", Bus.cycles, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Cycle ms:   ", Bus.cycle_ms, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Worst ms:   ", Bus.max_cycle_ms, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Polls:      ", Bus.polls, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "No answer:  ", Bus.misses, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Discovery:  ", Bus.discovery, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "Text whole: ", Bus.text_quadrants, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  chars     ", Bus.text_chars, 0);
+	ShNL(bPort);
+	ShFieldNumberOut(bPort, "  unchanged ", Bus.text_unchanged, 0);
+	ShNL(bPort);
+
+	// print the header
+	ShNL(bPort);
+	ShFieldOut(bPort, "Cab", 5);
+	ShFieldOut(bPort, "State", 8);
+	ShFieldOut(bPort, "Polls", 10);
+	ShFieldOut(bPort, "Missed", 8);
+	ShFieldOut(bPort, "Ans us", 8);
+	ShFieldOut(bPort, "Worst us", 10);
+	ShFieldOut(bPort, "Every ms", 10);
+	ShFieldOut(bPort, "Worst ms", 10);
+	ShNL(bPort);
+
+	// the broadcast address never answers
+	for(i = 1; i < MAX_CABS; i++)
+	{
+		GetNCECabStats(i, &Cab);
+		if(Cab.responses == 0 && Cab.state == CAB_STATE_ABSENT)
+		{
+			continue;
+		}
+
+		ShFieldNumberOut(bPort, "", i, 5);
+		ShFieldOut(bPort, apStates[Cab.state], 8);
+		ShFieldNumberOut(bPort, "", Cab.polls, 10);
+		ShFieldNumberOut(bPort, "", Cab.misses, 8);
+		ShFieldNumberOut(bPort, "", Cab.response_us, 8);
+		ShFieldNumberOut(bPort, "", Cab.max_response_us, 10);
+		ShFieldNumberOut(bPort, "", Cab.interval_ms, 10);
+		ShFieldNumberOut(bPort, "", Cab.max_interval_ms, 10);
+		ShNL(bPort);
+	}
+
+	return CMD_OK;
+}
+
 #ifdef NOT_USED
 CMD_RETURN ShTrack(uint8_t bPort, int argc, char *argv[])
 {
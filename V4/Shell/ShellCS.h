@@ -42,6 +42,18 @@ CMD_RETURN ShProgTrack(uint8_t bPort, int argc, char *argv[]);
 
 CMD_RETURN ShProgTrackWriteCV(uint8_t bPort, int argc, char *argv[]);
 CMD_RETURN ShProgTrackReadCV(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShSnapshot(uint8_t bPort, int argc, char *argv[]);
+
+CMD_RETURN ShTrackStats(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShTrackShare(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShTrip(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShAck(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShRecord(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShLatency(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShCsStats(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShSchedule(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShLocoStore(uint8_t bPort, int argc, char *argv[]);
+CMD_RETURN ShCabPoll(uint8_t bPort, int argc, char *argv[]);
 
 
 //CMD_RETURN ShCreateLoco(uint8_t bPort, int argc, char *argv[]);
@@ -0,0 +1,1060 @@
+/*******************************************************************************
+* @file HostHal.c
+* @brief Host model of the STM32F4 pieces used by the track outputs: TIM1
+*		 and TIM8, their update DMA streams, GPIO and NVIC
+*
+* @details	Each timer is modeled at PWM period granularity. At every
+*			update event the ARR and CCR1 shadow registers are loaded from
+*			their preload registers and the repetition counter from RCR.
+*			Then either the update interrupt runs, or - when the update
+*			DMA request is enabled - one DMA burst writes DCR.DBL+1
+*			halfwords into the timer registers starting at DCR.DBA, the
+*			same way the DMAR register does it in silicon. The two timers
+*			run side by side, their update events are handled in time
+*			order.
+*
+* @copyright	(c) 2019  all Rights Reserved.
+*******************************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include "task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TrackSim.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define TRACK_A_PIN				GPIO_PIN_9
+#define PROG_A_PIN				GPIO_PIN_6
+#define SCOPE_TRIGGER_PIN		GPIO_PIN_7
+
+// one timer tick is 0.5 us, VCD time units are 100 ns
+#define VCD_UNITS_PER_TICK		5
+
+#define DMA_SxCR_EN				0x0001
+
+#define MAX_EDGES				(1024 * 1024)
+
+#define MAX_IRQS				128
+
+// the timers and the core run from the same 168MHz clock
+#define CYCLES_PER_TICK			85
+
+/** @struct SIM_TIMER
+	@brief One modeled track timer with its update DMA stream and the
+	edges recorded on its output pin
+ */
+typedef struct sim_timer_t
+{
+	TIM_TypeDef*		pTim;
+	DMA_Stream_TypeDef*	pStream;
+	IRQn_Type			update_irq;
+	IRQn_Type			dma_irq;
+	void				(*pUpdateHandler)(void);
+	void				(*pDmaHandler)(void);
+	GPIO_TypeDef*		pPort;			// output pin (CH1)
+	uint16_t			pin;
+
+	uint32_t			ShadowARR;
+	uint32_t			ShadowCCR1;
+	uint32_t			Repetition;
+	uint8_t				bRunning;
+	uint64_t			Start;			// start of the next PWM period
+
+	DMA_HandleTypeDef*	pDma;
+	const uint16_t*		pDmaSource;
+	uint8_t				bDmaHalfFlag;
+	uint8_t				bDmaCompleteFlag;
+
+	SIM_EDGE*			pEdges;
+	uint32_t			EdgeCount;
+	uint8_t				bLevel;
+	uint8_t				bOutputEnabled;
+} SIM_TIMER;
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void TIM1_UP_TIM10_IRQHandler(void);
+extern void TIM8_UP_TIM13_IRQHandler(void);
+
+// the track wakeup interrupt the output interrupts pend
+extern void CAN2_SCE_IRQHandler(void);
+
+// only present when Track.c is built with TRACK_DMA_BURST
+extern void DMA2_Stream5_IRQHandler(void) __attribute__((weak));
+extern void DMA2_Stream1_IRQHandler(void) __attribute__((weak));
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+TIM_TypeDef SimTIM1;
+TIM_TypeDef SimTIM8;
+DMA_Stream_TypeDef SimDMA2_Stream5;
+DMA_Stream_TypeDef SimDMA2_Stream1;
+GPIO_TypeDef SimGPIOA;
+GPIO_TypeDef SimGPIOB;
+GPIO_TypeDef SimGPIOC;
+GPIO_TypeDef SimGPIOE;
+DWT_Type SimDWT;
+CoreDebug_Type SimCoreDebug;
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static SIM_TIMER aTimer[SIM_CHANNELS] =
+{
+	{ &SimTIM1, &SimDMA2_Stream5, TIM1_UP_TIM10_IRQn, DMA2_Stream5_IRQn,
+		TIM1_UP_TIM10_IRQHandler, DMA2_Stream5_IRQHandler, &SimGPIOE, TRACK_A_PIN },
+	{ &SimTIM8, &SimDMA2_Stream1, TIM8_UP_TIM13_IRQn, DMA2_Stream1_IRQn,
+		TIM8_UP_TIM13_IRQHandler, DMA2_Stream1_IRQHandler, &SimGPIOC, PROG_A_PIN },
+};
+
+static uint64_t Tick;
+
+static uint8_t abIrqEnabled[MAX_IRQS];
+static uint8_t bWakePending;
+
+static SIM_EDGE* pScopeEdges;
+static uint32_t ScopeEdgeCount;
+
+static uint32_t InterruptCount;
+
+static uint8_t bSimTask;
+static volatile uint32_t ThreadFlags;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/*********************************************************************
+*
+* FindTimer / FindDmaTimer
+*
+* @brief	Find the modeled timer behind a register block
+*
+* @param	timer or DMA stream registers
+*
+* @return	pointer to the timer model
+*
+*********************************************************************/
+static SIM_TIMER* FindTimer(TIM_TypeDef* pTim)
+{
+	return pTim == &SimTIM8 ? &aTimer[SIM_PROG] : &aTimer[SIM_MAIN];
+}
+
+static SIM_TIMER* FindDmaTimer(DMA_Stream_TypeDef* pStream)
+{
+	return pStream == &SimDMA2_Stream1 ? &aTimer[SIM_PROG] : &aTimer[SIM_MAIN];
+}
+
+
+/*********************************************************************
+*
+* RecordLevel
+*
+* @brief	Record the output level of a timer if it changed
+*
+* @param	pTimer - timer model
+*			tick - time of the edge
+*			level - SIM_LEVEL
+*
+* @return	none
+*
+*********************************************************************/
+static void RecordLevel(SIM_TIMER* pTimer, uint64_t tick, uint8_t level)
+{
+	if(!pTimer->bOutputEnabled)
+	{
+		level = SL_OFF;
+	}
+
+	if(level == pTimer->bLevel)
+	{
+		return;
+	}
+	pTimer->bLevel = level;
+
+	if(pTimer->pEdges == NULL)
+	{
+		pTimer->pEdges = malloc(MAX_EDGES * sizeof(SIM_EDGE));
+	}
+
+	if(pTimer->EdgeCount < MAX_EDGES)
+	{
+		pTimer->pEdges[pTimer->EdgeCount].tick = tick;
+		pTimer->pEdges[pTimer->EdgeCount].level = level;
+		pTimer->EdgeCount++;
+	}
+}
+
+
+/*********************************************************************
+*
+* RecordScope
+*
+* @brief	Record a scope trigger pin change
+*
+* @param	level - new pin level
+*
+* @return	none
+*
+*********************************************************************/
+static void RecordScope(uint8_t level)
+{
+	if(pScopeEdges == NULL)
+	{
+		pScopeEdges = malloc(MAX_EDGES * sizeof(SIM_EDGE));
+	}
+
+	if(ScopeEdgeCount < MAX_EDGES)
+	{
+		pScopeEdges[ScopeEdgeCount].tick = Tick;
+		pScopeEdges[ScopeEdgeCount].level = level;
+		ScopeEdgeCount++;
+	}
+}
+
+
+/*********************************************************************
+*
+* SimReset
+*
+* @brief	Put the model back to its power-on state
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void SimReset(void)
+{
+	SIM_TIMER* pTimer;
+
+	memset(abIrqEnabled, 0, sizeof(abIrqEnabled));
+	bWakePending = 0;
+
+	for(int i = 0; i < SIM_CHANNELS; i++)
+	{
+		pTimer = &aTimer[i];
+
+		memset(pTimer->pTim, 0, sizeof(TIM_TypeDef));
+		memset(pTimer->pStream, 0, sizeof(DMA_Stream_TypeDef));
+
+		pTimer->ShadowARR = 0;
+		pTimer->ShadowCCR1 = 0;
+		pTimer->Repetition = 0;
+		pTimer->bRunning = 0;
+		pTimer->Start = 0;
+
+		pTimer->pDma = NULL;
+		pTimer->pDmaSource = NULL;
+		pTimer->bDmaHalfFlag = 0;
+		pTimer->bDmaCompleteFlag = 0;
+
+		pTimer->EdgeCount = 0;
+		pTimer->bLevel = SL_OFF;
+		pTimer->bOutputEnabled = 0;
+	}
+
+	Tick = 0;
+	ScopeEdgeCount = 0;
+	InterruptCount = 0;
+}
+
+
+/*********************************************************************
+*
+* RunPendingWake
+*
+* @brief	Run the track wakeup interrupt once the output interrupt that
+*			pended it returns, it has the lower priority
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void RunPendingWake(void)
+{
+	if(bWakePending && abIrqEnabled[CAN2_SCE_IRQn])
+	{
+		bWakePending = 0;
+		CAN2_SCE_IRQHandler();
+	}
+}
+
+
+/*********************************************************************
+*
+* UpdateDma
+*
+* @brief	Service the update DMA request of a timer - one burst into DMAR
+*
+* @param	pTimer - timer model
+*
+* @return	none
+*
+*********************************************************************/
+static void UpdateDma(SIM_TIMER* pTimer)
+{
+	volatile uint32_t* pReg = (volatile uint32_t*)pTimer->pTim;
+	DMA_Stream_TypeDef* pStream = pTimer->pStream;
+	uint32_t base = pTimer->pTim->DCR & 0x1f;
+	uint32_t burst = ((pTimer->pTim->DCR >> 8) & 0x1f) + 1;
+
+	for(uint32_t i = 0; i < burst && pStream->NDTR != 0; i++)
+	{
+		pReg[base + i] = *pTimer->pDmaSource++;
+		pStream->NDTR--;
+	}
+
+	if(!pTimer->pDma->HalfDone && pStream->NDTR <= pTimer->pDma->Length / 2)
+	{
+		pTimer->pDma->HalfDone = 1;
+		pTimer->bDmaHalfFlag = 1;
+	}
+
+	if(pStream->NDTR == 0)
+	{
+		pStream->CR &= ~DMA_SxCR_EN;
+		pTimer->bDmaCompleteFlag = 1;
+	}
+
+	if((pTimer->bDmaHalfFlag || pTimer->bDmaCompleteFlag) && abIrqEnabled[pTimer->dma_irq] && pTimer->pDmaHandler)
+	{
+		InterruptCount++;
+		pTimer->pDmaHandler();
+		RunPendingWake();
+	}
+}
+
+
+/*********************************************************************
+*
+* UpdateEvent
+*
+* @brief	Timer update event - latch the preload registers and run the
+*			update interrupt or the update DMA request
+*
+* @param	pTimer - timer model
+*
+* @return	none
+*
+*********************************************************************/
+static void UpdateEvent(SIM_TIMER* pTimer)
+{
+	TIM_TypeDef* pTim = pTimer->pTim;
+
+	pTimer->ShadowARR = pTim->ARR;
+	pTimer->ShadowCCR1 = pTim->CCR1;
+	pTimer->Repetition = pTim->RCR & 0xff;
+
+	// the handlers run the instant the update event happens
+	pTim->CNT = 0;
+	SimDWT.CYCCNT = (uint32_t)(Tick * CYCLES_PER_TICK);
+
+	if((pTim->DIER & TIM_DMA_UPDATE) && (pTimer->pStream->CR & DMA_SxCR_EN) && pTimer->pDma)
+	{
+		UpdateDma(pTimer);
+	}
+
+	if((pTim->DIER & TIM_IT_UPDATE) && abIrqEnabled[pTimer->update_irq])
+	{
+		InterruptCount++;
+		pTimer->pUpdateHandler();
+		RunPendingWake();
+	}
+}
+
+
+/*********************************************************************
+*
+* RunPeriod
+*
+* @brief	Play one PWM period of a timer and handle the update event
+*			(or repetition count) at its end
+*
+* @param	pTimer - timer model
+*
+* @return	none
+*
+*********************************************************************/
+static void RunPeriod(SIM_TIMER* pTimer)
+{
+	// PWM mode 1, up counting: high while CNT < CCR1, period ARR + 1
+	if(pTimer->ShadowCCR1 != 0)
+	{
+		RecordLevel(pTimer, pTimer->Start, SL_HIGH);
+	}
+	if(pTimer->ShadowCCR1 <= pTimer->ShadowARR)
+	{
+		RecordLevel(pTimer, pTimer->Start + pTimer->ShadowCCR1, SL_LOW);
+	}
+
+	pTimer->Start += pTimer->ShadowARR + 1;
+	Tick = pTimer->Start;
+
+	if(pTimer->Repetition == 0)
+	{
+		UpdateEvent(pTimer);
+	}
+	else
+	{
+		pTimer->Repetition--;
+	}
+}
+
+
+/*********************************************************************
+*
+* SimRun
+*
+* @brief	Advance the timers by at least 'ticks' ticks, one PWM period
+*			at a time. Every period that starts before the end is played,
+*			the periods of the two timers in the order they end.
+*
+* @param	ticks - ticks to run
+*
+* @return	none
+*
+*********************************************************************/
+void SimRun(uint64_t ticks)
+{
+	uint64_t end = Tick + ticks;
+	SIM_TIMER* pNext;
+	SIM_TIMER* pTimer;
+
+	while(1)
+	{
+		pNext = NULL;
+		for(int i = 0; i < SIM_CHANNELS; i++)
+		{
+			pTimer = &aTimer[i];
+			if(!pTimer->bRunning || pTimer->Start >= end)
+			{
+				continue;
+			}
+			if(pNext == NULL || pTimer->Start + pTimer->ShadowARR < pNext->Start + pNext->ShadowARR)
+			{
+				pNext = pTimer;
+			}
+		}
+
+		if(pNext == NULL)
+		{
+			break;
+		}
+		RunPeriod(pNext);
+	}
+
+	if(Tick < end)
+	{
+		Tick = end;
+	}
+}
+
+
+/*********************************************************************
+*
+* SimIsRunning
+*
+* @brief	Check if any timer is running
+*
+* @param	none
+*
+* @return	1 = running
+*
+*********************************************************************/
+static uint8_t SimIsRunning(void)
+{
+	for(int i = 0; i < SIM_CHANNELS; i++)
+	{
+		if(aTimer[i].bRunning)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* SimGetTick
+*
+* @brief	Current model time
+*
+* @param	none
+*
+* @return	ticks since reset
+*
+*********************************************************************/
+uint64_t SimGetTick(void)
+{
+	return Tick;
+}
+
+
+/*********************************************************************
+*
+* SimGetEdgeCount / SimGetEdges
+*
+* @brief	Access the recorded edges of a track output (the main track
+*			without the channel)
+*
+*********************************************************************/
+uint32_t SimGetEdgeCount(void)
+{
+	return aTimer[SIM_MAIN].EdgeCount;
+}
+
+const SIM_EDGE* SimGetEdges(void)
+{
+	return aTimer[SIM_MAIN].pEdges;
+}
+
+uint32_t SimGetChannelEdgeCount(SIM_CHANNEL ch)
+{
+	return aTimer[ch].EdgeCount;
+}
+
+const SIM_EDGE* SimGetChannelEdges(SIM_CHANNEL ch)
+{
+	return aTimer[ch].pEdges;
+}
+
+
+/*********************************************************************
+*
+* SimFindBits
+*
+* @brief	Look for a run of bits with exactly the given half widths in
+*			the recorded edges of a track output
+*
+* @param	ch - track output
+*			first - edge to start looking at
+*			pBits - the bits expected, in the order they are sent
+*			count - number of bits
+*
+* @return	0 = found
+*
+*********************************************************************/
+int SimFindBits(SIM_CHANNEL ch, uint32_t first, const SIM_BIT* pBits, uint32_t count)
+{
+	const SIM_EDGE* pEdges = aTimer[ch].pEdges;
+	uint32_t i, k;
+
+	for(i = first; i + 2 * count < aTimer[ch].EdgeCount; i++)
+	{
+		for(k = 0; k < count; k++)
+		{
+			const SIM_EDGE* pBit = &pEdges[i + 2 * k];
+
+			if(pBit[0].level != SL_HIGH || pBit[1].level != SL_LOW
+				|| pBit[1].tick - pBit[0].tick != pBits[k].high
+				|| pBit[2].tick - pBit[1].tick != pBits[k].low)
+			{
+				break;
+			}
+		}
+		if(k == count)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/*********************************************************************
+*
+* SimGetInterruptCount
+*
+* @brief	Number of track interrupts (update or DMA, both timers) taken
+*			so far
+*
+* @param	none
+*
+* @return	interrupt count
+*
+*********************************************************************/
+uint32_t SimGetInterruptCount(void)
+{
+	return InterruptCount;
+}
+
+
+/*********************************************************************
+*
+* SimWriteCsv / SimWriteChannelCsv
+*
+* @brief	Write the recorded edges of a track output as compact
+*			"tick,level" CSV, one line per edge (ticks are 0.5 us, level
+*			is SIM_LEVEL)
+*
+* @param	ch - track output (the main track without it)
+*			name - file name
+*
+* @return	0 = success
+*
+*********************************************************************/
+int SimWriteCsv(const char* name)
+{
+	return SimWriteChannelCsv(SIM_MAIN, name);
+}
+
+int SimWriteChannelCsv(SIM_CHANNEL ch, const char* name)
+{
+	SIM_TIMER* pTimer = &aTimer[ch];
+	FILE* fp;
+
+	fp = fopen(name, "w");
+	if(fp == NULL)
+	{
+		return 1;
+	}
+
+	fprintf(fp, "tick,level\n");
+	for(uint32_t i = 0; i < pTimer->EdgeCount; i++)
+	{
+		fprintf(fp, "%llu,%u\n", (unsigned long long)pTimer->pEdges[i].tick, pTimer->pEdges[i].level);
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* SimCompareCsv / SimCompareChannelCsv
+*
+* @brief	Compare the recorded edges of a track output against a file
+*			written by SimWriteCsv
+*
+* @param	ch - track output (the main track without it)
+*			name - reference file name
+*
+* @return	0 = identical
+*
+*********************************************************************/
+int SimCompareCsv(const char* name)
+{
+	return SimCompareChannelCsv(SIM_MAIN, name);
+}
+
+int SimCompareChannelCsv(SIM_CHANNEL ch, const char* name)
+{
+	SIM_TIMER* pTimer = &aTimer[ch];
+	FILE* fp;
+	char line[64];
+	unsigned long long tick;
+	unsigned int level;
+	uint32_t i = 0;
+	int ret = 0;
+
+	fp = fopen(name, "r");
+	if(fp == NULL)
+	{
+		printf("Can't open %s\n", name);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		if(sscanf(line, "%llu,%u", &tick, &level) != 2)
+		{
+			// header
+			continue;
+		}
+		if(i >= pTimer->EdgeCount)
+		{
+			printf("Edge %u missing: expected %llu %u\n", i, tick, level);
+			ret = 1;
+			break;
+		}
+		if(pTimer->pEdges[i].tick != tick || pTimer->pEdges[i].level != level)
+		{
+			printf("Edge %u differs: expected %llu %u, got %llu %u\n", i, tick, level,
+					(unsigned long long)pTimer->pEdges[i].tick, pTimer->pEdges[i].level);
+			ret = 1;
+			break;
+		}
+		i++;
+	}
+
+	if(ret == 0 && i != pTimer->EdgeCount)
+	{
+		printf("%u extra edges\n", pTimer->EdgeCount - i);
+		ret = 1;
+	}
+	fclose(fp);
+	return ret;
+}
+
+
+/*********************************************************************
+*
+* SimWriteVcd
+*
+* @brief	Write both track outputs and the scope trigger as a VCD file
+*			for GTKWave. A track is 'z' while its output is off.
+*
+* @param	name - file name
+*
+* @return	0 = success
+*
+*********************************************************************/
+int SimWriteVcd(const char* name)
+{
+	static const char acLevel[] = { '0', '1', 'z' };
+	static const char acId[] = { '!', '#', '"' };
+	const SIM_EDGE* apEdges[SIM_CHANNELS + 1];
+	uint32_t aCount[SIM_CHANNELS + 1];
+	uint32_t aNext[SIM_CHANNELS + 1] = { 0 };
+	FILE* fp;
+	uint64_t tick;
+	int list;
+
+	fp = fopen(name, "w");
+	if(fp == NULL)
+	{
+		return 1;
+	}
+
+	for(int i = 0; i < SIM_CHANNELS; i++)
+	{
+		apEdges[i] = aTimer[i].pEdges;
+		aCount[i] = aTimer[i].EdgeCount;
+	}
+	apEdges[SIM_CHANNELS] = pScopeEdges;
+	aCount[SIM_CHANNELS] = ScopeEdgeCount;
+
+	fprintf(fp, "$version TrackSim $end\n");
+	fprintf(fp, "$timescale 100ns $end\n");
+	fprintf(fp, "$scope module sender $end\n");
+	fprintf(fp, "$var wire 1 ! track $end\n");
+	fprintf(fp, "$var wire 1 # prog $end\n");
+	fprintf(fp, "$var wire 1 \" scope $end\n");
+	fprintf(fp, "$upscope $end\n");
+	fprintf(fp, "$enddefinitions $end\n");
+	fprintf(fp, "#0\n$dumpvars\nz!\nz#\n0\"\n$end\n");
+
+	// merge the edge lists in time order
+	while(1)
+	{
+		list = -1;
+		for(int i = 0; i <= SIM_CHANNELS; i++)
+		{
+			if(aNext[i] < aCount[i] && (list < 0 || apEdges[i][aNext[i]].tick < tick))
+			{
+				list = i;
+				tick = apEdges[i][aNext[i]].tick;
+			}
+		}
+		if(list < 0)
+		{
+			break;
+		}
+
+		fprintf(fp, "#%llu\n", (unsigned long long)(tick * VCD_UNITS_PER_TICK));
+
+		for(int i = 0; i <= SIM_CHANNELS; i++)
+		{
+			while(aNext[i] < aCount[i] && apEdges[i][aNext[i]].tick == tick)
+			{
+				fprintf(fp, "%c%c\n", acLevel[apEdges[i][aNext[i]].level], acId[i]);
+				aNext[i]++;
+			}
+		}
+	}
+
+	fprintf(fp, "#%llu\n", (unsigned long long)(Tick * VCD_UNITS_PER_TICK));
+	fclose(fp);
+	return 0;
+}
+
+
+/**********************************************************************
+*
+*							HAL STUBS
+*
+**********************************************************************/
+
+HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef* htim)
+{
+	// the HAL generates an update (UG) so the shadow registers load at once
+	htim->Instance->ARR = htim->Init.Period;
+	htim->Instance->PSC = htim->Init.Prescaler;
+	htim->Instance->RCR = htim->Init.RepetitionCounter;
+	FindTimer(htim->Instance)->ShadowARR = htim->Init.Period;
+	FindTimer(htim->Instance)->Repetition = htim->Init.RepetitionCounter;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef* htim, TIM_ClockConfigTypeDef* sClockSourceConfig)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef* htim, TIM_MasterConfigTypeDef* sMasterConfig)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef* htim, TIM_OC_InitTypeDef* sConfig, uint32_t Channel)
+{
+	htim->Instance->CCR1 = sConfig->Pulse;
+	FindTimer(htim->Instance)->ShadowCCR1 = sConfig->Pulse;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef* htim, TIM_BreakDeadTimeConfigTypeDef* sBreakDeadTimeConfig)
+{
+	return HAL_OK;
+}
+
+/*********************************************************************
+*
+* StartTimer
+*
+* @brief	Start the counter, the first period begins now
+*
+* @param	pTimer - timer model
+*
+* @return	none
+*
+*********************************************************************/
+static void StartTimer(SIM_TIMER* pTimer)
+{
+	if(!pTimer->bRunning)
+	{
+		pTimer->bRunning = 1;
+		pTimer->Start = Tick;
+	}
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel)
+{
+	StartTimer(FindTimer(htim->Instance));
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_PWMN_Start(TIM_HandleTypeDef* htim, uint32_t Channel)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim)
+{
+	StartTimer(FindTimer(htim->Instance));
+	return HAL_OK;
+}
+
+void HAL_TIM_IRQHandler(TIM_HandleTypeDef* htim)
+{
+	htim->Instance->SR = 0;
+}
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef* hdma)
+{
+	hdma->State = HAL_DMA_STATE_READY;
+	FindDmaTimer(hdma->Instance)->pDma = hdma;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef* hdma, uint32_t SrcAddress, uint32_t DstAddress, uint32_t DataLength)
+{
+	if(hdma->State != HAL_DMA_STATE_READY)
+	{
+		return HAL_BUSY;
+	}
+
+	// the simulator is linked -no-pie so the static pattern buffers
+	// have 32 bit addresses, just like on the target
+	(void)DstAddress;
+
+	hdma->State = HAL_DMA_STATE_BUSY;
+	hdma->Length = DataLength;
+	hdma->HalfDone = 0;
+	FindDmaTimer(hdma->Instance)->pDmaSource = (const uint16_t*)(uintptr_t)SrcAddress;
+	hdma->Instance->NDTR = DataLength;
+	hdma->Instance->CR |= DMA_SxCR_EN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef* hdma)
+{
+	hdma->Instance->CR &= ~DMA_SxCR_EN;
+	hdma->State = HAL_DMA_STATE_READY;
+	return HAL_OK;
+}
+
+void HAL_DMA_IRQHandler(DMA_HandleTypeDef* hdma)
+{
+	SIM_TIMER* pTimer = FindDmaTimer(hdma->Instance);
+
+	if(pTimer->bDmaHalfFlag)
+	{
+		pTimer->bDmaHalfFlag = 0;
+		if(hdma->XferHalfCpltCallback)
+		{
+			hdma->XferHalfCpltCallback(hdma);
+		}
+	}
+
+	if(pTimer->bDmaCompleteFlag)
+	{
+		pTimer->bDmaCompleteFlag = 0;
+		hdma->State = HAL_DMA_STATE_READY;
+		if(hdma->XferCpltCallback)
+		{
+			hdma->XferCpltCallback(hdma);
+		}
+	}
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init)
+{
+	SIM_TIMER* pTimer;
+
+	for(int i = 0; i < SIM_CHANNELS; i++)
+	{
+		pTimer = &aTimer[i];
+		if(GPIOx == pTimer->pPort && (GPIO_Init->Pin & pTimer->pin))
+		{
+			// the level resumes with the next period
+			pTimer->bOutputEnabled = GPIO_Init->Mode == GPIO_MODE_AF_PP;
+			if(!pTimer->bOutputEnabled)
+			{
+				RecordLevel(pTimer, Tick, SL_OFF);
+			}
+		}
+	}
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if(GPIOx == &SimGPIOE && (GPIO_Pin & SCOPE_TRIGGER_PIN)
+		&& ((GPIOx->ODR & SCOPE_TRIGGER_PIN) != 0) != (PinState == GPIO_PIN_SET))
+	{
+		RecordScope(PinState == GPIO_PIN_SET);
+	}
+
+	if(PinState == GPIO_PIN_SET)
+	{
+		GPIOx->ODR |= GPIO_Pin;
+	}
+	else
+	{
+		GPIOx->ODR &= ~GPIO_Pin;
+	}
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	abIrqEnabled[IRQn] = 1;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	abIrqEnabled[IRQn] = 0;
+}
+
+void HAL_NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+	if(IRQn == CAN2_SCE_IRQn)
+	{
+		bWakePending = 1;
+	}
+}
+
+// time stamp for the Send error log (Arch/port.c reads the RTC)
+void GetCTime(char* time_buf)
+{
+	sprintf(time_buf, "tick %llu", (unsigned long long)Tick);
+}
+
+void Error_Handler(void)
+{
+	printf("Error_Handler called\n");
+	exit(2);
+}
+
+/*********************************************************************
+*
+* CMSIS-RTOS2 stand ins - the one host task waits by running the model
+*
+*********************************************************************/
+osThreadId_t osThreadGetId(void)
+{
+	return &bSimTask;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return &bSimTask;
+}
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+	ThreadFlags |= flags;
+	return ThreadFlags;
+}
+
+uint32_t osThreadFlagsClear(uint32_t flags)
+{
+	uint32_t previous = ThreadFlags;
+
+	ThreadFlags &= ~flags;
+	return previous;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+	uint32_t set;
+
+	while((ThreadFlags & flags) == 0)
+	{
+		if(timeout == 0 || !SimIsRunning())
+		{
+			return osFlagsErrorTimeout;
+		}
+		SimRun(SIM_TICKS_PER_OS_TICK);
+		if(timeout != osWaitForever)
+		{
+			timeout--;
+		}
+	}
+
+	set = ThreadFlags & flags;
+	ThreadFlags &= ~set;
+	return set;
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+	SimRun((uint64_t)ticks * SIM_TICKS_PER_OS_TICK);
+	return osOK;
+}
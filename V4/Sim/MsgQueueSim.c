@@ -0,0 +1,235 @@
+/*******************************************************************************
+* @file MsgQueueSim.c
+* @brief Host stress test for the command station event queue (MsgQueue.c)
+*
+* @details	Several producer threads queue events as fast as they can,
+*			one per virtual cab, while one consumer takes them off in
+*			batches the way CommandStationTask does. Every event carries
+*			its producer and a sequence number. A producer that finds
+*			the queue full counts a drop and tries again. The consumer
+*			checks that every event arrives once and in order for its
+*			producer, and that the queue statistics agree with the
+*			producers. The rate is printed with the drop count and the
+*			high water mark.
+*
+*			gcc -O2 -fcommon -pthread -ISim -IInc -ICS -ICS/Wangrow -o msgqueue_sim Sim/MsgQueueSim.c CS/MsgQueue.c
+*
+*			./msgqueue_sim
+*
+*			(run from the V4 directory, Sim/main.h stands in for the
+*			firmware one)
+*
+* @copyright	(c) 2019  all Rights Reserved.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "main.h"
+#include "MsgQueue.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define PRODUCERS		4
+#define EVENTS			2000000		// per producer
+
+// same batch as CommandStationTask
+#define BATCH			8
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static VIRTUAL_CAB aCabs[PRODUCERS];
+
+static uint32_t aSent[PRODUCERS];
+static uint32_t aRefused[PRODUCERS];
+static atomic_int ProducersDone;
+
+static uint32_t Failures;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/*********************************************************************
+*
+* SignalCommandStation
+*
+* @brief	The consumer polls, nothing to wake
+*
+*********************************************************************/
+void SignalCommandStation(uint32_t flags)
+{
+}
+
+
+/*********************************************************************
+*
+* NowNs
+*
+* @brief	Monotonic time
+*
+* @param	none
+*
+* @return	ns
+*
+*********************************************************************/
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/*********************************************************************
+*
+* Producer
+*
+* @brief	Queue EVENTS events numbered from 0 for one cab, a refused
+*			event is counted and queued again
+*
+* @param	argument - producer index
+*
+* @return	NULL
+*
+*********************************************************************/
+static void* Producer(void* argument)
+{
+	int producer = (int)(intptr_t)argument;
+	uint32_t i;
+
+	for(i = 0; i < EVENTS; i++)
+	{
+		while(!QueueMessage(MSG_CAB_KEY_MESSAGE, &aCabs[producer], (int)i))
+		{
+			aRefused[producer]++;
+			sched_yield();
+		}
+		aSent[producer]++;
+	}
+
+	atomic_fetch_add(&ProducersDone, 1);
+	return NULL;
+}
+
+
+/*********************************************************************
+*
+* main
+*
+* @brief	msgqueue_sim
+*
+*********************************************************************/
+int main(int argc, char *argv[])
+{
+	pthread_t aThreads[PRODUCERS];
+	EVENT_MESSAGE aMessages[BATCH];
+	MSG_QUEUE_STATS Stats;
+	int32_t aLast[PRODUCERS];
+	uint32_t aReceived[PRODUCERS];
+	uint32_t sent = 0;
+	uint32_t refused = 0;
+	uint32_t received = 0;
+	uint64_t start;
+	uint64_t ns;
+	int producer;
+	int count;
+	int i;
+
+	InitMessageQueue();
+
+	for(i = 0; i < PRODUCERS; i++)
+	{
+		aLast[i] = -1;
+		aReceived[i] = 0;
+	}
+
+	start = NowNs();
+	for(i = 0; i < PRODUCERS; i++)
+	{
+		pthread_create(&aThreads[i], NULL, Producer, (void*)(intptr_t)i);
+	}
+
+	while(1)
+	{
+		// read done first, everything queued before it is seen below
+		int done = atomic_load(&ProducersDone);
+
+		count = GetMessages(aMessages, BATCH);
+		for(i = 0; i < count; i++)
+		{
+			producer = aMessages[i].pMessagePointer - aCabs;
+			if(producer < 0 || producer >= PRODUCERS || aMessages[i].bMessageType != MSG_CAB_KEY_MESSAGE)
+			{
+				printf("bad event from producer %d\n", producer);
+				Failures++;
+				continue;
+			}
+			if(aMessages[i].nEvent != aLast[producer] + 1)
+			{
+				printf("producer %d: event %d after %d\n", producer, aMessages[i].nEvent, aLast[producer]);
+				Failures++;
+			}
+			aLast[producer] = aMessages[i].nEvent;
+			aReceived[producer]++;
+		}
+
+		if(count == 0)
+		{
+			if(done == PRODUCERS)
+			{
+				break;
+			}
+			sched_yield();
+		}
+	}
+	ns = NowNs() - start;
+
+	for(i = 0; i < PRODUCERS; i++)
+	{
+		pthread_join(aThreads[i], NULL);
+		if(aReceived[i] != aSent[i])
+		{
+			printf("producer %d: sent %u received %u\n", i, aSent[i], aReceived[i]);
+			Failures++;
+		}
+		sent += aSent[i];
+		refused += aRefused[i];
+		received += aReceived[i];
+	}
+
+	GetMessageQueueStats(&Stats);
+	if(Stats.queued != sent || Stats.dropped != refused || Stats.waiting != 0 || Stats.high_water > Stats.depth)
+	{
+		printf("statistics: queued %u dropped %u waiting %u most %u\n",
+			Stats.queued, Stats.dropped, Stats.waiting, Stats.high_water);
+		Failures++;
+	}
+
+	printf("%d producers, depth %u\n", PRODUCERS, Stats.depth);
+	printf("Received %u, dropped %u, most waiting %u\n", received, Stats.dropped, Stats.high_water);
+	printf("%.1f ns per event, %.1f M events/s\n", (double)ns / sent, (double)sent * 1000.0 / ns);
+
+	if(Failures)
+	{
+		printf("%u failures\n", Failures);
+		return 1;
+	}
+
+	printf("Order OK\n");
+	return 0;
+}
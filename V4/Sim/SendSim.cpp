@@ -0,0 +1,349 @@
+/*******************************************************************************
+* @file SendSim.cpp
+* @brief Host test program for the tester packet paths (Send_reg::send_*)
+*
+* @details	Drives the Send_reg methods the decoder tests use through
+*			Track.c and the TIM1/DMA model in HostHal.c, checks the half
+*			bit widths of each packet type against the clocks it was
+*			sent with, and writes the resulting track waveform as CSV
+*			and VCD. The CSV of a known good build is the reference
+*			for the next one:
+*
+*			mkdir -p lc; for f in Send/inc/*.h Send/src/*.h; do
+*				ln -sf $PWD/$f lc/`basename $f | tr A-Z a-z`; done
+*
+*			for f in HostHal Track IsrStats; do
+*				gcc -c -ISim -IInc -o $f.o `ls Sim/$f.c Src/$f.c 2>/dev/null`; done
+*
+*			g++ -no-pie -DSEND_VERSION=4 -ISim -Ilc -IInc -ISend/inc -ISend/src -IArch -o send_sim
+*				Sim/SendSim.cpp HostHal.o Track.o IsrStats.o Send/src/SEND_REG.cpp
+*				Send/src/SR_CORE.cpp Send/lib/BITS.cpp Send/lib/ZLOG.cpp
+*
+*			./send_sim -o send.csv -v send.vcd
+*			./send_sim -c send.csv
+*
+*			(run from the V4 directory; the Send sources include their
+*			headers in lower case, the lc links make that work on a case
+*			sensitive file system; the track sources are C, so they are
+*			compiled with gcc and only linked with g++)
+*
+* @copyright	(c) 2019  all Rights Reserved.
+*******************************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlog.h>
+#include <bits.h>
+#include <SEND_REG.h>
+#include "TrackSim.h"
+
+extern "C"
+{
+	#include "Track.h"
+};
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// long enough for the queued packets to drain
+#define SIM_DRAIN		(100000 * TICKS_PER_MICROSECOND)
+
+#define US(us)			((us) * TICKS_PER_MICROSECOND)
+
+// the bits at set_clk(200, 100, 116), a one is 58 us a half, a zero
+// 100 us
+#define ONE				SIM_BIT(US(116), US(58))
+#define ZERO			SIM_BIT(US(200), US(100))
+
+// a zero of send_stretched_byte(9900, 4950), 0T is 2 * 9900 - 200
+#define STRETCHED		SIM_BIT(US(19600), US(4950))
+
+#define BIT_COUNT(a)	(sizeof(a) / sizeof(a[0]))
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static Send_reg Sender;
+
+static uint32_t Failures;
+
+// what must reach the rails, each run starts at a known bit
+
+// the idle packet of set_clk, from the packet start bit
+static const SIM_BIT aIdleBits[] =
+{
+	ONE, ZERO, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE,
+	ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO,
+	ZERO, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE,
+};
+
+// 0x7e, the zeros stretched, from the end of the preamble
+static const SIM_BIT aStretchedBits[] =
+{
+	ONE, STRETCHED, STRETCHED, ONE, ONE, ONE, ONE, ONE, ONE, STRETCHED, STRETCHED,
+};
+
+// 0x54 after one 300/100 zero, then the interbyte zero
+static const SIM_BIT aAmbig1Bits[] =
+{
+	SIM_BIT(US(300), US(100)), ZERO, ONE, ZERO, ONE, ZERO, ONE, ZERO, SIM_BIT(US(300), US(100)),
+};
+
+// 0x3c after a 200/50 and a 200/150 zero, then the interbyte zero
+static const SIM_BIT aAmbig2Bits[] =
+{
+	SIM_BIT(US(200), US(50)), SIM_BIT(US(200), US(150)), ONE, ONE, ONE, ONE, ZERO, ZERO,
+	SIM_BIT(US(200), US(50)),
+};
+
+// the marginal clocks, the last preamble bit and the start bit
+static const SIM_BIT aShortBits[] = { SIM_BIT(US(104), US(52)), SIM_BIT(US(180), US(90)) };
+static const SIM_BIT aLongBits[] = { SIM_BIT(US(128), US(64)), SIM_BIT(US(240), US(160)) };
+
+// the end of the preamble bytes, then 0x03 with its first zero
+// stretched, 0x3a and 0x1d, MSB first and unframed
+static const SIM_BIT aSequenceBits[] =
+{
+	ONE, ONE, STRETCHED, ZERO, ZERO, ZERO, ZERO, ZERO, ONE, ONE,
+	ZERO, ZERO, ONE, ONE, ONE, ZERO, ONE, ZERO,
+	ZERO, ZERO, ZERO, ONE, ONE, ONE, ZERO, ONE,
+};
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/*********************************************************************
+*
+* Check
+*
+* @brief	Count a failed send
+*
+* @param	result - Send_reg result
+*			name - what was sent
+*
+* @return	none
+*
+*********************************************************************/
+static void Check(Rslt_t result, const char* name)
+{
+	if(result != OK)
+	{
+		printf("%s failed\n", name);
+		Failures++;
+	}
+}
+
+
+/*********************************************************************
+*
+* CheckBits
+*
+* @brief	Count a waveform without the expected bit widths
+*
+* @param	first - main track edge to look from
+*			pBits - the bits expected
+*			count - number of bits
+*			name - what was sent
+*
+* @return	none
+*
+*********************************************************************/
+static void CheckBits(uint32_t first, const SIM_BIT* pBits, uint32_t count, const char* name)
+{
+	if(SimFindBits(SIM_MAIN, first, pBits, count) != 0)
+	{
+		printf("%s bit widths wrong\n", name);
+		Failures++;
+	}
+}
+
+
+/*********************************************************************
+*
+* RunScenario
+*
+* @brief	Send the packet types the decoder tests use
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void RunScenario(void)
+{
+	Bits Packet(20);
+	uint32_t first;
+
+	Check(Sender.init_send(), "init_send");
+	Check(Sender.start_clk(), "start_clk");
+
+	// nominal clocks, this also sends an idle packet
+	first = SimGetEdgeCount();
+	Check(Sender.set_clk(200, 100, 116), "set_clk");
+
+	Check(Sender.send_rst(), "send_rst");
+	Check(Sender.send_idle(), "send_idle");
+	Check(Sender.send_base(), "send_base");
+	Check(Sender.send_bytes(3, 0x55, "bytes"), "send_bytes");
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aIdleBits, BIT_COUNT(aIdleBits), "idle");
+
+	// stretched and ambiguous zero bits
+	first = SimGetEdgeCount();
+	Sender.set_scope(true);
+	Check(Sender.send_stretched_byte(9900, 4950, 0x7e, "stretched"), "send_stretched_byte");
+	Check(Sender.send_1_ambig_bit(300, 100, 0x54, "ambig 1"), "send_1_ambig_bit");
+	Check(Sender.send_2_ambig_bits(200, 50, 200, 150, 0x3c, "ambig 2"), "send_2_ambig_bits");
+	Sender.set_scope(false);
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aStretchedBits, BIT_COUNT(aStretchedBits), "stretched");
+	CheckBits(first, aAmbig1Bits, BIT_COUNT(aAmbig1Bits), "ambig 1");
+	CheckBits(first, aAmbig2Bits, BIT_COUNT(aAmbig2Bits), "ambig 2");
+
+	// packets built bit by bit, they reach the rails bit for bit
+	Packet.clr_in().put_idle_pkt();
+	Check(Sender.send_pkt(Packet, "idle bits"), "send_pkt(Bits)");
+
+	// odd preamble, speed packet for loco 3
+	Packet.clr_in().put_1s(13).put_0s(1).put_byte(0x03).put_0s(1).put_byte(0x74);
+	Packet.put_0s(1).put_byte(0x77).put_1s(1).done();
+	Check(Sender.send_pkt(Packet, "short preamble"), "send_pkt(Bits)");
+
+	// the same packet cut off in the middle of the second byte
+	Packet.truncate(26);
+	Check(Sender.send_pkt(Packet, "truncated"), "send_pkt(Bits)");
+
+	// a flipped bit in the address, then with 0 and 1 swapped
+	Packet.clr_in().put_1s(14).put_0s(1).put_byte(0x03).put_0s(1).put_byte(0x74);
+	Packet.put_0s(1).put_byte(0x77).put_1s(1).done();
+	Check(Packet.set_flip(20), "set_flip");
+	Check(Sender.send_pkt(Packet, "flipped"), "send_pkt(Bits)");
+	Packet.clr_flip();
+	Sender.set_swap_0_1(true);
+	Check(Sender.send_pkt(Packet, "swapped"), "send_pkt(Bits)");
+	Sender.set_swap_0_1(false);
+
+	// marginal clocks
+	first = SimGetEdgeCount();
+	Check(Sender.set_clk(180, 90, 104), "set_clk");
+	Check(Sender.send_base(), "send_base");
+	Check(Sender.set_clk(240, 160, 128), "set_clk");
+	Check(Sender.send_base(), "send_base");
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aShortBits, BIT_COUNT(aShortBits), "short clocks");
+	CheckBits(first, aLongBits, BIT_COUNT(aLongBits), "long clocks");
+
+	// a packet in pieces is one unframed pattern, the alternating bits
+	// fill more than one
+	first = SimGetEdgeCount();
+	Check(Sender.set_clk(200, 100, 116), "set_clk");
+	Sender.set_scope(true);
+	Check(Sender.start_seq(), "start_seq");
+	Check(Sender.send_raw_bytes(12, 0x55, "alternating"), "send_raw_bytes");
+	Check(Sender.send_raw_bytes(2, 0xff, "preamble"), "send_raw_bytes");
+	Check(Sender.send_raw_stretched_byte(9900, 4950, 0x03, "stretched"), "send_raw_stretched_byte");
+	Check(Sender.send_raw_bytes(1, 0x3a, "packet"), "send_raw_bytes");
+	Check(Sender.send_raw_bytes(1, 0x1d, "packet"), "send_raw_bytes");
+	Check(Sender.end_seq(), "end_seq");
+	Sender.set_scope(false);
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aSequenceBits, BIT_COUNT(aSequenceBits), "sequence");
+}
+
+
+/*********************************************************************
+*
+* main
+*
+* @brief	send_sim [-o edges.csv] [-v edges.vcd] [-c reference.csv]
+*
+*********************************************************************/
+int main(int argc, char *argv[])
+{
+	const char* pOutput = NULL;
+	const char* pVcd = NULL;
+	const char* pReference = NULL;
+	int ret = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			pOutput = argv[++i];
+		}
+		else if(strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+		{
+			pVcd = argv[++i];
+		}
+		else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			pReference = argv[++i];
+		}
+		else
+		{
+			printf("Usage: %s [-o edges.csv] [-v edges.vcd] [-c reference.csv]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	SimReset();
+	MainTrackConfig();
+
+	RunScenario();
+
+	if(!IsPacketComplete())
+	{
+		printf("Track did not drain\n");
+		ret = 1;
+	}
+
+	if(Failures)
+	{
+		ret = 1;
+	}
+
+	printf("Edges:       %u\n", SimGetEdgeCount());
+	printf("Interrupts:  %u\n", SimGetInterruptCount());
+	printf("Ticks:       %llu\n", (unsigned long long)SimGetTick());
+
+	if(pOutput && SimWriteCsv(pOutput) != 0)
+	{
+		printf("Can't write %s\n", pOutput);
+		ret = 1;
+	}
+
+	if(pVcd && SimWriteVcd(pVcd) != 0)
+	{
+		printf("Can't write %s\n", pVcd);
+		ret = 1;
+	}
+
+	if(pReference)
+	{
+		if(SimCompareCsv(pReference) == 0)
+		{
+			printf("Edges match %s\n", pReference);
+		}
+		else
+		{
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
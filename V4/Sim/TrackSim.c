@@ -0,0 +1,607 @@
+/*******************************************************************************
+* @file TrackSim.c
+* @brief Host test program for the DCC track output (Track.c)
+*
+* @details	Runs the packet producers (BuildPacket, BuildPacketBytes,
+*			BuildPacketAmbig1/2, BuildPacketBits, BuildPacketStream)
+*			against the TIM1/DMA model in HostHal.c and records the
+*			edges the timer puts on the rails, the half bit widths of
+*			each producer are checked against the timing it was given.
+*			Service mode packets go
+*			out on the TIM8 programming track at the same time, they
+*			must not disturb the main track. At the end the tester and
+*			the command station share the main track through the
+*			arbiter. Track.c is compiled once
+*			per output mode and the edge list of one build is checked
+*			against the other:
+*
+*			gcc -no-pie -ISim -IInc -o track_isr Sim/TrackSim.c Sim/HostHal.c Src/Track.c Src/IsrStats.c
+*			gcc -no-pie -DTRACK_DMA_BURST -ISim -IInc -o track_dma Sim/TrackSim.c Sim/HostHal.c Src/Track.c Src/IsrStats.c
+*
+*			./track_isr -o isr.csv -p prog.csv -v isr.vcd
+*			./track_dma -c isr.csv -q prog.csv
+*
+*			(run from the V4 directory, -no-pie keeps the static buffers
+*			at 32 bit addresses for the DMA model)
+*
+* @copyright	(c) 2019  all Rights Reserved.
+*******************************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Track.h"
+#include "TrackSim.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// os ticks to wait for a free packet slot
+#define SIM_SLOT_TIMEOUT	1000
+
+// long enough for the longest test packet to drain
+#define SIM_DRAIN		(100000 * TICKS_PER_MICROSECOND)
+
+// queue a packet, waiting for a ring slot like the tester does
+#define SIM_SEND(call)	while((call) == 1) { SimSlotWait(); }
+
+// packets the tester and the command station race for the track with
+#define SIM_SHARED_PACKETS	100
+
+#define US(us)				((us) * TICKS_PER_MICROSECOND)
+
+// the nominal bits, a one is 58 us a half, a zero 100 us
+#define ONE					SIM_BIT(US(116), US(58))
+#define ZERO				SIM_BIT(US(200), US(100))
+
+#define BIT_COUNT(a)		(sizeof(a) / sizeof(a[0]))
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+static void SimSlotWait(void);
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static const uint8_t abIdle[] = { 0xff, 0x00, 0xff };
+static const uint8_t abReset[] = { 0x00, 0x00, 0x00 };
+static const uint8_t abSpeed[] = { 0x03, 0x74, 0x77 };
+static const uint8_t abLong[] = { 0xc1, 0x23, 0x3f, 0x9f, 0x00, 0x62 };
+
+// direct mode write and verify of CV 1 = 3
+static const uint8_t abWriteCV[] = { 0x7c, 0x00, 0x03, 0x7f };
+static const uint8_t abVerifyCV[] = { 0x74, 0x00, 0x03, 0x77 };
+
+// speed packets for loco 5 and loco 9, one per resource
+static const uint8_t abTester[] = { 0x05, 0x74, 0x71 };
+static const uint8_t abCommandStation[] = { 0x09, 0x68, 0x61 };
+
+// raw stream, 12 bit preamble idle packet (as sent by Send_reg)
+static const uint8_t abStream[] = { 0xff, 0xf7, 0xf8, 0x01, 0xff };
+
+static uint32_t SlotWaits;
+static uint32_t BurstGaps;
+static uint32_t ProgFailures;
+static uint32_t ArbiterFailures;
+static uint32_t TimingFailures;
+
+// who queued each shared packet, T = tester, C = command station
+static char szTurns[SIM_SHARED_PACKETS + 1];
+
+static const PACKET_BITS apStretched[] =
+{
+//	 period							count	pulse
+	{ONE_PERIOD,					13,		ONE_PULSE},
+	{ZERO_PERIOD * 4,				0,		ZERO_PULSE * 4},
+	{ONE_PERIOD,					7,		ONE_PULSE},
+	{0,								0,		0},
+};
+
+// what must reach the rails, each run starts at a known bit
+
+// the idle packet, from the packet start bit
+static const SIM_BIT aIdleBits[] =
+{
+	ONE, ZERO, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE,
+	ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO, ZERO,
+	ZERO, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE, ONE,
+};
+
+// the speed packet at the marginal timings, the last preamble bit, the
+// start bit and the address 3, LSB first as the encoder sends it
+static const SIM_BIT aShortBits[] =
+{
+	SIM_BIT(US(104), US(52)), SIM_BIT(US(180), US(90)),
+	SIM_BIT(US(104), US(52)), SIM_BIT(US(104), US(52)), SIM_BIT(US(180), US(90)), SIM_BIT(US(180), US(90)),
+	SIM_BIT(US(180), US(90)), SIM_BIT(US(180), US(90)), SIM_BIT(US(180), US(90)), SIM_BIT(US(180), US(90)),
+};
+static const SIM_BIT aLongBits[] =
+{
+	SIM_BIT(US(128), US(64)), SIM_BIT(US(240), US(160)),
+	SIM_BIT(US(128), US(64)), SIM_BIT(US(128), US(64)), SIM_BIT(US(240), US(160)), SIM_BIT(US(240), US(160)),
+	SIM_BIT(US(240), US(160)), SIM_BIT(US(240), US(160)), SIM_BIT(US(240), US(160)), SIM_BIT(US(240), US(160)),
+};
+
+// BuildPacketAmbig1, the first zero of the byte replaced by the
+// ambiguous one, which is the interbyte bit as well
+static const SIM_BIT aStretchedBits[] =
+{
+	SIM_BIT(US(9900), US(4950)), ONE, ONE, ONE, ONE, ONE, ONE, ONE, SIM_BIT(US(9900), US(4950)),
+};
+static const SIM_BIT aAmbig1Bits[] =
+{
+	SIM_BIT(US(300), US(100)), ZERO, ONE, ZERO, ONE, ZERO, ONE, ZERO, SIM_BIT(US(300), US(100)),
+};
+
+// BuildPacketAmbig2, the first two zeros replaced, the first ambiguous
+// zero is the interbyte bit
+static const SIM_BIT aAmbig2Bits[] =
+{
+	SIM_BIT(US(200), US(50)), SIM_BIT(US(200), US(150)), ONE, ONE, ONE, ONE, ONE, ONE,
+	SIM_BIT(US(200), US(50)),
+};
+static const SIM_BIT aAmbig2LongBits[] =
+{
+	SIM_BIT(US(1200), US(600)), SIM_BIT(US(400), US(200)), ZERO, ZERO, ZERO, ZERO, ZERO, ONE,
+	SIM_BIT(US(1200), US(600)),
+};
+
+// apStretched as preloaded
+static const SIM_BIT aPreloadedBits[] =
+{
+	ONE, ONE, SIM_BIT(ZERO_PERIOD * 4, ZERO_PULSE * 4), ONE, ONE,
+};
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/*********************************************************************
+*
+* SimSlotWait
+*
+* @brief	Wait for the track output to free a packet slot
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void SimSlotWait(void)
+{
+	SlotWaits++;
+	if(WaitForPacketSlot(SIM_SLOT_TIMEOUT) != 0)
+	{
+		printf("Timed out waiting for a packet slot\n");
+		exit(1);
+	}
+}
+
+
+/*********************************************************************
+*
+* CheckBits
+*
+* @brief	Count a main track waveform without the expected bit widths
+*
+* @param	first - main track edge to look from
+*			pBits - the bits expected
+*			count - number of bits
+*			name - what was sent
+*
+* @return	none
+*
+*********************************************************************/
+static void CheckBits(uint32_t first, const SIM_BIT* pBits, uint32_t count, const char* name)
+{
+	if(SimFindBits(SIM_MAIN, first, pBits, count) != 0)
+	{
+		printf("%s bit widths wrong\n", name);
+		TimingFailures++;
+	}
+}
+
+
+/*********************************************************************
+*
+* SendProg
+*
+* @brief	Queue a service mode sequence on the programming track, the
+*			resets and the instruction packets of S-9.2.3 fill the ring,
+*			so nothing waits and the main track producer keeps its timing
+*
+* @param	pointer to the instruction packet
+*			length
+*
+* @return	none
+*
+*********************************************************************/
+static void SendProg(const uint8_t* pPacket, uint8_t len)
+{
+	for(int i = 0; i < 3; i++)
+	{
+		if(BuildChannelPacket(TC_PROG, abReset, sizeof(abReset), 116, 200, 100) != 0)
+		{
+			ProgFailures++;
+		}
+	}
+	for(int i = 0; i < TRACK_PACKET_SLOTS - 3; i++)
+	{
+		if(BuildChannelPacket(TC_PROG, pPacket, len, 116, 200, 100) != 0)
+		{
+			ProgFailures++;
+		}
+	}
+}
+
+
+/*********************************************************************
+*
+* RunScenario
+*
+* @brief	Feed every packet producer through the track output
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void RunScenario(void)
+{
+	uint32_t first = SimGetEdgeCount();
+
+	// the programming track runs alongside the main track
+	SendProg(abWriteCV, sizeof(abWriteCV));
+
+	// back to back packets, the second waits for a free buffer
+	SIM_SEND(BuildPacket(abIdle, sizeof(abIdle), 116, 200, 100));
+	SIM_SEND(BuildPacket(abSpeed, sizeof(abSpeed), 116, 200, 100));
+	SIM_SEND(BuildPacket(abReset, sizeof(abReset), 116, 200, 100));
+	SIM_SEND(BuildPacket(abLong, sizeof(abLong), 116, 200, 100));
+
+	// marginal bit timings
+	SIM_SEND(BuildPacket(abSpeed, sizeof(abSpeed), 104, 180, 90));
+	SIM_SEND(BuildPacket(abSpeed, sizeof(abSpeed), 128, 240, 160));
+
+	// let the tracks go dark, then restart them
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aIdleBits, BIT_COUNT(aIdleBits), "idle");
+	CheckBits(first, aShortBits, BIT_COUNT(aShortBits), "short timing");
+	CheckBits(first, aLongBits, BIT_COUNT(aLongBits), "long timing");
+	first = SimGetEdgeCount();
+
+	SendProg(abVerifyCV, sizeof(abVerifyCV));
+
+	SIM_SEND(BuildPacketBytes(0x00, 2, 116, 200, 100));
+	SIM_SEND(BuildPacketBytes(0xff, 3, 116, 200, 100));
+	SIM_SEND(BuildPacketBytes(0x55, 5, 116, 200, 100));
+
+	// stretched and ambiguous zero bits
+	SIM_SEND(BuildPacketAmbig1(0xfe, 116, 9900, 4950, 200, 100));
+	SIM_SEND(BuildPacketAmbig1(0x54, 116, 300, 100, 200, 100));
+	SIM_SEND(BuildPacketAmbig2(0xfc, 116, 200, 50, 200, 150, 200, 100));
+	SIM_SEND(BuildPacketAmbig2(0x80, 116, 1200, 600, 400, 200, 200, 100));
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aStretchedBits, BIT_COUNT(aStretchedBits), "stretched");
+	CheckBits(first, aAmbig1Bits, BIT_COUNT(aAmbig1Bits), "ambig 1");
+	CheckBits(first, aAmbig2Bits, BIT_COUNT(aAmbig2Bits), "ambig 2");
+	CheckBits(first, aAmbig2LongBits, BIT_COUNT(aAmbig2LongBits), "long ambig 2");
+	first = SimGetEdgeCount();
+
+	// preloaded bit patterns
+	SIM_SEND(BuildPacketBits(apStretched, sizeof(apStretched) / sizeof(apStretched[0]) - 1));
+	SIM_SEND(BuildPacket(abIdle, sizeof(abIdle), 116, 200, 100));
+
+	// raw bit streams, whole and cut short, then with 0 and 1 swapped
+	SIM_SEND(BuildPacketStream(abStream, sizeof(abStream) * 8, 0, 116, 200, 100));
+	SIM_SEND(BuildPacketStream(abStream, 29, 0, 116, 200, 100));
+	SIM_SEND(BuildPacketStream(abStream, sizeof(abStream) * 8, 1, 116, 200, 100));
+
+	SimRun(SIM_DRAIN);
+	CheckBits(first, aPreloadedBits, BIT_COUNT(aPreloadedBits), "preloaded");
+
+	// a burst longer than the packet ring, the producer has to wait but
+	// the track must not go dark until the burst is done
+	first = SimGetEdgeCount();
+	for(int i = 0; i < TRACK_PACKET_SLOTS * 3; i++)
+	{
+		SIM_SEND(BuildPacket(abSpeed, sizeof(abSpeed), 116, 200, 100));
+	}
+	for(uint32_t i = first; i < SimGetEdgeCount(); i++)
+	{
+		if(SimGetEdges()[i].level == SL_OFF)
+		{
+			BurstGaps++;
+		}
+	}
+
+	SimRun(SIM_DRAIN);
+}
+
+
+/*********************************************************************
+*
+* RunArbiterScenario
+*
+* @brief	Let the tester and the command station both try to queue a
+*			packet at every opportunity, the arbiter has to hand out the
+*			turns by their shares and keep a critical section together
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void RunArbiterScenario(void)
+{
+	TRACK_LOCK Tester, CommandStation;
+	uint32_t sent = 0;
+	uint32_t shared = 0;
+
+	OpenTrack(TR_TESTER, TI_NONE, 0);
+	OpenTrack(TR_COMMAND_STATION, TI_NONE, 0);
+
+	// both always have a packet ready, and both ask every time round
+	while(sent < SIM_SHARED_PACKETS)
+	{
+		uint8_t queued = 0;
+
+		if(IsTrackTurn(TR_TESTER))
+		{
+			BuildPacket(abTester, sizeof(abTester), 116, 200, 100);
+			szTurns[sent++] = 'T';
+			queued = 1;
+		}
+		if(sent < SIM_SHARED_PACKETS && IsTrackTurn(TR_COMMAND_STATION))
+		{
+			BuildPacket(abCommandStation, sizeof(abCommandStation), 116, 200, 100);
+			szTurns[sent++] = 'C';
+			queued = 1;
+		}
+		if(!queued)
+		{
+			SimSlotWait();
+		}
+	}
+
+	// the command station still has its packet ready, let it go
+	while(!IsTrackTurn(TR_COMMAND_STATION))
+	{
+		SimSlotWait();
+	}
+	BuildPacket(abCommandStation, sizeof(abCommandStation), 116, 200, 100);
+
+	// a packet sent in pieces, the command station has to stay out
+	if(EnterTrackCritical(TR_TESTER, SIM_SLOT_TIMEOUT) != 0)
+	{
+		ArbiterFailures++;
+	}
+	for(int i = 0; i < 3; i++)
+	{
+		if(IsTrackTurn(TR_COMMAND_STATION))
+		{
+			ArbiterFailures++;
+			BuildPacket(abCommandStation, sizeof(abCommandStation), 116, 200, 100);
+		}
+		SIM_SEND(BuildPacketBytes(abTester[i], 1, 116, 200, 100));
+	}
+	ExitTrackCritical(TR_TESTER);
+
+	// and gets the next turn, it has earned it
+	if(!IsTrackTurn(TR_COMMAND_STATION))
+	{
+		SimSlotWait();
+	}
+	if(IsTrackTurn(TR_COMMAND_STATION))
+	{
+		BuildPacket(abCommandStation, sizeof(abCommandStation), 116, 200, 100);
+	}
+	else
+	{
+		ArbiterFailures++;
+	}
+
+	SimRun(SIM_DRAIN);
+
+	GetTrackLock(TR_TESTER, &Tester);
+	GetTrackLock(TR_COMMAND_STATION, &CommandStation);
+	printf("Turns:        %s\n", szTurns);
+	printf("Shared:       tester %u, command station %u packets\n", Tester.packets, CommandStation.packets);
+
+	// while the ring has room both get through, once it is full the
+	// shares (80 / 20) decide
+	for(int i = SIM_SHARED_PACKETS / 2; i < SIM_SHARED_PACKETS; i++)
+	{
+		if(szTurns[i] == 'C')
+		{
+			shared++;
+		}
+	}
+	if(shared != SIM_SHARED_PACKETS / 10)
+	{
+		printf("Command station got %u of the last %u turns\n", shared, SIM_SHARED_PACKETS / 2);
+		ArbiterFailures++;
+	}
+
+	CloseTrack(TR_TESTER);
+	CloseTrack(TR_COMMAND_STATION);
+}
+
+
+/*********************************************************************
+*
+* main
+*
+* @brief	track_sim [-o edges.csv] [-p prog.csv] [-v edges.vcd]
+*					[-c reference.csv] [-q prog reference.csv]
+*
+*********************************************************************/
+int main(int argc, char *argv[])
+{
+	const char* pOutput = NULL;
+	const char* pVcd = NULL;
+	const char* pReference = NULL;
+	const char* pProgOutput = NULL;
+	const char* pProgReference = NULL;
+	TRACK_STATS Stats;
+	ISR_STATS IsrStats;
+	int ret = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			pOutput = argv[++i];
+		}
+		else if(strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+		{
+			pVcd = argv[++i];
+		}
+		else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			pReference = argv[++i];
+		}
+		else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+		{
+			pProgOutput = argv[++i];
+		}
+		else if(strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+		{
+			pProgReference = argv[++i];
+		}
+		else
+		{
+			printf("Usage: %s [-o edges.csv] [-p prog.csv] [-v edges.vcd] [-c reference.csv] [-q prog.csv]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	SimReset();
+	MainTrackConfig();
+	ProgTrackConfig();
+
+	RunScenario();
+	RunArbiterScenario();
+
+	if(!IsPacketComplete())
+	{
+		printf("Track did not drain\n");
+		ret = 1;
+	}
+
+	if(!IsChannelPacketComplete(TC_PROG) || GetTrackChannelState(TC_PROG))
+	{
+		printf("Programming track did not drain\n");
+		ret = 1;
+	}
+
+	if(ProgFailures)
+	{
+		printf("%u programming track packets not queued\n", ProgFailures);
+		ret = 1;
+	}
+
+	#ifdef TRACK_DMA_BURST
+		printf("Mode:        DMA burst\n");
+	#else
+		printf("Mode:        update interrupt\n");
+	#endif
+	printf("Edges:       %u\n", SimGetEdgeCount());
+	printf("Interrupts:  %u\n", SimGetInterruptCount());
+	printf("Ticks:       %llu\n", (unsigned long long)SimGetTick());
+	printf("Slot waits:  %u\n", SlotWaits);
+
+	GetTrackStats(&Stats);
+	printf("Cache hits:   %u\n", Stats.cache_hits);
+	printf("Cache misses: %u\n", Stats.cache_misses);
+
+	if(GetTrackIsrStats(&IsrStats) == 0)
+	{
+		printf("ISR samples:  %u, max latency %u cycles\n", IsrStats.latency.count, IsrStats.latency.max);
+	}
+
+	GetChannelStats(TC_PROG, &Stats);
+	printf("Prog edges:   %u\n", SimGetChannelEdgeCount(SIM_PROG));
+	printf("Prog packets: %u, cache hits %u, misses %u\n", Stats.packets, Stats.cache_hits, Stats.cache_misses);
+
+	if(GetChannelIsrStats(TC_PROG, &IsrStats) == 0)
+	{
+		printf("Prog ISR:     %u samples, max latency %u cycles\n", IsrStats.latency.count, IsrStats.latency.max);
+	}
+
+	if(ArbiterFailures)
+	{
+		printf("Track arbiter failed %u checks\n", ArbiterFailures);
+		ret = 1;
+	}
+
+	if(TimingFailures)
+	{
+		printf("%u bit width checks failed\n", TimingFailures);
+		ret = 1;
+	}
+
+	if(BurstGaps)
+	{
+		printf("Track went dark %u times during the burst\n", BurstGaps);
+		ret = 1;
+	}
+
+	if(pOutput && SimWriteCsv(pOutput) != 0)
+	{
+		printf("Can't write %s\n", pOutput);
+		ret = 1;
+	}
+
+	if(pProgOutput && SimWriteChannelCsv(SIM_PROG, pProgOutput) != 0)
+	{
+		printf("Can't write %s\n", pProgOutput);
+		ret = 1;
+	}
+
+	if(pVcd && SimWriteVcd(pVcd) != 0)
+	{
+		printf("Can't write %s\n", pVcd);
+		ret = 1;
+	}
+
+	if(pReference)
+	{
+		if(SimCompareCsv(pReference) == 0)
+		{
+			printf("Edges match %s\n", pReference);
+		}
+		else
+		{
+			ret = 1;
+		}
+	}
+
+	if(pProgReference)
+	{
+		if(SimCompareChannelCsv(SIM_PROG, pProgReference) == 0)
+		{
+			printf("Prog edges match %s\n", pProgReference);
+		}
+		else
+		{
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
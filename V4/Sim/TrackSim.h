@@ -0,0 +1,107 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	TrackSim.h
+*
+* DATE CREATED:		5/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Host model of the track timers (TIM1 for the main track,
+*				TIM8 for the programming track) and their update DMA
+*				streams. The model advances each timer one PWM period at
+*				a time, latches the preload registers at each update
+*				event, runs the update interrupt or the DMA burst just
+*				like the hardware, and records every edge of both track
+*				outputs (and of the scope trigger) for CSV and VCD output.
+*
+* COPYRIGHT (c) 2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef TRACK_SIM_H
+#define TRACK_SIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+/** @enum SIM_CHANNEL
+	@brief The modeled track outputs (same order as TRACK_CHANNEL)
+ */
+typedef enum
+{
+	SIM_MAIN,		// TIM1
+	SIM_PROG,		// TIM8
+	SIM_CHANNELS,
+} SIM_CHANNEL;
+
+/** @enum SIM_LEVEL
+	@brief Track output level of an edge
+ */
+typedef enum
+{
+	SL_LOW,
+	SL_HIGH,
+	SL_OFF,			// output disabled (pins switched back to GPIO)
+} SIM_LEVEL;
+
+/** @struct SIM_EDGE
+	@brief One recorded track output edge
+ */
+typedef struct sim_edge_t
+{
+	uint64_t	tick;		// timer ticks since reset
+	uint8_t		level;		// one of SIM_LEVEL
+} SIM_EDGE;
+
+/** @struct SIM_BIT
+	@brief Expected widths of one bit on the rails, in timer ticks
+ */
+typedef struct sim_bit_t
+{
+	uint32_t	high;		// first half
+	uint32_t	low;		// second half
+} SIM_BIT;
+
+// the bit a PACKET_BITS period and pulse put on the rails, PWM mode 1
+// counts ARR + 1 ticks a period, the second half has the extra tick
+#define SIM_BIT(period, pulse)	{ (pulse), (period) - (pulse) + 1 }
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern void SimReset(void);
+
+extern void SimRun(uint64_t ticks);
+
+extern uint64_t SimGetTick(void);
+
+extern uint32_t SimGetEdgeCount(void);
+extern const SIM_EDGE* SimGetEdges(void);
+extern uint32_t SimGetChannelEdgeCount(SIM_CHANNEL ch);
+extern const SIM_EDGE* SimGetChannelEdges(SIM_CHANNEL ch);
+extern int SimFindBits(SIM_CHANNEL ch, uint32_t first, const SIM_BIT* pBits, uint32_t count);
+
+extern uint32_t SimGetInterruptCount(void);
+
+extern int SimWriteCsv(const char* name);
+extern int SimCompareCsv(const char* name);
+extern int SimWriteChannelCsv(SIM_CHANNEL ch, const char* name);
+extern int SimCompareChannelCsv(SIM_CHANNEL ch, const char* name);
+extern int SimWriteVcd(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,445 @@
+/*******************************************************************************
+* @file TrakListSim.c
+* @brief Host benchmark for the loco refresh scheduler (TrakList.c)
+*
+* @details	Fills the roster with 8 to MAX_LOCOS locos and runs the
+*			HandlePackets loco pass against it: a throttle change every
+*			few packets (MakeMostRecentLoco) and NextLocoMsg for every
+*			packet. The time per packet is printed next to the same
+*			pass on the linked list the scheduler used to keep, a
+*			linear FindByKey per throttle change. The order is checked
+*			too: a promoted loco goes next, a speed change goes ahead of
+*			a function change, even one of a loco already waiting, every
+*			loco gets a packet in each round, and no address gets a
+*			packet less than ADDRESS_SPACING_US after its last one.
+*
+*			gcc -O2 -fcommon -ISim -IInc -ICS -ICS/Wangrow -o traklist_sim Sim/TrakListSim.c CS/TrakList.c CS/LinkedList.c
+*
+*			./traklist_sim
+*
+*			(run from the V4 directory, Sim/main.h stands in for the
+*			firmware one)
+*
+* @copyright	(c) 2019  all Rights Reserved.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "LinkedList.h"
+#include "TrakList.h"
+#include "Loco.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+#define PACKETS			2000000
+
+// a throttle change every this many packets
+#define CHANGE_EVERY	4
+
+// track time of a packet, a loco packet is about this long
+#define PACKET_US		5000
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+Loco ActiveLocos[MAX_LOCOS];
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+// the old scheduler, a singly linked list searched by address
+static Link aListLinks[MAX_LOCOS];
+static LList ListLocos;
+static ListIterator ListSequence;
+static word ListFree;
+
+static uint32_t SimClock;
+
+static uint32_t Failures;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/*********************************************************************
+*
+* NowNs
+*
+* @brief	Monotonic time
+*
+* @param	none
+*
+* @return	ns
+*
+*********************************************************************/
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/*********************************************************************
+*
+* ListPromote
+*
+* @brief	MakeMostRecentLoco as it was on the linked list
+*
+* @param	pLoco - loco that changed
+*
+* @return	none
+*
+*********************************************************************/
+static void ListPromote(Loco* pLoco)
+{
+	ListIterator Iter;
+	Link* pLink;
+
+	Iter.m_List = &ListLocos;
+	if((pLink = FindByKey(&Iter, pLoco->Address)) == NULL)
+	{
+		pLink = &aListLinks[ListFree++];
+		pLink->m_index = pLoco;
+		pLink->m_key = pLoco->Address;
+		InsertAtTop(&ListLocos, pLink);
+	}
+	else
+	{
+		BringToTop(&ListLocos, pLink);
+	}
+	First(&ListSequence);
+}
+
+
+/*********************************************************************
+*
+* ListNext
+*
+* @brief	NextLocoMsg as it was on the linked list
+*
+* @param	none
+*
+* @return	the loco for the next packet
+*
+*********************************************************************/
+static Loco* ListNext(void)
+{
+	Link* pLink;
+
+	if((pLink = Next(&ListSequence)) == NULL)
+	{
+		pLink = First(&ListSequence);
+	}
+	return pLink ? (Loco*)pLink->m_index : NULL;
+}
+
+
+/*********************************************************************
+*
+* SendNext
+*
+* @brief	The scheduler part of HandlePackets, one packet of track
+*			time passes whether a loco is sent or not
+*
+* @param	none
+*
+* @return	the loco sent, NULL for an idle packet
+*
+*********************************************************************/
+static Loco* SendNext(void)
+{
+	Loco* pLoco;
+
+	pLoco = NextLocoMsg(SimClock);
+	if(pLoco != NULL && pLoco->LastPacketEnd != 0 && SimClock - pLoco->LastPacketEnd < ADDRESS_SPACING_US)
+	{
+		printf("address %u sent %u us after its last packet\n", pLoco->Address, SimClock - pLoco->LastPacketEnd);
+		Failures++;
+	}
+
+	SimClock += PACKET_US;
+	if(pLoco != NULL)
+	{
+		// the packet carried the change
+		pLoco->bChange = 0;
+		LocoMsgSent(pLoco, SimClock);
+	}
+
+	return pLoco;
+}
+
+
+/*********************************************************************
+*
+* FillRoster
+*
+* @brief	Put count locos on the track
+*
+* @param	count - number of locos
+*
+* @return	none
+*
+*********************************************************************/
+static void FillRoster(word count)
+{
+	word i;
+
+	memset(ActiveLocos, 0, sizeof(ActiveLocos));
+	InitLocoList();
+	SimClock = 1;
+
+	setup(&ListLocos);
+	ListSequence.m_List = &ListLocos;
+	ListFree = 0;
+
+	for(i = 0; i < count; i++)
+	{
+		ActiveLocos[i].Address = 100 + i;
+		MakeMostRecentLoco(&ActiveLocos[i]);
+		ListPromote(&ActiveLocos[i]);
+	}
+
+	// send the promotions
+	for(i = 0; i < count; i++)
+	{
+		SendNext();
+	}
+}
+
+
+/*********************************************************************
+*
+* CheckOrder
+*
+* @brief	A promoted loco goes next, every loco is refreshed once a
+*			round, the oldest comes off the track
+*
+* @param	count - number of locos
+*
+* @return	none
+*
+*********************************************************************/
+static void CheckOrder(word count)
+{
+	static uint8_t abSeen[MAX_LOCOS];
+	Loco* pLoco;
+	word i;
+
+	FillRoster(count);
+
+	memset(abSeen, 0, sizeof(abSeen));
+	for(i = 0; i < count; i++)
+	{
+		if((pLoco = SendNext()) != NULL)
+		{
+			abSeen[pLoco - ActiveLocos]++;
+		}
+	}
+	for(i = 0; i < count; i++)
+	{
+		if(abSeen[i] != 1)
+		{
+			printf("%u locos: loco %u refreshed %u times in a round\n", count, i, abSeen[i]);
+			Failures++;
+			break;
+		}
+	}
+
+	// throttle changes after every address had a rest
+	SimClock += ADDRESS_SPACING_US;
+	MakeMostRecentLoco(&ActiveLocos[count / 2]);
+	MakeMostRecentLoco(&ActiveLocos[0]);
+	if(SendNext() != &ActiveLocos[count / 2] || (count > 2 && SendNext() != &ActiveLocos[0]))
+	{
+		printf("%u locos: promoted loco not sent next\n", count);
+		Failures++;
+	}
+
+	// a speed change goes ahead of a function change that came first
+	SimClock += ADDRESS_SPACING_US;
+	ActiveLocos[1].bChange = CH_FUNCTION_1;
+	MakeMostRecentLoco(&ActiveLocos[1]);
+	ActiveLocos[2].bChange = CH_SPEED;
+	MakeMostRecentLoco(&ActiveLocos[2]);
+	if(SendNext() != &ActiveLocos[2] || SendNext() != &ActiveLocos[1])
+	{
+		printf("%u locos: speed change not sent first\n", count);
+		Failures++;
+	}
+
+	// a loco waiting with a function change moves ahead with a speed change
+	SimClock += ADDRESS_SPACING_US;
+	ActiveLocos[1].bChange = CH_FUNCTION_1;
+	MakeMostRecentLoco(&ActiveLocos[1]);
+	ActiveLocos[2].bChange = CH_FUNCTION_1;
+	MakeMostRecentLoco(&ActiveLocos[2]);
+	ActiveLocos[2].bChange |= CH_SPEED;
+	MakeMostRecentLoco(&ActiveLocos[2]);
+	if(SendNext() != &ActiveLocos[2] || SendNext() != &ActiveLocos[1])
+	{
+		printf("%u locos: waiting loco not moved ahead by its speed change\n", count);
+		Failures++;
+	}
+
+	// the fourth loco went on the track after the first three, and is
+	// the only one of them not changed since
+	if(count > 3 && OldestLoco() != &ActiveLocos[3])
+	{
+		printf("%u locos: wrong oldest loco\n", count);
+		Failures++;
+	}
+	if(GetRefreshCount() != (count > 3 ? count - 1 : count))
+	{
+		printf("%u locos: %u in the refresh ring\n", count, GetRefreshCount());
+		Failures++;
+	}
+}
+
+
+/*********************************************************************
+*
+* CheckSpacing
+*
+* @brief	A loco alone on the track has to rest between packets, the
+*			track idles in between
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void CheckSpacing(void)
+{
+	int i;
+
+	FillRoster(1);
+
+	for(i = 0; i < 10; i++)
+	{
+		MakeMostRecentLoco(&ActiveLocos[0]);
+		if(SendNext() != NULL || SendNext() != &ActiveLocos[0])
+		{
+			printf("1 loco: not sent every other packet\n");
+			Failures++;
+			break;
+		}
+	}
+}
+
+
+/*********************************************************************
+*
+* RunPass
+*
+* @brief	Time the HandlePackets loco pass
+*
+* @param	count - number of locos
+*			bfList - the old linked list scheduler
+*
+* @return	ns per packet
+*
+*********************************************************************/
+static double RunPass(word count, int bfList)
+{
+	volatile unsigned int Sum = 0;
+	uint32_t Random = 12345;
+	uint64_t start;
+	Loco* pLoco;
+	uint32_t i;
+
+	FillRoster(count);
+
+	start = NowNs();
+	for(i = 0; i < PACKETS; i++)
+	{
+		if(i % CHANGE_EVERY == 0)
+		{
+			Random = Random * 1103515245 + 12345;
+			pLoco = &ActiveLocos[(Random >> 16) % count];
+			if(bfList)
+			{
+				ListPromote(pLoco);
+			}
+			else
+			{
+				MakeMostRecentLoco(pLoco);
+			}
+		}
+
+		pLoco = bfList ? ListNext() : SendNext();
+		if(pLoco != NULL)
+		{
+			Sum += pLoco->Address;
+		}
+	}
+
+	return (double)(NowNs() - start) / PACKETS;
+}
+
+
+/*********************************************************************
+*
+* main
+*
+* @brief	traklist_sim
+*
+*********************************************************************/
+int main(int argc, char *argv[])
+{
+	static const word awRoster[] = { 8, 16, 32, 64, 128, 256 };
+	double Ring;
+	double List;
+	double Smallest = 0.0;
+	int i;
+
+	CheckSpacing();
+
+	printf("%-8s%12s%12s\n", "Locos", "Ring ns", "List ns");
+
+	for(i = 0; i < sizeof(awRoster) / sizeof(awRoster[0]); i++)
+	{
+		if(awRoster[i] > MAX_LOCOS)
+		{
+			break;
+		}
+
+		CheckOrder(awRoster[i]);
+
+		Ring = RunPass(awRoster[i], 0);
+		List = RunPass(awRoster[i], 1);
+		if(i == 0)
+		{
+			Smallest = Ring;
+		}
+
+		printf("%-8u%12.1f%12.1f\n", awRoster[i], Ring, List);
+	}
+
+	printf("Ring cost at %u locos is %.2f times the cost at %u\n",
+		awRoster[i - 1], Ring / Smallest, awRoster[0]);
+
+	if(Failures)
+	{
+		printf("%u failures\n", Failures);
+		return 1;
+	}
+
+	printf("Order OK\n");
+	return 0;
+}
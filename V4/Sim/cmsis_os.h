@@ -0,0 +1,67 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	cmsis_os.h
+*
+* DATE CREATED:		6/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Host stand in for the CMSIS-RTOS2 calls used by the track
+*				output. There is one task, waiting on a thread flag runs
+*				the timer model (HostHal.c) until an interrupt sets it.
+*
+* COPYRIGHT (c) 2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef CMSIS_OS_H
+#define CMSIS_OS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+typedef void* osThreadId_t;
+
+typedef enum
+{
+	osOK = 0,
+	osError = -1,
+	osErrorTimeout = -2,
+} osStatus_t;
+
+#define osWaitForever		0xFFFFFFFFU
+
+#define osFlagsWaitAny		0x00000000U
+#define osFlagsErrorTimeout	0xFFFFFFFEU
+
+// model time of one os tick (1 ms)
+#define SIM_TICKS_PER_OS_TICK	2000
+
+// FreeRTOSConfig.h, interrupts that use the RTOS run at this priority or lower
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY	5
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+extern osThreadId_t osThreadGetId(void);
+extern uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags);
+extern uint32_t osThreadFlagsClear(uint32_t flags);
+extern uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout);
+extern osStatus_t osDelay(uint32_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
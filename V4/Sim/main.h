@@ -0,0 +1,367 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	main.h (host simulator)
+*
+* DATE CREATED:		5/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Stand-in for the CubeMX main.h when the track module is
+*				compiled on the host. It supplies just enough of the
+*				STM32F4 HAL (types, constants and macros) for Track.c and
+*				the Send_reg packet paths to compile unchanged against the
+*				fake TIM/DMA model in HostHal.c.
+*
+* COPYRIGHT (c) 2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_SIM
+
+#define __IO	volatile
+
+/**********************************************************************
+*
+*							HAL STATUS
+*
+**********************************************************************/
+
+typedef enum
+{
+	HAL_OK,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT,
+} HAL_StatusTypeDef;
+
+/**********************************************************************
+*
+*							TIMER MODEL
+*
+**********************************************************************/
+
+/** @struct TIM_TypeDef
+	@brief Register layout of an advanced timer (TIM1/TIM8). The order
+	matters - the DMA burst addresses registers as an offset from CR1.
+ */
+typedef struct
+{
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t SMCR;
+	__IO uint32_t DIER;
+	__IO uint32_t SR;
+	__IO uint32_t EGR;
+	__IO uint32_t CCMR1;
+	__IO uint32_t CCMR2;
+	__IO uint32_t CCER;
+	__IO uint32_t CNT;
+	__IO uint32_t PSC;
+	__IO uint32_t ARR;
+	__IO uint32_t RCR;
+	__IO uint32_t CCR1;
+	__IO uint32_t CCR2;
+	__IO uint32_t CCR3;
+	__IO uint32_t CCR4;
+	__IO uint32_t BDTR;
+	__IO uint32_t DCR;
+	__IO uint32_t DMAR;
+} TIM_TypeDef;
+
+extern TIM_TypeDef SimTIM1;
+extern TIM_TypeDef SimTIM8;
+#define TIM1	(&SimTIM1)
+#define TIM8	(&SimTIM8)
+
+typedef struct
+{
+	uint32_t Prescaler;
+	uint32_t CounterMode;
+	uint32_t Period;
+	uint32_t ClockDivision;
+	uint32_t RepetitionCounter;
+	uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+struct __DMA_HandleTypeDef;
+
+typedef struct
+{
+	TIM_TypeDef* Instance;
+	TIM_Base_InitTypeDef Init;
+	struct __DMA_HandleTypeDef* hdma[7];
+} TIM_HandleTypeDef;
+
+typedef struct
+{
+	uint32_t ClockSource;
+	uint32_t ClockPolarity;
+	uint32_t ClockPrescaler;
+	uint32_t ClockFilter;
+} TIM_ClockConfigTypeDef;
+
+typedef struct
+{
+	uint32_t MasterOutputTrigger;
+	uint32_t MasterSlaveMode;
+} TIM_MasterConfigTypeDef;
+
+typedef struct
+{
+	uint32_t OCMode;
+	uint32_t Pulse;
+	uint32_t OCPolarity;
+	uint32_t OCNPolarity;
+	uint32_t OCFastMode;
+	uint32_t OCIdleState;
+	uint32_t OCNIdleState;
+} TIM_OC_InitTypeDef;
+
+typedef struct
+{
+	uint32_t OffStateRunMode;
+	uint32_t OffStateIDLEMode;
+	uint32_t LockLevel;
+	uint32_t DeadTime;
+	uint32_t BreakState;
+	uint32_t BreakPolarity;
+	uint32_t AutomaticOutput;
+} TIM_BreakDeadTimeConfigTypeDef;
+
+#define TIM_COUNTERMODE_UP				0
+#define TIM_CLOCKDIVISION_DIV1			0
+#define TIM_AUTORELOAD_PRELOAD_ENABLE	0x80
+#define TIM_CLOCKSOURCE_INTERNAL		0
+#define TIM_CLOCKPOLARITY_NONINVERTED	0
+#define TIM_ETRPRESCALER_DIV1			0
+#define TIM_TRGO_RESET					0
+#define TIM_MASTERSLAVEMODE_DISABLE		0
+#define TIM_OCMODE_PWM1					0x60
+#define TIM_OCPOLARITY_HIGH				0
+#define TIM_OCNPOLARITY_HIGH			0
+#define TIM_OCFAST_DISABLE				0
+#define TIM_OCIDLESTATE_RESET			0
+#define TIM_OCNIDLESTATE_SET			0
+#define TIM_OSSR_ENABLE					0
+#define TIM_OSSI_ENABLE					0
+#define TIM_LOCKLEVEL_OFF				0
+#define TIM_BREAK_DISABLE				0
+#define TIM_BREAKPOLARITY_LOW			0
+#define TIM_AUTOMATICOUTPUT_DISABLE		0
+#define TIM_CHANNEL_1					0
+
+#define TIM_IT_UPDATE					0x0001
+#define TIM_DMA_UPDATE					0x0100
+#define TIM_DMA_ID_UPDATE				0
+
+#define TIM_DMABASE_ARR					0x0000000BU
+#define TIM_DMABURSTLENGTH_3TRANSFERS	0x00000200U
+
+#define __HAL_TIM_SET_AUTORELOAD(__HANDLE__, __AUTORELOAD__) \
+	do{ (__HANDLE__)->Instance->ARR = (__AUTORELOAD__); (__HANDLE__)->Init.Period = (__AUTORELOAD__); } while(0)
+#define __HAL_TIM_SET_COMPARE(__HANDLE__, __CHANNEL__, __COMPARE__) \
+	((__HANDLE__)->Instance->CCR1 = (__COMPARE__))
+#define __HAL_TIM_ENABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->DIER |= (__INTERRUPT__))
+#define __HAL_TIM_DISABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->DIER &= ~(__INTERRUPT__))
+#define __HAL_TIM_ENABLE_DMA(__HANDLE__, __DMA__)		((__HANDLE__)->Instance->DIER |= (__DMA__))
+#define __HAL_TIM_DISABLE_DMA(__HANDLE__, __DMA__)		((__HANDLE__)->Instance->DIER &= ~(__DMA__))
+
+extern HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef* htim);
+extern HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef* htim, TIM_ClockConfigTypeDef* sClockSourceConfig);
+extern HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef* htim, TIM_MasterConfigTypeDef* sMasterConfig);
+extern HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef* htim, TIM_OC_InitTypeDef* sConfig, uint32_t Channel);
+extern HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef* htim, TIM_BreakDeadTimeConfigTypeDef* sBreakDeadTimeConfig);
+extern HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel);
+extern HAL_StatusTypeDef HAL_TIMEx_PWMN_Start(TIM_HandleTypeDef* htim, uint32_t Channel);
+extern HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim);
+extern void HAL_TIM_IRQHandler(TIM_HandleTypeDef* htim);
+
+/**********************************************************************
+*
+*							DMA MODEL
+*
+**********************************************************************/
+
+typedef struct
+{
+	__IO uint32_t CR;
+	__IO uint32_t NDTR;
+	__IO uint32_t PAR;
+	__IO uint32_t M0AR;
+} DMA_Stream_TypeDef;
+
+extern DMA_Stream_TypeDef SimDMA2_Stream5;
+extern DMA_Stream_TypeDef SimDMA2_Stream1;
+#define DMA2_Stream5	(&SimDMA2_Stream5)
+#define DMA2_Stream1	(&SimDMA2_Stream1)
+
+typedef struct
+{
+	uint32_t Channel;
+	uint32_t Direction;
+	uint32_t PeriphInc;
+	uint32_t MemInc;
+	uint32_t PeriphDataAlignment;
+	uint32_t MemDataAlignment;
+	uint32_t Mode;
+	uint32_t Priority;
+	uint32_t FIFOMode;
+} DMA_InitTypeDef;
+
+typedef enum
+{
+	HAL_DMA_STATE_RESET,
+	HAL_DMA_STATE_READY,
+	HAL_DMA_STATE_BUSY,
+} HAL_DMA_StateTypeDef;
+
+typedef struct __DMA_HandleTypeDef
+{
+	DMA_Stream_TypeDef* Instance;
+	DMA_InitTypeDef Init;
+	HAL_DMA_StateTypeDef State;
+	void* Parent;
+	void (*XferCpltCallback)(struct __DMA_HandleTypeDef* hdma);
+	void (*XferHalfCpltCallback)(struct __DMA_HandleTypeDef* hdma);
+	uint32_t Length;
+	uint8_t HalfDone;
+} DMA_HandleTypeDef;
+
+#define DMA_CHANNEL_6				0
+#define DMA_CHANNEL_7				0
+#define DMA_MEMORY_TO_PERIPH		0
+#define DMA_PINC_DISABLE			0
+#define DMA_MINC_ENABLE				0
+#define DMA_PDATAALIGN_HALFWORD		0
+#define DMA_MDATAALIGN_HALFWORD		0
+#define DMA_NORMAL					0
+#define DMA_PRIORITY_VERY_HIGH		0
+#define DMA_FIFOMODE_DISABLE		0
+
+#define __HAL_LINKDMA(__HANDLE__, __PPP_DMA_FIELD__, __DMA_HANDLE__) \
+	do{ (__HANDLE__)->__PPP_DMA_FIELD__ = &(__DMA_HANDLE__); (__DMA_HANDLE__).Parent = (__HANDLE__); } while(0)
+
+extern HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef* hdma);
+extern HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef* hdma, uint32_t SrcAddress, uint32_t DstAddress, uint32_t DataLength);
+extern HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef* hdma);
+extern void HAL_DMA_IRQHandler(DMA_HandleTypeDef* hdma);
+
+/**********************************************************************
+*
+*							GPIO, NVIC, RCC
+*
+**********************************************************************/
+
+typedef struct
+{
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef struct
+{
+	uint32_t ODR;
+	uint32_t AF;
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+extern GPIO_TypeDef SimGPIOA;
+extern GPIO_TypeDef SimGPIOB;
+extern GPIO_TypeDef SimGPIOC;
+extern GPIO_TypeDef SimGPIOE;
+#define GPIOA	(&SimGPIOA)
+#define GPIOB	(&SimGPIOB)
+#define GPIOC	(&SimGPIOC)
+#define GPIOE	(&SimGPIOE)
+
+#define GPIO_PIN_1					0x0002
+#define GPIO_PIN_5					0x0020
+#define GPIO_PIN_6					0x0040
+#define GPIO_PIN_7					0x0080
+#define GPIO_PIN_8					0x0100
+#define GPIO_PIN_9					0x0200
+
+#define GPIO_MODE_OUTPUT_PP			0x01
+#define GPIO_MODE_AF_PP				0x02
+#define GPIO_NOPULL					0
+#define GPIO_SPEED_FREQ_VERY_HIGH	0
+#define GPIO_AF1_TIM1				1
+#define GPIO_AF3_TIM8				3
+
+extern void HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init);
+extern void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+typedef enum
+{
+	TIM1_UP_TIM10_IRQn = 25,
+	TIM8_UP_TIM13_IRQn = 44,
+	DMA2_Stream1_IRQn = 57,
+	CAN2_SCE_IRQn = 66,
+	DMA2_Stream5_IRQn = 68,
+} IRQn_Type;
+
+extern void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+extern void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+extern void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+extern void HAL_NVIC_SetPendingIRQ(IRQn_Type IRQn);
+
+#define __HAL_RCC_TIM1_CLK_ENABLE()
+#define __HAL_RCC_TIM8_CLK_ENABLE()
+#define __HAL_RCC_GPIOA_CLK_ENABLE()
+#define __HAL_RCC_GPIOC_CLK_ENABLE()
+#define __HAL_RCC_DMA2_CLK_ENABLE()
+#define __HAL_RCC_GPIOE_CLK_ENABLE()
+
+#define __DMB()		__sync_synchronize()
+#define __disable_irq()
+#define __enable_irq()
+
+/**********************************************************************
+*
+*							DWT cycle counter
+*
+**********************************************************************/
+
+typedef struct
+{
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type SimDWT;
+extern CoreDebug_Type SimCoreDebug;
+#define DWT			(&SimDWT)
+#define CoreDebug	(&SimCoreDebug)
+
+#define DWT_CTRL_CYCCNTENA_Msk			0x00000001U
+#define CoreDebug_DEMCR_TRCENA_Msk		0x01000000U
+
+extern void Error_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MAIN_H */
@@ -0,0 +1,30 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	task.h
+*
+* DATE CREATED:		8/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Host stand in for the FreeRTOS task calls used outside
+*				the CMSIS-RTOS2 layer
+*
+* COPYRIGHT (c) 2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#ifndef TASK_H
+#define TASK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* TaskHandle_t;
+
+extern TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
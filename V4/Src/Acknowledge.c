@@ -6,13 +6,24 @@
 *
 * PROGRAMMER:
 *
-* DESCRIPTION:
+* DESCRIPTION:		Programming track current. ADC1 converts PA0 without a
+*					break, DMA fills the two halves of aAckSamples in
+*					turn and each half is filtered in the DMA interrupt:
+*					a fast average for the level, a slow one for the
+*					baseline, and an edge detector that times the ACK
+*					pulse from the samples. The analog watchdog trips the
+*					track on a single sample.
 *
 * COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
 *
 **********************************************************************/
 #include "main.h"
+#include "cmsis_os.h"
+#include <string.h>
+#include "Track.h"
 #include "Acknowledge.h"
+#include "Recorder.h"
+#include "Latency.h"
 
 /**********************************************************************
 *
@@ -20,13 +31,67 @@
 *
 **********************************************************************/
 
-#define MAX_CURRENT		250.0
+// ADC counts, the level or the baseline
+#define MAX_CURRENT		250
+
+// the baseline, a motor running rather than a decoder at rest
+#define LOCO_CURRENT	150
+
+// above the baseline, S-9.2.3 asks for 60mA
+#define ACK_CURRENT		50
+
+// the pulse edges are timed where the level crosses this, half way up
+#define ACK_RELEASE		(ACK_CURRENT / 2)
+
+// samples in half of the DMA buffer, 375us at 42.7kHz
+#define ACK_HALF_SAMPLES		16
+
+// ADC clocks a conversion, sample time plus 12 bits
+#define ACK_ADC_CLOCKS			(480 + 12)
 
-#define LOCO_CURRENT	20.0
+// the filters run in fixed point with this many fraction bits
+#define ACK_Q					12
 
-#define ACK_CURRENT		50.0
+// level average over 8 samples (190us, about a DCC bit), baseline over 1024 (24ms)
+#define ACK_LEVEL_SHIFT			3
+#define ACK_BASE_SHIFT			10
 
-#define BASE_DELAY		50		// in 10MS ticks
+// samples above ACK_CURRENT before it counts as an ACK, 190us
+#define ACK_CONFIRM_SAMPLES		8
+
+// a pulse longer than 20ms is a change of load, the baseline moves to it
+#define ACK_MAX_SAMPLES			854
+
+// the baseline stays put for 10ms after a pulse, the current settles
+#define ACK_HOLDOFF_SAMPLES		427
+
+// below the track timers, the filter doesn't use the RTOS
+#define ACK_DMA_PRIORITY		(configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1)
+
+enum
+{
+	ACK_STATE_IDLE,
+	ACK_STATE_PULSE,
+	ACK_STATE_HOLDOFF,
+};
+
+// PA0 senses the programming track current
+#define TRIP_CHANNEL			TC_PROG
+
+// instantaneous, above the averaged MAX_CURRENT so the inrush into decoder capacitors doesn't trip
+#define TRIP_THRESHOLD			500
+
+#define TRIP_RETRIES			3
+
+#define TRIP_BACKOFF			100		// ms
+
+#define TRIP_BACKOFF_MAX		2000	// ms
+
+// running this long without a trip forgets the earlier ones
+#define TRIP_QUIET_TIME			5000	// ms
+
+// samples followed after a trip for the peak, 480 cycle samples at 21MHz are 23.4us
+#define TRIP_PEAK_SAMPLES		32
 
 
 /**********************************************************************
@@ -52,18 +117,44 @@ float ProgTrackCurrent = 0.0;
 **********************************************************************/
 
 static ADC_HandleTypeDef AdcHandle;
+static DMA_HandleTypeDef hdmaAdc;
+
+// DMA fills one half while the other is filtered
+static uint16_t aAckSamples[2 * ACK_HALF_SAMPLES];
 
-/* Variable used to get converted value */
-static __IO uint16_t uhADCxConvertedValue = 0;
+// CPU cycles between samples, for the DWT time of a sample
+static uint32_t AckSampleCycles;
 
+// filters, ADC counts << ACK_Q
+static volatile int32_t AckLevel;
+static volatile int32_t AckBase;
 
-static float fBaseAvg;
-static float fLevelAvg;
+static uint8_t AckState;
+static uint8_t bfRising;
+static volatile uint8_t bfAckActive;
+static uint16_t AckSamples;			// in the pulse or the holdoff
+static int32_t AckPeak;
+static uint32_t AckRise;			// DWT time the level went past ACK_RELEASE
 
-static uint8_t BaseDelay;
+static ACK_PULSE AckPulse;
+static ACK_STATS AckStats;
 
 static uint8_t bfFirstTime;
 
+static TRIP_CONFIG TripConfig = { TRIP_THRESHOLD, TRIP_RETRIES, TRIP_BACKOFF, TRIP_BACKOFF_MAX };
+
+static volatile TRIP_STATE TripState = TRIP_ARMED;
+
+static uint16_t TripRetry;			// consecutive trips
+static uint32_t TripBackoff;		// ms
+static uint32_t TripTick;			// ms, time of the last trip
+static uint32_t ArmedTick;			// ms, time the track last came back on
+
+static volatile uint16_t PeakSamples;
+
+static TRIP_ENTRY aTripLog[TRIP_LOG_SIZE];
+static volatile uint32_t TripCount;
+
 /**********************************************************************
 *
 *							CODE
@@ -86,6 +177,7 @@ static uint8_t bfFirstTime;
 void InitAcknowledge(void)
 {
 	ADC_ChannelConfTypeDef sConfig;
+	ADC_AnalogWDGConfTypeDef AwdConfig;
 
 	/*##-1- Configure the ADC peripheral #######################################*/
 	AdcHandle.Instance = ADC1;
@@ -96,7 +188,7 @@ void InitAcknowledge(void)
 		Error_Handler();
 	}
 
-//	AdcHandle.Init.ClockPrescaler        = ADC_CLOCK_ASYNC_DIV1;          /* Asynchronous clock mode, input ADC clock not divided */
+	AdcHandle.Init.ClockPrescaler        = ADC_CLOCK_SYNC_PCLK_DIV4;      /* 21MHz ADC clock */
 	AdcHandle.Init.Resolution            = ADC_RESOLUTION_12B;            /* 12-bit resolution for converted data */
 	AdcHandle.Init.DataAlign             = ADC_DATAALIGN_RIGHT;           /* Right-alignment for converted data */
 	AdcHandle.Init.ScanConvMode          = DISABLE;                       /* Sequencer disabled (ADC conversion on only 1 channel: channel set on rank 1) */
@@ -108,7 +200,7 @@ void InitAcknowledge(void)
 	AdcHandle.Init.NbrOfDiscConversion   = 1;                             /* Parameter discarded because sequencer is disabled */
 	AdcHandle.Init.ExternalTrigConv      = ADC_SOFTWARE_START;            /* Software start to trig the 1st conversion manually, without external event */
 	AdcHandle.Init.ExternalTrigConvEdge  = ADC_EXTERNALTRIGCONVEDGE_NONE; /* Parameter discarded because software trigger chosen */
-	AdcHandle.Init.DMAContinuousRequests = DISABLE;                       /* DMA one-shot mode selected (not applied to this example) */
+	AdcHandle.Init.DMAContinuousRequests = ENABLE;                        /* DMA circular, a request for every conversion */
 //	AdcHandle.Init.Overrun               = ADC_OVR_DATA_OVERWRITTEN;      /* DR register is overwritten with the last conversion result in case of overrun */
 //	AdcHandle.Init.OversamplingMode      = DISABLE;                       /* No oversampling */
 
@@ -120,8 +212,8 @@ void InitAcknowledge(void)
 
 	/*##-2- Configure ADC regular channel ######################################*/
 	sConfig.Channel      = ADC_CHANNEL_0;               /* Sampled channel number */
-//	sConfig.Rank         = ADC_REGULAR_RANK_1;          /* Rank of sampled channel number ADCx_CHANNEL */
-//	sConfig.SamplingTime = ADC_SAMPLETIME_6CYCLES_5;    /* Sampling time (number of clock cycles unit) */
+	sConfig.Rank         = 1;                           /* Rank of sampled channel number ADCx_CHANNEL */
+	sConfig.SamplingTime = ADC_SAMPLETIME_480CYCLES;    /* 23.4us per conversion, the watchdog checks each one */
 //	sConfig.SingleDiff   = ADC_SINGLE_ENDED;            /* Single-ended input channel */
 //	sConfig.OffsetNumber = ADC_OFFSET_NONE;             /* No offset subtraction */
 	sConfig.Offset = 0;                                 /* Parameter discarded because offset correction is disabled */
@@ -138,120 +230,451 @@ void InitAcknowledge(void)
 	//    Error_Handler();
 	//}
 
-	/*##-3- Start the conversion process #######################################*/
-	if (HAL_ADC_Start_IT(&AdcHandle) != HAL_OK)
+	/*##-3- DMA into the two halves of aAckSamples ###########################*/
+	__HAL_RCC_DMA2_CLK_ENABLE();
+
+	hdmaAdc.Instance = DMA2_Stream0;
+	hdmaAdc.Init.Channel = DMA_CHANNEL_0;
+	hdmaAdc.Init.Direction = DMA_PERIPH_TO_MEMORY;
+	hdmaAdc.Init.PeriphInc = DMA_PINC_DISABLE;
+	hdmaAdc.Init.MemInc = DMA_MINC_ENABLE;
+	hdmaAdc.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+	hdmaAdc.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+	hdmaAdc.Init.Mode = DMA_CIRCULAR;
+	hdmaAdc.Init.Priority = DMA_PRIORITY_HIGH;
+	hdmaAdc.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	if (HAL_DMA_Init(&hdmaAdc) != HAL_OK)
 	{
-	    /* Start Conversation Error */
 	    Error_Handler();
 	}
+	__HAL_LINKDMA(&AdcHandle, DMA_Handle, hdmaAdc);
+
+	HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, ACK_DMA_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+	// ADC clock is PCLK2 / 4
+	AckSampleCycles = (SystemCoreClock / (HAL_RCC_GetPCLK2Freq() / 4)) * ACK_ADC_CLOCKS;
+
+	/*##-4- Over-current trip on the analog watchdog ###########################*/
+	AwdConfig.WatchdogMode   = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	AwdConfig.HighThreshold  = TripConfig.threshold;
+	AwdConfig.LowThreshold   = 0;
+	AwdConfig.Channel        = ADC_CHANNEL_0;
+	AwdConfig.ITMode         = ENABLE;
+	AwdConfig.WatchdogNumber = 0;
+	if (HAL_ADC_AnalogWDGConfig(&AdcHandle, &AwdConfig) != HAL_OK)
+	{
+	    Error_Handler();
+	}
+
+	// same group priority as the track timers, the trip doesn't preempt a track update
+	HAL_NVIC_SetPriority(ADC_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(ADC_IRQn);
+
+	TripState = TRIP_ARMED;
+	TripRetry = 0;
+	ArmedTick = HAL_GetTick();
+
 	bfFirstTime = 1;
+
+	/*##-5- Start the conversion process #######################################*/
+	if (HAL_ADC_Start_DMA(&AdcHandle, (uint32_t*)aAckSamples, 2 * ACK_HALF_SAMPLES) != HAL_OK)
+	{
+	    /* Start Conversation Error */
+	    Error_Handler();
+	}
 }
 
 
-//*******************************************************************************
-//
-// FUNCTION     E_AverageFloat
-//
-// INPUTS:      Old value, new value
-//
-// OUTPUTS:     New Average
-//
-// DESCRIPTION: Exponitional average - floating point version
-//
-//*******************************************************************************
-float E_AverageFloat(float OldValue, float NewValue, unsigned char AverageConstant)
+/**********************************************************************
+*
+* FUNCTION:		FilterSamples
+*
+* ARGUMENTS:	pSamples - the half of aAckSamples DMA is done with
+*
+* RETURNS:
+*
+* DESCRIPTION:	Run the samples through the level and baseline filters
+*				and the edge detector. A pulse is an ACK once it has
+*				been above ACK_CURRENT for ACK_CONFIRM_SAMPLES. Its
+*				edges are timed where the level crosses ACK_RELEASE on
+*				the way up and on the way down, the filter delays both
+*				the same so the width comes out right.
+*
+* RESTRICTIONS:	DMA interrupt
+*
+**********************************************************************/
+static void FilterSamples(const uint16_t* pSamples)
 {
-    float Avg;
+	uint32_t Now = DWT->CYCCNT;
+	uint32_t Time;
+	TRIP_ENTRY* pEntry;
+	int32_t Level = AckLevel;
+	int32_t Base = AckBase;
+	int32_t Above;
+	int i;
 
-    Avg = NewValue * AverageConstant;
-    Avg += OldValue * (100.0 - AverageConstant);
-    return Avg / 100.0;
+	RecordSamples(pSamples, ACK_HALF_SAMPLES, Now, AckSampleCycles);
+
+	if(bfFirstTime)
+	{
+		bfFirstTime = 0;
+		Level = (int32_t)pSamples[0] << ACK_Q;
+		Base = Level;
+	}
+
+	for(i = 0; i < ACK_HALF_SAMPLES; i++)
+	{
+		// follow the current down after a trip for the peak
+		if(PeakSamples)
+		{
+			PeakSamples--;
+			pEntry = &aTripLog[(TripCount - 1) % TRIP_LOG_SIZE];
+			if(pSamples[i] > pEntry->peak)
+			{
+				pEntry->peak = pSamples[i];
+			}
+		}
+
+		Level += (((int32_t)pSamples[i] << ACK_Q) - Level) >> ACK_LEVEL_SHIFT;
+		Above = Level - Base;
+
+		// the last sample of the half was converted just now
+		Time = Now - (ACK_HALF_SAMPLES - 1 - i) * AckSampleCycles;
+
+		switch(AckState)
+		{
+			case ACK_STATE_HOLDOFF:
+				if(++AckSamples >= ACK_HOLDOFF_SAMPLES)
+				{
+					AckState = ACK_STATE_IDLE;
+				}
+				// no break, a pulse can start in the holdoff
+
+			case ACK_STATE_IDLE:
+				if(Above <= (ACK_RELEASE << ACK_Q))
+				{
+					bfRising = 0;
+					if(AckState == ACK_STATE_IDLE)
+					{
+						Base += (Level - Base) >> ACK_BASE_SHIFT;
+					}
+				}
+				else
+				{
+					if(!bfRising)
+					{
+						bfRising = 1;
+						AckRise = Time;
+					}
+					if(Above > (ACK_CURRENT << ACK_Q))
+					{
+						AckState = ACK_STATE_PULSE;
+						AckSamples = 0;
+						AckPeak = Level;
+					}
+				}
+			break;
+
+			case ACK_STATE_PULSE:
+				AckSamples++;
+				if(Level > AckPeak)
+				{
+					AckPeak = Level;
+				}
+
+				if(AckSamples == ACK_CONFIRM_SAMPLES)
+				{
+					bfAckActive = 1;
+					LatencyRise(AckRise);
+					if(AckStatus != OVER_CURRENT)
+					{
+						AckStatus = ACK_DETECTED;
+					}
+				}
+
+				if(Above <= (ACK_RELEASE << ACK_Q))
+				{
+					if(bfAckActive)
+					{
+						AckPulse.start = AckRise;
+						AckPulse.end = Time;
+						AckPulse.width_us = (Time - AckRise) / (SystemCoreClock / 1000000);
+						AckPulse.amplitude = (AckPeak - Base) >> ACK_Q;
+						AckPulse.base = Base >> ACK_Q;
+						AckStats.pulses++;
+					}
+					else
+					{
+						AckStats.glitches++;
+					}
+					bfAckActive = 0;
+					bfRising = 0;
+					AckState = ACK_STATE_HOLDOFF;
+					AckSamples = 0;
+				}
+				else if(AckSamples >= ACK_MAX_SAMPLES)
+				{
+					// the load changed, start again from here
+					AckStats.long_pulses++;
+					bfAckActive = 0;
+					bfRising = 0;
+					Base = Level;
+					AckState = ACK_STATE_IDLE;
+				}
+			break;
+		}
+	}
+
+	AckLevel = Level;
+	AckBase = Base;
+	AckStats.blocks++;
 }
 
 
 /**********************************************************************
 *
-* FUNCTION:		HAL_ADC_ConvCpltCallback
+* FUNCTION:		HAL_ADC_ConvHalfCpltCallback / HAL_ADC_ConvCpltCallback
 *
 * ARGUMENTS:	AdcHandle : AdcHandle handle
 *
 * RETURNS:
 *
-* DESCRIPTION:	Conversion complete callback in non blocking mode
+* DESCRIPTION:	DMA is done with the first or the second half of
+*				aAckSamples and is filling the other
 *
-* RESTRICTIONS:
+* RESTRICTIONS:	DMA interrupt
 *
 **********************************************************************/
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* AdcHandle)
+{
+
+	FilterSamples(&aAckSamples[0]);
+}
+
 void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* AdcHandle)
 {
-	/* Get the converted value of regular channel */
-	uhADCxConvertedValue = HAL_ADC_GetValue(AdcHandle);
 
-	if(bfFirstTime)
+	FilterSamples(&aAckSamples[ACK_HALF_SAMPLES]);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		HAL_ADC_ErrorCallback
+*
+* ARGUMENTS:	AdcHandle : AdcHandle handle
+*
+* RETURNS:
+*
+* DESCRIPTION:	An overrun stops the DMA requests, start again
+*
+* RESTRICTIONS:	ADC interrupt
+*
+**********************************************************************/
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef* AdcHandle)
+{
+
+	AckStats.overruns++;
+
+	HAL_ADC_Stop_DMA(AdcHandle);
+	HAL_ADC_Start_DMA(AdcHandle, (uint32_t*)aAckSamples, 2 * ACK_HALF_SAMPLES);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		HAL_ADC_LevelOutOfWindowCallback
+*
+* ARGUMENTS:	AdcHandle : AdcHandle handle
+*
+* RETURNS:
+*
+* DESCRIPTION:	Analog watchdog, a sample above the trip threshold. The
+*				track goes off first, then the trip is logged and the
+*				watchdog stays quiet until the retry turns the track
+*				back on.
+*
+* RESTRICTIONS:	Interrupt context
+*
+**********************************************************************/
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef* AdcHandle)
+{
+	uint32_t start = DWT->CYCCNT;
+	TRIP_ENTRY* pEntry;
+	uint32_t shift;
+
+	DisableTrackChannel(TRIP_CHANNEL);
+
+	// the watchdog fires on every sample while the current is high
+	__HAL_ADC_DISABLE_IT(AdcHandle, ADC_IT_AWD);
+
+	pEntry = &aTripLog[TripCount % TRIP_LOG_SIZE];
+	pEntry->off_cycles = DWT->CYCCNT - start;
+	pEntry->cycles = start;
+	pEntry->tick = HAL_GetTick();
+	pEntry->sample = HAL_ADC_GetValue(AdcHandle);
+	pEntry->peak = pEntry->sample;
+	pEntry->retry = ++TripRetry;
+	TripCount++;
+	PeakSamples = TRIP_PEAK_SAMPLES;
+
+	AckStatus = OVER_CURRENT;
+	TripTick = pEntry->tick;
+
+	if(TripRetry > TripConfig.retries)
 	{
-		bfFirstTime = 0;
-		fBaseAvg = uhADCxConvertedValue;
-		BaseDelay = 0;
+		TripState = TRIP_LOCKED;
+	}
+	else
+	{
+		// double the backoff for each consecutive trip
+		shift = TripRetry - 1 < 16 ? TripRetry - 1 : 16;
+		TripBackoff = (uint32_t)TripConfig.backoff << shift;
+		if(TripBackoff > TripConfig.backoff_max)
+		{
+			TripBackoff = TripConfig.backoff_max;
+		}
+		TripState = TRIP_BACKOFF;
 	}
 }
 
 
 /**********************************************************************
 *
-* FUNCTION:		Acknowledge
+* FUNCTION:		ADC_IRQHandler
 *
 * ARGUMENTS:
 *
 * RETURNS:
 *
-* DESCRIPTION:	ACK pulse detector
+* DESCRIPTION:	ADC1, 2 and 3 global interrupt
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-void Acknowledge(void)
+void ADC_IRQHandler(void)
+{
+	HAL_ADC_IRQHandler(&AdcHandle);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		DMA2_Stream0_IRQHandler
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	ADC1 samples
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void DMA2_Stream0_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdmaAdc);
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ArmTrip
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Arm the watchdog and turn the track back on, a short
+*				still there trips again on the first sample
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void ArmTrip(void)
 {
-    //int raw;
-    //unsigned char Ret = 0;
-    float fRaw;
-    //float fLevel;
+	__disable_irq();
+	TripState = TRIP_ARMED;
+	ArmedTick = HAL_GetTick();
+	__HAL_ADC_CLEAR_FLAG(&AdcHandle, ADC_FLAG_AWD);
+	__HAL_ADC_ENABLE_IT(&AdcHandle, ADC_IT_AWD);
+	__enable_irq();
+
+	EnableTrackChannel(TRIP_CHANNEL);
+}
 
 
-    fRaw = (float)uhADCxConvertedValue;
+/**********************************************************************
+*
+* FUNCTION:		CheckTrip
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Retry after the backoff, forget the earlier trips once
+*				the track has run clean for a while
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static void CheckTrip(void)
+{
+	uint32_t now = HAL_GetTick();
 
-    // convert to real-world current
+	if(TripState == TRIP_BACKOFF)
+	{
+		if(now - TripTick >= TripBackoff)
+		{
+			ArmTrip();
+		}
+	}
+	else if(TripState == TRIP_ARMED && TripRetry && now - ArmedTick >= TRIP_QUIET_TIME)
+	{
+		TripRetry = 0;
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		Acknowledge
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Track state for service mode, every tick. The ACK
+*				itself is set from the DMA interrupt as soon as the
+*				pulse is confirmed, and again here while it lasts.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void Acknowledge(void)
+{
+	int32_t Level = AckLevel >> ACK_Q;
 
-    fLevelAvg = E_AverageFloat(fLevelAvg, fRaw, 80);
-    ProgTrackCurrent = fLevelAvg;
+	ProgTrackCurrent = (float)Level;
 
+	// the analog watchdog turns the track off, this only brings it back
+	CheckTrip();
 
-    if(fLevelAvg > LOCO_CURRENT)
-    {
-      	// indicate loco present
-    	AckStatus = LOCO_PRESENT;
-    }
-    else if(fLevelAvg > MAX_CURRENT)
-    {
-    	// indicate over-current
+	if(TripState != TRIP_ARMED || Level > MAX_CURRENT)
+	{
+		// indicate over-current
 		AckStatus = OVER_CURRENT;
-    }
-    else if(fLevelAvg > (fBaseAvg + ACK_CURRENT))
-    {
-    	// indicate ACK
+	}
+	else if(bfAckActive)
+	{
 		AckStatus = ACK_DETECTED;
-
-    	// set a delay before the base average is started again
-    	BaseDelay = BASE_DELAY;
-    }
-    else
-    {
-    	--BaseDelay;
-    	if(BaseDelay == 0)
-    	{
-    		BaseDelay = 1;
-    		fBaseAvg = E_AverageFloat(fBaseAvg, fLevelAvg, 10);
-    	}
-    }
+	}
+	else if(AckStatus != ACK_DETECTED && (AckBase >> ACK_Q) > LOCO_CURRENT)
+	{
+		// indicate loco present
+		AckStatus = LOCO_PRESENT;
+	}
 }
 
 /**********************************************************************
@@ -262,16 +685,17 @@ void Acknowledge(void)
 *
 * RETURNS:
 *
-* DESCRIPTION:
+* DESCRIPTION:	Forget a latched ACK, the next Acknowledge() sets it
+*				again if the current is still up
 *
 * RESTRICTIONS:
 *
 **********************************************************************/
-//void ClearAck(void)
-//{
-//
-//	AckStatus = NO_ACK;
-//}
+void ClearAck(void)
+{
+
+	AckStatus = NO_ACK;
+}
 
 
 /**********************************************************************
@@ -313,3 +737,235 @@ uint8_t GetAck(void)
 	return AckStatus;
 }
 
+
+/**********************************************************************
+*
+* FUNCTION:		GetAckPulse
+*
+* ARGUMENTS:	pPulse - where to put the last ACK pulse
+*
+* RETURNS:		ACK pulses measured, 0 = none yet
+*
+* DESCRIPTION:	The last pulse that ended, a caller can tell a new
+*				one by the count
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+uint32_t GetAckPulse(ACK_PULSE* pPulse)
+{
+	uint32_t count;
+
+	__disable_irq();
+	*pPulse = AckPulse;
+	count = AckStats.pulses;
+	__enable_irq();
+
+	return count;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetAckStats / ClearAckStats
+*
+* ARGUMENTS:	pStats - where to put the statistics
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetAckStats(ACK_STATS* pStats)
+{
+
+	__disable_irq();
+	*pStats = AckStats;
+	__enable_irq();
+
+	pStats->level = AckLevel >> ACK_Q;
+	pStats->base = AckBase >> ACK_Q;
+}
+
+void ClearAckStats(void)
+{
+
+	__disable_irq();
+	memset(&AckStats, 0, sizeof(AckStats));
+	memset(&AckPulse, 0, sizeof(AckPulse));
+	__enable_irq();
+}
+
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetTripConfig
+*
+* ARGUMENTS:	pConfig - where to put the trip settings
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetTripConfig(TRIP_CONFIG* pConfig)
+{
+
+	*pConfig = TripConfig;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SetTripConfig
+*
+* ARGUMENTS:	pConfig - new trip settings
+*
+* RETURNS:		0 - OK, -1 - bad settings
+*
+* DESCRIPTION:	Change the threshold and the retry policy, the new
+*				threshold takes effect on the next sample
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int SetTripConfig(const TRIP_CONFIG* pConfig)
+{
+	if(pConfig->threshold == 0 || pConfig->threshold > 0xfff ||
+		pConfig->backoff == 0 || pConfig->backoff_max < pConfig->backoff)
+	{
+		return -1;
+	}
+
+	__disable_irq();
+	TripConfig = *pConfig;
+	if(AdcHandle.Instance)
+	{
+		AdcHandle.Instance->HTR = TripConfig.threshold;
+	}
+	__enable_irq();
+
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetTripState
+*
+* ARGUMENTS:
+*
+* RETURNS:		TRIP_STATE
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+TRIP_STATE GetTripState(void)
+{
+
+	return TripState;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ResetTrip
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Clear a trip and turn the track back on
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void ResetTrip(void)
+{
+	if(TripState != TRIP_ARMED)
+	{
+		TripRetry = 0;
+		ArmTrip();
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetTripCount
+*
+* ARGUMENTS:
+*
+* RETURNS:		trips since the log was cleared
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+uint32_t GetTripCount(void)
+{
+
+	return TripCount;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetTripEntry
+*
+* ARGUMENTS:	n - 0 is the latest trip
+*				pEntry - where to put it
+*
+* RETURNS:		0 - OK, -1 - not in the log
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int GetTripEntry(uint32_t n, TRIP_ENTRY* pEntry)
+{
+	uint32_t count = TripCount;
+
+	if(n >= count || n >= TRIP_LOG_SIZE)
+	{
+		return -1;
+	}
+
+	__disable_irq();
+	*pEntry = aTripLog[(count - 1 - n) % TRIP_LOG_SIZE];
+	__enable_irq();
+
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		ClearTripLog
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void ClearTripLog(void)
+{
+	__disable_irq();
+	PeakSamples = 0;
+	TripCount = 0;
+	memset(aTripLog, 0, sizeof(aTripLog));
+	__enable_irq();
+}
@@ -0,0 +1,161 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	IsrStats.c
+*
+* DATE CREATED:		8/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:	Interrupt latency and duration statistics. The handler
+*				notes the DWT cycle counter on entry and records the
+*				entry latency (supplied by the caller, it depends on the
+*				interrupt source) and its own run time on exit.
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include "task.h"
+#include <string.h>
+#include "IsrStats.h"
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+
+/*********************************************************************
+*
+* IsrStatsInit
+*
+* @brief	Start the DWT cycle counter
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void IsrStatsInit(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
+/*********************************************************************
+*
+* IsrStatsClear
+*
+* @brief	Clear the statistics (the worst case is kept since reset)
+*
+* @param	pointer to the statistics
+*
+* @return	none
+*
+*********************************************************************/
+void IsrStatsClear(ISR_STATS* pStats)
+{
+	memset(&pStats->latency, 0, sizeof(pStats->latency));
+	memset(&pStats->duration, 0, sizeof(pStats->duration));
+}
+
+
+/*********************************************************************
+*
+* IsrStatsRecord
+*
+* @brief	Record one pass through an interrupt handler, called last
+*			thing in the handler (interrupt context)
+*
+* @param	pointer to the statistics
+*			cycle counter on entry to the handler
+*			entry latency in cycles
+*
+* @return	none
+*
+*********************************************************************/
+void IsrStatsRecord(ISR_STATS* pStats, uint32_t start, uint32_t latency)
+{
+	uint32_t duration = DWT->CYCCNT - start;
+
+	StatsHistRecord(&pStats->latency, latency, ISR_STATS_BUCKET_SHIFT);
+	StatsHistRecord(&pStats->duration, duration, ISR_STATS_BUCKET_SHIFT);
+
+	if(latency > pStats->worst_latency)
+	{
+		pStats->worst_latency = latency;
+		pStats->worst_duration = duration;
+		pStats->worst_time = start;
+		pStats->worst_task = (osThreadId_t)xTaskGetCurrentTaskHandle();
+	}
+}
+
+
+/*********************************************************************
+*
+* StatsHistRecord
+*
+* @brief	Add a sample to a histogram, also used for the decoder
+*			response latency (interrupt context)
+*
+* @param	pointer to the histogram
+*			sample
+*			bucket width, log2
+*
+* @return	none
+*
+*********************************************************************/
+void StatsHistRecord(STATS_HIST* pHist, uint32_t value, uint32_t shift)
+{
+	uint32_t bucket = value >> shift;
+
+	if(pHist->count == 0 || value < pHist->min)
+	{
+		pHist->min = value;
+	}
+	if(value > pHist->max)
+	{
+		pHist->max = value;
+	}
+	pHist->sum += value;
+	pHist->count++;
+
+	pHist->hist[bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1]++;
+}
+
+
+/*********************************************************************
+*
+* StatsHistPercentile
+*
+* @brief	Find a percentile in a histogram
+*
+* @param	pointer to the histogram
+*			bucket width, log2
+*			percentile in tenths of a percent (500 = median)
+*
+* @return	upper edge of the bucket holding the percentile, the
+*			largest sample for the last bucket
+*
+*********************************************************************/
+uint32_t StatsHistPercentile(const STATS_HIST* pHist, uint32_t shift, uint32_t per_mille)
+{
+	uint64_t target = ((uint64_t)pHist->count * per_mille + 999) / 1000;
+	uint64_t sum = 0;
+	uint32_t edge;
+
+	for(int i = 0; i < STATS_HIST_BUCKETS - 1; i++)
+	{
+		sum += pHist->hist[i];
+		if(sum >= target && sum != 0)
+		{
+			edge = ((i + 1) << shift) - 1;
+			return edge < pHist->max ? edge : pHist->max;
+		}
+	}
+	return pHist->max;
+}
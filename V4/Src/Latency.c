@@ -0,0 +1,295 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Latency.c
+*
+* DATE CREATED:		24/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Decoder response latency. The programming track
+*					interrupt notes when the last bit of each packet ends
+*					(GetChannelPacketEnd), the ACK detector calls
+*					LatencyRise with the DWT time of every confirmed
+*					current rise. The time from the last packet end to
+*					the rise goes in the histogram of the test running
+*					and the decoder on the track. Both times come from
+*					the cycle counter, the rise is timed where the
+*					filtered level crosses half the ACK current so it
+*					includes the level filter delay (under 190us).
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#include "main.h"
+#include "cmsis_os.h"
+#include <string.h>
+#include "Track.h"
+#include "Latency.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+static uint32_t DecoderCount(const LATENCY_DECODER* pDecoder);
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static LATENCY_DECODER aDecoders[LAT_DECODERS];
+
+// set by the task, used by the DMA interrupt
+static volatile uint8_t LatTest = LAT_TEST_NONE;
+static volatile uint8_t LatDecoder;
+
+static LATENCY_STATS LatStats;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+* FUNCTION:		DecoderCount
+*
+* ARGUMENTS:	pDecoder - decoder entry
+*
+* RETURNS:		rises timed for it over all the tests
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+static uint32_t DecoderCount(const LATENCY_DECODER* pDecoder)
+{
+	uint32_t count = 0;
+	int i;
+
+	for(i = 0; i < LAT_TESTS; i++)
+	{
+		count += pDecoder->aTest[i].count;
+	}
+	return count;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		LatencyRise
+*
+* ARGUMENTS:	onset - DWT time the current started to rise
+*
+* RETURNS:
+*
+* DESCRIPTION:	Time a confirmed current rise on the programming track
+*				from the end of the last packet before it
+*
+* RESTRICTIONS:	ACK DMA interrupt
+*
+**********************************************************************/
+void LatencyRise(uint32_t onset)
+{
+	uint32_t end;
+	uint32_t us;
+
+	LatStats.rises++;
+
+	if(LatTest >= LAT_TESTS)
+	{
+		LatStats.untested++;
+		return;
+	}
+
+	if(GetChannelPacketEnd(TC_PROG, onset, &end) != 0)
+	{
+		LatStats.unmatched++;
+		return;
+	}
+
+	us = (onset - end) / (SystemCoreClock / 1000000);
+	if(us > LAT_WINDOW_US)
+	{
+		LatStats.unmatched++;
+		return;
+	}
+
+	aDecoders[LatDecoder].bfUsed = 1;
+	StatsHistRecord(&aDecoders[LatDecoder].aTest[LatTest], us, LAT_BUCKET_SHIFT);
+
+	LatStats.timed++;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SetLatencyTest
+*
+* ARGUMENTS:	bTest - LAT_TEST_, LAT_TEST_NONE when nothing is sent
+*
+* RETURNS:
+*
+* DESCRIPTION:	The packets sent from now on are for this test
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void SetLatencyTest(uint8_t bTest)
+{
+
+	LatTest = bTest;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		SetLatencyDecoder
+*
+* ARGUMENTS:	bManufacturer - CV8, 0 = not identified
+*				bVersion - CV7
+*				wSerial - CV105, CV106
+*
+* RETURNS:
+*
+* DESCRIPTION:	The decoder on the programming track from now on. A new
+*				decoder takes a free entry, or the one with the fewest
+*				rises when they are all used.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void SetLatencyDecoder(uint8_t bManufacturer, uint8_t bVersion, uint16_t wSerial)
+{
+	LATENCY_DECODER* pDecoder;
+	uint8_t bIndex = 0;
+	uint8_t bFewest = 1;
+	int i;
+
+	if(bManufacturer != 0)
+	{
+		for(i = 1; i < LAT_DECODERS; i++)
+		{
+			pDecoder = &aDecoders[i];
+			if(!pDecoder->bfUsed)
+			{
+				if(bIndex == 0)
+				{
+					bIndex = i;
+				}
+			}
+			else if(pDecoder->bManufacturer == bManufacturer &&
+				pDecoder->bVersion == bVersion &&
+				pDecoder->wSerial == wSerial)
+			{
+				LatDecoder = i;
+				return;
+			}
+			else if(DecoderCount(pDecoder) < DecoderCount(&aDecoders[bFewest]))
+			{
+				bFewest = i;
+			}
+		}
+
+		if(bIndex == 0)
+		{
+			bIndex = bFewest;
+			LatStats.replaced++;
+		}
+
+		__disable_irq();
+		pDecoder = &aDecoders[bIndex];
+		memset(pDecoder, 0, sizeof(LATENCY_DECODER));
+		pDecoder->bfUsed = 1;
+		pDecoder->bManufacturer = bManufacturer;
+		pDecoder->bVersion = bVersion;
+		pDecoder->wSerial = wSerial;
+		__enable_irq();
+	}
+
+	LatDecoder = bIndex;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetLatencyDecoder
+*
+* ARGUMENTS:	bIndex - 0 to LAT_DECODERS - 1
+*				pDecoder - where to copy it
+*
+* RETURNS:		0 = copied, 1 = the entry is not used
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int GetLatencyDecoder(uint8_t bIndex, LATENCY_DECODER* pDecoder)
+{
+
+	if(bIndex >= LAT_DECODERS || !aDecoders[bIndex].bfUsed)
+	{
+		return 1;
+	}
+
+	__disable_irq();
+	*pDecoder = aDecoders[bIndex];
+	__enable_irq();
+	return 0;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetLatencyStats / ClearLatencyStats
+*
+* ARGUMENTS:	pStats - where to copy them
+*
+* RETURNS:
+*
+* DESCRIPTION:	Clear drops the histograms of every decoder, the decoder
+*				on the track stays current
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetLatencyStats(LATENCY_STATS* pStats)
+{
+
+	__disable_irq();
+	*pStats = LatStats;
+	__enable_irq();
+}
+
+void ClearLatencyStats(void)
+{
+	int i;
+
+	__disable_irq();
+	for(i = 0; i < LAT_DECODERS; i++)
+	{
+		memset(aDecoders[i].aTest, 0, sizeof(aDecoders[i].aTest));
+		aDecoders[i].bfUsed = i == LatDecoder && i != 0;
+	}
+	memset(&LatStats, 0, sizeof(LatStats));
+	__enable_irq();
+}
+
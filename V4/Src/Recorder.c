@@ -0,0 +1,497 @@
+/**********************************************************************
+*
+* SOURCE FILENAME:	Recorder.c
+*
+* DATE CREATED:		22/Oct/2019
+*
+* PROGRAMMER:
+*
+* DESCRIPTION:		Programming track current recorder. The ACK detector
+*					hands every half of its DMA buffer to RecordSamples,
+*					which keeps the last REC_PRE_SAMPLES in a ring. A
+*					trigger from service mode starts a window with that
+*					history and fills it from the following blocks. The
+*					last REC_WINDOWS windows stay in RAM. A writer claims
+*					a window and writes it straight from there, the
+*					recorder does not reuse a claimed window. A failed
+*					operation holds the windows until they are cleared.
+*
+* COPYRIGHT (c) 1999-2019 by K2 Engineering  All Rights Reserved.
+*
+**********************************************************************/
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+#include "ff.h"
+#include "Recorder.h"
+
+/**********************************************************************
+*
+*							DEFINITIONS
+*
+**********************************************************************/
+
+// the history ring is indexed with a mask
+typedef char REC_PRE_SAMPLES_CHECK[(REC_PRE_SAMPLES & (REC_PRE_SAMPLES - 1)) == 0 ? 1 : -1];
+
+/**********************************************************************
+*
+*							FUNCTION PROTOTYPES
+*
+**********************************************************************/
+
+static REC_WINDOW* PickWindow(void);
+static void StartWindow(uint32_t last, uint32_t sample_cycles);
+
+/**********************************************************************
+*
+*							GLOBAL VARIABLES
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+*							STATIC VARIABLES
+*
+**********************************************************************/
+
+static REC_WINDOW aWindows[REC_WINDOWS];
+static REC_WINDOW* pFilling;
+
+static uint16_t aPre[REC_PRE_SAMPLES];
+static uint32_t PreHead;
+
+static uint32_t Sequence;
+static volatile uint32_t LastSequence;		// window of the last trigger, 0 = none
+static volatile uint8_t bfHeld;
+
+// the trigger, set by the task, taken by the next block
+static volatile uint8_t bfPending;
+static uint8_t PendingTag;
+static uint8_t PendingArg;
+static uint16_t PendingCV;
+static uint32_t PendingCycles;
+static uint32_t PendingTick;
+
+static REC_STATS RecStats;
+
+static FIL RecFile;
+
+/**********************************************************************
+*
+*							CODE
+*
+**********************************************************************/
+
+/**********************************************************************
+*
+* FUNCTION:		PickWindow
+*
+* ARGUMENTS:
+*
+* RETURNS:		a free window, else the oldest done one, NULL = none
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:	interrupts off or the DMA interrupt
+*
+**********************************************************************/
+static REC_WINDOW* PickWindow(void)
+{
+	REC_WINDOW* pOldest = NULL;
+	int i;
+
+	for(i = 0; i < REC_WINDOWS; i++)
+	{
+		if(aWindows[i].state == REC_FREE)
+		{
+			return &aWindows[i];
+		}
+		if(aWindows[i].state == REC_DONE && (pOldest == NULL || aWindows[i].sequence < pOldest->sequence))
+		{
+			pOldest = &aWindows[i];
+		}
+	}
+	return pOldest;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		StartWindow
+*
+* ARGUMENTS:	last - DWT time of the newest sample
+*				sample_cycles - DWT cycles between samples
+*
+* RETURNS:
+*
+* DESCRIPTION:	Take the pending trigger, a window starts with the
+*				history ring, oldest sample first
+*
+* RESTRICTIONS:	DMA interrupt
+*
+**********************************************************************/
+static void StartWindow(uint32_t last, uint32_t sample_cycles)
+{
+	REC_WINDOW* pWindow;
+	uint32_t i;
+
+	bfPending = 0;
+
+	if(pFilling != NULL)
+	{
+		// cut short by the next burst
+		pFilling->state = REC_DONE;
+		pFilling = NULL;
+		RecStats.windows++;
+	}
+
+	if(bfHeld || (pWindow = PickWindow()) == NULL)
+	{
+		RecStats.dropped++;
+		LastSequence = 0;
+		return;
+	}
+
+	pWindow->sequence = ++Sequence;
+	pWindow->trigger = PendingCycles;
+	pWindow->first = last - (REC_PRE_SAMPLES - 1) * sample_cycles;
+	pWindow->sample_cycles = sample_cycles;
+	pWindow->tick = PendingTick;
+	pWindow->cv = PendingCV;
+	pWindow->tag = PendingTag;
+	pWindow->arg = PendingArg;
+	pWindow->ack_us = 0;
+	pWindow->status = REC_STATUS_NONE;
+
+	for(i = 0; i < REC_PRE_SAMPLES; i++)
+	{
+		pWindow->samples[i] = aPre[(PreHead + i) & (REC_PRE_SAMPLES - 1)];
+	}
+	pWindow->count = REC_PRE_SAMPLES;
+
+	pWindow->state = REC_FILLING;
+	pFilling = pWindow;
+	LastSequence = pWindow->sequence;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordSamples
+*
+* ARGUMENTS:	pSamples - block of ADC samples
+*				count - samples in the block
+*				last - DWT time of the last sample
+*				sample_cycles - DWT cycles between samples
+*
+* RETURNS:
+*
+* DESCRIPTION:	Keep the history and fill the open window
+*
+* RESTRICTIONS:	DMA interrupt
+*
+**********************************************************************/
+void RecordSamples(const uint16_t* pSamples, uint32_t count, uint32_t last, uint32_t sample_cycles)
+{
+	uint32_t n;
+	uint32_t i;
+
+	for(i = 0; i < count; i++)
+	{
+		aPre[PreHead++ & (REC_PRE_SAMPLES - 1)] = pSamples[i];
+	}
+
+	if(bfPending)
+	{
+		// the block is already in the history
+		StartWindow(last, sample_cycles);
+		return;
+	}
+
+	if(pFilling != NULL)
+	{
+		n = REC_WINDOW_SAMPLES - pFilling->count;
+		if(n > count)
+		{
+			n = count;
+		}
+		memcpy(&pFilling->samples[pFilling->count], pSamples, n * sizeof(uint16_t));
+		pFilling->count += n;
+
+		if(pFilling->count == REC_WINDOW_SAMPLES)
+		{
+			pFilling->state = REC_DONE;
+			pFilling = NULL;
+			RecStats.windows++;
+		}
+	}
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordTrigger
+*
+* ARGUMENTS:	tag - REC_TAG_
+*				cv - CV of the operation
+*				arg - bit or value
+*
+* RETURNS:
+*
+* DESCRIPTION:	Start a window with the next block of samples
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void RecordTrigger(uint8_t tag, uint16_t cv, uint8_t arg)
+{
+
+	PendingTag = tag;
+	PendingCV = cv;
+	PendingArg = arg;
+	PendingCycles = DWT->CYCCNT;
+	PendingTick = HAL_GetTick();
+	RecStats.triggers++;
+
+	// the trigger is complete before the interrupt can take it
+	__DMB();
+	bfPending = 1;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordResult
+*
+* ARGUMENTS:	status - REC_STATUS_
+*				ack_us - width of the ACK pulse, 0 = none
+*
+* RETURNS:
+*
+* DESCRIPTION:	How the burst of the last trigger ended
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void RecordResult(uint8_t status, uint16_t ack_us)
+{
+	int i;
+
+	__disable_irq();
+	for(i = 0; i < REC_WINDOWS && LastSequence != 0; i++)
+	{
+		if(aWindows[i].sequence == LastSequence && aWindows[i].state != REC_FREE)
+		{
+			aWindows[i].status = status;
+			aWindows[i].ack_us = ack_us;
+			break;
+		}
+	}
+	__enable_irq();
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordHold / RecordClear
+*
+* ARGUMENTS:
+*
+* RETURNS:
+*
+* DESCRIPTION:	Hold the windows there are, the one filling still
+*				fills. Clear drops every window that is not claimed
+*				and records again.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void RecordHold(void)
+{
+
+	if(!bfHeld)
+	{
+		bfHeld = 1;
+		RecStats.holds++;
+	}
+}
+
+void RecordClear(void)
+{
+	int i;
+
+	__disable_irq();
+	for(i = 0; i < REC_WINDOWS; i++)
+	{
+		if(aWindows[i].state != REC_CLAIMED)
+		{
+			aWindows[i].state = REC_FREE;
+		}
+	}
+	pFilling = NULL;
+	LastSequence = 0;
+	bfHeld = 0;
+	__enable_irq();
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordClaim
+*
+* ARGUMENTS:	after - sequence of the last window taken, 0 = none
+*
+* RETURNS:		the oldest done window after it, NULL = none
+*
+* DESCRIPTION:	Hand a window to a writer, it stays put until it is
+*				released
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+const REC_WINDOW* RecordClaim(uint32_t after)
+{
+	REC_WINDOW* pWindow = NULL;
+	int i;
+
+	__disable_irq();
+	for(i = 0; i < REC_WINDOWS; i++)
+	{
+		if(aWindows[i].state == REC_DONE && aWindows[i].sequence > after &&
+			(pWindow == NULL || aWindows[i].sequence < pWindow->sequence))
+		{
+			pWindow = &aWindows[i];
+		}
+	}
+	if(pWindow != NULL)
+	{
+		pWindow->state = REC_CLAIMED;
+	}
+	__enable_irq();
+
+	return pWindow;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordRelease
+*
+* ARGUMENTS:	pWindow - a claimed window
+*
+* RETURNS:
+*
+* DESCRIPTION:	The writer is done, the window can be reused
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void RecordRelease(const REC_WINDOW* pWindow)
+{
+
+	((REC_WINDOW*)pWindow)->state = REC_DONE;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		RecordDump
+*
+* ARGUMENTS:	szFile - file to write
+*				bfCsv - text, else binary
+*
+* RETURNS:		windows written, -1 = FatFs error
+*
+* DESCRIPTION:	Write the done windows, oldest first. Binary is each
+*				window header (REC_HEADER_SIZE) and its samples, as
+*				they are in RAM. CSV is a line a sample: sequence, us
+*				from the trigger and ADC counts, under a comment line
+*				for each window.
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+int RecordDump(const char* szFile, uint8_t bfCsv)
+{
+	const REC_WINDOW* pWindow;
+	char szLine[96];
+	uint32_t after = 0;
+	uint32_t cycles_us = SystemCoreClock / 1000000;
+	uint32_t i;
+	int count = 0;
+	FRESULT res = FR_OK;
+	UINT bw;
+
+	if(f_open(&RecFile, szFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	{
+		return -1;
+	}
+
+	if(bfCsv)
+	{
+		f_puts("Sequence,us,ADC\r\n", &RecFile);
+	}
+
+	while(res == FR_OK && (pWindow = RecordClaim(after)) != NULL)
+	{
+		after = pWindow->sequence;
+
+		if(bfCsv)
+		{
+			sprintf(szLine, "# sequence %lu tick %lu tag %u cv %u arg %u status %u ack %u us\r\n",
+				(unsigned long)pWindow->sequence, (unsigned long)pWindow->tick, pWindow->tag, pWindow->cv,
+				pWindow->arg, pWindow->status, pWindow->ack_us);
+			f_puts(szLine, &RecFile);
+
+			for(i = 0; i < pWindow->count && res == FR_OK; i++)
+			{
+				sprintf(szLine, "%lu,%ld,%u\r\n", (unsigned long)pWindow->sequence,
+					(long)((int32_t)(pWindow->first + i * pWindow->sample_cycles - pWindow->trigger) / (int32_t)cycles_us),
+					pWindow->samples[i]);
+				if(f_puts(szLine, &RecFile) < 0)
+				{
+					res = FR_DISK_ERR;
+				}
+			}
+		}
+		else
+		{
+			res = f_write(&RecFile, pWindow, REC_HEADER_SIZE, &bw);
+			if(res == FR_OK)
+			{
+				res = f_write(&RecFile, pWindow->samples, pWindow->count * sizeof(uint16_t), &bw);
+			}
+		}
+
+		RecordRelease(pWindow);
+		count++;
+	}
+
+	if(f_close(&RecFile) != FR_OK || res != FR_OK)
+	{
+		return -1;
+	}
+	return count;
+}
+
+
+/**********************************************************************
+*
+* FUNCTION:		GetRecordStats
+*
+* ARGUMENTS:	pStats - where to put the statistics
+*
+* RETURNS:
+*
+* DESCRIPTION:
+*
+* RESTRICTIONS:
+*
+**********************************************************************/
+void GetRecordStats(REC_STATS* pStats)
+{
+
+	*pStats = RecStats;
+	pStats->bfHeld = bfHeld;
+}
@@ -10,9 +10,11 @@
 * @copyright	(c) 2019  all Rights Reserved.
 *******************************************************************************/
 #include "main.h"
+#include "cmsis_os.h"
 #include <stdio.h>
 #include <string.h>
 #include "Track.h"
+#include "IsrStats.h"
 
 /**********************************************************************
 *
@@ -23,6 +25,16 @@
 //#define IDLE_IDLE_PACKETS
 //#define ENABLE_AT_STARTUP1
 
+/**
+	@brief Stream the packet patterns to the track timers with the DMA burst
+	(DCR/DMAR) instead of reloading ARR/RCR/CCR1 from the update interrupt
+	for every bit. The CPU is only interrupted at the packet boundaries.
+ */
+//#define TRACK_DMA_BURST
+
+// measure the update interrupt latency and run time (shell isrstat)
+#define TRACK_ISR_STATS
+
 #define __HAL_TIM_SET_REPETITION(__HANDLE__, __REPETITION__) \
   do{                                                    \
     (__HANDLE__)->Instance->RCR = (__REPETITION__);  \
@@ -30,7 +42,7 @@
   } while(0)
 
 
-/** 
+/**
 	@brief Track output pin definitions
  */
 #define TRACK_A_PIN			GPIO_PIN_9
@@ -55,12 +67,49 @@
 #define TRACK_ENABLE_SPEED	GPIO_SPEED_FREQ_VERY_HIGH
 #define TRACK_ENABLE_PORT	GPIOB
 
+/**
+	@brief Programming track output pin definitions (TIM8 CH1 on PC6,
+	CH1N on PA5 - PA7 is the Ethernet RMII CRS_DV on the Nucleo-144)
+ */
+#define PROG_A_PIN			GPIO_PIN_6
+#define PROG_A_AF			GPIO_AF3_TIM8
+#define PROG_A_PORT			GPIOC
+
+#define PROG_B_PIN			GPIO_PIN_5
+#define PROG_B_AF			GPIO_AF3_TIM8
+#define PROG_B_PORT			GPIOA
+
+#define PROG_ENABLE_PIN		GPIO_PIN_8
+#define PROG_ENABLE_PORT	GPIOC
+
 #define SCOPE_TRIGGER_Pin	GPIO_PIN_7
 #define SCOPE_TRIGGER_MODE	GPIO_MODE_OUTPUT_PP
 #define SCOPE_TRIGGER_PU_PD	GPIO_NOPULL
 #define SCOPE_TRIGGER_SPEED	GPIO_SPEED_FREQ_VERY_HIGH
 #define SCOPE_TRIGGER_Port	GPIOE
 
+/**
+	@brief Track DMA definitions (TIM1_UP is DMA2 stream 5 channel 6,
+	TIM8_UP is DMA2 stream 1 channel 7)
+ */
+#define TRACK_DMA_STREAM	DMA2_Stream5
+#define TRACK_DMA_CHANNEL	DMA_CHANNEL_6
+#define TRACK_DMA_IRQn		DMA2_Stream5_IRQn
+
+#define PROG_DMA_STREAM		DMA2_Stream1
+#define PROG_DMA_CHANNEL	DMA_CHANNEL_7
+#define PROG_DMA_IRQn		DMA2_Stream1_IRQn
+
+// one burst loads ARR, RCR and CCR1 from one PACKET_BITS entry
+#define TRACK_DMA_BURST_LENGTH	(sizeof(PACKET_BITS) / sizeof(uint16_t))
+
+// CPU cycles a pattern entry plays for, the timers count the core clock
+// through the prescaler and an entry is count + 1 periods of period + 1
+#define ENTRY_CYCLES(p)		(((uint32_t)(p)->count + 1) * ((uint32_t)(p)->period + 1) * (TIMER_PRESCALER + 1))
+
+// end times kept of the packets played from the ring
+#define TRACK_PACKET_ENDS	8
+
 /** @enum MAIN_TRACK_STATES
 	@brief Track state machine states
  */
@@ -76,8 +125,187 @@ enum
 #define PACKET_COMPLETE			1
 #define PACKET_NOT_COMPLETE		0
 
-#define BUFFER_AVAILABLE		1
-#define BUFFER_NOT_AVAILABLE	0
+// the TIM1 repetition counter is 8 bits
+#define MAX_REPETITION			255
+
+// thread flag set for a task waiting in WaitForChannelSlot (one per channel)
+#define TRACK_FLAG_SLOT			0x0001
+
+// thread flag set for a task waiting in WaitForTrackTurn
+#define TRACK_FLAG_TURN			0x0010
+
+// the timer and DMA interrupts stay above the RTOS ceiling, nothing may
+// hold off the next entry, so they make no RTOS calls
+#define TRACK_IRQ_PRIORITY		0
+
+// they pend this otherwise unused vector (CAN2 is not used) for the slot
+// wakeups, it runs at the RTOS ceiling once they return
+#define TRACK_WAKE_IRQ			CAN2_SCE_IRQn
+#define TRACK_WAKE_PRIORITY		configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+
+// main track shares while the tester, the command station and the
+// shell packet command contend
+#define TESTER_SHARE			80
+#define TESTER_PRIORITY			1
+#define CS_SHARE				20
+#define CS_PRIORITY				0
+#define SHELL_SHARE				20
+#define SHELL_PRIORITY			2
+
+// a resource holding the track in a critical section builds up debt,
+// this much is paid back afterwards, the rest is forgiven
+#define ARBITER_CREDIT_LIMIT	400
+
+#define RING_INDEX(index)		((index) & (TRACK_PACKET_SLOTS - 1))
+
+// preamble, 3 bytes with runs of equal bits, end bit and terminator
+#define IDLE_PACKET_SIZE		8
+
+// what the main track does when it runs out of packets and nobody has
+// opened it with a policy of their own
+#ifdef IDLE_IDLE_PACKETS
+	#define MAIN_TRACK_IDLE		TI_IDLE
+#else
+	#define MAIN_TRACK_IDLE		TI_NONE
+#endif
+
+
+/** @struct TRACK_ARBITER
+	@brief Shares the main track between the resources at packet
+	boundaries (smooth weighted round robin over the resources that have
+	a packet ready)
+ */
+typedef struct trackarbiter_t
+{
+	TRACK_LOCK				aLock[TRACK_RESOURCES];
+	TRACK_RESOURCE			grant;			// queues the next main track packet
+	TRACK_RESOURCE			critical;		// keeps the track until ExitTrackCritical
+	osThreadId_t			aWaiter[TRACK_RESOURCES];
+} TRACK_ARBITER;
+
+
+/** @struct PACKET_ENCODER
+	@brief Run length encoder state while a packet pattern is built.
+	Consecutive bits with the same timing are merged into one entry
+	and played with the repetition counter.
+ */
+typedef struct packet_encoder_t
+{
+	PACKET_BITS*	pStart;		// first entry of the packet buffer
+	PACKET_BITS*	pNext;		// next free entry
+	PACKET_BITS*	pLast;		// last entry (reserved for the terminator)
+	uint32_t		bits;		// bits encoded
+} PACKET_ENCODER;
+
+
+/** @struct PACKET_CACHE
+	@brief A compiled packet kept for reuse, keyed by the packet bytes and
+	the bit timings it was built with. The entry is in use while a ring
+	slot refers to it: queued is counted by the producer and released by
+	the track interrupt, so each count is written by one side only.
+ */
+typedef struct packet_cache_t
+{
+	uint8_t			bytes[TRACK_CACHE_BYTES];
+	uint8_t			len;		// 0 = entry empty
+	uint16_t		clk1t;
+	uint16_t		clk0t;
+	uint16_t		clk0h;
+	uint16_t		preambles;
+	uint32_t		used;		// LRU stamp
+	uint32_t		queued;
+	volatile uint32_t released;
+	PACKET_BITS		pattern[TRACK_PACKET_SIZE];
+} PACKET_CACHE;
+
+
+/** @struct TRACK_HARDWARE
+	@brief The timer, DMA stream and pins behind one track output
+ */
+typedef struct track_hardware_t
+{
+	TIM_TypeDef*		timer;
+	IRQn_Type			timer_irq;
+	DMA_Stream_TypeDef*	dma_stream;
+	uint32_t			dma_channel;
+	IRQn_Type			dma_irq;
+	GPIO_TypeDef*		a_port;
+	uint16_t			a_pin;
+	GPIO_TypeDef*		b_port;
+	uint16_t			b_pin;
+	uint8_t				af;			// alternate function of both pins
+	GPIO_TypeDef*		enable_port;
+	uint16_t			enable_pin;
+	uint16_t			preambles;	// default number of preambles
+	uint8_t				scope;		// drives the scope trigger
+} TRACK_HARDWARE;
+
+
+/** @struct TRACK_OUTPUT
+	@brief Everything one track output owns. Each output has its own
+	timer, packet ring, packet cache, idle policy and statistics so the
+	programming track can run service mode while the main track keeps
+	sending operations traffic.
+
+	The ring has a single producer (the task that owns the output) that
+	fills the slot at RingHead and then advances RingHead, the track
+	interrupt plays the slot at RingTail and advances RingTail when it is
+	done with it. Each index is written by one side only so no lock is
+	needed. A slot plays either the packet built in its own buffer or,
+	for a packet found in the cache, the cached pattern itself.
+
+	The idle packet is built with the programmed clocks in a buffer that
+	is neither the current idle packet nor playing, then handed over with
+	pIdlePacket. With three buffers there is always one free.
+ */
+typedef struct track_output_t
+{
+	TRACK_CHANNEL			channel;
+	const TRACK_HARDWARE*	pHardware;
+	TIM_HandleTypeDef		htim;
+	#ifdef TRACK_DMA_BURST
+		DMA_HandleTypeDef	hdma;
+		uint32_t			DmaTailCycles;	// last two entries of the pattern streaming
+	#endif
+
+	PACKET_BITS*			CurrentPacket;
+	PACKET_BITS*			CurrentPattern;
+	uint32_t				PacketComplete;
+	uint8_t					bTrackState;
+	uint8_t					bStopped;		// ran out of packets, restart on the next one
+	uint8_t					bSlotPlaying;	// the current packet came from the ring
+	uint32_t				ScopeTriggerBitCount;
+
+	// DWT time the last bit of a ring packet ends, written by the interrupt
+	uint32_t				LoadedCycles;	// the entry in the timer preload
+	uint32_t				aPacketEnd[TRACK_PACKET_ENDS];
+	volatile uint32_t		PacketEnds;
+
+	TRACK_IDLE				idle;
+	uint16_t				idle_clk1t;		// ticks
+	uint16_t				idle_clk0t;
+	uint16_t				idle_clk0h;
+	PACKET_BITS				aIdlePacket[3][IDLE_PACKET_SIZE];
+	PACKET_BITS* volatile	pIdlePacket;
+
+	PACKET_BITS				aPacketRing[TRACK_PACKET_SLOTS][TRACK_PACKET_SIZE];
+	PACKET_BITS*			apRingPattern[TRACK_PACKET_SLOTS];
+	PACKET_CACHE*			apRingEntry[TRACK_PACKET_SLOTS];
+	volatile uint32_t		RingHead;
+	volatile uint32_t		RingTail;
+
+	osThreadId_t			SlotWaiter;
+	void					(*pSlotCallback)(void);
+	volatile uint8_t		bWakePending;	// a slot came free, set by the interrupt
+
+	PACKET_CACHE			aPacketCache[TRACK_CACHE_ENTRIES];
+	uint32_t				CacheClock;
+
+	TRACK_STATS				Stats;
+	#ifdef TRACK_ISR_STATS
+		ISR_STATS			IsrStats;
+	#endif
+} TRACK_OUTPUT;
 
 
 /**********************************************************************
@@ -86,10 +314,39 @@ enum
 *
 **********************************************************************/
 
-void MarkPacketUnused(PACKET_BITS* p);
+static void TrackConfig(TRACK_OUTPUT* pTrack);
+static void TrackInterrupt(TRACK_OUTPUT* pTrack);
+
+static PACKET_BITS* GetFreePacket(TRACK_OUTPUT* pTrack);
+static void ReleasePacket(TRACK_OUTPUT* pTrack);
 
-void BuildIdlePacket(uint16_t no_preambles);
+static void BuildIdlePacket(PACKET_BITS* pPacket, const uint8_t* abBytes, uint16_t no_preambles, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+static void RebuildIdlePacket(TRACK_OUTPUT* pTrack, TRACK_IDLE ti);
+static uint16_t GetPreambles(TRACK_OUTPUT* pTrack);
 
+static PACKET_CACHE* CacheLookup(TRACK_OUTPUT* pTrack, const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h, uint16_t preambles);
+static PACKET_CACHE* CacheAllocate(TRACK_OUTPUT* pTrack);
+
+static void EncodeStart(PACKET_ENCODER* pEncoder, PACKET_BITS* pPacket, uint32_t size);
+static void EncodeBits(PACKET_ENCODER* pEncoder, uint16_t period, uint16_t pulse, uint32_t count);
+static void EncodeByte(PACKET_ENCODER* pEncoder, uint8_t packet_byte, uint8_t first_bit, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h);
+static int EncodeEnd(PACKET_ENCODER* pEncoder, TRACK_STATS* pStats);
+
+static uint8_t SelectNextPacket(TRACK_OUTPUT* pTrack);
+static void MarkPacketEnd(TRACK_OUTPUT* pTrack, uint32_t tail);
+static void QueuePacket(TRACK_OUTPUT* pTrack, PACKET_BITS* pPacket, PACKET_CACHE* pEntry);
+
+static uint8_t TakeTurn(TRACK_RESOURCE tr);
+static void ChargeTurn(void);
+static void WakeTurnWaiters(TRACK_RESOURCE tr);
+static void UpdateMainIdle(void);
+
+#ifdef TRACK_DMA_BURST
+	static TRACK_OUTPUT* GetDmaTrack(DMA_HandleTypeDef* hdma);
+	static void TrackDmaStart(TRACK_OUTPUT* pTrack, const PACKET_BITS* pPattern);
+	static void TrackDmaHalfComplete(DMA_HandleTypeDef* hdma);
+	static void TrackDmaComplete(DMA_HandleTypeDef* hdma);
+#endif
 
 /**********************************************************************
 *
@@ -97,16 +354,30 @@ void BuildIdlePacket(uint16_t no_preambles);
 *
 **********************************************************************/
 
-PACKET_BITS apIdlePacket[6];
-PACKET_BITS apPacket1[80];
-PACKET_BITS apPacket2[80];
-
-PACKET_BITS* CurrentPacket;
-PACKET_BITS* CurrentPattern;
-
-static TIM_HandleTypeDef	htim1;
+// played (but never output) while the last packet finishes before the
+// track is turned off, the preload registers run two entries ahead
+static PACKET_BITS apTrackStop[3] =
+{
+	{ONE_PERIOD,	0,	ONE_PULSE},
+	{ONE_PERIOD,	0,	ONE_PULSE},
+	{0,				0,	0},
+};
 
-TRACK_LOCK TrackLock;
+static const TRACK_HARDWARE aTrackHardware[TRACK_CHANNELS] =
+{
+	// TC_MAIN
+	{
+		TIM1, TIM1_UP_TIM10_IRQn, TRACK_DMA_STREAM, TRACK_DMA_CHANNEL, TRACK_DMA_IRQn,
+		TRACK_A_PORT, TRACK_A_PIN, TRACK_B_PORT, TRACK_B_PIN, TRACK_A_AF,
+		TRACK_ENABLE_PORT, TRACK_ENABLE_PIN, NO_OF_PREAMBLE_BITS, 1
+	},
+	// TC_PROG
+	{
+		TIM8, TIM8_UP_TIM13_IRQn, PROG_DMA_STREAM, PROG_DMA_CHANNEL, PROG_DMA_IRQn,
+		PROG_A_PORT, PROG_A_PIN, PROG_B_PORT, PROG_B_PIN, PROG_A_AF,
+		PROG_ENABLE_PORT, PROG_ENABLE_PIN, SERVICE_PREAMBLE_BITS, 0
+	},
+};
 
 /**********************************************************************
 *
@@ -114,13 +385,24 @@ TRACK_LOCK TrackLock;
 *
 **********************************************************************/
 
-uint8_t bTrackState;
-
 static uint32_t ScopeTriggerBitOffset = 20;
-static uint32_t ScopeTriggerBitCount;
 
-static uint32_t BufferAvailable;
-static uint32_t PacketComplete;
+static const uint8_t abIdleBytes[3] = { 0xff, 0x00, 0xff };
+static const uint8_t abResetBytes[3] = { 0x00, 0x00, 0x00 };
+
+static TRACK_OUTPUT aTrack[TRACK_CHANNELS];
+
+static TRACK_ARBITER Arbiter =
+{
+	.aLock =
+	{
+		[TR_TESTER]				= { .share = TESTER_SHARE, .priority = TESTER_PRIORITY },
+		[TR_COMMAND_STATION]	= { .share = CS_SHARE, .priority = CS_PRIORITY },
+		[TR_SHELL]				= { .share = SHELL_SHARE, .priority = SHELL_PRIORITY },
+	},
+};
+
+#define MAIN_TRACK		(&aTrack[TC_MAIN])
 
 /**********************************************************************
 *
@@ -133,7 +415,7 @@ static uint32_t PacketComplete;
 *
 * MainTrackConfig
 *
-* @brief	Track output init 
+* @brief	Track output init
 *
 * @param	none
 *
@@ -143,21 +425,80 @@ static uint32_t PacketComplete;
 void MainTrackConfig(void)
 {
 	GPIO_InitTypeDef GPIO_InitStruct;
+
+	__HAL_RCC_TIM1_CLK_ENABLE();
+	__HAL_RCC_GPIOE_CLK_ENABLE();
+
+	aTrack[TC_MAIN].channel = TC_MAIN;
+	aTrack[TC_MAIN].pHardware = &aTrackHardware[TC_MAIN];
+	aTrack[TC_MAIN].idle = MAIN_TRACK_IDLE;
+	TrackConfig(&aTrack[TC_MAIN]);
+
+	/*Configure GPIO pin : Scope Trigger */
+	GPIO_InitStruct.Pin = SCOPE_TRIGGER_Pin;
+	GPIO_InitStruct.Mode = SCOPE_TRIGGER_MODE;
+	GPIO_InitStruct.Pull = SCOPE_TRIGGER_PU_PD;
+	GPIO_InitStruct.Speed = SCOPE_TRIGGER_SPEED;
+	HAL_GPIO_Init(SCOPE_TRIGGER_Port, &GPIO_InitStruct);
+}
+
+
+/*********************************************************************
+*
+* ProgTrackConfig
+*
+* @brief	Programming track output init (TIM8). The programming track
+*			turns off when it runs out of packets until service mode
+*			asks for something else with SetChannelIdle.
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void ProgTrackConfig(void)
+{
+	__HAL_RCC_TIM8_CLK_ENABLE();
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+
+	aTrack[TC_PROG].channel = TC_PROG;
+	aTrack[TC_PROG].pHardware = &aTrackHardware[TC_PROG];
+	aTrack[TC_PROG].idle = TI_NONE;
+	TrackConfig(&aTrack[TC_PROG]);
+}
+
+
+/*********************************************************************
+*
+* TrackConfig
+*
+* @brief	Set up the timer, the DMA stream and the pins of a track
+*			output, the track is left turned off
+*
+* @param	pointer to the track output
+*
+* @return	none
+*
+*********************************************************************/
+static void TrackConfig(TRACK_OUTPUT* pTrack)
+{
+	const TRACK_HARDWARE* pHardware = pTrack->pHardware;
+	TIM_HandleTypeDef* htim = &pTrack->htim;
+	GPIO_InitTypeDef GPIO_InitStruct;
 	TIM_ClockConfigTypeDef sClockSourceConfig;
 	TIM_MasterConfigTypeDef sMasterConfig;
 	TIM_OC_InitTypeDef sConfigOC;
 	TIM_BreakDeadTimeConfigTypeDef sBreakDeadTimeConfig;
 
-	__HAL_RCC_TIM1_CLK_ENABLE();
-
-	htim1.Instance = TIM1;
-	htim1.Init.Prescaler = TIMER_PRESCALER;
-	htim1.Init.CounterMode = TIM_COUNTERMODE_UP;
-	htim1.Init.Period = ONE_PERIOD;
-	htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-	htim1.Init.RepetitionCounter = 0;
-	htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
-	if (HAL_TIM_PWM_Init(&htim1) != HAL_OK)
+	htim->Instance = pHardware->timer;
+	htim->Init.Prescaler = TIMER_PRESCALER;
+	htim->Init.CounterMode = TIM_COUNTERMODE_UP;
+	htim->Init.Period = ONE_PERIOD;
+	htim->Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+	htim->Init.RepetitionCounter = 0;
+	htim->Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+	if (HAL_TIM_PWM_Init(htim) != HAL_OK)
 	{
 		Error_Handler();
 	}
@@ -166,14 +507,14 @@ void MainTrackConfig(void)
 	sClockSourceConfig.ClockPolarity = TIM_CLOCKPOLARITY_NONINVERTED;
 	sClockSourceConfig.ClockPrescaler = TIM_ETRPRESCALER_DIV1;
 	sClockSourceConfig.ClockFilter = 0;
-	if (HAL_TIM_ConfigClockSource(&htim1, &sClockSourceConfig) != HAL_OK)
+	if (HAL_TIM_ConfigClockSource(htim, &sClockSourceConfig) != HAL_OK)
 	{
 		Error_Handler();
 	}
 
 	sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
 	sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-	if (HAL_TIMEx_MasterConfigSynchronization(&htim1, &sMasterConfig) != HAL_OK)
+	if (HAL_TIMEx_MasterConfigSynchronization(htim, &sMasterConfig) != HAL_OK)
 	{
 		Error_Handler();
 	}
@@ -185,7 +526,7 @@ void MainTrackConfig(void)
 	sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
 	sConfigOC.OCIdleState = TIM_OCIDLESTATE_RESET;
 	sConfigOC.OCNIdleState = TIM_OCNIDLESTATE_SET;
-	if (HAL_TIM_PWM_ConfigChannel(&htim1, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+	if (HAL_TIM_PWM_ConfigChannel(htim, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
 	{
 		Error_Handler();
 	}
@@ -199,77 +540,107 @@ void MainTrackConfig(void)
 	sBreakDeadTimeConfig.BreakState = TIM_BREAK_DISABLE;
 	sBreakDeadTimeConfig.BreakPolarity = TIM_BREAKPOLARITY_LOW;
 	sBreakDeadTimeConfig.AutomaticOutput = TIM_AUTOMATICOUTPUT_DISABLE;
-	if (HAL_TIMEx_ConfigBreakDeadTime(&htim1, &sBreakDeadTimeConfig) != HAL_OK)
+	if (HAL_TIMEx_ConfigBreakDeadTime(htim, &sBreakDeadTimeConfig) != HAL_OK)
 	{
 		Error_Handler();
 	}
 
-	//__HAL_TIM_MOE_ENABLE(&htim1);
+	//__HAL_TIM_MOE_ENABLE(htim);
+
+	#ifdef TRACK_DMA_BURST
+		__HAL_RCC_DMA2_CLK_ENABLE();
+
+		pTrack->hdma.Instance = pHardware->dma_stream;
+		pTrack->hdma.Init.Channel = pHardware->dma_channel;
+		pTrack->hdma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+		pTrack->hdma.Init.PeriphInc = DMA_PINC_DISABLE;
+		pTrack->hdma.Init.MemInc = DMA_MINC_ENABLE;
+		pTrack->hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+		pTrack->hdma.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+		pTrack->hdma.Init.Mode = DMA_NORMAL;
+		pTrack->hdma.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+		pTrack->hdma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+		if (HAL_DMA_Init(&pTrack->hdma) != HAL_OK)
+		{
+			Error_Handler();
+		}
+		__HAL_LINKDMA(htim, hdma[TIM_DMA_ID_UPDATE], pTrack->hdma);
+
+		pTrack->hdma.XferHalfCpltCallback = TrackDmaHalfComplete;
+		pTrack->hdma.XferCpltCallback = TrackDmaComplete;
 
+		// every update event bursts one PACKET_BITS entry into ARR, RCR, CCR1
+		htim->Instance->DCR = TIM_DMABASE_ARR | TIM_DMABURSTLENGTH_3TRANSFERS;
 
-	MarkPacketUnused(apPacket1);
-	MarkPacketUnused(apPacket2);
+		HAL_NVIC_SetPriority(pHardware->dma_irq, TRACK_IRQ_PRIORITY, 0);
+	#endif
 
-	BuildIdlePacket(NO_OF_PREAMBLE_BITS);
-	CurrentPacket = apIdlePacket;
-	CurrentPattern = apIdlePacket+1;
 
-	__HAL_TIM_SET_AUTORELOAD(&htim1, apIdlePacket[0].period);
-	__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, apIdlePacket[0].pulse);
-	__HAL_TIM_SET_REPETITION(&htim1, apIdlePacket[0].count);
+	// the packet end times need the cycle counter whether or not the
+	// interrupt is measured
+	IsrStatsInit();
 
-	__HAL_RCC_GPIOE_CLK_ENABLE();
+	pTrack->RingHead = 0;
+	pTrack->RingTail = 0;
 
-	/* Tim1 Chan1 GPIO pin configuration  */
-	GPIO_InitStruct.Pin       = TRACK_A_PIN;
+	pTrack->idle_clk1t = ONE_PERIOD;
+	pTrack->idle_clk0t = ZERO_PERIOD;
+	pTrack->idle_clk0h = ZERO_PULSE;
+	BuildIdlePacket(pTrack->aIdlePacket[0], pTrack->idle == TI_RESET ? abResetBytes : abIdleBytes,
+			pHardware->preambles, ONE_PERIOD, ZERO_PERIOD, ZERO_PULSE);
+	pTrack->pIdlePacket = pTrack->aIdlePacket[0];
+	pTrack->CurrentPacket = pTrack->pIdlePacket;
+	pTrack->CurrentPattern = pTrack->pIdlePacket+1;
+
+	__HAL_TIM_SET_AUTORELOAD(htim, pTrack->pIdlePacket[0].period);
+	__HAL_TIM_SET_COMPARE(htim, TIM_CHANNEL_1, pTrack->pIdlePacket[0].pulse);
+	__HAL_TIM_SET_REPETITION(htim, pTrack->pIdlePacket[0].count);
+
+	/* Chan1 GPIO pin configuration  */
+	GPIO_InitStruct.Pin       = pHardware->a_pin;
 	GPIO_InitStruct.Mode      = TRACK_A_MODE_D;
 	GPIO_InitStruct.Pull      = TRACK_A_PU_PD;
 	GPIO_InitStruct.Speed     = TRACK_A_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_A_AF;
-	HAL_GPIO_Init(TRACK_A_PORT, &GPIO_InitStruct);
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->a_port, &GPIO_InitStruct);
 
-	/* Tim1 Chan1n GPIO pin configuration  */
-	GPIO_InitStruct.Pin 	  = TRACK_B_PIN;
+	/* Chan1n GPIO pin configuration  */
+	GPIO_InitStruct.Pin 	  = pHardware->b_pin;
 	GPIO_InitStruct.Mode      = TRACK_B_MODE_D;
 	GPIO_InitStruct.Pull      = TRACK_B_PU_PD;
 	GPIO_InitStruct.Speed     = TRACK_B_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_B_AF;
-	HAL_GPIO_Init(TRACK_B_PORT, &GPIO_InitStruct);
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->b_port, &GPIO_InitStruct);
 
-	/* Tim1 Enable GPIO pin configuration  */
-	GPIO_InitStruct.Pin 	  = TRACK_ENABLE_PIN;
+	/* Enable GPIO pin configuration  */
+	GPIO_InitStruct.Pin 	  = pHardware->enable_pin;
 	GPIO_InitStruct.Mode      = TRACK_ENABLE_MODE;
 	GPIO_InitStruct.Pull      = TRACK_ENABLE_PU_PD;
 	GPIO_InitStruct.Speed     = TRACK_ENABLE_SPEED;
-	HAL_GPIO_Init(TRACK_ENABLE_PORT, &GPIO_InitStruct);
+	HAL_GPIO_Init(pHardware->enable_port, &GPIO_InitStruct);
 
-	/*Configure GPIO pin : Scope Trigger */
-	GPIO_InitStruct.Pin = SCOPE_TRIGGER_Pin;
-	GPIO_InitStruct.Mode = SCOPE_TRIGGER_MODE;
-	GPIO_InitStruct.Pull = SCOPE_TRIGGER_PU_PD;
-	GPIO_InitStruct.Speed = SCOPE_TRIGGER_SPEED;
-	HAL_GPIO_Init(SCOPE_TRIGGER_Port, &GPIO_InitStruct);
+	// enable timer interrupts, both outputs run at the same priority
+	HAL_NVIC_SetPriority(pHardware->timer_irq, TRACK_IRQ_PRIORITY, 0);
 
-	//Enable Timer 1 interrupts
-	HAL_NVIC_SetPriority(TIM1_UP_TIM10_IRQn, 0, 3);
-//	HAL_NVIC_EnableIRQ(TIM1_UP_TIM10_IRQn);
-//	__HAL_TIM_ENABLE_IT(&htim1, TIM_IT_UPDATE);
+	// both outputs share the wakeup interrupt
+	HAL_NVIC_SetPriority(TRACK_WAKE_IRQ, TRACK_WAKE_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TRACK_WAKE_IRQ);
 
-	PacketComplete = PACKET_COMPLETE;
-	BufferAvailable = BUFFER_AVAILABLE;
+	pTrack->PacketComplete = PACKET_COMPLETE;
+	pTrack->bStopped = 1;
 
 	#ifdef ENABLE_AT_STARTUP
-		EnableTrack();
+		EnableTrackChannel(pTrack->channel);
 	#else
-		DisableTrack();
+		DisableTrackChannel(pTrack->channel);
 	#endif
 
-	if(HAL_TIMEx_PWMN_Start(&htim1, TIM_CHANNEL_1) != HAL_OK)
+	if(HAL_TIMEx_PWMN_Start(htim, TIM_CHANNEL_1) != HAL_OK)
 	{
 		Error_Handler();
 	}
 
-	if(HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1) != HAL_OK)
+	if(HAL_TIM_PWM_Start(htim, TIM_CHANNEL_1) != HAL_OK)
 	{
 		Error_Handler();
 	}
@@ -280,7 +651,7 @@ void MainTrackConfig(void)
 *
 * TIM1_UP_TIM10_IRQHandler
 *
-* @brief	Track output interrupt 
+* @brief	Main track output interrupt
 *
 * @param	none
 *
@@ -289,663 +660,2108 @@ void MainTrackConfig(void)
 *********************************************************************/
 void TIM1_UP_TIM10_IRQHandler(void)
 {
+	TrackInterrupt(&aTrack[TC_MAIN]);
+}
 
 
-	__HAL_TIM_SET_AUTORELOAD(&htim1, CurrentPattern->period);
-	__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, CurrentPattern->pulse);
-	__HAL_TIM_SET_REPETITION(&htim1, CurrentPattern->count);
+/*********************************************************************
+*
+* TIM8_UP_TIM13_IRQHandler
+*
+* @brief	Programming track output interrupt
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void TIM8_UP_TIM13_IRQHandler(void)
+{
+	TrackInterrupt(&aTrack[TC_PROG]);
+}
 
 
-	ScopeTriggerBitCount--;
-	if(ScopeTriggerBitCount == 0)
-	{
-		HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_SET);
-	}
-	else
+/*********************************************************************
+*
+* CAN2_SCE_IRQHandler
+*
+* @brief	Track wakeup interrupt, pended by the track output interrupts
+*			when a packet slot comes free, wakes the task waiting for a
+*			slot and runs the slot callback
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void CAN2_SCE_IRQHandler(void)
+{
+	for(int i = 0; i < TRACK_CHANNELS; i++)
 	{
-		HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_RESET);
-	}
-
+		TRACK_OUTPUT* pTrack = &aTrack[i];
 
-	CurrentPattern++;
-
-	if(CurrentPattern->period == 0)
-	{
-		if(CurrentPacket != apIdlePacket)
+		if(!pTrack->bWakePending)
 		{
-			MarkPacketUnused(CurrentPacket);
+			continue;
 		}
 
-		if(apPacket1[0].period != 0)
-		{
-			CurrentPacket = apPacket1;
-			CurrentPattern = apPacket1;
-			ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		}
-		else if(apPacket2[0].period != 0)
+		// cleared first, a slot freed from here on pends another pass
+		pTrack->bWakePending = 0;
+
+		if(pTrack->SlotWaiter != NULL)
 		{
-			CurrentPacket = apPacket2;
-			CurrentPattern = apPacket2;
-			ScopeTriggerBitCount = ScopeTriggerBitOffset;
+			osThreadFlagsSet(pTrack->SlotWaiter, TRACK_FLAG_SLOT << (pTrack->channel));
 		}
-		else
+
+		if(pTrack->pSlotCallback != NULL)
 		{
-			#ifdef IDLE_IDLE_PACKETS
-				CurrentPacket = apIdlePacket;
-				CurrentPattern = apIdlePacket;
-				ScopeTriggerBitCount = ScopeTriggerBitOffset;
-			#else
-				DisableTrack();
-			#endif
-
-			PacketComplete = PACKET_COMPLETE;
+			pTrack->pSlotCallback();
 		}
 	}
-
-    HAL_TIM_IRQHandler(&htim1);
-
 }
 
 
 /*********************************************************************
 *
-* MarkPacketUnused
+* TrackInterrupt
 *
-* @brief	Mark the packet buffer un-uesd (for double buffering)
+* @brief	Track output update interrupt, load the next pattern entry
 *
-* @param	pointer to packet buffer
+* @param	pointer to the track output
 *
 * @return	none
 *
 *********************************************************************/
-void MarkPacketUnused(PACKET_BITS* p)
+static void TrackInterrupt(TRACK_OUTPUT* pTrack)
 {
-	p->count = 0;
-	p->period = 0;
-	p->pulse = 0;
-}
+	TIM_HandleTypeDef* htim = &pTrack->htim;
+
+	#ifdef TRACK_ISR_STATS
+		// TIM1 and TIM8 run from the 168MHz core clock, the counter
+		// started at zero on the update event (resolution one timer tick)
+		uint32_t start = DWT->CYCCNT;
+		uint32_t latency = htim->Instance->CNT * (TIMER_PRESCALER + 1);
+	#endif
+	// the entry loaded last time has just started
+	uint32_t playing = pTrack->LoadedCycles;
+
+	__HAL_TIM_SET_AUTORELOAD(htim, pTrack->CurrentPattern->period);
+	__HAL_TIM_SET_COMPARE(htim, TIM_CHANNEL_1, pTrack->CurrentPattern->pulse);
+	__HAL_TIM_SET_REPETITION(htim, pTrack->CurrentPattern->count);
+	pTrack->LoadedCycles = ENTRY_CYCLES(pTrack->CurrentPattern);
+
+
+	if(pTrack->pHardware->scope)
+	{
+		// one entry is count + 1 bits
+		if(pTrack->ScopeTriggerBitCount != 0 && pTrack->ScopeTriggerBitCount <= (uint32_t)pTrack->CurrentPattern->count + 1)
+		{
+			pTrack->ScopeTriggerBitCount = 0;
+			HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_SET);
+		}
+		else
+		{
+			if(pTrack->ScopeTriggerBitCount != 0)
+			{
+				pTrack->ScopeTriggerBitCount -= pTrack->CurrentPattern->count + 1;
+			}
+			HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_RESET);
+		}
+	}
 
 
+	pTrack->CurrentPattern++;
+
+	if(pTrack->CurrentPattern->period == 0)
+	{
+		// the last entry is in the preload, behind the one playing
+		if(pTrack->bSlotPlaying)
+		{
+			MarkPacketEnd(pTrack, playing + pTrack->LoadedCycles);
+		}
+		SelectNextPacket(pTrack);
+	}
+
+    HAL_TIM_IRQHandler(htim);
+
+	#ifdef TRACK_ISR_STATS
+		IsrStatsRecord(&pTrack->IsrStats, start, latency);
+	#endif
+}
+
 
 /*********************************************************************
 *
-* BuildPreamble
+* SelectNextPacket
 *
-* @brief	Build a bit pattern for a preamble into the packet passed in for cnt bits at clklt width
+* @brief	Release the packet that just finished and switch to the next
+*			full packet buffer, the idle (or reset) packet, or turn the
+*			track off, whichever the idle policy of the output says
 *
-* @param	pointer to packet buffer
-*			number of preambles
-*			preamble pulse width
+* @param	pointer to the track output
 *
-* @return	pointer to packet buffer past the preamble
+* @return	1 = a packet was selected, 0 = the track was turned off
 *
 *********************************************************************/
-PACKET_BITS* BuildPreamble(PACKET_BITS* p, uint16_t cnt, uint16_t clk1t)
+static uint8_t SelectNextPacket(TRACK_OUTPUT* pTrack)
 {
+	if(pTrack->bSlotPlaying)
+	{
+		pTrack->bSlotPlaying = 0;
+		ReleasePacket(pTrack);
+	}
 
-	for(int i = 0; i < cnt; i++)
+	if(pTrack->RingTail != pTrack->RingHead)
+	{
+		pTrack->CurrentPacket = pTrack->apRingPattern[RING_INDEX(pTrack->RingTail)];
+		pTrack->CurrentPattern = pTrack->CurrentPacket;
+		pTrack->ScopeTriggerBitCount = ScopeTriggerBitOffset;
+		pTrack->PacketComplete = PACKET_NOT_COMPLETE;
+		pTrack->bSlotPlaying = 1;
+	}
+	else if(pTrack->idle != TI_NONE)
+	{
+		pTrack->CurrentPacket = pTrack->pIdlePacket;
+		pTrack->CurrentPattern = pTrack->pIdlePacket;
+		pTrack->ScopeTriggerBitCount = ScopeTriggerBitOffset;
+		pTrack->PacketComplete = PACKET_COMPLETE;
+	}
+	else
 	{
-		p->count = 0;
-		p->period = clk1t;
-		p->pulse = clk1t/2;
-		p++;
+		if(pTrack->CurrentPacket != apTrackStop)
+		{
+			// the last entries are still in the timer, a whole run
+			// of bits with repetition counts, let them finish
+			pTrack->CurrentPacket = apTrackStop;
+			pTrack->CurrentPattern = apTrackStop;
+			return 1;
+		}
+		DisableTrackChannel(pTrack->channel);
+
+		pTrack->bStopped = 1;
+		pTrack->PacketComplete = PACKET_COMPLETE;
+		return 0;
 	}
-	return p;
+	return 1;
 }
 
+
 /*********************************************************************
 *
-* BuildIdlePacket
+* MarkPacketEnd
 *
-* @brief	Pre-build a bit pattern for an idle packet to be ready if 
-*			the track generator runs out of packets and is configured
-*			to send idle packets
+* @brief	Note when the last bit of the ring packet whose last entry
+*			was just loaded ends. The interrupt runs at the update event
+*			with the entries still to play in the timer, so the end is
+*			in the future by the cycles given.
 *
-* @param	number of preambles
+* @param	pointer to the track output
+*			CPU cycles from the update event to the end of the packet
 *
 * @return	none
 *
 *********************************************************************/
-void BuildIdlePacket(uint16_t no_preambles)
+static void MarkPacketEnd(TRACK_OUTPUT* pTrack, uint32_t tail)
 {
+	// the counter started at zero on the update event
+	uint32_t update = DWT->CYCCNT - pTrack->htim.Instance->CNT * (TIMER_PRESCALER + 1);
 
-	// ToDo - change this to use the programmed clock registers
-	// preamble
-	apIdlePacket[0].count = no_preambles-1;
-	apIdlePacket[0].period = ONE_PERIOD;
-	apIdlePacket[0].pulse = ONE_PULSE;
-	//pBuildPacket = BuildPreambel(pBuildPacket, no_preambles, ONE_PERIOD);
-
-	// first interbyte
-	apIdlePacket[1].count = 0;
-	apIdlePacket[1].period = ZERO_PERIOD;
-	apIdlePacket[1].pulse = ZERO_PULSE;
-
-	// first byte
-	apIdlePacket[2].count = 7;
-	apIdlePacket[2].period = ONE_PERIOD;
-	apIdlePacket[2].pulse = ONE_PULSE;
-
-	// second byte and second interbyte
-	apIdlePacket[3].count = 9;
-	apIdlePacket[3].period = ZERO_PERIOD;
-	apIdlePacket[3].pulse = ZERO_PULSE;
-
-	// third byte
-	apIdlePacket[4].count = 8;
-	apIdlePacket[4].period = ONE_PERIOD;
-	apIdlePacket[4].pulse = ONE_PULSE;
-
-	// terminator
-	apIdlePacket[5].count = 0;
-	apIdlePacket[5].period = 0;
-	apIdlePacket[5].pulse = 0;
+	pTrack->aPacketEnd[pTrack->PacketEnds % TRACK_PACKET_ENDS] = update + tail;
+	__DMB();
+	pTrack->PacketEnds++;
 }
 
 
 /*********************************************************************
 *
-* BuildPacket
+* QueuePacket
 *
-* @brief	Build a bit pattern for a packet based on the bits in buf,
-*			and the bit widths in  clk1t, clk0t, and clk0h
+* @brief	Hand a compiled packet to the track output in the free ring
+*			slot, and restart the output if it has run out of packets
 *
-* @param	pointer to packet bytes
-*			length
-*			1 total width
-*			0 total width
-*			0 first half width
+* @param	pointer to the track output
+*			pointer to the pattern (the slot buffer from GetFreePacket
+*			or a cached pattern)
+*			cache entry the pattern belongs to, NULL = slot buffer
 *
-* @return	0 = sucess
+* @return	none
 *
 *********************************************************************/
-//int BuildPacket(const uint8_t* buf, uint8_t len, uint8_t times, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
-int BuildPacket(const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+static void QueuePacket(TRACK_OUTPUT* pTrack, PACKET_BITS* pPacket, PACKET_CACHE* pEntry)
 {
-	PACKET_BITS* pBuildPacket;
-	PACKET_BITS* pPacket;
-	uint8_t mask;
-	uint8_t packet_byte;
-
+	TIM_HandleTypeDef* htim = &pTrack->htim;
 
-	if(apPacket1[0].period == 0)
-	{
-		pBuildPacket = apPacket1;
-	}
-	else if(apPacket2[0].period == 0)
+	pTrack->apRingPattern[RING_INDEX(pTrack->RingHead)] = pPacket;
+	pTrack->apRingEntry[RING_INDEX(pTrack->RingHead)] = pEntry;
+	if(pEntry != NULL)
 	{
-		pBuildPacket = apPacket2;
+		pEntry->queued++;
 	}
-	else
-	{
-		return 1;
-	}
-
-	clk1t *= TICKS_PER_MICROSECOND;
-	clk0t *= TICKS_PER_MICROSECOND;
-	clk0h *= TICKS_PER_MICROSECOND;
 
-	pPacket = pBuildPacket;
+	// cleared before the slot is visible, the interrupt only sets it
+	// again once the ring has run dry behind this packet
+	pTrack->PacketComplete = PACKET_NOT_COMPLETE;
 
-	// preamble
-	pBuildPacket = BuildPreamble(pBuildPacket, 18, clk1t);
-
-	// first interbyte
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t;
-	pBuildPacket->pulse = clk0h;
-	pBuildPacket++;
+	// the pattern has to be in memory before the interrupt can see the slot
+	__DMB();
+	pTrack->RingHead++;
 
-	for(int i = 0; i < len; i++)
+	if(pTrack->channel == TC_MAIN)
 	{
-		mask = 0x01;
-		packet_byte = *buf++;
-		for(int b = 0; b < 8; b++)
-		{
-			if(packet_byte & mask)
-			{
-				// build a one bit
-				pBuildPacket->count = 0;
-				pBuildPacket->period = clk1t;
-				pBuildPacket->pulse = clk1t/2;
-			}
-			else
-			{
-				// build a zero bit
-				pBuildPacket->count = 0;
-				pBuildPacket->period = clk0t;
-				pBuildPacket->pulse = clk0h;
-			}
-			pBuildPacket++;
-			mask <<= 1;
-		}
-
-		// interbyte
-		pBuildPacket->count = 0;
-		pBuildPacket->period = clk0t;
-		pBuildPacket->pulse = clk0h;
-		pBuildPacket++;
+		ChargeTurn();
 	}
 
-	// terminator
-	pBuildPacket->count = 0;
-	pBuildPacket->period = 0;
-	pBuildPacket->pulse = 0;
-
-	if(PacketComplete == PACKET_COMPLETE)
+	if(pTrack->bStopped)
 	{
-		__HAL_TIM_SET_AUTORELOAD(&htim1, pPacket->period);
-		__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pPacket->pulse);
-		__HAL_TIM_SET_REPETITION(&htim1, pPacket->count);
+		pTrack->bStopped = 0;
+
+		__HAL_TIM_SET_AUTORELOAD(htim, pPacket->period);
+		__HAL_TIM_SET_COMPARE(htim, TIM_CHANNEL_1, pPacket->pulse);
+		// a single lead in bit, the first entry may be a whole preamble run
+		__HAL_TIM_SET_REPETITION(htim, 0);
+		pTrack->LoadedCycles = ((uint32_t)pPacket->period + 1) * (TIMER_PRESCALER + 1);
 
-		ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		CurrentPacket = apIdlePacket;
-		CurrentPattern = apIdlePacket;
+		pTrack->ScopeTriggerBitCount = ScopeTriggerBitOffset;
+		pTrack->CurrentPacket = pTrack->pIdlePacket;
+		pTrack->CurrentPattern = pTrack->pIdlePacket;
 
-		PacketComplete = PACKET_NOT_COMPLETE;
+		#ifdef TRACK_DMA_BURST
+			TrackDmaStart(pTrack, pTrack->CurrentPattern);
+		#endif
 
-		EnableTrack();
+		EnableTrackChannel(pTrack->channel);
 	}
-	return 0;
 }
 
 
+#ifdef TRACK_DMA_BURST
 /*********************************************************************
 *
-* BuildPacketBytes
+* GetDmaTrack
 *
-* @brief	Build a bit pattern for a packet based on repeating the byte
-*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
+* @brief	Find the track output a DMA handle belongs to
 *
-* @param	packet byte
-*			count
-*			1 total width
-*			0 total width
-*			0 first half width
+* @param	DMA handle
 *
-* @return	0 = success
+* @return	pointer to the track output
 *
 *********************************************************************/
-int BuildPacketBytes(const uint8_t packet_byte, uint8_t count, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+static TRACK_OUTPUT* GetDmaTrack(DMA_HandleTypeDef* hdma)
 {
-	#ifdef USE_BuildPacket
-		PACKET_BITS* pBuildPacket;
-		PACKET_BITS* pPacket;
-		uint8_t mask;
-
-
-		if(apPacket1[0].period == 0)
-		{
-			pBuildPacket = apPacket1;
-		}
-		else if(apPacket2[0].period == 0)
-		{
-			pBuildPacket = apPacket2;
-		}
-		else
-		{
-			return;		// return an error?
-		}
-
-		clk1t *= TICKS_PER_MICROSECOND;
-		clk0t *= TICKS_PER_MICROSECOND;
-		clk0h *= TICKS_PER_MICROSECOND;
+	return hdma == &aTrack[TC_PROG].hdma ? &aTrack[TC_PROG] : &aTrack[TC_MAIN];
+}
 
-		pPacket = pBuildPacket;
 
-		for(int i = 0; i < count; i++)
-		{
-			mask = 0x01;
-			for(int b = 0; b < 8; b++)
-			{
-				if(packet_byte & mask)
-				{
-					// build a one bit
-					pBuildPacket->count = 0;
-					pBuildPacket->period = clk1t;
-					pBuildPacket->pulse = clk1t/2;
-				}
-				else
-				{
-					// build a zero bit
-					pBuildPacket->count = 0;
-					pBuildPacket->period = clk0t;
-					pBuildPacket->pulse = clk0h;
-				}
-				pBuildPacket++;
-				mask <<= 1;
-			}
+/*********************************************************************
+*
+* TrackDmaStart
+*
+* @brief	Stream a packet pattern to the timer with the DMA burst. Each
+*			update event transfers one PACKET_BITS entry into the ARR,
+*			RCR and CCR1 preload registers, exactly what the update
+*			interrupt does in the non-DMA mode.
+*
+* @param	pointer to the track output
+*			pointer to the first pattern entry to send
+*
+* @return	none
+*
+*********************************************************************/
+static void TrackDmaStart(TRACK_OUTPUT* pTrack, const PACKET_BITS* pPattern)
+{
+	uint32_t length = 0;
 
-			// interbyte
-			pBuildPacket->count = 0;
-			pBuildPacket->period = clk0t;
-			pBuildPacket->pulse = clk0h;
-			pBuildPacket++;
-		}
+	while(pPattern[length].period != 0)
+	{
+		length++;
+	}
 
-		// terminator
-		pBuildPacket->count = 0;
-		pBuildPacket->period = 0;
-		pBuildPacket->pulse = 0;
+	// the last entry goes into the preload while the one ahead of it plays
+	pTrack->DmaTailCycles = ENTRY_CYCLES(&pPattern[length - 1]);
+	if(length > 1)
+	{
+		pTrack->DmaTailCycles += ENTRY_CYCLES(&pPattern[length - 2]);
+	}
 
-		//__HAL_TIM_SET_AUTORELOAD(&htim1, CurrentPattern->period);
-		//__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, CurrentPattern->pulse);
-		//__HAL_TIM_SET_REPETITION(&htim1, CurrentPattern->count);
-		//ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		//PacketComplete = PACKET_NOT_COMPLETE;
-		//EnableTrack();
+	__HAL_TIM_DISABLE_DMA(&pTrack->htim, TIM_DMA_UPDATE);
 
-		if(PacketComplete == PACKET_COMPLETE)
-		{
-			__HAL_TIM_SET_AUTORELOAD(&htim1, pPacket->period);
-			__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pPacket->pulse);
-			__HAL_TIM_SET_REPETITION(&htim1, pPacket->count);
+	if(HAL_DMA_Start_IT(&pTrack->hdma, (uint32_t)(uintptr_t)pPattern, (uint32_t)(uintptr_t)&pTrack->htim.Instance->DMAR,
+			length * TRACK_DMA_BURST_LENGTH) != HAL_OK)
+	{
+		Error_Handler();
+	}
 
-			ScopeTriggerBitCount = ScopeTriggerBitOffset;
-			CurrentPacket = apIdlePacket;
-			CurrentPattern = apIdlePacket;
+	__HAL_TIM_ENABLE_DMA(&pTrack->htim, TIM_DMA_UPDATE);
+}
 
-			PacketComplete = PACKET_NOT_COMPLETE;
 
-			EnableTrack();
-		}
-	#else
-		uint8_t buf[6];
+/*********************************************************************
+*
+* TrackDmaHalfComplete
+*
+* @brief	Half way through the packet - drop the scope trigger
+*
+* @param	DMA handle
+*
+* @return	none
+*
+*********************************************************************/
+static void TrackDmaHalfComplete(DMA_HandleTypeDef* hdma)
+{
+	if(GetDmaTrack(hdma)->pHardware->scope)
+	{
+		HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_RESET);
+	}
+}
+
+
+/*********************************************************************
+*
+* TrackDmaComplete
+*
+* @brief	The last entry of the packet has been loaded into the timer,
+*			chain the next packet (same point as the terminator in the
+*			update interrupt). The scope trigger marks the packet start.
+*
+* @param	DMA handle
+*
+* @return	none
+*
+*********************************************************************/
+static void TrackDmaComplete(DMA_HandleTypeDef* hdma)
+{
+	TRACK_OUTPUT* pTrack = GetDmaTrack(hdma);
+
+	if(pTrack->bSlotPlaying)
+	{
+		MarkPacketEnd(pTrack, pTrack->DmaTailCycles);
+	}
 
-		if(count < 6)
+	if(SelectNextPacket(pTrack))
+	{
+		if(pTrack->pHardware->scope)
 		{
-			memset(buf, packet_byte, count);
-			return BuildPacket(buf, count, clk1t, clk0t, clk0h);
+			HAL_GPIO_WritePin(SCOPE_TRIGGER_Port, SCOPE_TRIGGER_Pin, GPIO_PIN_SET);
 		}
+		TrackDmaStart(pTrack, pTrack->CurrentPattern);
+	}
+}
 
-		return 1;
-	#endif
+
+/*********************************************************************
+*
+* DMA2_Stream5_IRQHandler
+*
+* @brief	Main track output DMA interrupt (packet boundaries only)
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+void DMA2_Stream5_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&aTrack[TC_MAIN].hdma);
 }
 
 
 /*********************************************************************
 *
-* BuildPacketAmbig1
+* DMA2_Stream1_IRQHandler
 *
-* @brief	Build a bit pattern for a packet based on repeating the byte
-*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
-*			with 1 ambiguous zero bit
+* @brief	Programming track output DMA interrupt (packet boundaries only)
 *
-* @param	packet byte
-*			count
-*			1 total width
-*			0 total width
-*			0 first half width
-*			0 total width ambiguous zero bit
-*			0 first half width ambiguous zero bit
+* @param	none
 *
-* @return	0 = success
+* @return	none
 *
 *********************************************************************/
-int BuildPacketAmbig1(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t, uint16_t clk0h)
+void DMA2_Stream1_IRQHandler(void)
 {
-	PACKET_BITS* pBuildPacket;
-	PACKET_BITS* pPacket;
-	uint8_t mask;
+	HAL_DMA_IRQHandler(&aTrack[TC_PROG].hdma);
+}
+#endif
 
 
-	if(apPacket1[0].period == 0)
-	{
-		pBuildPacket = apPacket1;
-	}
-	else if(apPacket2[0].period == 0)
+/*********************************************************************
+*
+* GetFreePacket
+*
+* @brief	Get the ring slot the next packet is built in
+*
+* @param	pointer to the track output
+*
+* @return	pointer to packet buffer, NULL = all slots are queued
+*
+*********************************************************************/
+static PACKET_BITS* GetFreePacket(TRACK_OUTPUT* pTrack)
+{
+	if(pTrack->RingHead - pTrack->RingTail >= TRACK_PACKET_SLOTS)
 	{
-		pBuildPacket = apPacket2;
+		return NULL;
 	}
-	else
+	return pTrack->aPacketRing[RING_INDEX(pTrack->RingHead)];
+}
+
+
+/*********************************************************************
+*
+* ReleasePacket
+*
+* @brief	The track output is done with the packet at the ring tail,
+*			hand the slot back and have a waiting producer woken
+*			(interrupt context)
+*
+* @param	pointer to the track output
+*
+* @return	none
+*
+*********************************************************************/
+static void ReleasePacket(TRACK_OUTPUT* pTrack)
+{
+	PACKET_CACHE* pEntry = pTrack->apRingEntry[RING_INDEX(pTrack->RingTail)];
+
+	if(pEntry != NULL)
 	{
-		return 1;
+		pEntry->released++;
 	}
 
-	clk1t *= TICKS_PER_MICROSECOND;
-	clk0t1 *= TICKS_PER_MICROSECOND;
-	clk0h1 *= TICKS_PER_MICROSECOND;
-	clk0t *= TICKS_PER_MICROSECOND;
-	clk0h *= TICKS_PER_MICROSECOND;
+	pTrack->RingTail++;
 
-	pPacket = pBuildPacket;
+	// no RTOS calls above its ceiling, the wakeup interrupt makes them
+	pTrack->bWakePending = 1;
+	HAL_NVIC_SetPendingIRQ(TRACK_WAKE_IRQ);
+}
 
-	// set the zero stretch for the first bit
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t1;
-	pBuildPacket->pulse = clk0h1;
-	pBuildPacket++;
 
-	// do the rest
-	mask = 0x02;
-	for(int b = 0; b < 7; b++)
+/*********************************************************************
+*
+* EncodeStart
+*
+* @brief	Start run length encoding a packet into a packet buffer
+*
+* @param	pointer to the encoder
+*			pointer to packet buffer
+*			size of the packet buffer in entries
+*
+* @return	none
+*
+*********************************************************************/
+static void EncodeStart(PACKET_ENCODER* pEncoder, PACKET_BITS* pPacket, uint32_t size)
+{
+	pEncoder->pStart = pPacket;
+	pEncoder->pNext = pPacket;
+	pEncoder->pLast = pPacket + size - 1;
+	pEncoder->bits = 0;
+}
+
+
+/*********************************************************************
+*
+* EncodeBits
+*
+* @brief	Add count bits of the same timing to the packet. The bits
+*			are merged into the previous entry when the timing matches
+*			and the repetition counter has room.
+*
+* @param	pointer to the encoder
+*			bit period (ticks)
+*			bit pulse (ticks)
+*			number of bits
+*
+* @return	none - an overflow is reported by EncodeEnd
+*
+*********************************************************************/
+static void EncodeBits(PACKET_ENCODER* pEncoder, uint16_t period, uint16_t pulse, uint32_t count)
+{
+	PACKET_BITS* pPrevious;
+	uint32_t run;
+
+	pEncoder->bits += count;
+
+	while(count)
+	{
+		pPrevious = pEncoder->pNext - 1;
+		if(pEncoder->pNext != pEncoder->pStart
+			&& pPrevious->period == period
+			&& pPrevious->pulse == pulse
+			&& pPrevious->count < MAX_REPETITION)
+		{
+			run = MAX_REPETITION - pPrevious->count;
+			if(run > count)
+			{
+				run = count;
+			}
+			pPrevious->count += run;
+			count -= run;
+		}
+		else if(pEncoder->pNext < pEncoder->pLast)
+		{
+			pEncoder->pNext->period = period;
+			pEncoder->pNext->pulse = pulse;
+			pEncoder->pNext->count = 0;
+			pEncoder->pNext++;
+			count--;
+		}
+		else
+		{
+			// out of room, flag the overflow for EncodeEnd
+			pEncoder->pNext = pEncoder->pLast + 1;
+			return;
+		}
+	}
+}
+
+
+/*********************************************************************
+*
+* EncodeByte
+*
+* @brief	Add the bits of a packet byte, bit 0 first (the order the
+*			track output has always used), starting at first_bit
+*
+* @param	pointer to the encoder
+*			packet byte
+*			first bit to send (0 - 7)
+*			1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	none
+*
+*********************************************************************/
+static void EncodeByte(PACKET_ENCODER* pEncoder, uint8_t packet_byte, uint8_t first_bit, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	for(int b = first_bit; b < 8; b++)
 	{
-		if(packet_byte & mask)
+		if(packet_byte & (1 << b))
 		{
 			// build a one bit
-			pBuildPacket->count = 0;
-			pBuildPacket->period = clk1t;
-			pBuildPacket->pulse = clk1t/2;
+			EncodeBits(pEncoder, clk1t, clk1t/2, 1);
 		}
 		else
 		{
 			// build a zero bit
-			pBuildPacket->count = 0;
-			pBuildPacket->period = clk0t;
-			pBuildPacket->pulse = clk0h;
+			EncodeBits(pEncoder, clk0t, clk0h, 1);
 		}
-		pBuildPacket++;
-		mask <<= 1;
 	}
+}
 
-	// interbyte
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t1;
-	pBuildPacket->pulse = clk0h1;
-	pBuildPacket++;
 
+/*********************************************************************
+*
+* EncodeEnd
+*
+* @brief	Terminate the packet and update the encoder statistics
+*
+* @param	pointer to the encoder
+*			pointer to the statistics of the track output
+*
+* @return	0 = success, 2 = the packet did not fit
+*
+*********************************************************************/
+static int EncodeEnd(PACKET_ENCODER* pEncoder, TRACK_STATS* pStats)
+{
+	uint32_t entries;
+
+	if(pEncoder->pNext > pEncoder->pLast)
+	{
+		// the slot was never queued, it is simply used again
+		pStats->overflows++;
+		return 2;
+	}
 
 	// terminator
-	pBuildPacket->count = 0;
-	pBuildPacket->period = 0;
-	pBuildPacket->pulse = 0;
+	pEncoder->pNext->count = 0;
+	pEncoder->pNext->period = 0;
+	pEncoder->pNext->pulse = 0;
+
+	entries = pEncoder->pNext - pEncoder->pStart;
+
+	pStats->packets++;
+	pStats->bits += pEncoder->bits;
+	pStats->entries += entries;
+	if(entries > pStats->max_entries)
+	{
+		pStats->max_entries = entries;
+	}
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* BuildPreamble
+*
+* @brief	Build a bit pattern for a preamble of cnt bits at clklt width,
+*			it ends up as a single entry for up to 256 bits
+*
+* @param	pointer to the encoder
+*			number of preambles
+*			preamble pulse width
+*
+* @return	none
+*
+*********************************************************************/
+static void BuildPreamble(PACKET_ENCODER* pEncoder, uint16_t cnt, uint16_t clk1t)
+{
+	EncodeBits(pEncoder, clk1t, clk1t/2, cnt);
+}
+
+
+/*********************************************************************
+*
+* BuildIdlePacket
+*
+* @brief	Pre-build a bit pattern for an idle (or reset) packet to be
+*			ready if the track generator runs out of packets and is
+*			configured to send idle packets
+*
+* @param	pointer to the idle packet buffer (IDLE_PACKET_SIZE entries)
+*			the three packet bytes (idle or reset)
+*			number of preambles
+*			1 total width (ticks)
+*			0 total width (ticks)
+*			0 first half width (ticks)
+*
+* @return	none
+*
+*********************************************************************/
+static void BuildIdlePacket(PACKET_BITS* pPacket, const uint8_t* abBytes, uint16_t no_preambles, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	PACKET_ENCODER Encoder;
+
+	EncodeStart(&Encoder, pPacket, IDLE_PACKET_SIZE);
+
+	// preamble
+	EncodeBits(&Encoder, clk1t, clk1t/2, no_preambles);
+
+	// the three bytes with the interbyte bits
+	for(int i = 0; i < 3; i++)
+	{
+		EncodeBits(&Encoder, clk0t, clk0h, 1);
+		EncodeByte(&Encoder, abBytes[i], 0, clk1t, clk0t, clk0h);
+	}
+
+	// packet end bit
+	EncodeBits(&Encoder, clk1t, clk1t/2, 1);
+
+	// a preamble that does not fit gets the default one
+	if(Encoder.pNext > Encoder.pLast)
+	{
+		BuildIdlePacket(pPacket, abBytes, NO_OF_PREAMBLE_BITS, clk1t, clk0t, clk0h);
+		return;
+	}
 
-	//__HAL_TIM_SET_AUTORELOAD(&htim1, CurrentPattern->period);
-	//__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, CurrentPattern->pulse);
-	//__HAL_TIM_SET_REPETITION(&htim1, CurrentPattern->count);
-	//ScopeTriggerBitCount = ScopeTriggerBitOffset;
-	//PacketComplete = PACKET_NOT_COMPLETE;
-	//EnableTrack();
+	// terminator, the statistics are left alone
+	Encoder.pNext->count = 0;
+	Encoder.pNext->period = 0;
+	Encoder.pNext->pulse = 0;
+}
+
+
+/*********************************************************************
+*
+* RebuildIdlePacket
+*
+* @brief	Rebuild the idle packet of a track output with its clocks.
+*			It is built in a spare idle buffer and takes over the next
+*			time the track output falls back to idle.
+*
+* @param	pointer to the track output
+*			idle policy the packet is for (TI_RESET sends reset packets)
+*
+* @return	none
+*
+*********************************************************************/
+static void RebuildIdlePacket(TRACK_OUTPUT* pTrack, TRACK_IDLE ti)
+{
+	PACKET_BITS* pSpare = NULL;
 
-	if(PacketComplete == PACKET_COMPLETE)
+	// the interrupt only ever switches to pIdlePacket, so a buffer that is
+	// neither that nor the one playing stays free while it is rebuilt
+	for(int i = 0; i < 3; i++)
 	{
-		__HAL_TIM_SET_AUTORELOAD(&htim1, pPacket->period);
-		__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pPacket->pulse);
-		__HAL_TIM_SET_REPETITION(&htim1, pPacket->count);
+		if(pTrack->aIdlePacket[i] != pTrack->pIdlePacket && pTrack->aIdlePacket[i] != pTrack->CurrentPacket)
+		{
+			pSpare = pTrack->aIdlePacket[i];
+			break;
+		}
+	}
+
+	BuildIdlePacket(pSpare, ti == TI_RESET ? abResetBytes : abIdleBytes, GetPreambles(pTrack),
+			pTrack->idle_clk1t, pTrack->idle_clk0t, pTrack->idle_clk0h);
+
+	__DMB();
+	pTrack->pIdlePacket = pSpare;
+}
 
-		ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		CurrentPacket = apIdlePacket;
-		CurrentPattern = apIdlePacket;
 
-		PacketComplete = PACKET_NOT_COMPLETE;
+/*********************************************************************
+*
+* GetPreambles
+*
+* @brief	Number of preamble bits a track output sends, the main track
+*			uses the count of the resource whose turn it is
+*
+* @param	pointer to the track output
+*
+* @return	preamble bits
+*
+*********************************************************************/
+static uint16_t GetPreambles(TRACK_OUTPUT* pTrack)
+{
+	TRACK_RESOURCE tr = Arbiter.grant;
 
-		EnableTrack();
+	if(pTrack->channel == TC_MAIN)
+	{
+		if(tr == TR_NONE)
+		{
+			// the idle packet, use the resource that picked the policy
+			for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
+			{
+				if(Arbiter.aLock[i].open && Arbiter.aLock[i].preambles &&
+				   (tr == TR_NONE || Arbiter.aLock[i].priority > Arbiter.aLock[tr].priority))
+				{
+					tr = i;
+				}
+			}
+		}
+		if(tr != TR_NONE && Arbiter.aLock[tr].preambles)
+		{
+			return Arbiter.aLock[tr].preambles;
+		}
+	}
+	return pTrack->pHardware->preambles;
+}
+
+
+/*********************************************************************
+*
+* SetIdleClocks
+*
+* @brief	Rebuild the main track idle packet with the programmed bit
+*			widths
+*
+* @param	1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	0 = success, 2 = bad clocks
+*
+*********************************************************************/
+int SetIdleClocks(uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	if(clk1t == 0 || clk0t == 0)
+	{
+		return 2;
+	}
+
+	MAIN_TRACK->idle_clk1t = clk1t * TICKS_PER_MICROSECOND;
+	MAIN_TRACK->idle_clk0t = clk0t * TICKS_PER_MICROSECOND;
+	MAIN_TRACK->idle_clk0h = clk0h * TICKS_PER_MICROSECOND;
+	RebuildIdlePacket(MAIN_TRACK, MAIN_TRACK->idle);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* SetChannelIdle
+*
+* @brief	Set what a track output does when it runs out of packets:
+*			turn off, or keep sending idle or reset packets. The new
+*			policy takes over at the next packet boundary.
+*
+* @param	track output, one of TRACK_CHANNEL
+*			idle policy, one of TRACK_IDLE
+*
+* @return	0 = success, 2 = bad channel
+*
+*********************************************************************/
+int SetChannelIdle(TRACK_CHANNEL tc, TRACK_IDLE ti)
+{
+	if(tc >= TRACK_CHANNELS || aTrack[tc].pHardware == NULL)
+	{
+		return 2;
+	}
+
+	// the packet is in place before the interrupt can see the policy
+	RebuildIdlePacket(&aTrack[tc], ti);
+	__DMB();
+	aTrack[tc].idle = ti;
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* CacheLookup
+*
+* @brief	Find a compiled packet in the cache
+*
+* @param	pointer to the track output
+*			pointer to packet bytes
+*			length
+*			1 total width
+*			0 total width
+*			0 first half width
+*			number of preambles
+*
+* @return	pointer to the cache entry, NULL = not cached
+*
+*********************************************************************/
+static PACKET_CACHE* CacheLookup(TRACK_OUTPUT* pTrack, const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h, uint16_t preambles)
+{
+	PACKET_CACHE* pEntry = pTrack->aPacketCache;
+
+	for(int i = 0; i < TRACK_CACHE_ENTRIES; i++, pEntry++)
+	{
+		if(pEntry->len == len
+			&& pEntry->clk1t == clk1t
+			&& pEntry->clk0t == clk0t
+			&& pEntry->clk0h == clk0h
+			&& pEntry->preambles == preambles
+			&& memcmp(pEntry->bytes, buf, len) == 0)
+		{
+			pEntry->used = ++pTrack->CacheClock;
+			return pEntry;
+		}
+	}
+	return NULL;
+}
+
+
+/*********************************************************************
+*
+* CacheAllocate
+*
+* @brief	Get the least recently used cache entry that no ring slot
+*			refers to. The entry is emptied, the caller fills in the key
+*			once the packet has been built in it.
+*
+* @param	pointer to the track output
+*
+* @return	pointer to the cache entry, NULL = all entries are queued
+*
+*********************************************************************/
+static PACKET_CACHE* CacheAllocate(TRACK_OUTPUT* pTrack)
+{
+	PACKET_CACHE* pEntry = pTrack->aPacketCache;
+	PACKET_CACHE* pOldest = NULL;
+
+	for(int i = 0; i < TRACK_CACHE_ENTRIES; i++, pEntry++)
+	{
+		if(pEntry->queued != pEntry->released)
+		{
+			continue;
+		}
+		if(pEntry->len == 0)
+		{
+			pOldest = pEntry;
+			break;
+		}
+		if(pOldest == NULL || pEntry->used < pOldest->used)
+		{
+			pOldest = pEntry;
+		}
+	}
+
+	if(pOldest != NULL)
+	{
+		pOldest->len = 0;
+	}
+	return pOldest;
+}
+
+
+/*********************************************************************
+*
+* BuildPacket
+*
+* @brief	Build a bit pattern for a main track packet based on the bits
+*			in buf, and the bit widths in  clk1t, clk0t, and clk0h
+*
+* @param	pointer to packet bytes
+*			length
+*			1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	0 = success, 1 = no buffer available, 2 = too long
+*
+*********************************************************************/
+//int BuildPacket(const uint8_t* buf, uint8_t len, uint8_t times, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+int BuildPacket(const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	return BuildChannelPacket(TC_MAIN, buf, len, clk1t, clk0t, clk0h);
+}
+
+
+/*********************************************************************
+*
+* BuildChannelPacket
+*
+* @brief	Build a bit pattern for a packet based on the bits in buf,
+*			and the bit widths in  clk1t, clk0t, and clk0h, and queue it
+*			on a track output
+*
+* @param	track output, one of TRACK_CHANNEL
+*			pointer to packet bytes
+*			length
+*			1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	0 = success, 1 = no buffer available, 2 = too long
+*
+* @note		Packets of up to TRACK_CACHE_BYTES are compiled into the packet
+*			cache of the output, sending the same packet with the same
+*			timing again only queues a pointer to the compiled pattern.
+*
+*********************************************************************/
+int BuildChannelPacket(TRACK_CHANNEL tc, const uint8_t* buf, uint8_t len, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	TRACK_OUTPUT* pTrack = &aTrack[tc];
+	PACKET_BITS* pBuildPacket;
+	PACKET_CACHE* pEntry = NULL;
+	PACKET_ENCODER Encoder;
+	uint16_t tick1t, tick0t, tick0h;
+	uint16_t preambles;
+
+	// a zero period is the pattern terminator
+	if(tc >= TRACK_CHANNELS || clk1t == 0 || clk0t == 0)
+	{
+		return 2;
+	}
+
+	pBuildPacket = GetFreePacket(pTrack);
+	if(pBuildPacket == NULL)
+	{
+		return 1;
+	}
+
+	preambles = GetPreambles(pTrack);
+
+	if(len != 0 && len <= TRACK_CACHE_BYTES)
+	{
+		pEntry = CacheLookup(pTrack, buf, len, clk1t, clk0t, clk0h, preambles);
+		if(pEntry != NULL)
+		{
+			// already compiled, hand the cached pattern to the ring slot
+			pTrack->Stats.cache_hits++;
+			QueuePacket(pTrack, pEntry->pattern, pEntry);
+			return 0;
+		}
+
+		// build it in a free cache entry, or in the slot if all are queued
+		pEntry = CacheAllocate(pTrack);
+		if(pEntry != NULL)
+		{
+			pBuildPacket = pEntry->pattern;
+		}
+	}
+	pTrack->Stats.cache_misses++;
+
+	tick1t = clk1t * TICKS_PER_MICROSECOND;
+	tick0t = clk0t * TICKS_PER_MICROSECOND;
+	tick0h = clk0h * TICKS_PER_MICROSECOND;
+
+	EncodeStart(&Encoder, pBuildPacket, TRACK_PACKET_SIZE);
+
+	// preamble
+	BuildPreamble(&Encoder, preambles, tick1t);
+
+	// first interbyte
+	EncodeBits(&Encoder, tick0t, tick0h, 1);
+
+	for(int i = 0; i < len; i++)
+	{
+		EncodeByte(&Encoder, buf[i], 0, tick1t, tick0t, tick0h);
+
+		// interbyte
+		EncodeBits(&Encoder, tick0t, tick0h, 1);
+	}
+
+	if(EncodeEnd(&Encoder, &pTrack->Stats) != 0)
+	{
+		return 2;
+	}
+
+	if(pEntry != NULL)
+	{
+		memcpy(pEntry->bytes, buf, len);
+		pEntry->clk1t = clk1t;
+		pEntry->clk0t = clk0t;
+		pEntry->clk0h = clk0h;
+		pEntry->preambles = preambles;
+		pEntry->used = ++pTrack->CacheClock;
+		pEntry->len = len;
+	}
+
+	QueuePacket(pTrack, pBuildPacket, pEntry);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* BuildPacketBytes
+*
+* @brief	Build a bit pattern for a packet based on repeating the byte
+*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
+*
+* @param	packet byte
+*			count
+*			1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	0 = success
+*
+*********************************************************************/
+int BuildPacketBytes(const uint8_t packet_byte, uint8_t count, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	uint8_t buf[6];
+
+	if(count < 6)
+	{
+		memset(buf, packet_byte, count);
+		return BuildPacket(buf, count, clk1t, clk0t, clk0h);
+	}
+
+	return 2;
+}
+
+
+/*********************************************************************
+*
+* BuildPacketAmbig1
+*
+* @brief	Build a bit pattern for a packet based on repeating the byte
+*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
+*			with 1 ambiguous zero bit
+*
+* @param	packet byte
+*			count
+*			1 total width
+*			0 total width
+*			0 first half width
+*			0 total width ambiguous zero bit
+*			0 first half width ambiguous zero bit
+*
+* @return	0 = success
+*
+*********************************************************************/
+int BuildPacketAmbig1(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t, uint16_t clk0h)
+{
+	PACKET_BITS* pBuildPacket;
+	PACKET_ENCODER Encoder;
+
+
+	pBuildPacket = GetFreePacket(MAIN_TRACK);
+	if(pBuildPacket == NULL)
+	{
+		return 1;
+	}
+
+	clk1t *= TICKS_PER_MICROSECOND;
+	clk0t1 *= TICKS_PER_MICROSECOND;
+	clk0h1 *= TICKS_PER_MICROSECOND;
+	clk0t *= TICKS_PER_MICROSECOND;
+	clk0h *= TICKS_PER_MICROSECOND;
+
+	EncodeStart(&Encoder, pBuildPacket, TRACK_PACKET_SIZE);
+
+	// set the zero stretch for the first bit
+	EncodeBits(&Encoder, clk0t1, clk0h1, 1);
+
+	// do the rest
+	EncodeByte(&Encoder, packet_byte, 1, clk1t, clk0t, clk0h);
+
+	// interbyte
+	EncodeBits(&Encoder, clk0t1, clk0h1, 1);
+
+	if(EncodeEnd(&Encoder, &MAIN_TRACK->Stats) != 0)
+	{
+		return 2;
+	}
+
+	QueuePacket(MAIN_TRACK, pBuildPacket, NULL);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* BuildPacketAmbig2
+*
+* @brief	Build a bit pattern for a packet based on repeating the byte
+*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
+*			with 2 ambiguous bits
+*
+* @param	packet byte
+*			count
+*			1 total width
+*			0 total width
+*			0 first half width
+*			0 total width first ambiguous zero bit
+*			0 first half width first ambiguous zero bit
+*			0 total width second ambiguous zero bit
+*			0 first half width second ambiguous zero bit
+*
+* @return	none
+*
+*********************************************************************/
+int BuildPacketAmbig2(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t2, uint16_t clk0h2, uint16_t clk0t, uint16_t clk0h)
+{
+	PACKET_BITS* pBuildPacket;
+	PACKET_ENCODER Encoder;
+
+
+	pBuildPacket = GetFreePacket(MAIN_TRACK);
+	if(pBuildPacket == NULL)
+	{
+		return 1;
+	}
+
+	clk1t *= TICKS_PER_MICROSECOND;
+	clk0t1 *= TICKS_PER_MICROSECOND;
+	clk0h1 *= TICKS_PER_MICROSECOND;
+	clk0t2 *= TICKS_PER_MICROSECOND;
+	clk0h2 *= TICKS_PER_MICROSECOND;
+	clk0t *= TICKS_PER_MICROSECOND;
+	clk0h *= TICKS_PER_MICROSECOND;
+
+	EncodeStart(&Encoder, pBuildPacket, TRACK_PACKET_SIZE);
+
+	// set the zero stretch for the first bit
+	EncodeBits(&Encoder, clk0t1, clk0h1, 1);
+
+	// set the zero stretch for the second bit
+	EncodeBits(&Encoder, clk0t2, clk0h2, 1);
+
+	// do the rest
+	EncodeByte(&Encoder, packet_byte, 2, clk1t, clk0t, clk0h);
+
+	// interbyte
+	EncodeBits(&Encoder, clk0t1, clk0h1, 1);
+
+	if(EncodeEnd(&Encoder, &MAIN_TRACK->Stats) != 0)
+	{
+		return 2;
+	}
+
+	QueuePacket(MAIN_TRACK, pBuildPacket, NULL);
+	return 0;
+}
+
+/*********************************************************************
+*
+* BuildPacketStream
+*
+* @brief	Build a bit pattern straight from a raw DCC bit stream, the
+*			way the tester hardware shifted it out: most significant bit
+*			first, a 1 bit is a one, and nothing is added - the preamble,
+*			the framing and any odd lengths or flipped bits are whatever
+*			the stream holds
+*
+* @param	pointer to the stream bytes
+*			number of bits to send (need not be a whole number of bytes)
+*			non-zero to swap the 0 and 1 bits
+*			1 total width
+*			0 total width
+*			0 first half width
+*
+* @return	0 = success, 1 = no buffer available, 2 = too long or empty
+*
+*********************************************************************/
+int BuildPacketStream(const uint8_t* stream, uint32_t bits, uint8_t invert, uint16_t clk1t, uint16_t clk0t, uint16_t clk0h)
+{
+	PACKET_BITS* pBuildPacket;
+	PACKET_ENCODER Encoder;
+	uint8_t bit, run_bit = 0;
+	uint32_t run = 0;
+
+	// a zero period is the pattern terminator
+	if(bits == 0 || clk1t == 0 || clk0t == 0)
+	{
+		return 2;
+	}
+
+	pBuildPacket = GetFreePacket(MAIN_TRACK);
+	if(pBuildPacket == NULL)
+	{
+		return 1;
+	}
+
+	clk1t *= TICKS_PER_MICROSECOND;
+	clk0t *= TICKS_PER_MICROSECOND;
+	clk0h *= TICKS_PER_MICROSECOND;
+
+	EncodeStart(&Encoder, pBuildPacket, TRACK_PACKET_SIZE);
+
+	// collect runs of equal bits, each run is one EncodeBits call
+	for(uint32_t i = 0; i < bits; i++)
+	{
+		bit = ((stream[i >> 3] << (i & 7)) & 0x80) ? 1 : 0;
+		bit ^= invert ? 1 : 0;
+
+		if(run != 0 && bit != run_bit)
+		{
+			if(run_bit)
+			{
+				EncodeBits(&Encoder, clk1t, clk1t/2, run);
+			}
+			else
+			{
+				EncodeBits(&Encoder, clk0t, clk0h, run);
+			}
+			run = 0;
+		}
+		run_bit = bit;
+		run++;
+	}
+
+	if(run_bit)
+	{
+		EncodeBits(&Encoder, clk1t, clk1t/2, run);
+	}
+	else
+	{
+		EncodeBits(&Encoder, clk0t, clk0h, run);
+	}
+
+	if(EncodeEnd(&Encoder, &MAIN_TRACK->Stats) != 0)
+	{
+		return 2;
+	}
+
+	QueuePacket(MAIN_TRACK, pBuildPacket, NULL);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* BuildPacketBits
+*
+* @brief	Move a preloaded bit pattern (typically from a file, or a
+*			tester sequence) to an empty packet buffer and terminate it
+*
+* @param	pointer to the pattern entries
+*			number of entries, without a terminator
+*
+* @return	0 = success, 1 = no buffer available, 2 = too long or empty
+*
+*********************************************************************/
+int BuildPacketBits(const PACKET_BITS* packet, uint8_t count)
+{
+	PACKET_BITS* pBuildPacket;
+	TRACK_STATS* pStats = &MAIN_TRACK->Stats;
+	uint32_t bits = 0;
+
+	// room for the terminator
+	if(count == 0 || count > TRACK_PACKET_SIZE - 1)
+	{
+		pStats->overflows++;
+		return 2;
+	}
+
+	pBuildPacket = GetFreePacket(MAIN_TRACK);
+	if(pBuildPacket == NULL)
+	{
+		return 1;
+	}
+
+	memcpy(pBuildPacket, packet, count * sizeof(PACKET_BITS));
+
+	pBuildPacket[count].count = 0;
+	pBuildPacket[count].period = 0;
+	pBuildPacket[count].pulse = 0;
+
+	for(int i = 0; i < count; i++)
+	{
+		bits += (uint32_t)packet[i].count + 1;
+	}
+
+	pStats->packets++;
+	pStats->bits += bits;
+	pStats->entries += count;
+	if(count > pStats->max_entries)
+	{
+		pStats->max_entries = count;
+	}
+
+	QueuePacket(MAIN_TRACK, pBuildPacket, NULL);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* EnableTrack / DisableTrack / GetTrackState
+*
+* @brief	Main track wrappers for the channel functions
+*
+*********************************************************************/
+void EnableTrack(void)
+{
+	EnableTrackChannel(TC_MAIN);
+}
+
+void DisableTrack(void)
+{
+	DisableTrackChannel(TC_MAIN);
+}
+
+uint8_t GetTrackState(void)
+{
+	return GetTrackChannelState(TC_MAIN);
+}
+
+
+/*********************************************************************
+*
+* EnableTrackChannel
+*
+* @brief	Turn a track output on
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	none
+*
+*********************************************************************/
+void EnableTrackChannel(TRACK_CHANNEL tc)
+{
+	TRACK_OUTPUT* pTrack = &aTrack[tc];
+	const TRACK_HARDWARE* pHardware = pTrack->pHardware;
+	GPIO_InitTypeDef GPIO_InitStruct;
+
+	if(pHardware == NULL)
+	{
+		// not configured
+		return;
+	}
+
+	HAL_GPIO_WritePin(pHardware->enable_port, pHardware->enable_pin, GPIO_PIN_SET);
+
+
+	/* Chan1 GPIO pin configuration  */
+	GPIO_InitStruct.Pin       = pHardware->a_pin;
+	GPIO_InitStruct.Mode      = TRACK_A_MODE_E;
+	GPIO_InitStruct.Pull      = TRACK_A_PU_PD;
+	GPIO_InitStruct.Speed     = TRACK_A_SPEED;
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->a_port, &GPIO_InitStruct);
+
+	/* Chan1n GPIO pin configuration  */
+	GPIO_InitStruct.Pin 	  = pHardware->b_pin;
+	GPIO_InitStruct.Mode      = TRACK_B_MODE_E;
+	GPIO_InitStruct.Pull      = TRACK_B_PU_PD;
+	GPIO_InitStruct.Speed     = TRACK_B_SPEED;
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->b_port, &GPIO_InitStruct);
+
+	HAL_TIM_Base_Start(&pTrack->htim);
+
+	//if(HAL_TIMEx_PWMN_Start(&pTrack->htim, TIM_CHANNEL_1) != HAL_OK)
+	//{
+	//    Error_Handler();
+	//}
+
+	//if(HAL_TIM_PWM_Start(&pTrack->htim, TIM_CHANNEL_1) != HAL_OK)
+	//{
+	//    Error_Handler();
+	//}
+
+	#ifdef TRACK_DMA_BURST
+		// the DMA stream carries the pattern, only the packet boundaries interrupt
+		HAL_NVIC_EnableIRQ(pHardware->dma_irq);
+	#else
+		HAL_NVIC_EnableIRQ(pHardware->timer_irq);
+		__HAL_TIM_ENABLE_IT(&pTrack->htim, TIM_IT_UPDATE);
+	#endif
+
+	pTrack->bTrackState = 1;
+}
+
+/*********************************************************************
+*
+* DisableTrackChannel
+*
+* @brief	Turn a track output off
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	none
+*
+*********************************************************************/
+void DisableTrackChannel(TRACK_CHANNEL tc)
+{
+	TRACK_OUTPUT* pTrack = &aTrack[tc];
+	const TRACK_HARDWARE* pHardware = pTrack->pHardware;
+	GPIO_InitTypeDef GPIO_InitStruct;
+
+	if(pHardware == NULL)
+	{
+		// not configured
+		return;
+	}
+
+	HAL_GPIO_WritePin(pHardware->enable_port, pHardware->enable_pin, GPIO_PIN_RESET);
+
+	/* Chan1 GPIO pin configuration  */
+	GPIO_InitStruct.Pin       = pHardware->a_pin;
+	GPIO_InitStruct.Mode      = TRACK_A_MODE_D;
+	GPIO_InitStruct.Pull      = TRACK_A_PU_PD;
+	GPIO_InitStruct.Speed     = TRACK_A_SPEED;
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->a_port, &GPIO_InitStruct);
+
+	/* Chan1n GPIO pin configuration  */
+	GPIO_InitStruct.Pin 	  = pHardware->b_pin;
+	GPIO_InitStruct.Mode      = TRACK_B_MODE_D;
+	GPIO_InitStruct.Pull      = TRACK_B_PU_PD;
+	GPIO_InitStruct.Speed     = TRACK_B_SPEED;
+	GPIO_InitStruct.Alternate = pHardware->af;
+	HAL_GPIO_Init(pHardware->b_port, &GPIO_InitStruct);
+
+	// stop the timer
+	__HAL_TIM_DISABLE_IT(&pTrack->htim, TIM_IT_UPDATE);
+
+	#ifdef TRACK_DMA_BURST
+		__HAL_TIM_DISABLE_DMA(&pTrack->htim, TIM_DMA_UPDATE);
+		if(pTrack->hdma.State == HAL_DMA_STATE_BUSY)
+		{
+			HAL_DMA_Abort(&pTrack->hdma);
+		}
+		HAL_NVIC_DisableIRQ(pHardware->dma_irq);
+	#endif
+
+//k	__HAL_TIM_SET_AUTORELOAD(&pTrack->htim, ONE_PERIOD);
+//k	__HAL_TIM_SET_COMPARE(&pTrack->htim, TIM_CHANNEL_1, ONE_PERIOD);
+
+	//HAL_TIM_Base_Stop(&pTrack->htim);
+
+	HAL_NVIC_DisableIRQ(pHardware->timer_irq);
+
+	//if(HAL_TIMEx_PWMN_Stop(&pTrack->htim, TIM_CHANNEL_1) != HAL_OK)
+	//{
+	//    Error_Handler();
+	//}
+
+	//if(HAL_TIM_PWM_Stop(&pTrack->htim, TIM_CHANNEL_1) != HAL_OK)
+	//{
+	//    Error_Handler();
+	//}
+
+	pTrack->bTrackState = 0;
+}
+
+
+/*********************************************************************
+*
+* GetTrackChannelState
+*
+* @brief	Get the state of a track output (on or off)
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	Track state
+*
+*********************************************************************/
+uint8_t GetTrackChannelState(TRACK_CHANNEL tc)
+{
+	return aTrack[tc].bTrackState;
+}
+
+
+/*********************************************************************
+*
+* IsPacketBufferAvailable / GetFreePacketSlots / WaitForPacketSlot /
+* RegisterPacketSlotCallback / IsPacketComplete
+*
+* @brief	Main track wrappers for the channel functions
+*
+*********************************************************************/
+uint32_t IsPacketBufferAvailable(void)
+{
+	return IsChannelBufferAvailable(TC_MAIN);
+}
+
+uint32_t GetFreePacketSlots(void)
+{
+	return GetChannelFreeSlots(TC_MAIN);
+}
+
+int WaitForPacketSlot(uint32_t timeout)
+{
+	return WaitForChannelSlot(TC_MAIN, timeout);
+}
+
+void RegisterPacketSlotCallback(void (*pCallback)(void))
+{
+	RegisterChannelSlotCallback(TC_MAIN, pCallback);
+}
+
+uint32_t IsPacketComplete(void)
+{
+	return IsChannelPacketComplete(TC_MAIN);
+}
+
+
+/*********************************************************************
+*
+* IsChannelBufferAvailable
+*
+* @brief	Non-zero if buffer is available, 0 otherwize
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	1 = available
+*
+*********************************************************************/
+uint32_t IsChannelBufferAvailable(TRACK_CHANNEL tc)
+{
+	return aTrack[tc].RingHead - aTrack[tc].RingTail < TRACK_PACKET_SLOTS;
+}
+
+
+/*********************************************************************
+*
+* GetChannelFreeSlots
+*
+* @brief	Number of packets that can be queued without waiting
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	free ring slots
+*
+*********************************************************************/
+uint32_t GetChannelFreeSlots(TRACK_CHANNEL tc)
+{
+	return TRACK_PACKET_SLOTS - (aTrack[tc].RingHead - aTrack[tc].RingTail);
+}
+
+
+/*********************************************************************
+*
+* WaitForChannelSlot
+*
+* @brief	Block the calling task until a packet can be queued. Only the
+*			task that owns the output (the producer) may call this.
+*
+* @param	track output, one of TRACK_CHANNEL
+*			timeout - os ticks to wait, osWaitForever to wait forever
+*
+* @return	0 = a slot is free, 1 = timed out
+*
+*********************************************************************/
+int WaitForChannelSlot(TRACK_CHANNEL tc, uint32_t timeout)
+{
+	TRACK_OUTPUT* pTrack = &aTrack[tc];
+	uint32_t flag = TRACK_FLAG_SLOT << tc;
+
+	if(IsChannelBufferAvailable(tc))
+	{
+		return 0;
+	}
+
+	osThreadFlagsClear(flag);
+	pTrack->SlotWaiter = osThreadGetId();
+
+	// the track may have released a slot before the waiter was set
+	if(!IsChannelBufferAvailable(tc))
+	{
+		osThreadFlagsWait(flag, osFlagsWaitAny, timeout);
+	}
+
+	pTrack->SlotWaiter = NULL;
+
+	return IsChannelBufferAvailable(tc) ? 0 : 1;
+}
+
+
+/*********************************************************************
+*
+* RegisterChannelSlotCallback
+*
+* @brief	Set a function called (from the track wakeup interrupt, at
+*			the RTOS ceiling) every time the track output hands a packet
+*			slot back, NULL to remove it
+*
+* @param	track output, one of TRACK_CHANNEL
+*			pCallback - function to call
+*
+* @return	none
+*
+*********************************************************************/
+void RegisterChannelSlotCallback(TRACK_CHANNEL tc, void (*pCallback)(void))
+{
+	aTrack[tc].pSlotCallback = pCallback;
+}
+
+
+/*********************************************************************
+*
+* IsChannelPacketComplete
+*
+* @brief	Non-zero if packet(s) are done sending (track off, idle, or reset)
+*
+* @param	track output, one of TRACK_CHANNEL
+*
+* @return	1 = complete
+*
+*********************************************************************/
+uint32_t IsChannelPacketComplete(TRACK_CHANNEL tc)
+{
+	return aTrack[tc].PacketComplete;
+}
+
+
+/*********************************************************************
+*
+* OpenTrack
+*
+* @brief	Open the main track for a resource. The open resources share
+*			the track packet by packet, see SetTrackShare.
+*
+* @param	tr - which procees is requesting the track, one of TRACK_RESOURCE
+*			ti - what should the track generator do when it runs out of packets,
+*				 one of TRACK_IDLE, the open resource with the highest
+*				 priority and a policy other than TI_NONE sets it
+*			preambles -  number of preambles, 0 = used default, longer
+*				 than MAX_PREAMBLE_BITS is cut to that
+*
+* @return	TRACK_LOCK_STATUS, TL_LOCKED = the resource has no share
+*
+*********************************************************************/
+TRACK_LOCK_STATUS OpenTrack(TRACK_RESOURCE tr, TRACK_IDLE ti, uint16_t preambles)
+{
+	TRACK_LOCK* pLock;
+
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES)
+	{
+		return TL_NONE;
+	}
+
+	pLock = &Arbiter.aLock[tr];
+	if(pLock->share == 0)
+	{
+		// track resource locked
+		return TL_LOCKED;
+	}
+
+	pLock->idle = ti;
+	pLock->preambles = preambles > MAX_PREAMBLE_BITS ? MAX_PREAMBLE_BITS : preambles;
+	pLock->open = 1;
+	UpdateMainIdle();
+
+	// track resource assigned
+	return TL_ASSIGNED;
+}
+
+
+/*********************************************************************
+*
+* CloseTrack
+*
+* @brief	Close the track for a resource, any turn or critical section
+*			it holds goes to the other resources
+*
+* @param	Track resource
+*
+* @return	none
+*
+*********************************************************************/
+void CloseTrack(TRACK_RESOURCE tr)
+{
+	TRACK_LOCK* pLock;
+
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES)
+	{
+		return;
+	}
+
+	pLock = &Arbiter.aLock[tr];
+
+	__disable_irq();
+	pLock->open = 0;
+	pLock->waiting = 0;
+	pLock->credit = 0;
+	if(Arbiter.critical == tr)
+	{
+		Arbiter.critical = TR_NONE;
+	}
+	if(Arbiter.grant == tr)
+	{
+		Arbiter.grant = TR_NONE;
+	}
+	__enable_irq();
+
+	pLock->idle = TI_NONE;
+	pLock->preambles = 0;
+	UpdateMainIdle();
+
+	WakeTurnWaiters(tr);
+}
+
+
+/*********************************************************************
+*
+* IsTrackOpen
+*
+* @brief	Check to see if the track resource is open
+*
+* @param	Track resource
+*
+* @return	1 = open
+*
+*********************************************************************/
+uint8_t IsTrackOpen(TRACK_RESOURCE tr)
+{
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES)
+	{
+		return 0;
+	}
+	return Arbiter.aLock[tr].open;
+}
+
+
+/*********************************************************************
+*
+* GetTrackPreambles
+*
+* @brief	Number of preamble bits the main track packets of a resource
+*			are built with, the count it opened the track with or the
+*			default
+*
+* @param	Track resource
+*
+* @return	preamble bits
+*
+*********************************************************************/
+uint16_t GetTrackPreambles(TRACK_RESOURCE tr)
+{
+	if(tr != TR_NONE && tr < TRACK_RESOURCES && Arbiter.aLock[tr].preambles)
+	{
+		return Arbiter.aLock[tr].preambles;
+	}
+	return aTrackHardware[TC_MAIN].preambles;
+}
+
+
+/*********************************************************************
+*
+* SetTrackShare
+*
+* @brief	Set how much of the main track a resource gets while the
+*			resources contend for it. A resource that has nothing to send
+*			gives its turns away, so the shares only matter under load.
+*
+* @param	Track resource
+*			share - relative share of the packets, e.g. 80 and 20
+*			priority - higher wins ties and picks the idle policy
+*
+* @return	0 = success, 2 = bad resource
+*
+*********************************************************************/
+int SetTrackShare(TRACK_RESOURCE tr, uint8_t share, uint8_t priority)
+{
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES)
+	{
+		return 2;
+	}
+
+	__disable_irq();
+	Arbiter.aLock[tr].share = share;
+	Arbiter.aLock[tr].priority = priority;
+	Arbiter.aLock[tr].credit = 0;
+	__enable_irq();
+
+	UpdateMainIdle();
+	WakeTurnWaiters(tr);
+	return 0;
+}
+
+
+/*********************************************************************
+*
+* TakeTurn
+*
+* @brief	Decide if a resource may queue the next main track packet,
+*			the caller has a packet ready. Called with interrupts off.
+*
+* @param	Track resource
+*
+* @return	1 = the resource has the turn until it queues the packet
+*
+*********************************************************************/
+static uint8_t TakeTurn(TRACK_RESOURCE tr)
+{
+	TRACK_LOCK* pLock = &Arbiter.aLock[tr];
+	uint8_t turn = 1;
+	int32_t score;
+
+	if(Arbiter.critical == tr || Arbiter.grant == tr)
+	{
+		return 1;
+	}
+
+	if(Arbiter.critical != TR_NONE || Arbiter.grant != TR_NONE)
+	{
+		// another resource is in a critical section, or has the turn
+		turn = 0;
+	}
+	else
+	{
+		// the contender with the most credit goes first
+		score = pLock->credit + pLock->share;
+		for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
+		{
+			TRACK_LOCK* pOther = &Arbiter.aLock[i];
+
+			if(i == tr || !pOther->open || !pOther->waiting)
+			{
+				continue;
+			}
+			if(pOther->credit + pOther->share > score ||
+			   (pOther->credit + pOther->share == score && pOther->priority > pLock->priority))
+			{
+				turn = 0;
+				break;
+			}
+		}
+	}
+
+	if(!turn)
+	{
+		if(!pLock->waiting)
+		{
+			pLock->waits++;
+		}
+		pLock->waiting = 1;
+		return 0;
 	}
-	return 0;
+
+	Arbiter.grant = tr;
+	return 1;
 }
 
 
 /*********************************************************************
 *
-* BuildPacketAmbig2
+* ChargeTurn
 *
-* @brief	Build a bit pattern for a packet based on repeating the byte
-*			in packet_byte, and the bit widths in  clk1t, clk0t, and clk0h
-*			with 2 ambiguous bits
+* @brief	Account for a packet just queued on the main track by the
+*			resource with the turn, and pass the turn on
 *
-* @param	packet byte
-*			count
-*			1 total width
-*			0 total width
-*			0 first half width
-*			0 total width first ambiguous zero bit
-*			0 first half width first ambiguous zero bit
-*			0 total width second ambiguous zero bit
-*			0 first half width second ambiguous zero bit
+* @param	none
 *
 * @return	none
 *
 *********************************************************************/
-int BuildPacketAmbig2(const uint8_t packet_byte, uint16_t clk1t, uint16_t clk0t1, uint16_t clk0h1, uint16_t clk0t2, uint16_t clk0h2, uint16_t clk0t, uint16_t clk0h)
+static void ChargeTurn(void)
 {
-	PACKET_BITS* pBuildPacket;
-	PACKET_BITS* pPacket;
-	uint8_t mask;
-
+	TRACK_RESOURCE tr = Arbiter.grant;
+	TRACK_LOCK* pLock;
+	int32_t total = 0;
 
-	if(apPacket1[0].period == 0)
-	{
-		pBuildPacket = apPacket1;
-	}
-	else if(apPacket2[0].period == 0)
+	if(tr == TR_NONE)
 	{
-		pBuildPacket = apPacket2;
-	}
-	else
-	{
-		return 1;		// return an error?
+		// not arbitrated (a producer that never opened the track)
+		return;
 	}
 
-	clk1t *= TICKS_PER_MICROSECOND;
-	clk0t1 *= TICKS_PER_MICROSECOND;
-	clk0h1 *= TICKS_PER_MICROSECOND;
-	clk0t2 *= TICKS_PER_MICROSECOND;
-	clk0h2 *= TICKS_PER_MICROSECOND;
-	clk0t *= TICKS_PER_MICROSECOND;
-	clk0h *= TICKS_PER_MICROSECOND;
+	pLock = &Arbiter.aLock[tr];
 
-	pPacket = pBuildPacket;
+	__disable_irq();
+	pLock->waiting = 0;
+	pLock->packets++;
 
-	// set the zero stretch for the first bit
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t1;
-	pBuildPacket->pulse = clk0h1;
-	pBuildPacket++;
+	// everybody with a packet ready earns their share, the one that
+	// sent pays for all of it
+	for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
+	{
+		TRACK_LOCK* pOther = &Arbiter.aLock[i];
 
-	// set the zero stretch for the second bit
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t2;
-	pBuildPacket->pulse = clk0h2;
-	pBuildPacket++;
+		if(pOther->open && (i == tr || pOther->waiting))
+		{
+			pOther->credit += pOther->share;
+			total += pOther->share;
+		}
+	}
+	pLock->credit -= total;
 
-	// do the rest
-	mask = 0x04;
-	for(int b = 0; b < 6; b++)
+	for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
 	{
-		if(packet_byte & mask)
+		TRACK_LOCK* pOther = &Arbiter.aLock[i];
+
+		if(pOther->credit > ARBITER_CREDIT_LIMIT)
 		{
-			// build a one bit
-			pBuildPacket->count = 0;
-			pBuildPacket->period = clk1t;
-			pBuildPacket->pulse = clk1t/2;
+			pOther->credit = ARBITER_CREDIT_LIMIT;
 		}
-		else
+		else if(pOther->credit < -ARBITER_CREDIT_LIMIT)
 		{
-			// build a zero bit
-			pBuildPacket->count = 0;
-			pBuildPacket->period = clk0t;
-			pBuildPacket->pulse = clk0h;
+			pOther->credit = -ARBITER_CREDIT_LIMIT;
 		}
-		pBuildPacket++;
-		mask <<= 1;
 	}
 
-	// interbyte
-	pBuildPacket->count = 0;
-	pBuildPacket->period = clk0t1;
-	pBuildPacket->pulse = clk0h1;
-	pBuildPacket++;
-
+	if(Arbiter.critical != tr)
+	{
+		Arbiter.grant = TR_NONE;
+	}
+	__enable_irq();
 
-	// terminator
-	pBuildPacket->count = 0;
-	pBuildPacket->period = 0;
-	pBuildPacket->pulse = 0;
+	WakeTurnWaiters(tr);
+}
 
-	//__HAL_TIM_SET_AUTORELOAD(&htim1, CurrentPattern->period);
-	//__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, CurrentPattern->pulse);
-	//__HAL_TIM_SET_REPETITION(&htim1, CurrentPattern->count);
-	//ScopeTriggerBitCount = ScopeTriggerBitOffset;
-	//PacketComplete = PACKET_NOT_COMPLETE;
-	//EnableTrack();
 
-	if(PacketComplete == PACKET_COMPLETE)
+/*********************************************************************
+*
+* WakeTurnWaiters
+*
+* @brief	The turn has moved on, wake the resources waiting for it
+*
+* @param	resource that gave up the turn
+*
+* @return	none
+*
+*********************************************************************/
+static void WakeTurnWaiters(TRACK_RESOURCE tr)
+{
+	for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
 	{
-		__HAL_TIM_SET_AUTORELOAD(&htim1, pPacket->period);
-		__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pPacket->pulse);
-		__HAL_TIM_SET_REPETITION(&htim1, pPacket->count);
+		osThreadId_t waiter = Arbiter.aWaiter[i];
+
+		if(i != tr && waiter != NULL)
+		{
+			osThreadFlagsSet(waiter, TRACK_FLAG_TURN);
+		}
+	}
+}
+
 
-		ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		CurrentPacket = apIdlePacket;
-		CurrentPattern = apIdlePacket;
+/*********************************************************************
+*
+* UpdateMainIdle
+*
+* @brief	Give the main track the idle policy of the open resource
+*			with the highest priority that asked for one
+*
+* @param	none
+*
+* @return	none
+*
+*********************************************************************/
+static void UpdateMainIdle(void)
+{
+	TRACK_IDLE ti = MAIN_TRACK_IDLE;
+	int priority = -1;
 
-		PacketComplete = PACKET_NOT_COMPLETE;
+	for(int i = TR_NONE + 1; i < TRACK_RESOURCES; i++)
+	{
+		TRACK_LOCK* pLock = &Arbiter.aLock[i];
 
-		EnableTrack();
+		if(pLock->open && pLock->idle != TI_NONE && pLock->priority > priority)
+		{
+			ti = pLock->idle;
+			priority = pLock->priority;
+		}
 	}
-	return 0;
+
+	SetChannelIdle(TC_MAIN, ti);
 }
 
+
 /*********************************************************************
 *
-* BuildPacketBits
+* IsTrackTurn
 *
-* @brief	Build a bit pattern for a packet based on repeating the byte
-*			Move the preloaded bit pattern (typically from a file)
-*			to an empty packet buffer.
+* @brief	Non-zero if a resource may queue its next main track packet
+*			now. Only ask with a packet ready, the turn is held until
+*			the packet is queued.
 *
-* @param	pointer to packet bytes
-*			count
+* @param	Track resource
 *
-* @return	0 = success
+* @return	1 = queue the packet, 0 = try again later
 *
 *********************************************************************/
-int BuildPacketBits(const PACKET_BITS* packet, uint8_t count)
+uint32_t IsTrackTurn(TRACK_RESOURCE tr)
 {
-	PACKET_BITS* pBuildPacket;
-	PACKET_BITS* pPacket;
+	uint32_t turn;
 
-
-	if(apPacket1[0].period == 0)
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES || !Arbiter.aLock[tr].open)
 	{
-		pBuildPacket = apPacket1;
+		return 0;
 	}
-	else if(apPacket2[0].period == 0)
+
+	__disable_irq();
+	if(IsChannelBufferAvailable(TC_MAIN))
 	{
-		pBuildPacket = apPacket2;
+		turn = TakeTurn(tr);
 	}
 	else
+	{
+		// no room for anybody, but the packet counts when the turn
+		// is handed out with the next free slot
+		Arbiter.aLock[tr].waiting = 1;
+		turn = 0;
+	}
+	__enable_irq();
+
+	return turn;
+}
+
+
+/*********************************************************************
+*
+* WaitForTrackTurn
+*
+* @brief	Block the calling task until its resource may queue the next
+*			main track packet and a slot is free. Only ask with a packet
+*			ready, the turn is held until the packet is queued.
+*
+* @param	Track resource
+*			timeout - os ticks to wait for each hand over, osWaitForever
+*			to wait forever
+*
+* @return	0 = queue the packet, 1 = timed out
+*
+*********************************************************************/
+int WaitForTrackTurn(TRACK_RESOURCE tr, uint32_t timeout)
+{
+	uint8_t turn;
+
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES || !Arbiter.aLock[tr].open)
 	{
 		return 1;
 	}
 
-	pPacket = pBuildPacket;
+	Arbiter.aWaiter[tr] = osThreadGetId();
 
-	memcpy((char*)pBuildPacket, (char*)packet, sizeof(PACKET_BITS));
-	
-	if(PacketComplete == PACKET_COMPLETE)
+	do
 	{
-		__HAL_TIM_SET_AUTORELOAD(&htim1, pPacket->period);
-		__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, pPacket->pulse);
-		__HAL_TIM_SET_REPETITION(&htim1, pPacket->count);
+		osThreadFlagsClear(TRACK_FLAG_TURN);
+
+		__disable_irq();
+		turn = TakeTurn(tr);
+		__enable_irq();
 
-		ScopeTriggerBitCount = ScopeTriggerBitOffset;
-		CurrentPacket = apIdlePacket;
-		CurrentPattern = apIdlePacket;
+		if(!turn && osThreadFlagsWait(TRACK_FLAG_TURN, osFlagsWaitAny, timeout) == osFlagsErrorTimeout)
+		{
+			Arbiter.aWaiter[tr] = NULL;
+			return 1;
+		}
+	} while(!turn);
 
-		PacketComplete = PACKET_NOT_COMPLETE;
+	Arbiter.aWaiter[tr] = NULL;
 
-		EnableTrack();
+	if(WaitForChannelSlot(TC_MAIN, timeout) != 0)
+	{
+		ReleaseTrackTurn(tr);
+		return 1;
 	}
 	return 0;
 }
@@ -953,253 +2769,264 @@ int BuildPacketBits(const PACKET_BITS* packet, uint8_t count)
 
 /*********************************************************************
 *
-* EnableTrack
+* ReleaseTrackTurn
 *
-* @brief	Turn the track output on
+* @brief	Give back a turn without queueing a packet (the packet could
+*			not be built). A critical section is kept.
 *
-* @param	none
+* @param	Track resource
 *
 * @return	none
 *
 *********************************************************************/
-void EnableTrack(void)
+void ReleaseTrackTurn(TRACK_RESOURCE tr)
 {
-	GPIO_InitTypeDef GPIO_InitStruct;
-
-	HAL_GPIO_WritePin(TRACK_ENABLE_PORT, TRACK_ENABLE_PIN, GPIO_PIN_SET);
-
-
-	/* Tim1 Chan1 GPIO pin configuration  */
-	GPIO_InitStruct.Pin       = TRACK_A_PIN;
-	GPIO_InitStruct.Mode      = TRACK_A_MODE_E;
-	GPIO_InitStruct.Pull      = TRACK_A_PU_PD;
-	GPIO_InitStruct.Speed     = TRACK_A_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_A_AF;
-	HAL_GPIO_Init(TRACK_A_PORT, &GPIO_InitStruct);
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES || Arbiter.grant != tr || Arbiter.critical == tr)
+	{
+		return;
+	}
 
-	/* Tim1 Chan1n GPIO pin configuration  */
-	GPIO_InitStruct.Pin 	  = TRACK_B_PIN;
-	GPIO_InitStruct.Mode      = TRACK_B_MODE_E;
-	GPIO_InitStruct.Pull      = TRACK_B_PU_PD;
-	GPIO_InitStruct.Speed     = TRACK_B_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_B_AF;
-	HAL_GPIO_Init(TRACK_B_PORT, &GPIO_InitStruct);
+	__disable_irq();
+	Arbiter.grant = TR_NONE;
+	Arbiter.aLock[tr].waiting = 0;
+	__enable_irq();
 
-	HAL_TIM_Base_Start(&htim1);
+	WakeTurnWaiters(tr);
+}
 
-	//if(HAL_TIMEx_PWMN_Start(&htim1, TIM_CHANNEL_1) != HAL_OK)
-	//{
-	//    Error_Handler();
-	//}
 
-	//if(HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1) != HAL_OK)
-	//{
-	//    Error_Handler();
-	//}
+/*********************************************************************
+*
+* EnterTrackCritical
+*
+* @brief	Keep the main track for a resource until ExitTrackCritical,
+*			for packet sequences that must not be split (a packet sent
+*			as fragments, back to back packets). It waits for the turn
+*			of the resource like WaitForTrackTurn.
+*
+* @param	Track resource
+*			timeout - os ticks to wait for each hand over
+*
+* @return	0 = the track is held, 1 = timed out
+*
+*********************************************************************/
+int EnterTrackCritical(TRACK_RESOURCE tr, uint32_t timeout)
+{
+	if(WaitForTrackTurn(tr, timeout) != 0)
+	{
+		return 1;
+	}
 
-	HAL_NVIC_EnableIRQ(TIM1_UP_TIM10_IRQn);
-	__HAL_TIM_ENABLE_IT(&htim1, TIM_IT_UPDATE);
+	__disable_irq();
+	Arbiter.critical = tr;
+	Arbiter.grant = tr;
+	__enable_irq();
 
-	bTrackState = 1;
+	return 0;
 }
 
+
 /*********************************************************************
 *
-* EnableTrack
+* ExitTrackCritical
 *
-* @brief	Turn the track output off
+* @brief	Let the other resources back onto the main track
 *
-* @param	none
+* @param	Track resource
 *
 * @return	none
 *
 *********************************************************************/
-void DisableTrack(void)
+void ExitTrackCritical(TRACK_RESOURCE tr)
 {
-	GPIO_InitTypeDef GPIO_InitStruct;
-
-	HAL_GPIO_WritePin(TRACK_ENABLE_PORT, TRACK_ENABLE_PIN, GPIO_PIN_RESET);
-
-	/* Tim1 Chan1 GPIO pin configuration  */
-	GPIO_InitStruct.Pin       = TRACK_A_PIN;
-	GPIO_InitStruct.Mode      = TRACK_A_MODE_D;
-	GPIO_InitStruct.Pull      = TRACK_A_PU_PD;
-	GPIO_InitStruct.Speed     = TRACK_A_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_A_AF;
-	HAL_GPIO_Init(TRACK_A_PORT, &GPIO_InitStruct);
-
-	/* Tim1 Chan1n GPIO pin configuration  */
-	GPIO_InitStruct.Pin 	  = TRACK_B_PIN;
-	GPIO_InitStruct.Mode      = TRACK_B_MODE_D;
-	GPIO_InitStruct.Pull      = TRACK_B_PU_PD;
-	GPIO_InitStruct.Speed     = TRACK_B_SPEED;
-	GPIO_InitStruct.Alternate = TRACK_B_AF;
-	HAL_GPIO_Init(TRACK_B_PORT, &GPIO_InitStruct);
-
-	// stop the timer
-	__HAL_TIM_DISABLE_IT(&htim1, TIM_IT_UPDATE);
-
-//k	__HAL_TIM_SET_AUTORELOAD(&htim1, ONE_PERIOD);
-//k	__HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, ONE_PERIOD);
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES || Arbiter.critical != tr)
+	{
+		return;
+	}
 
-	//HAL_TIM_Base_Stop(&htim1);
+	__disable_irq();
+	Arbiter.critical = TR_NONE;
+	Arbiter.grant = TR_NONE;
+	Arbiter.aLock[tr].waiting = 0;
+	__enable_irq();
 
-	HAL_NVIC_DisableIRQ(TIM1_UP_TIM10_IRQn);
+	WakeTurnWaiters(tr);
+}
 
-	//if(HAL_TIMEx_PWMN_Stop(&htim1, TIM_CHANNEL_1) != HAL_OK)
-	//{
-	//    Error_Handler();
-	//}
 
-	//if(HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_1) != HAL_OK)
-	//{
-	//    Error_Handler();
-	//}
+/*********************************************************************
+*
+* GetTrackLock
+*
+* @brief	Copy the share settings and the packet counts of a resource
+*
+* @param	Track resource
+*			pointer to the copy
+*
+* @return	none
+*
+*********************************************************************/
+void GetTrackLock(TRACK_RESOURCE tr, TRACK_LOCK* pLock)
+{
+	if(tr == TR_NONE || tr >= TRACK_RESOURCES)
+	{
+		memset(pLock, 0, sizeof(TRACK_LOCK));
+		return;
+	}
 
-	bTrackState = 0;
+	__disable_irq();
+	*pLock = Arbiter.aLock[tr];
+	__enable_irq();
 }
 
 
 /*********************************************************************
 *
-* GetTrackState
-*
-* @brief	Get the track state (on or off)
+* GetTrackStats / ClearTrackStats / GetTrackIsrStats / ClearTrackIsrStats
 *
-* @param	none
-*
-* @return	Track state
+* @brief	Main track wrappers for the channel functions
 *
 *********************************************************************/
-uint8_t GetTrackState(void)
+void GetTrackStats(TRACK_STATS* pStats)
 {
-	return bTrackState;
+	GetChannelStats(TC_MAIN, pStats);
+}
+
+void ClearTrackStats(void)
+{
+	ClearChannelStats(TC_MAIN);
+}
+
+int GetTrackIsrStats(ISR_STATS* pStats)
+{
+	return GetChannelIsrStats(TC_MAIN, pStats);
+}
+
+void ClearTrackIsrStats(void)
+{
+	ClearChannelIsrStats(TC_MAIN);
 }
 
 
 /*********************************************************************
 *
-* IsPacketBufferAvailable
+* GetChannelStats
 *
-* @brief	Non-zero if buffer is available, 0 otherwize
+* @brief	Get a copy of the packet encoder statistics of a track output
 *
-* @param	none
+* @param	track output, one of TRACK_CHANNEL
+*			pointer to the statistics
 *
-* @return	1 = available
+* @return	none
 *
 *********************************************************************/
-uint32_t IsPacketBufferAvailable(void)
+void GetChannelStats(TRACK_CHANNEL tc, TRACK_STATS* pStats)
 {
-	// ToDo - guard this against the interrupt
-	if(apPacket1[0].period == 0)
-	{
-		return 1;
-	}
-	else if(apPacket2[0].period == 0)
-	{
-		return 1;
-	}
-	else
-	{
-		return 0;
-	}
-
-	return BufferAvailable;
-
+	*pStats = aTrack[tc].Stats;
 }
 
 
 /*********************************************************************
 *
-* IsPacketComplete
+* ClearChannelStats
 *
-* @brief	Non-zero if packet(s) are done sending (track off, idle, or reset)
+* @brief	Clear the packet encoder statistics of a track output
 *
-* @param	none
+* @param	track output, one of TRACK_CHANNEL
 *
-* @return	1 = complete
+* @return	none
 *
 *********************************************************************/
-uint32_t IsPacketComplete(void)
+void ClearChannelStats(TRACK_CHANNEL tc)
 {
-	return PacketComplete;
+	memset(&aTrack[tc].Stats, 0, sizeof(TRACK_STATS));
 }
 
 
 /*********************************************************************
 *
-* OpenTrack
+* GetChannelIsrStats
 *
-* @brief	Non-zero if packet(s) are done sending (track off, idle, or reset)
+* @brief	Get a copy of the interrupt latency statistics of a track
+*			output
 *
-* @param	tr - which procees is requesting the track, one of TRACK_RESOURCE 
-*			ti - what should the track generator do when it runs out of packets,
-*				 one of TRACK_IDLE 
-*			preambles -  number of preambles, 0 = used default
+* @param	track output, one of TRACK_CHANNEL
+*			pointer to the statistics
 *
-* @return	TRACK_LOCK_STATUS
+* @return	0 = success, 1 = not measured in this build
 *
 *********************************************************************/
-TRACK_LOCK_STATUS OpenTrack(TRACK_RESOURCE tr, TRACK_IDLE ti, uint16_t preambles)
+int GetChannelIsrStats(TRACK_CHANNEL tc, ISR_STATS* pStats)
 {
-	// ToDo - make this threadsafe
-	
-	if(TrackLock.lock == tr)
-	{
-		// track resource assigned
-		return TL_ASSIGNED;
-	}
-	else if(TrackLock.lock == TR_NONE)
-	{
-		// assign track resource
-		TrackLock.lock = tr;
-		TrackLock.idle = ti;
-		TrackLock.preambles = preambles;
-		return TL_ASSIGNED;
-	}
-	else
-	{
-		// track resource locked
-		return TL_LOCKED;
-	}
+	#ifdef TRACK_ISR_STATS
+		// the timer and DMA interrupts run at TRACK_IRQ_PRIORITY, above the
+		// RTOS ceiling, a short blackout gives a consistent copy
+		__disable_irq();
+		*pStats = aTrack[tc].IsrStats;
+		__enable_irq();
+		return 0;
+	#else
+		memset(pStats, 0, sizeof(ISR_STATS));
+		return 1;
+	#endif
 }
 
 
 /*********************************************************************
 *
-* CloseTrack
+* GetChannelPacketEnd
 *
-* @brief	Close the track (make it available to another process)
+* @brief	Find when the last ring packet (not an idle or reset filler)
+*			that ended at or before a time ended, the end of its last
+*			pattern entry (the end bit is the first preamble bit of the
+*			packet after it). Safe from an interrupt below the track
+*			interrupt priority.
 *
-* @param	none
+* @param	track output, one of TRACK_CHANNEL
+*			DWT time
+*			pointer to the DWT time the packet ended
 *
-* @return	none
+* @return	0 = found, 1 = none of the recent packets ended by then
 *
 *********************************************************************/
-void CloseTrack(void)
+int GetChannelPacketEnd(TRACK_CHANNEL tc, uint32_t before, uint32_t* pEnd)
 {
-	// ToDo - make this threadsafe
+	TRACK_OUTPUT* pTrack = &aTrack[tc];
+	uint32_t ends = pTrack->PacketEnds;
+	uint32_t end;
+
+	__DMB();
 
-	TrackLock.lock = TR_NONE;
-	TrackLock.idle = TI_NONE;
-	TrackLock.preambles = 0;
+	// newest first, the oldest slot may be written meanwhile
+	for(uint32_t i = 1; i < TRACK_PACKET_ENDS && i <= ends; i++)
+	{
+		end = pTrack->aPacketEnd[(ends - i) % TRACK_PACKET_ENDS];
+		if((int32_t)(before - end) >= 0)
+		{
+			*pEnd = end;
+			return 0;
+		}
+	}
+	return 1;
 }
 
 
 /*********************************************************************
 *
-* IsTrackOpen
+* ClearChannelIsrStats
 *
-* @brief	Check to see if the track resource is open
+* @brief	Clear the interrupt latency statistics of a track output
 *
-* @param	Track resource
+* @param	track output, one of TRACK_CHANNEL
 *
-* @return	1 = open
+* @return	none
 *
 *********************************************************************/
-uint8_t IsTrackOpen(TRACK_RESOURCE tr)
+void ClearChannelIsrStats(TRACK_CHANNEL tc)
 {
-	// ToDo - make this threadsafe
-
-	return TrackLock.lock == tr;
+	#ifdef TRACK_ISR_STATS
+		__disable_irq();
+		IsrStatsClear(&aTrack[tc].IsrStats);
+		__enable_irq();
+	#endif
 }
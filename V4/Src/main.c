@@ -51,6 +51,9 @@ extern void http_server_socket_init(void);
 
 #define VERSION		3
 
+// bytes, the locostore stack is static, the FreeRTOS heap is nearly full
+#define LOCOSTORE_STACK_SIZE	1500
+
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -77,6 +80,9 @@ osThreadId_t defaultTaskHandle;
 uint32_t PCLK1Freq;
 
 FATFS fs;
+
+static StaticTask_t LocoStoreTaskCb;
+static uint32_t LocoStoreTaskStack[LOCOSTORE_STACK_SIZE / sizeof(uint32_t)];
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -160,7 +166,8 @@ int main(void)
 	GetSettings();
 
 	MainTrackConfig();
-	//InitAcknowledge();
+	ProgTrackConfig();
+	InitAcknowledge();
 
 	lVersion = VERSION;
 	lSerialNumber = MakeSerialNumber();
@@ -254,6 +261,18 @@ int main(void)
 	};
 	osThreadNew(CommandStationTask, NULL, &commandstationTask_attributes);
 
+	const osThreadAttr_t locostoreTask_attributes = {
+		.name = "locostore",
+		.priority = (osPriority_t) osPriorityBelowNormal,
+		.cb_mem = &LocoStoreTaskCb,
+		.cb_size = sizeof(LocoStoreTaskCb),
+		.stack_mem = LocoStoreTaskStack,
+		.stack_size = sizeof(LocoStoreTaskStack)
+	};
+	osThreadId_t locostoreTaskHandle = osThreadNew(LocoStoreTask, NULL, &locostoreTask_attributes);
+	// without it the loco table is never saved, stop here
+	configASSERT(locostoreTaskHandle != NULL);
+
 //	http_server_init();
 	telnet_server_init();
 